@@ -73,6 +73,7 @@ struct _EAttachmentPrivate {
 	guint loading  : 1;
 	guint saving   : 1;
 	guint shown    : 1;
+	guint estimate_size : 1;
 
 	camel_cipher_validity_encrypt_t encrypted;
 	camel_cipher_validity_sign_t signed_;
@@ -96,6 +97,7 @@ enum {
 	PROP_CAN_SHOW,
 	PROP_DISPOSITION,
 	PROP_ENCRYPTED,
+	PROP_ESTIMATE_SIZE,
 	PROP_FILE,
 	PROP_FILE_INFO,
 	PROP_ICON,
@@ -636,6 +638,12 @@ attachment_set_property (GObject *object,
 				g_value_get_int (value));
 			return;
 
+		case PROP_ESTIMATE_SIZE:
+			e_attachment_set_estimate_size (
+				E_ATTACHMENT (object),
+				g_value_get_boolean (value));
+			return;
+
 		case PROP_FILE:
 			e_attachment_set_file (
 				E_ATTACHMENT (object),
@@ -698,6 +706,13 @@ attachment_get_property (GObject *object,
 				E_ATTACHMENT (object)));
 			return;
 
+		case PROP_ESTIMATE_SIZE:
+			g_value_set_boolean (
+				value,
+				e_attachment_get_estimate_size (
+				E_ATTACHMENT (object)));
+			return;
+
 		case PROP_FILE:
 			g_value_take_object (
 				value,
@@ -872,6 +887,16 @@ e_attachment_class_init (EAttachmentClass *class)
 			G_PARAM_READWRITE |
 			G_PARAM_CONSTRUCT));
 
+	g_object_class_install_property (
+		object_class,
+		PROP_ESTIMATE_SIZE,
+		g_param_spec_boolean (
+			"estimate-size",
+			"Estimate Size",
+			NULL,
+			FALSE,
+			G_PARAM_READWRITE));
+
 	g_object_class_install_property (
 		object_class,
 		PROP_FILE,
@@ -1525,6 +1550,53 @@ e_attachment_set_shown (EAttachment *attachment,
 	g_object_notify (G_OBJECT (attachment), "shown");
 }
 
+/**
+ * e_attachment_get_estimate_size:
+ * @attachment: an #EAttachment
+ *
+ * Returns whether loading @attachment from a #CamelMimePart estimates
+ * the size of its content instead of decoding it to learn the exact
+ * size.  See e_attachment_set_estimate_size().
+ *
+ * Returns: whether the size of the content is estimated
+ **/
+gboolean
+e_attachment_get_estimate_size (EAttachment *attachment)
+{
+	g_return_val_if_fail (E_IS_ATTACHMENT (attachment), FALSE);
+
+	return attachment->priv->estimate_size;
+}
+
+/**
+ * e_attachment_set_estimate_size:
+ * @attachment: an #EAttachment
+ * @estimate_size: whether to estimate the size of the content
+ *
+ * Sets whether loading @attachment from a #CamelMimePart may estimate
+ * the size of its content from the encoded data already in memory,
+ * instead of decoding all of it just to learn the exact size.  This
+ * suits attachments which are only displayed, like those of a message
+ * in the preview.  Those of the composer keep the exact size.
+ *
+ * This only affects the size shown for @attachment.  The attachment is
+ * still loaded as a whole, and its content is decoded when it is
+ * opened or saved.
+ **/
+void
+e_attachment_set_estimate_size (EAttachment *attachment,
+                                gboolean estimate_size)
+{
+	g_return_if_fail (E_IS_ATTACHMENT (attachment));
+
+	if (attachment->priv->estimate_size == estimate_size)
+		return;
+
+	attachment->priv->estimate_size = estimate_size;
+
+	g_object_notify (G_OBJECT (attachment), "estimate-size");
+}
+
 camel_cipher_validity_encrypt_t
 e_attachment_get_encrypted (EAttachment *attachment)
 {
@@ -1999,6 +2071,7 @@ attachment_load_from_mime_part_thread (GSimpleAsyncResult *simple,
 	gchar *allocated, *decoded_string = NULL;
 	CamelStream *null;
 	CamelDataWrapper *dw;
+	GByteArray *byte_array;
 
 	load_context = g_object_get_data (
 		G_OBJECT (simple), ATTACHMENT_LOAD_CONTEXT);
@@ -2096,12 +2169,28 @@ attachment_load_from_mime_part_thread (GSimpleAsyncResult *simple,
 			file_info, attribute, string);
 
 	dw = camel_medium_get_content (CAMEL_MEDIUM (mime_part));
-	null = camel_stream_null_new ();
-	/* this actually downloads the part and makes it available later */
-	camel_data_wrapper_decode_to_stream_sync (
-		dw, null, attachment->priv->cancellable, NULL);
-	g_file_info_set_size (file_info, CAMEL_STREAM_NULL (null)->written);
-	g_object_unref (null);
+	byte_array = camel_data_wrapper_get_byte_array (dw);
+
+	if (attachment->priv->estimate_size &&
+	    byte_array != NULL && byte_array->len > 0) {
+		gsize size = byte_array->len;
+
+		/* The content is already in memory.  Don't decode it
+		 * just to learn its size, estimate the size from the
+		 * encoded data instead.  It gets decoded when the
+		 * attachment is actually opened or saved. */
+		if (camel_mime_part_get_encoding (mime_part) == CAMEL_TRANSFER_ENCODING_BASE64)
+			size = size / 1.37;
+
+		g_file_info_set_size (file_info, size);
+	} else {
+		null = camel_stream_null_new ();
+		/* this actually downloads the part and makes it available later */
+		camel_data_wrapper_decode_to_stream_sync (
+			dw, null, attachment->priv->cancellable, NULL);
+		g_file_info_set_size (file_info, CAMEL_STREAM_NULL (null)->written);
+		g_object_unref (null);
+	}
 
 	load_context->mime_part = g_object_ref (mime_part);
 
@@ -100,6 +100,9 @@ gboolean	e_attachment_get_saving		(EAttachment *attachment);
 gboolean	e_attachment_get_shown		(EAttachment *attachment);
 void		e_attachment_set_shown		(EAttachment *attachment,
 						 gboolean shown);
+gboolean	e_attachment_get_estimate_size	(EAttachment *attachment);
+void		e_attachment_set_estimate_size	(EAttachment *attachment,
+						 gboolean estimate_size);
 camel_cipher_validity_encrypt_t
 		e_attachment_get_encrypted	(EAttachment *attachment);
 void		e_attachment_set_encrypted	(EAttachment *attachment,
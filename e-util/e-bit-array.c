@@ -29,140 +29,213 @@
 
 #include "e-bit-array.h"
 
-#define ONES ((guint32) 0xffffffff)
+/* The set bits are kept as a sorted array of disjoint, non-adjacent
+ * half-open ranges [start, end), so selecting everything, selecting a
+ * range and shifting rows around on insert and delete cost O(ranges)
+ * at worst instead of O(rows), and a big selection takes a few bytes. */
+typedef struct _BitRange BitRange;
 
-#define BOX(n) ((n) / 32)
-#define OFFSET(n) (31 - ((n) % 32))
-#define BITMASK(n) ((guint32)(((guint32) 0x1) << OFFSET((n))))
-#define BITMASK_LEFT(n) ((((n) % 32) == 0) ? 0 : (ONES << (32 - ((n) % 32))))
-#define BITMASK_RIGHT(n) ((guint32)(((guint32) ONES) >> ((n) % 32)))
+struct _BitRange {
+	gint start;
+	gint end;
+};
+
+#define RANGE(bit_array, i) (g_array_index ((bit_array)->ranges, BitRange, (i)))
 
 G_DEFINE_TYPE (
 	EBitArray,
 	e_bit_array,
 	G_TYPE_OBJECT)
 
+/* Returns the index of the first range ending after @row. */
+static guint
+bit_array_find_range (EBitArray *bit_array,
+                      gint row)
+{
+	guint low = 0, high = bit_array->ranges->len;
+
+	while (low < high) {
+		guint mid = (low + high) / 2;
+
+		if (RANGE (bit_array, mid).end <= row)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/* Replaces @n_remove ranges at @index with @n_pieces new ones. */
 static void
-e_bit_array_insert_real (EBitArray *bit_array,
-                         gint row)
+bit_array_splice (EBitArray *bit_array,
+                  guint index,
+                  guint n_remove,
+                  const BitRange *pieces,
+                  guint n_pieces)
 {
-	gint box;
-	gint i;
-	if (bit_array->bit_count >= 0) {
-		/* Add another word if needed. */
-		if ((bit_array->bit_count & 0x1f) == 0) {
-			bit_array->data = g_renew (
-				guint32, bit_array->data,
-				(bit_array->bit_count >> 5) + 1);
-			bit_array->data[bit_array->bit_count >> 5] = 0;
-		}
+	guint i;
 
-		/* The box is the word that our row is in. */
-		box = BOX (row);
-		/* Shift all words to the right of our box right one bit. */
-		for (i = bit_array->bit_count >> 5; i > box; i--) {
-			bit_array->data[i] =
-				(bit_array->data[i] >> 1) |
-				(bit_array->data[i - 1] << 31);
-		}
+	for (i = 0; i < n_remove; i++)
+		bit_array->selected -= RANGE (bit_array, index + i).end - RANGE (bit_array, index + i).start;
+	for (i = 0; i < n_pieces; i++)
+		bit_array->selected += pieces[i].end - pieces[i].start;
+
+	if (n_remove > 0)
+		g_array_remove_range (bit_array->ranges, index, n_remove);
+	if (n_pieces > 0)
+		g_array_insert_vals (bit_array->ranges, index, pieces, n_pieces);
+}
+
+/* Moves every range starting at or after index @from by @delta rows. */
+static void
+bit_array_shift (EBitArray *bit_array,
+                 guint from,
+                 gint delta)
+{
+	guint i;
 
-		/* Shift right half of box one bit to the right. */
-		bit_array->data[box] =
-			(bit_array->data[box] & BITMASK_LEFT (row)) |
-			((bit_array->data[box] & BITMASK_RIGHT (row)) >> 1);
-		bit_array->bit_count++;
+	for (i = from; i < bit_array->ranges->len; i++) {
+		RANGE (bit_array, i).start += delta;
+		RANGE (bit_array, i).end += delta;
 	}
 }
 
 static void
-e_bit_array_delete_real (EBitArray *bit_array,
-                         gint row,
-                         gboolean move_selection_mode)
+bit_array_set_range (EBitArray *bit_array,
+                     gint start,
+                     gint end,
+                     gboolean value)
 {
-	gint box;
-	gint i;
-	gint last;
-	gint selected = FALSE;
-
-	if (bit_array->bit_count > 0) {
-		guint32 bitmask;
-		box = row >> 5;
-		last = (bit_array->bit_count - 1) >> 5;
-
-		/* Build bitmasks for the left and right half of the box */
-		bitmask = BITMASK_RIGHT (row) >> 1;
-		if (move_selection_mode)
-			selected = e_bit_array_value_at (bit_array, row);
-		/* Shift right half of box one bit to the left. */
-		bit_array->data[box] =
-			(bit_array->data[box] & BITMASK_LEFT (row)) |
-			((bit_array->data[box] & bitmask) << 1);
-
-		/* Shift all words to the right of our box left one bit. */
-		if (box < last) {
-			bit_array->data[box] &= bit_array->data[box + 1] >> 31;
-
-			for (i = box + 1; i < last; i++) {
-				bit_array->data[i] =
-					(bit_array->data[i] << 1) |
-					(bit_array->data[i + 1] >> 31);
-			}
-			/* this over-runs our memory! */
-			/*bit_array->data[i] = bit_array->data[i] << 1; */
+	BitRange pieces[2];
+	guint first, last, n_pieces = 0;
+
+	start = MAX (start, 0);
+	end = MIN (end, bit_array->bit_count);
+	if (start >= end)
+		return;
+
+	if (value) {
+		/* Swallow every range overlapping or touching the new one. */
+		first = bit_array_find_range (bit_array, start - 1);
+		for (last = first; last < bit_array->ranges->len; last++) {
+			if (RANGE (bit_array, last).start > end)
+				break;
 		}
-		bit_array->bit_count--;
-		/* Remove the last word if not needed. */
-		if ((bit_array->bit_count & 0x1f) == 0) {
-			bit_array->data = g_renew (guint32, bit_array->data, bit_array->bit_count >> 5);
+
+		pieces[0].start = start;
+		pieces[0].end = end;
+		if (first < last) {
+			pieces[0].start = MIN (start, RANGE (bit_array, first).start);
+			pieces[0].end = MAX (end, RANGE (bit_array, last - 1).end);
 		}
-		if (move_selection_mode && selected && bit_array->bit_count > 0) {
-			e_bit_array_select_single_row (
-				bit_array, row == bit_array->bit_count ? row - 1 : row);
+		n_pieces = 1;
+	} else {
+		/* Keep whatever sticks out of the cleared range. */
+		first = bit_array_find_range (bit_array, start);
+		for (last = first; last < bit_array->ranges->len; last++) {
+			if (RANGE (bit_array, last).start >= end)
+				break;
+		}
+
+		if (first == last)
+			return;
+
+		if (RANGE (bit_array, first).start < start) {
+			pieces[n_pieces].start = RANGE (bit_array, first).start;
+			pieces[n_pieces].end = start;
+			n_pieces++;
+		}
+		if (RANGE (bit_array, last - 1).end > end) {
+			pieces[n_pieces].start = end;
+			pieces[n_pieces].end = RANGE (bit_array, last - 1).end;
+			n_pieces++;
 		}
 	}
+
+	bit_array_splice (bit_array, first, last - first, pieces, n_pieces);
 }
 
-/* FIXME : Improve efficiency here. */
 void
 e_bit_array_delete (EBitArray *bit_array,
                     gint row,
                     gint count)
 {
-	gint i;
-	for (i = 0; i < count; i++)
-		e_bit_array_delete_real (bit_array, row, FALSE);
+	guint index;
+
+	if (row < 0 || row >= bit_array->bit_count || count <= 0)
+		return;
+
+	count = MIN (count, bit_array->bit_count - row);
+
+	bit_array_set_range (bit_array, row, row + count, FALSE);
+
+	index = bit_array_find_range (bit_array, row);
+	bit_array_shift (bit_array, index, -count);
+	bit_array->bit_count -= count;
+
+	/* The ranges on both sides of the hole may now touch. */
+	if (index > 0 && index < bit_array->ranges->len &&
+	    RANGE (bit_array, index - 1).end == RANGE (bit_array, index).start) {
+		RANGE (bit_array, index - 1).end = RANGE (bit_array, index).end;
+		g_array_remove_index (bit_array->ranges, index);
+	}
 }
 
-/* FIXME : Improve efficiency here. */
 void
 e_bit_array_delete_single_mode (EBitArray *bit_array,
                                 gint row,
                                 gint count)
 {
 	gint i;
-	for (i = 0; i < count; i++)
-		e_bit_array_delete_real (bit_array, row, TRUE);
+
+	for (i = 0; i < count; i++) {
+		gboolean selected;
+
+		selected = e_bit_array_value_at (bit_array, row);
+		e_bit_array_delete (bit_array, row, 1);
+		if (selected && bit_array->bit_count > 0) {
+			e_bit_array_select_single_row (
+				bit_array, row == bit_array->bit_count ? row - 1 : row);
+		}
+	}
 }
 
-/* FIXME : Improve efficiency here. */
 void
 e_bit_array_insert (EBitArray *bit_array,
                     gint row,
                     gint count)
 {
-	gint i;
-	for (i = 0; i < count; i++)
-		e_bit_array_insert_real (bit_array, row);
+	guint index;
+
+	if (count <= 0)
+		return;
+
+	row = CLAMP (row, 0, bit_array->bit_count);
+	bit_array->bit_count += count;
+
+	/* New rows come in unselected, splitting a range if needed. */
+	index = bit_array_find_range (bit_array, row);
+	if (index < bit_array->ranges->len && RANGE (bit_array, index).start < row) {
+		BitRange tail;
+
+		tail.start = row;
+		tail.end = RANGE (bit_array, index).end;
+		RANGE (bit_array, index).end = row;
+		g_array_insert_val (bit_array->ranges, index + 1, tail);
+		index++;
+	}
+
+	bit_array_shift (bit_array, index, count);
 }
 
-/* FIXME: Implement this more efficiently. */
 void
 e_bit_array_move_row (EBitArray *bit_array,
                       gint old_row,
                       gint new_row)
 {
-	e_bit_array_delete_real (bit_array, old_row, FALSE);
-	e_bit_array_insert_real (bit_array, new_row);
+	e_bit_array_delete (bit_array, old_row, 1);
+	e_bit_array_insert (bit_array, new_row, 1);
 }
 
 static void
@@ -172,7 +245,7 @@ bit_array_finalize (GObject *object)
 
 	bit_array = E_BIT_ARRAY (object);
 
-	g_free (bit_array->data);
+	g_array_free (bit_array->ranges, TRUE);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_bit_array_parent_class)->finalize (object);
@@ -191,10 +264,14 @@ gboolean
 e_bit_array_value_at (EBitArray *bit_array,
                       gint n)
 {
-	if (bit_array->bit_count < n || bit_array->bit_count == 0)
-		return 0;
-	else
-		return (bit_array->data[BOX (n)] >> OFFSET (n)) & 0x1;
+	guint index;
+
+	if (n < 0 || n >= bit_array->bit_count)
+		return FALSE;
+
+	index = bit_array_find_range (bit_array, n);
+
+	return index < bit_array->ranges->len && RANGE (bit_array, index).start <= n;
 }
 
 /**
@@ -211,25 +288,17 @@ e_bit_array_foreach (EBitArray *bit_array,
                      EForeachFunc callback,
                      gpointer closure)
 {
-	gint i;
-	gint last = (bit_array->bit_count + 31) / 32;
-	for (i = 0; i < last; i++) {
-		if (bit_array->data[i]) {
-			gint j;
-			guint32 value = bit_array->data[i];
-			for (j = 0; j < 32; j++) {
-				if (value & 0x80000000) {
-					callback (i * 32 + j, closure);
-				}
-				value <<= 1;
-			}
-		}
+	guint i;
+
+	for (i = 0; i < bit_array->ranges->len; i++) {
+		BitRange range = RANGE (bit_array, i);
+		gint row;
+
+		for (row = range.start; row < range.end; row++)
+			callback (row, closure);
 	}
 }
 
-#define PART(x,n) (((x) & (0x01010101 << n)) >> n)
-#define SECTION(x, n) (((x) >> (n * 8)) & 0xff)
-
 /**
  * e_bit_array_selected_count
  * @bit_array: #EBitArray to count
@@ -241,27 +310,7 @@ e_bit_array_foreach (EBitArray *bit_array,
 gint
 e_bit_array_selected_count (EBitArray *bit_array)
 {
-	gint count;
-	gint i;
-	gint last;
-
-	if (!bit_array->data)
-		return 0;
-
-	count = 0;
-
-	last = BOX (bit_array->bit_count - 1);
-
-	for (i = 0; i <= last; i++) {
-		gint j;
-		guint32 thiscount = 0;
-		for (j = 0; j < 8; j++)
-			thiscount += PART (bit_array->data[i], j);
-		for (j = 0; j < 4; j++)
-			count += SECTION (thiscount, j);
-	}
-
-	return count;
+	return bit_array->selected;
 }
 
 /**
@@ -274,26 +323,7 @@ e_bit_array_selected_count (EBitArray *bit_array)
 void
 e_bit_array_select_all (EBitArray *bit_array)
 {
-	gint i;
-
-	if (!bit_array->data)
-		bit_array->data = g_new0 (guint32, (bit_array->bit_count + 31) / 32);
-
-	for (i = 0; i < (bit_array->bit_count + 31) / 32; i++) {
-		bit_array->data[i] = ONES;
-	}
-
-	/* need to zero out the bits corresponding to the rows not
-	 * selected in the last full 32 bit mask */
-	if (bit_array->bit_count % 32) {
-		gint unselected_mask = 0;
-		gint num_unselected_in_last_byte = 32 - bit_array->bit_count % 32;
-
-		for (i = 0; i < num_unselected_in_last_byte; i++)
-			unselected_mask |= 1 << i;
-
-		bit_array->data[(bit_array->bit_count + 31) / 32 - 1] &= ~unselected_mask;
-	}
+	bit_array_set_range (bit_array, 0, bit_array->bit_count, TRUE);
 }
 
 gint
@@ -302,19 +332,12 @@ e_bit_array_bit_count (EBitArray *bit_array)
 	return bit_array->bit_count;
 }
 
-#define OPERATE(object, i,mask,grow) \
-	((grow) ? (((object)->data[(i)]) |= ((guint32) ~(mask))) : \
-	(((object)->data[(i)]) &= (mask)))
-
 void
 e_bit_array_change_one_row (EBitArray *bit_array,
                             gint row,
                             gboolean grow)
 {
-	gint i;
-	i = BOX (row);
-
-	OPERATE (bit_array, i, ~BITMASK (row), grow);
+	bit_array_set_range (bit_array, row, row + 1, grow);
 }
 
 void
@@ -323,42 +346,24 @@ e_bit_array_change_range (EBitArray *bit_array,
                           gint end,
                           gboolean grow)
 {
-	gint i, last;
-	if (start != end) {
-		i = BOX (start);
-		last = BOX (end);
-
-		if (i == last) {
-			OPERATE (
-				bit_array, i, BITMASK_LEFT (start) |
-				BITMASK_RIGHT (end), grow);
-		} else {
-			OPERATE (bit_array, i, BITMASK_LEFT (start), grow);
-			if (grow)
-				for (i++; i < last; i++)
-					bit_array->data[i] = ONES;
-			else
-				for (i++; i < last; i++)
-					bit_array->data[i] = 0;
-			OPERATE (bit_array, i, BITMASK_RIGHT (end), grow);
-		}
-	}
+	bit_array_set_range (bit_array, start, end, grow);
 }
 
 void
 e_bit_array_select_single_row (EBitArray *bit_array,
                                gint row)
 {
-	gint i;
-	for (i = 0; i < ((bit_array->bit_count + 31) / 32); i++) {
-		if (!((i == BOX (row) && bit_array->data[i] == BITMASK (row)) ||
-		      (i != BOX (row) && bit_array->data[i] == 0))) {
-			g_free (bit_array->data);
-			bit_array->data = g_new0 (guint32, (bit_array->bit_count + 31) / 32);
-			bit_array->data[BOX (row)] = BITMASK (row);
-
-			break;
-		}
+	BitRange range;
+
+	if (bit_array->selected == 1 && e_bit_array_value_at (bit_array, row))
+		return;
+
+	bit_array_splice (bit_array, 0, bit_array->ranges->len, NULL, 0);
+
+	if (row >= 0 && row < bit_array->bit_count) {
+		range.start = row;
+		range.end = row + 1;
+		bit_array_splice (bit_array, 0, 0, &range, 1);
 	}
 }
 
@@ -366,17 +371,17 @@ void
 e_bit_array_toggle_single_row (EBitArray *bit_array,
                                gint row)
 {
-	if (bit_array->data[BOX (row)] & BITMASK (row))
-		bit_array->data[BOX (row)] &= ~BITMASK (row);
-	else
-		bit_array->data[BOX (row)] |= BITMASK (row);
+	bit_array_set_range (
+		bit_array, row, row + 1,
+		!e_bit_array_value_at (bit_array, row));
 }
 
 static void
 e_bit_array_init (EBitArray *bit_array)
 {
-	bit_array->data = NULL;
+	bit_array->ranges = g_array_new (FALSE, FALSE, sizeof (BitRange));
 	bit_array->bit_count = 0;
+	bit_array->selected = 0;
 }
 
 static void
@@ -395,7 +400,6 @@ e_bit_array_new (gint count)
 
 	bit_array = g_object_new (E_TYPE_BIT_ARRAY, NULL);
 	bit_array->bit_count = count;
-	bit_array->data = g_new0 (guint32, (bit_array->bit_count + 31) / 32);
 
 	return bit_array;
 }
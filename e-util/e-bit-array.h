@@ -58,7 +58,8 @@ struct _EBitArray {
 	GObject parent;
 
 	gint bit_count;
-	guint32 *data;
+	gint selected;
+	GArray *ranges;
 };
 
 struct _EBitArrayClass {
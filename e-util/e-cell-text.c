@@ -51,6 +51,7 @@
 #include "e-canvas.h"
 #include "e-cell-text.h"
 #include "e-table-item.h"
+#include "e-table-subset.h"
 #include "e-table.h"
 #include "e-text-event-processor-emacs-like.h"
 #include "e-text-event-processor.h"
@@ -109,6 +110,13 @@ G_DEFINE_TYPE (ECellText, e_cell_text, E_TYPE_CELL)
 
 #define TEXT_PAD 4
 
+/* Laid out cells kept per view; the whole cache is dropped when full. */
+#define LAYOUT_CACHE_MAX 1024
+
+#define TEXT_ATTR_BOLD		(1 << 0)
+#define TEXT_ATTR_STRIKEOUT	(1 << 1)
+#define TEXT_ATTR_UNDERLINE	(1 << 2)
+
 typedef struct {
 	gpointer lines;			/* Text split into lines (private field) */
 	gint num_lines;			/* Number of lines of text */
@@ -132,8 +140,31 @@ typedef struct {
 	gint xofs, yofs;                 /* This gets added to the x
                                            and y for the cell text. */
 	gdouble ellipsis_width[2];      /* The width of the ellipsis. */
+
+	/*
+	 * Layouts of drawn cells by row of layouts_model, which is the
+	 * source model of a sorted or filtered model so that the order
+	 * of the rows does not matter.  A layout is reused until that
+	 * model reports a change of its row, or until the cell settings
+	 * it was built with change.
+	 */
+	GHashTable *layouts;
+	ETableModel *layouts_model;
+	gulong layouts_handler_ids[5];
+	GtkJustification layouts_justify;
+	gchar *layouts_font_name;
+	gint layouts_bold_column;
+	gint layouts_strikeout_column;
+	gint layouts_underline_column;
 } ECellTextView;
 
+typedef struct {
+	gint model_col;
+	gint width;
+	gchar *text;		/* only for text formatted by a subclass */
+	PangoLayout *layout;
+} CachedLayout;
+
 struct _CellEdit {
 
 	ECellTextView *text_view;
@@ -325,6 +356,87 @@ ect_cancel_edit (ECellTextView *text_view)
 	e_table_item_leave_edit_ (text_view->cell_view.e_table_item_view);
 }
 
+static void
+cached_layout_free (CachedLayout *cached)
+{
+	g_object_unref (cached->layout);
+	g_free (cached->text);
+	g_slice_free (CachedLayout, cached);
+}
+
+static void
+ect_layouts_model_changed_cb (ETableModel *model,
+                              ECellTextView *text_view)
+{
+	g_hash_table_remove_all (text_view->layouts);
+}
+
+static void
+ect_layouts_row_changed_cb (ETableModel *model,
+                            gint row,
+                            ECellTextView *text_view)
+{
+	g_hash_table_remove (text_view->layouts, GINT_TO_POINTER (row));
+}
+
+static void
+ect_layouts_cell_changed_cb (ETableModel *model,
+                             gint col,
+                             gint row,
+                             ECellTextView *text_view)
+{
+	g_hash_table_remove (text_view->layouts, GINT_TO_POINTER (row));
+}
+
+static void
+ect_layouts_rows_changed_cb (ETableModel *model,
+                             gint row,
+                             gint count,
+                             ECellTextView *text_view)
+{
+	/* The rows below moved. */
+	g_hash_table_remove_all (text_view->layouts);
+}
+
+/*
+ * ECellText fields are public and may be changed at any time, drop the
+ * layouts built with other settings.
+ */
+static void
+ect_check_layout_settings (ECellTextView *text_view)
+{
+	ECellText *ect = E_CELL_TEXT (text_view->cell_view.ecell);
+
+	if (text_view->layouts_justify == ect->justify &&
+	    text_view->layouts_bold_column == ect->bold_column &&
+	    text_view->layouts_strikeout_column == ect->strikeout_column &&
+	    text_view->layouts_underline_column == ect->underline_column &&
+	    g_strcmp0 (text_view->layouts_font_name, ect->font_name) == 0)
+		return;
+
+	g_hash_table_remove_all (text_view->layouts);
+
+	text_view->layouts_justify = ect->justify;
+	text_view->layouts_bold_column = ect->bold_column;
+	text_view->layouts_strikeout_column = ect->strikeout_column;
+	text_view->layouts_underline_column = ect->underline_column;
+	g_free (text_view->layouts_font_name);
+	text_view->layouts_font_name = g_strdup (ect->font_name);
+}
+
+static gint
+ect_layout_key_row (ECellTextView *text_view,
+                    gint row)
+{
+	ETableModel *model = text_view->cell_view.e_table_model;
+
+	if (text_view->layouts_model != model)
+		return e_table_subset_view_to_model_row (
+			E_TABLE_SUBSET (model), row);
+
+	return row;
+}
+
 /*
  * ECell::new_view method
  */
@@ -347,6 +459,36 @@ ect_new_view (ECell *ecell,
 	text_view->xofs = 0.0;
 	text_view->yofs = 0.0;
 
+	text_view->layouts = g_hash_table_new_full (
+		g_direct_hash, g_direct_equal,
+		(GDestroyNotify) NULL,
+		(GDestroyNotify) cached_layout_free);
+
+	if (E_IS_TABLE_SUBSET (table_model))
+		text_view->layouts_model = e_table_subset_get_source_model (
+			E_TABLE_SUBSET (table_model));
+	if (text_view->layouts_model == NULL)
+		text_view->layouts_model = table_model;
+	g_object_ref (text_view->layouts_model);
+
+	text_view->layouts_handler_ids[0] = g_signal_connect (
+		text_view->layouts_model, "model_changed",
+		G_CALLBACK (ect_layouts_model_changed_cb), text_view);
+	text_view->layouts_handler_ids[1] = g_signal_connect (
+		text_view->layouts_model, "model_row_changed",
+		G_CALLBACK (ect_layouts_row_changed_cb), text_view);
+	text_view->layouts_handler_ids[2] = g_signal_connect (
+		text_view->layouts_model, "model_cell_changed",
+		G_CALLBACK (ect_layouts_cell_changed_cb), text_view);
+	text_view->layouts_handler_ids[3] = g_signal_connect (
+		text_view->layouts_model, "model_rows_inserted",
+		G_CALLBACK (ect_layouts_rows_changed_cb), text_view);
+	text_view->layouts_handler_ids[4] = g_signal_connect (
+		text_view->layouts_model, "model_rows_deleted",
+		G_CALLBACK (ect_layouts_rows_changed_cb), text_view);
+
+	ect_check_layout_settings (text_view);
+
 	return (ECellView *) text_view;
 }
 
@@ -357,6 +499,7 @@ static void
 ect_kill_view (ECellView *ecv)
 {
 	ECellTextView *text_view = (ECellTextView *) ecv;
+	guint ii;
 
 	if (text_view->cell_view.kill_view_cb)
 	    (text_view->cell_view.kill_view_cb)(ecv, text_view->cell_view.kill_view_cb_data);
@@ -364,6 +507,15 @@ ect_kill_view (ECellView *ecv)
 	if (text_view->cell_view.kill_view_cb_data)
 	    g_list_free (text_view->cell_view.kill_view_cb_data);
 
+	for (ii = 0; ii < G_N_ELEMENTS (text_view->layouts_handler_ids); ii++)
+		g_signal_handler_disconnect (
+			text_view->layouts_model,
+			text_view->layouts_handler_ids[ii]);
+	g_object_unref (text_view->layouts_model);
+
+	g_hash_table_destroy (text_view->layouts);
+	g_free (text_view->layouts_font_name);
+
 	g_free (text_view);
 }
 
@@ -395,31 +547,64 @@ ect_unrealize (ECellView *ecv)
 
 	g_object_unref (text_view->i_cursor);
 
+	g_hash_table_remove_all (text_view->layouts);
+
 	if (E_CELL_CLASS (e_cell_text_parent_class)->unrealize)
 		(* E_CELL_CLASS (e_cell_text_parent_class)->unrealize) (ecv);
 
 }
 
+/*
+ * ECell::style_set method
+ */
+static void
+ect_style_set (ECellView *ecell_view,
+               GtkStyle *previous_style)
+{
+	ECellTextView *text_view = (ECellTextView *) ecell_view;
+
+	/* Cached layouts carry the old font. */
+	g_hash_table_remove_all (text_view->layouts);
+}
+
+static guint
+text_attrs (ECellTextView *text_view,
+            gint row)
+{
+	ECellView *ecell_view = (ECellView *) text_view;
+	ECellText *ect = E_CELL_TEXT (ecell_view->ecell);
+	guint attrs = 0;
+
+	if (row < 0)
+		return 0;
+
+	if (ect->bold_column >= 0 &&
+	    e_table_model_value_at (ecell_view->e_table_model, ect->bold_column, row))
+		attrs |= TEXT_ATTR_BOLD;
+	if (ect->strikeout_column >= 0 &&
+	    e_table_model_value_at (ecell_view->e_table_model, ect->strikeout_column, row))
+		attrs |= TEXT_ATTR_STRIKEOUT;
+	if (ect->underline_column >= 0 &&
+	    e_table_model_value_at (ecell_view->e_table_model, ect->underline_column, row))
+		attrs |= TEXT_ATTR_UNDERLINE;
+
+	return attrs;
+}
+
 static PangoAttrList *
 build_attr_list (ECellTextView *text_view,
                  gint row,
                  gint text_length)
 {
 
-	ECellView *ecell_view = (ECellView *) text_view;
-	ECellText *ect = E_CELL_TEXT (ecell_view->ecell);
 	PangoAttrList *attrs = pango_attr_list_new ();
 	gboolean bold, strikeout, underline;
+	guint flags;
 
-	bold = ect->bold_column >= 0 &&
-		row >= 0 &&
-		e_table_model_value_at (ecell_view->e_table_model, ect->bold_column, row);
-	strikeout = ect->strikeout_column >= 0 &&
-		row >= 0 &&
-		e_table_model_value_at (ecell_view->e_table_model, ect->strikeout_column, row);
-	underline = ect->underline_column >= 0 &&
-		row >= 0 &&
-		e_table_model_value_at (ecell_view->e_table_model, ect->underline_column, row);
+	flags = text_attrs (text_view, row);
+	bold = (flags & TEXT_ATTR_BOLD) != 0;
+	strikeout = (flags & TEXT_ATTR_STRIKEOUT) != 0;
+	underline = (flags & TEXT_ATTR_UNDERLINE) != 0;
 
 	if (bold || strikeout || underline) {
 		if (bold) {
@@ -597,7 +782,58 @@ generate_layout (ECellTextView *text_view,
 		return edit->layout;
 	}
 
-	if (row >= 0) {
+	if (row >= 0 && !edit && width > 0) {
+		CachedLayout *cached = NULL;
+		gchar *temp = NULL;
+		gboolean formatted;
+		gint key;
+
+		ect_check_layout_settings (text_view);
+
+		/* Subclasses may format the same value differently over
+		 * time, as ECellDate does for recent dates, so compare
+		 * their text.  The model's own values only change along
+		 * with a signal. */
+		formatted = E_CELL_TEXT_GET_CLASS (ect)->get_text != ect_real_get_text;
+		if (formatted)
+			temp = e_cell_text_get_text (ect, ecell_view->e_table_model, model_col, row);
+
+		key = ect_layout_key_row (text_view, row);
+		if (key >= 0)
+			cached = g_hash_table_lookup (text_view->layouts, GINT_TO_POINTER (key));
+
+		if (cached &&
+		    cached->model_col == model_col &&
+		    cached->width == width &&
+		    (!formatted || g_strcmp0 (cached->text, temp ? temp : "?") == 0)) {
+			layout = g_object_ref (cached->layout);
+		} else {
+			const gchar *text;
+
+			if (!formatted)
+				temp = e_cell_text_get_text (ect, ecell_view->e_table_model, model_col, row);
+			text = temp ? temp : "?";
+
+			layout = build_layout (text_view, row, text, width);
+
+			if (key >= 0) {
+				if (g_hash_table_size (text_view->layouts) >= LAYOUT_CACHE_MAX)
+					g_hash_table_remove_all (text_view->layouts);
+
+				cached = g_slice_new (CachedLayout);
+				cached->model_col = model_col;
+				cached->width = width;
+				cached->text = formatted ? g_strdup (text) : NULL;
+				cached->layout = g_object_ref (layout);
+				g_hash_table_insert (
+					text_view->layouts,
+					GINT_TO_POINTER (key), cached);
+			}
+		}
+
+		if (temp != NULL)
+			e_cell_text_free_text (ect, temp);
+	} else if (row >= 0) {
 		gchar *temp = e_cell_text_get_text (ect, ecell_view->e_table_model, model_col, row);
 		layout = build_layout (text_view, row, temp ? temp : "?", width);
 		e_cell_text_free_text (ect, temp);
@@ -1583,6 +1819,7 @@ e_cell_text_class_init (ECellTextClass *class)
 	ecc->kill_view  = ect_kill_view;
 	ecc->realize    = ect_realize;
 	ecc->unrealize  = ect_unrealize;
+	ecc->style_set  = ect_style_set;
 	ecc->draw       = ect_draw;
 	ecc->event      = ect_event;
 	ecc->height     = ect_height;
@@ -66,6 +66,29 @@ static gint special_chars[] = {
 	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 1, 9, 3, 0, 3     /*    p - del  */
 };
 
+/* Characters e_text_to_html_full() copies to the output unchanged,
+ * unless one of the flags gives them a meaning:
+ *
+ * 1 = copied as-is
+ * 2 = space, special with E_TEXT_TO_HTML_CONVERT_SPACES
+ * 4 = '@', special with E_TEXT_TO_HTML_CONVERT_ADDRESSES
+ * 8 = ':' and '.', one of which is in every URL prefix,
+ *     special with E_TEXT_TO_HTML_CONVERT_URLS
+ */
+static const guchar plain_chars[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0,    /*  nul - 0x0f */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,    /* 0x10 - 0x1f */
+	3, 1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 9, 1,    /*   sp - /    */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 9, 1, 0, 1, 0, 1,    /*    0 - ?    */
+	5, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    /*    @ - O    */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    /*    P - _    */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    /*    ` - o    */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1     /*    p - del  */
+};
+
+#define is_plain_char(c, special) \
+	(c < 128 && (plain_chars[c] & (1 | special)) == 1)
+
 #define is_addr_char(c) (c < 128 && !(special_chars[c] & 1))
 #define is_url_char(c) (c < 128 && !(special_chars[c] & 8))
 #define is_trailing_garbage(c) (c > 127 || (special_chars[c] & 2))
@@ -229,14 +252,22 @@ e_text_to_html_full (const gchar *input,
                      guint flags,
                      guint32 color)
 {
-	const guchar *cur, *next, *linestart;
+	const guchar *cur, *next, *linestart, *end;
 	gchar *buffer = NULL;
 	gchar *out = NULL;
 	gint buffer_size = 0, col;
 	gboolean colored = FALSE, saw_citation = FALSE;
+	guchar special = 0;
+
+	if (flags & E_TEXT_TO_HTML_CONVERT_SPACES)
+		special |= 2;
+	if (flags & E_TEXT_TO_HTML_CONVERT_ADDRESSES)
+		special |= 4;
+	if (flags & E_TEXT_TO_HTML_CONVERT_URLS)
+		special |= 8;
 
 	/* Allocate a translation buffer.  */
-	buffer_size = strlen (input) * 2 + 5;
+	buffer_size = strlen (input) * 2 + 6;
 	buffer = g_malloc (buffer_size);
 
 	out = buffer;
@@ -276,6 +307,30 @@ e_text_to_html_full (const gchar *input,
 			out += sprintf (out, "&gt; ");
 		}
 
+		/* Most of the text needs no conversion at all,
+		 * copy everything up to the next special character
+		 * in one go. */
+		for (end = cur; is_plain_char (*end, special); end++)
+			;
+
+		/* Leave a URL prefix before the ':' or '.'
+		 * that stopped us to the code below. */
+		if (*end == ':' && (special & 8))
+			end = MAX (cur, end - 6);
+		else if (*end == '.' && (special & 8))
+			end = MAX (cur, end - 3);
+
+		if (end > cur) {
+			out = check_size (&buffer, &buffer_size, out, end - cur);
+			memcpy (out, cur, end - cur);
+			out += end - cur;
+			col += end - cur;
+			cur = end;
+
+			if (!*cur)
+				break;
+		}
+
 		u = g_utf8_get_char ((gchar *) cur);
 		if (g_unichar_isalpha (u) &&
 		    (flags & E_TEXT_TO_HTML_CONVERT_URLS)) {
@@ -455,6 +510,12 @@ e_text_to_html (const gchar *input,
 
 #ifdef E_HTML_UTILS_TEST
 
+/* Checks the URL detection and the golden output below.  Built
+ * as test-html-utils; run it with "--benchmark [MB]" to also
+ * measure throughput. */
+
+#include <stdlib.h>
+
 struct {
 	gchar *text, *url;
 } url_tests[] = {
@@ -517,6 +578,111 @@ struct {
 };
 gint num_url_tests = G_N_ELEMENTS (url_tests);
 
+/* Expected output for a mix of flags, to catch any change in
+ * what e_text_to_html_full() produces, not just in its links. */
+struct {
+	const gchar *text;
+	guint flags;
+	const gchar *html;
+} golden_tests[] = {
+	{ "Plain text without anything special.",
+	  0,
+	  "Plain text without anything special." },
+	{ "a < b && c > d \"quoted\"",
+	  0,
+	  "a &lt; b &amp;&amp; c &gt; d &quot;quoted&quot;" },
+	{ "line one\nline two\n",
+	  E_TEXT_TO_HTML_CONVERT_NL,
+	  "line one<br>\nline two<br>\n" },
+	{ "  indented\n\ttabbed\tcolumns  here",
+	  E_TEXT_TO_HTML_CONVERT_NL | E_TEXT_TO_HTML_CONVERT_SPACES,
+	  "&nbsp; indented<br>\n&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;tabbed&nbsp;&nbsp;columns&nbsp; here" },
+	{ "see http://www.example.com/a?b=1&c=2, or www.example.org.",
+	  E_TEXT_TO_HTML_CONVERT_URLS,
+	  "see <a href=\"http://www.example.com/a?b=1&amp;c=2\">http://www.example.com/a?b=1&amp;c=2</a>, or <a href=\"http://www.example.org\">www.example.org</a>." },
+	{ "mail bob@example.com or <alice@example.org>.",
+	  E_TEXT_TO_HTML_CONVERT_ADDRESSES,
+	  "mail <a href=\"mailto:bob@example.com\">bob@example.com</a> or &lt;<a href=\"mailto:alice@example.org\">alice@example.org</a>&gt;." },
+	{ "prefixhttp://example.com/x and mailto:bob@example.com",
+	  E_TEXT_TO_HTML_CONVERT_URLS | E_TEXT_TO_HTML_CONVERT_ADDRESSES,
+	  "prefix<a href=\"http://example.com/x\">http://example.com/x</a> and <a href=\"mailto:bob@example.com\">mailto:bob@example.com</a>" },
+	{ "> quoted\n> more\nreply\n>From here\nend\n",
+	  E_TEXT_TO_HTML_MARK_CITATION,
+	  "<FONT COLOR=\"#737373\">&gt; quoted\n&gt; more\n</FONT>reply\nFrom here\nend\n" },
+	{ ">From mbox\nplain\n",
+	  E_TEXT_TO_HTML_MARK_CITATION,
+	  "From mbox\nplain\n" },
+	{ "cite me\nand me\n",
+	  E_TEXT_TO_HTML_CITE,
+	  "&gt; cite me\n&gt; and me\n" },
+	{ "caf\303\251 na\303\257ve \377 bytes",
+	  0,
+	  "caf&#233; na&#239;ve &#255; bytes" },
+	{ "caf\303\251 na\303\257ve",
+	  E_TEXT_TO_HTML_ESCAPE_8BIT,
+	  "caf? na?ve" },
+	{ "2013-10-01 12:00:01 INFO server.c:42 started, see http://localhost:8080/status",
+	  E_TEXT_TO_HTML_CONVERT_URLS | E_TEXT_TO_HTML_CONVERT_NL,
+	  "2013-10-01 12:00:01 INFO server.c:42 started, see <a href=\"http://localhost:8080/status\">http://localhost:8080/status</a>" },
+	{ "pre",
+	  E_TEXT_TO_HTML_PRE,
+	  "<PRE>pre</PRE>" },
+};
+gint num_golden_tests = G_N_ELEMENTS (golden_tests);
+
+/* Something like a log dump, the kind of message that used to
+ * take seconds to render. */
+static gchar *
+benchmark_text (gsize size)
+{
+	GString *text;
+	guint ii = 0;
+
+	text = g_string_new ("");
+
+	while (text->len < size) {
+		g_string_append_printf (
+			text, "2013-10-01 12:%02u:%02u INFO  worker.c:%u "
+			"request %u from client <%u> served in %u ms, "
+			"see http://build.example.com/log/%u & mail "
+			"admin@example.com\n> quoted line %u\n",
+			ii / 60 % 60, ii % 60, ii % 977,
+			ii, ii * 7, ii % 100, ii, ii);
+		ii++;
+	}
+
+	return g_string_free (text, FALSE);
+}
+
+static void
+benchmark (gsize size)
+{
+	gchar *text;
+	gint64 start, elapsed;
+	guint flags;
+	gint ii;
+
+	text = benchmark_text (size);
+
+	flags = E_TEXT_TO_HTML_CONVERT_NL |
+		E_TEXT_TO_HTML_CONVERT_SPACES |
+		E_TEXT_TO_HTML_CONVERT_URLS |
+		E_TEXT_TO_HTML_CONVERT_ADDRESSES |
+		E_TEXT_TO_HTML_MARK_CITATION;
+
+	start = g_get_monotonic_time ();
+	for (ii = 0; ii < 10; ii++)
+		g_free (e_text_to_html_full (text, flags, 0x737373));
+	elapsed = g_get_monotonic_time () - start;
+
+	printf (
+		"%" G_GSIZE_FORMAT " bytes x 10 in %.3f s, %.1f MB/s\n",
+		strlen (text), elapsed / 1e6,
+		10.0 * strlen (text) / elapsed);
+
+	g_free (text);
+}
+
 gint
 main (gint argc,
       gchar **argv)
@@ -554,7 +720,28 @@ main (gint argc,
 		g_free (html);
 	}
 
+	for (i = 0; i < num_golden_tests; i++) {
+		html = e_text_to_html_full (
+			golden_tests[i].text,
+			golden_tests[i].flags, 0x737373);
+
+		if (strcmp (html, golden_tests[i].html) != 0) {
+			printf (
+				"FAILED on \"%s\" -> %s\n  (got %s)\n\n",
+				golden_tests[i].text,
+				golden_tests[i].html, html);
+			errors++;
+		}
+
+		g_free (html);
+	}
+
 	printf ("\n%d errors\n", errors);
+
+	/* Throughput on a few MB of log-like text. */
+	if (argc > 1 && strcmp (argv[1], "--benchmark") == 0)
+		benchmark (argc > 2 ? atoi (argv[2]) * 1024 * 1024 : 4 * 1024 * 1024);
+
 	return errors;
 }
 #endif
@@ -158,76 +158,6 @@ e_string_search (gconstpointer haystack,
 		return FALSE;
 }
 
-static gint
-e_table_str_case_compare (gconstpointer x,
-                          gconstpointer y,
-                          gpointer cmp_cache)
-{
-	const gchar *cx = NULL, *cy = NULL;
-
-	if (!cmp_cache)
-		return e_str_case_compare (x, y);
-
-	if (x == NULL || y == NULL) {
-		if (x == y)
-			return 0;
-		else
-			return x ? -1 : 1;
-	}
-
-	#define prepare_value(_z, _cz)						\
-		_cz = e_table_sorting_utils_lookup_cmp_cache (cmp_cache, _z);	\
-		if (!_cz) {							\
-			gchar *tmp = g_utf8_casefold (_z, -1);			\
-			_cz = g_utf8_collate_key (tmp, -1);			\
-			g_free (tmp);						\
-										\
-			e_table_sorting_utils_add_to_cmp_cache (		\
-				cmp_cache, _z, (gchar *) _cz);			\
-		}
-
-	prepare_value (x, cx);
-	prepare_value (y, cy);
-
-	#undef prepare_value
-
-	return strcmp (cx, cy);
-}
-
-static gint
-e_table_collate_compare (gconstpointer x,
-                         gconstpointer y,
-                         gpointer cmp_cache)
-{
-	const gchar *cx = NULL, *cy = NULL;
-
-	if (!cmp_cache)
-		return e_collate_compare (x, y);
-
-	if (x == NULL || y == NULL) {
-		if (x == y)
-			return 0;
-		else
-			return x ? -1 : 1;
-	}
-
-	#define prepare_value(_z, _cz)						\
-		_cz = e_table_sorting_utils_lookup_cmp_cache (cmp_cache, _z);	\
-		if (!_cz) {							\
-			_cz = g_utf8_collate_key (_z, -1);			\
-										\
-			e_table_sorting_utils_add_to_cmp_cache (		\
-				cmp_cache, _z, (gchar *) _cz);			\
-		}
-
-	prepare_value (x, cx);
-	prepare_value (y, cy);
-
-	#undef prepare_value
-
-	return strcmp (cx, cy);
-}
-
 static void
 safe_unref (gpointer object)
 {
@@ -267,10 +197,10 @@ e_table_extras_init (ETableExtras *extras)
 		(GCompareDataFunc) e_str_compare);
 	e_table_extras_add_compare (
 		extras, "stringcase",
-		(GCompareDataFunc) e_table_str_case_compare);
+		e_table_sorting_utils_str_case_compare);
 	e_table_extras_add_compare (
 		extras, "collate",
-		(GCompareDataFunc) e_table_collate_compare);
+		e_table_sorting_utils_collate_compare);
 	e_table_extras_add_compare (
 		extras, "integer",
 		(GCompareDataFunc) e_int_compare);
@@ -118,6 +118,7 @@ static void eti_cursor_activated (ESelectionModel *selection, gint row, gint col
 static void eti_selection_change (ESelectionModel *selection, ETableItem *eti);
 static void eti_selection_row_change (ESelectionModel *selection, gint row, ETableItem *eti);
 static void e_table_item_redraw_row (ETableItem *eti, gint row);
+static void eti_item_region_redraw (ETableItem *eti, gint x0, gint y0, gint x1, gint y1);
 
 #define ETI_SINGLE_ROW_HEIGHT(eti) ((eti)->uniform_row_height_cache != -1 ? (eti)->uniform_row_height_cache : eti_row_height((eti), -1))
 #define ETI_MULTIPLE_ROW_HEIGHT(eti,row) ((eti)->height_cache && (eti)->height_cache[(row)] != -1 ? (eti)->height_cache[(row)] : eti_row_height((eti),(row)))
@@ -534,7 +535,6 @@ eti_reflow (GnomeCanvasItem *item,
 		if (new_height != eti->height) {
 			eti->height = new_height;
 			e_canvas_item_request_parent_reflow (GNOME_CANVAS_ITEM (eti));
-			eti->needs_redraw = 1;
 			gnome_canvas_item_request_update (GNOME_CANVAS_ITEM (eti));
 		}
 		eti->needs_compute_height = 0;
@@ -571,7 +571,16 @@ eti_update (GnomeCanvasItem *item,
 	y2 = item->y2;
 
 	eti_bounds (item, &item->x1, &item->y1, &item->x2, &item->y2);
-	if (item->x1 != x1 ||
+	if (item->x1 == x1 &&
+	    item->y1 == y1 &&
+	    item->x2 == x2 &&
+	    item->y2 != y2) {
+		/* Only the height changed; repaint the strip that
+		 * appeared or disappeared at the bottom. */
+		gnome_canvas_request_redraw (
+			item->canvas, x1, MIN (y2, item->y2),
+			x2, MAX (y2, item->y2));
+	} else if (item->x1 != x1 ||
 	    item->y1 != y1 ||
 	    item->x2 != x2 ||
 	    item->y2 != y2) {
@@ -584,7 +593,17 @@ eti_update (GnomeCanvasItem *item,
 			item->canvas, item->x1, item->y1,
 			item->x2, item->y2);
 		eti->needs_redraw = 0;
+	} else if (eti->damage_from_row != -1) {
+		gint y;
+
+		/* Rows above the damage kept their place and contents.
+		 * Back off a little for the grid line and cursor border. */
+		y = e_table_item_row_diff (eti, 0, eti->damage_from_row);
+		eti_item_region_redraw (
+			eti, 0, MAX (0, y - 2), eti->width, eti->height);
 	}
+
+	eti->damage_from_row = -1;
 }
 
 /*
@@ -737,6 +756,146 @@ confirm_height_cache (ETableItem *eti)
 	for (i = 0; i < eti->rows; i++) {
 		eti->height_cache[i] = -1;
 	}
+	eti->height_unknown = eti->rows;
+}
+
+static void
+free_height_tree (ETableItem *eti)
+{
+	g_free (eti->height_tree);
+	eti->height_tree = NULL;
+}
+
+/*
+ * Builds the prefix sums over the row heights.  Rows which were not
+ * measured yet are counted with the height of the first row, so asking
+ * for the position of a row far down the table does not measure every
+ * row above it; the sums get corrected as the rows get measured.
+ */
+static void
+confirm_height_tree (ETableItem *eti)
+{
+	const gint rows = eti->rows;
+	gint i, j;
+
+	if (eti->height_tree)
+		return;
+
+	if (!eti->height_cache)
+		calculate_height_cache (eti);
+
+	eti->height_estimate = rows > 0 ? eti_row_height (eti, 0) : 0;
+
+	eti->height_tree = g_new (gint, rows + 1);
+	eti->height_tree[0] = 0;
+	for (i = 1; i <= rows; i++) {
+		gint height = eti->height_cache[i - 1];
+
+		eti->height_tree[i] = height == -1 ? eti->height_estimate : height;
+	}
+	for (i = 1; i <= rows; i++) {
+		j = i + (i & -i);
+		if (j <= rows)
+			eti->height_tree[j] += eti->height_tree[i];
+	}
+}
+
+static void
+height_tree_add (ETableItem *eti,
+                 gint row,
+                 gint delta)
+{
+	for (row++; row <= eti->rows; row += row & -row)
+		eti->height_tree[row] += delta;
+}
+
+/*
+ * Returns the sum of the heights of the first @n_rows rows, without
+ * the separators.
+ */
+static gint
+height_tree_sum (ETableItem *eti,
+                 gint n_rows)
+{
+	gint sum = 0;
+
+	for (; n_rows > 0; n_rows -= n_rows & -n_rows)
+		sum += eti->height_tree[n_rows];
+
+	return sum;
+}
+
+/*
+ * Returns the largest number of leading rows whose heights, each plus
+ * @height_extra, add up to no more than @offset.
+ */
+static gint
+height_tree_find (ETableItem *eti,
+                  gint offset,
+                  gint height_extra)
+{
+	gint pos = 0, step = 1;
+
+	if (offset < 0)
+		return 0;
+
+	while (step <= eti->rows / 2)
+		step <<= 1;
+
+	for (; step > 0; step >>= 1) {
+		gint next = pos + step;
+
+		if (next <= eti->rows &&
+		    eti->height_tree[next] + step * height_extra <= offset) {
+			pos = next;
+			offset -= eti->height_tree[next] + step * height_extra;
+		}
+	}
+
+	return pos;
+}
+
+/*
+ * Marks everything from @row down as needing a repaint, for changes that
+ * move or resize rows without touching those above.
+ */
+static void
+eti_damage_from_row (ETableItem *eti,
+                     gint row)
+{
+	if (eti->damage_from_row == -1 || row < eti->damage_from_row)
+		eti->damage_from_row = MAX (row, 0);
+
+	gnome_canvas_item_request_update (GNOME_CANVAS_ITEM (eti));
+}
+
+/*
+ * Stores @height as the height of @row, keeping the prefix sums in sync.
+ * Queues a reflow when the total height of the item changes.
+ */
+static void
+eti_set_row_height (ETableItem *eti,
+                    gint row,
+                    gint height)
+{
+	gint old_height = eti->height_cache[row];
+
+	if (old_height == height)
+		return;
+
+	if (old_height == -1) {
+		eti->height_unknown--;
+		old_height = eti->height_estimate;
+	}
+
+	eti->height_cache[row] = height;
+
+	if (eti->height_tree && height != old_height) {
+		height_tree_add (eti, row, height - old_height);
+		eti->needs_compute_height = 1;
+		e_canvas_item_request_reflow (GNOME_CANVAS_ITEM (eti));
+		eti_damage_from_row (eti, row);
+	}
 }
 
 static gboolean
@@ -773,7 +932,9 @@ free_height_cache (ETableItem *eti)
 			g_free (eti->height_cache);
 		eti->height_cache = NULL;
 		eti->height_cache_idle_count = 0;
+		eti->height_unknown = 0;
 		eti->uniform_row_height_cache = -1;
+		free_height_tree (eti);
 
 		if (eti->uniform_row_height && eti->height_cache_idle_id != 0) {
 			g_source_remove (eti->height_cache_idle_id);
@@ -809,16 +970,8 @@ eti_row_height (ETableItem *eti,
 		if (!eti->height_cache) {
 			calculate_height_cache (eti);
 		}
-		if (eti->height_cache[row] == -1) {
-			eti->height_cache[row] = eti_row_height_real (eti, row);
-			if (row > 0 &&
-			    eti->length_threshold != -1 &&
-			    eti->rows > eti->length_threshold &&
-			    eti->height_cache[row] != eti_row_height (eti, 0)) {
-				eti->needs_compute_height = 1;
-				e_canvas_item_request_reflow (GNOME_CANVAS_ITEM (eti));
-			}
-		}
+		if (eti->height_cache[row] == -1)
+			eti_set_row_height (eti, row, eti_row_height_real (eti, row));
 		return eti->height_cache[row];
 	}
 }
@@ -833,7 +986,8 @@ eti_row_height (ETableItem *eti,
  * many rows in the table that performing the previous step could take
  * too long) set by the ETableItem->length_threshold that would determine
  * when the height is computed by using the first row as the size for
- * every other row in the ETableItem.
+ * every row not measured yet.  Either way the sum itself comes from the
+ * height tree, so asking again is cheap.
  */
 static gint
 eti_get_height (ETableItem *eti)
@@ -848,36 +1002,24 @@ eti_get_height (ETableItem *eti)
 		gint row_height = ETI_ROW_HEIGHT (eti, -1);
 		return ((row_height + height_extra) * rows + height_extra);
 	} else {
-		gint height;
 		gint row;
-		if (eti->length_threshold != -1) {
-			if (rows > eti->length_threshold) {
-				gint row_height = ETI_ROW_HEIGHT (eti, 0);
-				if (eti->height_cache) {
-					height = 0;
-					for (row = 0; row < rows; row++) {
-						if (eti->height_cache[row] == -1) {
-							height += (row_height + height_extra) * (rows - row);
-							break;
-						}
-						else
-							height += eti->height_cache[row] + height_extra;
-					}
-				} else
-					height = (ETI_ROW_HEIGHT (eti, 0) + height_extra) * rows;
 
-				/*
-				 * 1 pixel at the top
-				 */
-				return height + height_extra;
+		if (!eti->height_cache)
+			calculate_height_cache (eti);
+
+		if (eti->length_threshold == -1 || rows <= eti->length_threshold) {
+			for (row = 0; eti->height_unknown > 0 && row < rows; row++) {
+				if (eti->height_cache[row] == -1)
+					eti_row_height (eti, row);
 			}
 		}
 
-		height = height_extra;
-		for (row = 0; row < rows; row++)
-			height += ETI_ROW_HEIGHT (eti, row) + height_extra;
+		confirm_height_tree (eti);
 
-		return height;
+		/*
+		 * 1 pixel at the top
+		 */
+		return height_tree_sum (eti, rows) + (rows + 1) * height_extra;
 	}
 }
 
@@ -921,12 +1063,13 @@ e_table_item_row_diff (ETableItem *eti,
 	if (eti->uniform_row_height) {
 		return ((end_row - start_row) * (ETI_ROW_HEIGHT (eti, -1) + height_extra));
 	} else {
-		gint row, total;
-		total = 0;
-		for (row = start_row; row < end_row; row++)
-			total += ETI_ROW_HEIGHT (eti, row) + height_extra;
+		if (start_row >= end_row)
+			return 0;
 
-		return total;
+		confirm_height_tree (eti);
+
+		return height_tree_sum (eti, end_row) - height_tree_sum (eti, start_row) +
+			(end_row - start_row) * height_extra;
 	}
 }
 
@@ -1228,14 +1371,43 @@ eti_table_model_changed (ETableModel *table_model,
 
 	eti_unfreeze (eti);
 
+	/* The signal carries no row range and a resort moves every row,
+	 * so all rows are damaged.  The cells keep their layouts across
+	 * a resort, so repainting them is cheap. */
 	eti->needs_compute_height = 1;
 	e_canvas_item_request_reflow (GNOME_CANVAS_ITEM (eti));
-	eti->needs_redraw = 1;
-	gnome_canvas_item_request_update (GNOME_CANVAS_ITEM (eti));
+	eti_damage_from_row (eti, 0);
 
 	eti_idle_maybe_show_cursor (eti);
 }
 
+/*
+ * Measures @row again after its content changed.  When its height differs
+ * from the cached one, only that row's entry in the height tree is updated
+ * and the rows from @row down get reflowed and redrawn.
+ */
+static gboolean
+eti_row_height_changed (ETableItem *eti,
+                        gint row)
+{
+	gint height;
+
+	if (eti->uniform_row_height || !eti->height_cache || eti->height_cache[row] == -1)
+		return FALSE;
+
+	height = eti_row_height_real (eti, row);
+	if (height == eti->height_cache[row])
+		return FALSE;
+
+	eti_set_row_height (eti, row, height);
+
+	eti->needs_compute_height = 1;
+	e_canvas_item_request_reflow (GNOME_CANVAS_ITEM (eti));
+	eti_damage_from_row (eti, row);
+
+	return TRUE;
+}
+
 static void
 eti_table_model_row_changed (ETableModel *table_model,
                              gint row,
@@ -1248,8 +1420,8 @@ eti_table_model_row_changed (ETableModel *table_model,
 		return;
 	}
 
-	if ((!eti->uniform_row_height) && eti->height_cache && eti->height_cache[row] != -1 && eti_row_height_real (eti, row) != eti->height_cache[row]) {
-		eti_table_model_changed (table_model, eti);
+	if (eti_row_height_changed (eti, row)) {
+		eti_unfreeze (eti);
 		return;
 	}
 
@@ -1271,8 +1443,8 @@ eti_table_model_cell_changed (ETableModel *table_model,
 		return;
 	}
 
-	if ((!eti->uniform_row_height) && eti->height_cache && eti->height_cache[row] != -1 && eti_row_height_real (eti, row) != eti->height_cache[row]) {
-		eti_table_model_changed (table_model, eti);
+	if (eti_row_height_changed (eti, row)) {
+		eti_unfreeze (eti);
 		return;
 	}
 
@@ -1301,7 +1473,9 @@ eti_table_model_rows_inserted (ETableModel *table_model,
 		memmove (eti->height_cache + row + count, eti->height_cache + row, (eti->rows - count - row) * sizeof (gint));
 		for (i = row; i < row + count; i++)
 			eti->height_cache[i] = -1;
+		eti->height_unknown += count;
 	}
+	free_height_tree (eti);
 
 	eti_unfreeze (eti);
 
@@ -1309,8 +1483,7 @@ eti_table_model_rows_inserted (ETableModel *table_model,
 
 	eti->needs_compute_height = 1;
 	e_canvas_item_request_reflow (GNOME_CANVAS_ITEM (eti));
-	eti->needs_redraw = 1;
-	gnome_canvas_item_request_update (GNOME_CANVAS_ITEM (eti));
+	eti_damage_from_row (eti, row);
 }
 
 static void
@@ -1328,9 +1501,18 @@ eti_table_model_rows_deleted (ETableModel *table_model,
 
 	eti->rows = e_table_model_row_count (eti->table_model);
 
+	if (eti->height_cache) {
+		gint i;
+		for (i = row; i < row + count; i++) {
+			if (eti->height_cache[i] == -1)
+				eti->height_unknown--;
+		}
+	}
+
 	if (eti->height_cache && (eti->rows > row)) {
 		memmove (eti->height_cache + row, eti->height_cache + row + count, (eti->rows - row) * sizeof (gint));
 	}
+	free_height_tree (eti);
 
 	eti_unfreeze (eti);
 
@@ -1338,8 +1520,7 @@ eti_table_model_rows_deleted (ETableModel *table_model,
 
 	eti->needs_compute_height = 1;
 	e_canvas_item_request_reflow (GNOME_CANVAS_ITEM (eti));
-	eti->needs_redraw = 1;
-	gnome_canvas_item_request_update (GNOME_CANVAS_ITEM (eti));
+	eti_damage_from_row (eti, row);
 }
 
 /**
@@ -1578,6 +1759,7 @@ eti_dispose (GObject *object)
 	if (eti->height_cache)
 		g_free (eti->height_cache);
 	eti->height_cache = NULL;
+	free_height_tree (eti);
 
 	/* Chain up to parent's dispose() method. */
 	G_OBJECT_CLASS (e_table_item_parent_class)->dispose (object);
@@ -1728,6 +1910,7 @@ e_table_item_init (ETableItem *eti)
 	eti->click_count               = 0;
 
 	eti->height_cache              = NULL;
+	eti->height_tree               = NULL;
 	eti->height_cache_idle_id      = 0;
 	eti->height_cache_idle_count   = 0;
 
@@ -1750,6 +1933,7 @@ e_table_item_init (ETableItem *eti)
 
 	eti->needs_redraw              = 0;
 	eti->needs_compute_height      = 0;
+	eti->damage_from_row           = -1;
 
 	eti->in_key_press              = 0;
 
@@ -1858,6 +2042,7 @@ eti_unrealize (GnomeCanvasItem *item)
 	if (eti->height_cache)
 		g_free (eti->height_cache);
 	eti->height_cache = NULL;
+	free_height_tree (eti);
 	eti->height_cache_idle_count = 0;
 
 	eti_unrealize_cell_views (eti);
@@ -1971,8 +2156,11 @@ eti_draw (GnomeCanvasItem *item,
 		y_offset = 0;
 		first_row = -1;
 
-		y1 = y2 = floor (eti_base_y) + height_extra;
-		for (row = 0; row < rows; row++, y1 = y2) {
+		confirm_height_tree (eti);
+		row = height_tree_find (eti, y - (floor (eti_base_y) + height_extra) - 1, height_extra);
+
+		y1 = y2 = floor (eti_base_y) + height_extra + height_tree_sum (eti, row) + row * height_extra;
+		for (; row < rows; row++, y1 = y2) {
 
 			y2 += ETI_ROW_HEIGHT (eti, row) + height_extra;
 
@@ -2259,10 +2447,14 @@ find_cell (ETableItem *eti,
 		if (row >= eti->rows)
 			return FALSE;
 	} else {
-		y1 = y2 = height_extra;
 		if (y < height_extra)
 			return FALSE;
-		for (row = 0; row < rows; row++, y1 = y2) {
+
+		confirm_height_tree (eti);
+		row = height_tree_find (eti, y - height_extra - 1, height_extra);
+
+		y1 = y2 = height_extra + height_tree_sum (eti, row) + row * height_extra;
+		for (; row < rows; row++, y1 = y2) {
 			y2 += ETI_ROW_HEIGHT (eti, row) + height_extra;
 
 			if (y <= y2)
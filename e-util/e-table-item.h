@@ -150,6 +150,20 @@ struct _ETableItem {
 	gint height_cache_idle_id;
 	gint height_cache_idle_count;
 
+	/*
+	 * Prefix sums of height_cache (a Fenwick tree indexed from 1).
+	 * Rows not measured yet are counted as height_estimate.
+	 */
+	gint *height_tree;
+	gint height_estimate;
+	gint height_unknown;
+
+	/*
+	 * First view row whose position or height changed since the
+	 * last update; everything below it gets redrawn.  -1 if none.
+	 */
+	gint damage_from_row;
+
 	/*
 	 * Lengh Threshold: above this, we stop computing correctly
 	 * the size
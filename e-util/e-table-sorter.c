@@ -46,54 +46,6 @@ G_DEFINE_TYPE_WITH_CODE (
 		E_TYPE_SORTER,
 		e_table_sorter_interface_init))
 
-struct qsort_data {
-	ETableSorter *table_sorter;
-	gpointer *vals;
-	gint cols;
-	gint *ascending;
-	GCompareDataFunc *compare;
-	gpointer cmp_cache;
-};
-
-/* FIXME: Make it not cache the second and later columns (as if anyone cares.) */
-
-static gint
-qsort_callback (gconstpointer data1,
-                gconstpointer data2,
-                gpointer user_data)
-{
-	struct qsort_data *qd = (struct qsort_data *) user_data;
-	gint row1 = *(gint *) data1;
-	gint row2 = *(gint *) data2;
-	gint j;
-	gint sort_count;
-	gint comp_val = 0;
-	gint ascending = 1;
-
-	sort_count =
-		e_table_sort_info_sorting_get_count (
-			qd->table_sorter->sort_info) +
-		e_table_sort_info_grouping_get_count (
-			qd->table_sorter->sort_info);
-
-	for (j = 0; j < sort_count; j++) {
-		comp_val = (*(qd->compare[j]))(qd->vals[qd->cols * row1 + j], qd->vals[qd->cols * row2 + j], qd->cmp_cache);
-		ascending = qd->ascending[j];
-		if (comp_val != 0)
-			break;
-	}
-	if (comp_val == 0) {
-		if (row1 < row2)
-			comp_val = -1;
-		if (row1 > row2)
-			comp_val = 1;
-	}
-	if (!ascending)
-		comp_val = -comp_val;
-
-	return comp_val;
-}
-
 static void
 table_sorter_clean (ETableSorter *table_sorter)
 {
@@ -109,71 +61,25 @@ table_sorter_clean (ETableSorter *table_sorter)
 static void
 table_sorter_sort (ETableSorter *table_sorter)
 {
+	ETableSortKeys *keys;
 	gint rows;
 	gint i;
-	gint j;
-	gint cols;
-	gint group_cols;
-	struct qsort_data qd;
 
 	if (table_sorter->sorted)
 		return;
 
 	rows = e_table_model_row_count (table_sorter->source);
-	group_cols = e_table_sort_info_grouping_get_count (table_sorter->sort_info);
-	cols = e_table_sort_info_sorting_get_count (table_sorter->sort_info) + group_cols;
 
 	table_sorter->sorted = g_new (int, rows);
 	for (i = 0; i < rows; i++)
 		table_sorter->sorted[i] = i;
 
-	qd.cols = cols;
-	qd.table_sorter = table_sorter;
-
-	qd.vals = g_new (gpointer , rows * cols);
-	qd.ascending = g_new (int, cols);
-	qd.compare = g_new (GCompareDataFunc, cols);
-	qd.cmp_cache = e_table_sorting_utils_create_cmp_cache ();
-
-	for (j = 0; j < cols; j++) {
-		ETableColumnSpecification *spec;
-		ETableCol *col;
-		GtkSortType sort_type;
-
-		if (j < group_cols)
-			spec = e_table_sort_info_grouping_get_nth (
-				table_sorter->sort_info,
-				j, &sort_type);
-		else
-			spec = e_table_sort_info_sorting_get_nth (
-				table_sorter->sort_info,
-				j - group_cols, &sort_type);
-
-		col = e_table_header_get_column_by_spec (
-			table_sorter->full_header, spec);
-		if (col == NULL) {
-			gint last = e_table_header_count (
-				table_sorter->full_header) - 1;
-			col = e_table_header_get_column (
-				table_sorter->full_header, last);
-		}
-
-		for (i = 0; i < rows; i++) {
-			qd.vals[i * cols + j] = e_table_model_value_at (
-				table_sorter->source,
-				col->spec->model_col, i);
-		}
-
-		qd.compare[j] = col->compare;
-		qd.ascending[j] = (sort_type == GTK_SORT_ASCENDING);
-	}
-
-	g_qsort_with_data (table_sorter->sorted, rows, sizeof (gint), qsort_callback, &qd);
-
-	g_free (qd.vals);
-	g_free (qd.ascending);
-	g_free (qd.compare);
-	e_table_sorting_utils_free_cmp_cache (qd.cmp_cache);
+	keys = e_table_sort_keys_new (
+		table_sorter->source,
+		table_sorter->sort_info,
+		table_sorter->full_header, TRUE);
+	e_table_sort_keys_sort (keys, table_sorter->sorted, rows, NULL);
+	e_table_sort_keys_free (keys);
 }
 
 static void
@@ -194,6 +100,45 @@ table_sorter_backsort (ETableSorter *table_sorter)
 	}
 }
 
+/* Moves @row to where it belongs after its values changed,
+ * instead of sorting all the rows again. */
+static void
+table_sorter_reposition (ETableSorter *table_sorter,
+                         gint row)
+{
+	ETableSortKeys *keys;
+	gint *sorted;
+	gint rows, old_pos, new_pos, i;
+
+	if (!table_sorter->sorted)
+		return;
+
+	table_sorter_backsort (table_sorter);
+
+	rows = e_table_model_row_count (table_sorter->source);
+	sorted = table_sorter->sorted;
+	old_pos = table_sorter->backsorted[row];
+
+	memmove (
+		sorted + old_pos, sorted + old_pos + 1,
+		(rows - old_pos - 1) * sizeof (gint));
+
+	keys = e_table_sort_keys_new (
+		table_sorter->source,
+		table_sorter->sort_info,
+		table_sorter->full_header, TRUE);
+	new_pos = e_table_sort_keys_find_position (keys, sorted, rows - 1, row);
+	e_table_sort_keys_free (keys);
+
+	memmove (
+		sorted + new_pos + 1, sorted + new_pos,
+		(rows - new_pos - 1) * sizeof (gint));
+	sorted[new_pos] = row;
+
+	for (i = MIN (old_pos, new_pos); i <= MAX (old_pos, new_pos); i++)
+		table_sorter->backsorted[sorted[i]] = i;
+}
+
 static void
 table_sorter_model_changed_cb (ETableModel *table_model,
                                ETableSorter *table_sorter)
@@ -206,7 +151,7 @@ table_sorter_model_row_changed_cb (ETableModel *table_model,
                                    gint row,
                                    ETableSorter *table_sorter)
 {
-	table_sorter_clean (table_sorter);
+	table_sorter_reposition (table_sorter, row);
 }
 
 static void
@@ -215,7 +160,7 @@ table_sorter_model_cell_changed_cb (ETableModel *table_model,
                                     gint row,
                                     ETableSorter *table_sorter)
 {
-	table_sorter_clean (table_sorter);
+	table_sorter_reposition (table_sorter, row);
 }
 
 static void
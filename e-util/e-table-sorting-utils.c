@@ -29,59 +29,75 @@
 #include <string.h>
 #include <camel/camel.h>
 
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+
 #include "e-misc-utils.h"
 
 #define d(x)
 
-/* This takes source rows. */
-static gint
-etsu_compare (ETableModel *source,
-              ETableSortInfo *sort_info,
-              ETableHeader *full_header,
-              gint row1,
-              gint row2,
-              gpointer cmp_cache)
-{
-	gint j;
-	gint sort_count = e_table_sort_info_sorting_get_count (sort_info);
-	gint comp_val = 0;
-	GtkSortType sort_type = GTK_SORT_ASCENDING;
-
-	for (j = 0; j < sort_count; j++) {
-		ETableColumnSpecification *spec;
-		ETableCol *col;
-
-		spec = e_table_sort_info_sorting_get_nth (
-			sort_info, j, &sort_type);
+/* Below this many indices per thread e_table_sorting_utils_sort_indices()
+ * does not bother with extra threads. */
+#define SORT_INDICES_PER_THREAD	16384
+#define SORT_MAX_THREADS	8
+#define SORT_CANCEL_CHECK	4096
 
-		col = e_table_header_get_column_by_spec (full_header, spec);
-		if (col == NULL) {
-			gint last = e_table_header_count (full_header) - 1;
-			col = e_table_header_get_column (full_header, last);
-		}
+typedef struct {
+	ETableSortingCompareFunc compare_func;
+	gpointer user_data;
+	GCancellable *cancellable;
 
-		comp_val = (*col->compare) (
-			e_table_model_value_at (
-				source, col->spec->compare_col, row1),
-			e_table_model_value_at (
-				source, col->spec->compare_col, row2),
-			cmp_cache);
-		if (comp_val != 0)
-			break;
-	}
+	/* Sorted runs are src[bounds[i]] .. src[bounds[i + 1] - 1]. */
+	gint *src;
+	gint *dst;
+	gint *bounds;
+	gint n_runs;
 
-	if (comp_val == 0) {
-		if (row1 < row2)
-			comp_val = -1;
-		if (row1 > row2)
-			comp_val = 1;
-	}
+	gpointer *cmp_caches;
+	volatile gint cancelled;
+} SortIndicesData;
 
-	if (sort_type == GTK_SORT_DESCENDING)
-		comp_val = -comp_val;
+typedef struct {
+	SortIndicesData *data;
+	gint task;
+} SortIndicesTask;
+
+/* How the values of a sort column are compared.  Columns using one of
+ * the stock compare functions get their values decorated into plain
+ * keys once per sort; anything else keeps the model values and calls
+ * the column's compare function. */
+typedef enum {
+	SORT_KEY_VALUE,
+	SORT_KEY_INT,
+	SORT_KEY_STRING,
+	SORT_KEY_COLLATE,
+	SORT_KEY_CASE_COLLATE
+} SortKeyKind;
 
-	return comp_val;
-}
+typedef struct {
+	ETableCol *col;
+	GtkSortType sort_type;
+	SortKeyKind kind;
+
+	/* Keys indexed by source row, only set while sorting. */
+	gint64 *ints;
+	gconstpointer *values;
+	GHashTable *collation_keys;
+} SortKeyColumn;
+
+struct _ETableSortKeys {
+	ETableModel *source;
+	SortKeyColumn *columns;
+	gint n_columns;
+};
+
+static gboolean	sort_indices_real		(gint *indices,
+						 gint n_indices,
+						 ETableSortingCompareFunc compare_func,
+						 gpointer user_data,
+						 GCancellable *cancellable,
+						 gint max_threads);
 
 typedef struct {
 	gint cols;
@@ -135,38 +151,257 @@ e_sort_callback (gconstpointer data1,
 	return comp_val;
 }
 
-void
-e_table_sorting_utils_sort (ETableModel *source,
-                            ETableSortInfo *sort_info,
-                            ETableHeader *full_header,
-                            gint *map_table,
-                            gint rows)
+static SortKeyKind
+sort_key_kind (ETableCol *col)
+{
+	if (col->compare == (GCompareDataFunc) e_int_compare)
+		return SORT_KEY_INT;
+	if (col->compare == (GCompareDataFunc) e_str_compare)
+		return SORT_KEY_STRING;
+	if (col->compare == e_table_sorting_utils_collate_compare)
+		return SORT_KEY_COLLATE;
+	if (col->compare == e_table_sorting_utils_str_case_compare)
+		return SORT_KEY_CASE_COLLATE;
+
+	return SORT_KEY_VALUE;
+}
+
+/* Equal keys are ordered by source row, and the sort type of the last
+ * compared column flips the whole result, ties included. */
+static gint
+sort_keys_finish (gint comp_val,
+                  GtkSortType sort_type,
+                  gint row1,
+                  gint row2)
+{
+	if (comp_val == 0) {
+		if (row1 < row2)
+			comp_val = -1;
+		if (row1 > row2)
+			comp_val = 1;
+	}
+
+	if (sort_type == GTK_SORT_DESCENDING)
+		comp_val = -comp_val;
+
+	return comp_val;
+}
+
+/* This takes source rows and asks the model for the values. */
+static gint
+sort_keys_compare_rows (ETableSortKeys *keys,
+                        gint row1,
+                        gint row2,
+                        gpointer cmp_cache)
+{
+	GtkSortType sort_type = GTK_SORT_ASCENDING;
+	gint comp_val = 0;
+	gint j;
+
+	for (j = 0; j < keys->n_columns; j++) {
+		SortKeyColumn *column = &keys->columns[j];
+		gint compare_col = column->col->spec->compare_col;
+
+		comp_val = (*column->col->compare) (
+			e_table_model_value_at (keys->source, compare_col, row1),
+			e_table_model_value_at (keys->source, compare_col, row2),
+			cmp_cache);
+		sort_type = column->sort_type;
+		if (comp_val != 0)
+			break;
+	}
+
+	return sort_keys_finish (comp_val, sort_type, row1, row2);
+}
+
+/* This takes source rows and only looks at the decorated keys. */
+static gint
+sort_keys_compare_cb (gint row1,
+                      gint row2,
+                      gpointer cmp_cache,
+                      gpointer user_data)
+{
+	ETableSortKeys *keys = user_data;
+	GtkSortType sort_type = GTK_SORT_ASCENDING;
+	gint comp_val = 0;
+	gint j;
+
+	for (j = 0; j < keys->n_columns; j++) {
+		SortKeyColumn *column = &keys->columns[j];
+
+		switch (column->kind) {
+		case SORT_KEY_INT:
+			comp_val =
+				column->ints[row1] == column->ints[row2] ? 0 :
+				column->ints[row1] < column->ints[row2] ? -1 : 1;
+			break;
+		case SORT_KEY_VALUE:
+			comp_val = (*column->col->compare) (
+				column->values[row1],
+				column->values[row2],
+				cmp_cache);
+			break;
+		default:
+			/* Plain strings or collation keys. */
+			comp_val = e_str_compare (
+				column->values[row1],
+				column->values[row2]);
+			break;
+		}
+
+		sort_type = column->sort_type;
+		if (comp_val != 0)
+			break;
+	}
+
+	return sort_keys_finish (comp_val, sort_type, row1, row2);
+}
+
+static const gchar *
+sort_key_collation_key (SortKeyColumn *column,
+                        const gchar *value)
+{
+	gchar *key;
+
+	if (value == NULL)
+		return NULL;
+
+	key = g_hash_table_lookup (column->collation_keys, value);
+	if (key == NULL) {
+		if (column->kind == SORT_KEY_CASE_COLLATE) {
+			gchar *tmp = g_utf8_casefold (value, -1);
+			key = g_utf8_collate_key (tmp, -1);
+			g_free (tmp);
+		} else {
+			key = g_utf8_collate_key (value, -1);
+		}
+
+		g_hash_table_insert (
+			column->collation_keys, g_strdup (value), key);
+	}
+
+	return key;
+}
+
+static void
+sort_keys_decorate (ETableSortKeys *keys,
+                    const gint *rows,
+                    gint n_rows)
 {
 	gint total_rows;
-	gint i;
+	gint i, j;
+
+	total_rows = e_table_model_row_count (keys->source);
+
+	for (j = 0; j < keys->n_columns; j++) {
+		SortKeyColumn *column = &keys->columns[j];
+		gint compare_col = column->col->spec->compare_col;
+
+		if (column->kind == SORT_KEY_INT)
+			column->ints = g_new (gint64, total_rows);
+		else
+			column->values = g_new (gconstpointer, total_rows);
+
+		if (column->kind == SORT_KEY_COLLATE ||
+		    column->kind == SORT_KEY_CASE_COLLATE)
+			column->collation_keys = g_hash_table_new_full (
+				(GHashFunc) g_str_hash,
+				(GEqualFunc) g_str_equal,
+				(GDestroyNotify) g_free,
+				(GDestroyNotify) g_free);
+
+		for (i = 0; i < n_rows; i++) {
+			gint row = rows[i];
+			gconstpointer value;
+
+			value = e_table_model_value_at (
+				keys->source, compare_col, row);
+
+			switch (column->kind) {
+			case SORT_KEY_INT:
+				column->ints[row] = GPOINTER_TO_INT (value);
+				break;
+			case SORT_KEY_COLLATE:
+			case SORT_KEY_CASE_COLLATE:
+				column->values[row] =
+					sort_key_collation_key (column, value);
+				break;
+			default:
+				column->values[row] = value;
+				break;
+			}
+		}
+	}
+}
+
+static void
+sort_keys_undecorate (ETableSortKeys *keys)
+{
 	gint j;
-	gint cols;
-	ETableSortClosure closure;
 
-	g_return_if_fail (E_IS_TABLE_MODEL (source));
-	g_return_if_fail (E_IS_TABLE_SORT_INFO (sort_info));
-	g_return_if_fail (E_IS_TABLE_HEADER (full_header));
+	for (j = 0; j < keys->n_columns; j++) {
+		SortKeyColumn *column = &keys->columns[j];
 
-	total_rows = e_table_model_row_count (source);
-	cols = e_table_sort_info_sorting_get_count (sort_info);
-	closure.cols = cols;
+		g_free (column->ints);
+		column->ints = NULL;
 
-	closure.vals = g_new (gpointer, total_rows * cols);
-	closure.sort_type = g_new (GtkSortType, cols);
-	closure.compare = g_new (GCompareDataFunc, cols);
-	closure.cmp_cache = e_table_sorting_utils_create_cmp_cache ();
+		g_free (column->values);
+		column->values = NULL;
 
-	for (j = 0; j < cols; j++) {
+		if (column->collation_keys) {
+			g_hash_table_destroy (column->collation_keys);
+			column->collation_keys = NULL;
+		}
+	}
+}
+
+/**
+ * e_table_sort_keys_new:
+ * @source: an #ETableModel
+ * @sort_info: an #ETableSortInfo
+ * @full_header: an #ETableHeader
+ * @with_grouping: whether to sort by the grouping columns first
+ *
+ * Resolves the columns of @sort_info against @full_header once, for
+ * comparing rows of @source with e_table_sort_keys_sort() and
+ * e_table_sort_keys_find_position().
+ *
+ * Returns: a new #ETableSortKeys; free it with e_table_sort_keys_free()
+ **/
+ETableSortKeys *
+e_table_sort_keys_new (ETableModel *source,
+                       ETableSortInfo *sort_info,
+                       ETableHeader *full_header,
+                       gboolean with_grouping)
+{
+	ETableSortKeys *keys;
+	gint group_cols;
+	gint j;
+
+	g_return_val_if_fail (E_IS_TABLE_MODEL (source), NULL);
+	g_return_val_if_fail (E_IS_TABLE_SORT_INFO (sort_info), NULL);
+	g_return_val_if_fail (E_IS_TABLE_HEADER (full_header), NULL);
+
+	group_cols = with_grouping ?
+		e_table_sort_info_grouping_get_count (sort_info) : 0;
+
+	keys = g_slice_new0 (ETableSortKeys);
+	keys->source = g_object_ref (source);
+	keys->n_columns = group_cols +
+		e_table_sort_info_sorting_get_count (sort_info);
+	keys->columns = g_new0 (SortKeyColumn, keys->n_columns);
+
+	for (j = 0; j < keys->n_columns; j++) {
+		SortKeyColumn *column = &keys->columns[j];
 		ETableColumnSpecification *spec;
 		ETableCol *col;
 
-		spec = e_table_sort_info_sorting_get_nth (
-			sort_info, j, &closure.sort_type[j]);
+		if (j < group_cols)
+			spec = e_table_sort_info_grouping_get_nth (
+				sort_info, j, &column->sort_type);
+		else
+			spec = e_table_sort_info_sorting_get_nth (
+				sort_info, j - group_cols, &column->sort_type);
 
 		col = e_table_header_get_column_by_spec (full_header, spec);
 		if (col == NULL) {
@@ -174,19 +409,131 @@ e_table_sorting_utils_sort (ETableModel *source,
 			col = e_table_header_get_column (full_header, last);
 		}
 
-		for (i = 0; i < rows; i++) {
-			closure.vals[map_table[i] * cols + j] = e_table_model_value_at (source, col->spec->compare_col, map_table[i]);
-		}
-		closure.compare[j] = col->compare;
+		column->col = col;
+		column->kind = sort_key_kind (col);
 	}
 
-	g_qsort_with_data (
-		map_table, rows, sizeof (gint), e_sort_callback, &closure);
+	return keys;
+}
 
-	g_free (closure.vals);
-	g_free (closure.sort_type);
-	g_free (closure.compare);
-	e_table_sorting_utils_free_cmp_cache (closure.cmp_cache);
+/**
+ * e_table_sort_keys_free:
+ * @keys: an #ETableSortKeys
+ *
+ * Frees @keys.
+ **/
+void
+e_table_sort_keys_free (ETableSortKeys *keys)
+{
+	g_return_if_fail (keys != NULL);
+
+	sort_keys_undecorate (keys);
+
+	g_object_unref (keys->source);
+	g_free (keys->columns);
+	g_slice_free (ETableSortKeys, keys);
+}
+
+/**
+ * e_table_sort_keys_sort:
+ * @keys: an #ETableSortKeys
+ * @rows: source rows to sort
+ * @n_rows: number of items in @rows
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ *
+ * Sorts @rows.  The sort values of every row are read from the model
+ * once up front, integers and strings compared by the stock compare
+ * functions are turned into plain keys (collation keys for the collating
+ * ones), and the rows are then sorted by those keys only.
+ *
+ * Returns: %TRUE if @rows were sorted, %FALSE when cancelled
+ **/
+gboolean
+e_table_sort_keys_sort (ETableSortKeys *keys,
+                        gint *rows,
+                        gint n_rows,
+                        GCancellable *cancellable)
+{
+	gint max_threads = SORT_MAX_THREADS;
+	gboolean sorted;
+	gint j;
+
+	g_return_val_if_fail (keys != NULL, FALSE);
+	g_return_val_if_fail (rows != NULL || n_rows == 0, FALSE);
+
+	/* Custom compare functions were never meant to be thread-safe. */
+	for (j = 0; j < keys->n_columns; j++) {
+		if (keys->columns[j].kind == SORT_KEY_VALUE)
+			max_threads = 1;
+	}
+
+	sort_keys_decorate (keys, rows, n_rows);
+
+	sorted = sort_indices_real (
+		rows, n_rows, sort_keys_compare_cb,
+		keys, cancellable, max_threads);
+
+	sort_keys_undecorate (keys);
+
+	return sorted;
+}
+
+/**
+ * e_table_sort_keys_find_position:
+ * @keys: an #ETableSortKeys
+ * @sorted: source rows, already sorted
+ * @n_sorted: number of items in @sorted
+ * @row: the source row to look for
+ *
+ * Binary-searches @sorted for the place @row belongs to, asking the model
+ * only for the values of the rows it compares against.  @row itself must
+ * not be in @sorted.
+ *
+ * Returns: the index in @sorted to insert @row at
+ **/
+gint
+e_table_sort_keys_find_position (ETableSortKeys *keys,
+                                 const gint *sorted,
+                                 gint n_sorted,
+                                 gint row)
+{
+	gpointer cmp_cache;
+	gint low = 0, high = n_sorted;
+
+	g_return_val_if_fail (keys != NULL, 0);
+
+	cmp_cache = e_table_sorting_utils_create_cmp_cache ();
+
+	while (low < high) {
+		gint mid = low + (high - low) / 2;
+
+		if (sort_keys_compare_rows (keys, sorted[mid], row, cmp_cache) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	e_table_sorting_utils_free_cmp_cache (cmp_cache);
+
+	return low;
+}
+
+void
+e_table_sorting_utils_sort (ETableModel *source,
+                            ETableSortInfo *sort_info,
+                            ETableHeader *full_header,
+                            gint *map_table,
+                            gint rows)
+{
+	ETableSortKeys *keys;
+
+	g_return_if_fail (E_IS_TABLE_MODEL (source));
+	g_return_if_fail (E_IS_TABLE_SORT_INFO (sort_info));
+	g_return_if_fail (E_IS_TABLE_HEADER (full_header));
+
+	keys = e_table_sort_keys_new (source, sort_info, full_header, FALSE);
+	e_table_sort_keys_sort (keys, map_table, rows, NULL);
+	e_table_sort_keys_free (keys);
 }
 
 gboolean
@@ -222,7 +569,6 @@ e_table_sorting_utils_affects_sort (ETableSortInfo *sort_info,
 	return FALSE;
 }
 
-/* FIXME: This could be done in time log n instead of time n with a binary search. */
 gint
 e_table_sorting_utils_insert (ETableModel *source,
                               ETableSortInfo *sort_info,
@@ -231,15 +577,12 @@ e_table_sorting_utils_insert (ETableModel *source,
                               gint rows,
                               gint row)
 {
+	ETableSortKeys *keys;
 	gint i;
-	gpointer cmp_cache = e_table_sorting_utils_create_cmp_cache ();
-
-	i = 0;
-	/* handle insertions when we have a 'sort group' */
-	while (i < rows && etsu_compare (source, sort_info, full_header, map_table[i], row, cmp_cache) < 0)
-		i++;
 
-	e_table_sorting_utils_free_cmp_cache (cmp_cache);
+	keys = e_table_sort_keys_new (source, sort_info, full_header, FALSE);
+	i = e_table_sort_keys_find_position (keys, map_table, rows, row);
+	e_table_sort_keys_free (keys);
 
 	return i;
 }
@@ -253,26 +596,29 @@ e_table_sorting_utils_check_position (ETableModel *source,
                                       gint rows,
                                       gint view_row)
 {
+	ETableSortKeys *keys;
 	gint i;
 	gint row;
 	gpointer cmp_cache;
 
 	i = view_row;
 	row = map_table[i];
+	keys = e_table_sort_keys_new (source, sort_info, full_header, FALSE);
 	cmp_cache = e_table_sorting_utils_create_cmp_cache ();
 
 	i = view_row;
-	if (i < rows - 1 && etsu_compare (source, sort_info, full_header, map_table[i + 1], row, cmp_cache) < 0) {
+	if (i < rows - 1 && sort_keys_compare_rows (keys, map_table[i + 1], row, cmp_cache) < 0) {
 		i++;
-		while (i < rows - 1 && etsu_compare (source, sort_info, full_header, map_table[i], row, cmp_cache) < 0)
+		while (i < rows - 1 && sort_keys_compare_rows (keys, map_table[i], row, cmp_cache) < 0)
 			i++;
-	} else if (i > 0 && etsu_compare (source, sort_info, full_header, map_table[i - 1], row, cmp_cache) > 0) {
+	} else if (i > 0 && sort_keys_compare_rows (keys, map_table[i - 1], row, cmp_cache) > 0) {
 		i--;
-		while (i > 0 && etsu_compare (source, sort_info, full_header, map_table[i], row, cmp_cache) > 0)
+		while (i > 0 && sort_keys_compare_rows (keys, map_table[i], row, cmp_cache) > 0)
 			i--;
 	}
 
 	e_table_sorting_utils_free_cmp_cache (cmp_cache);
+	e_table_sort_keys_free (keys);
 
 	return i;
 }
@@ -536,3 +882,332 @@ e_table_sorting_utils_lookup_cmp_cache (gpointer cmp_cache,
 
 	return g_hash_table_lookup (cmp_cache, key);
 }
+
+/**
+ * e_table_sorting_utils_str_case_compare:
+ * @x: a string
+ * @y: another string
+ * @cmp_cache: (allow-none): a compare cache, or %NULL
+ *
+ * Compares two strings case-insensitively in the current locale,
+ * remembering the collation keys in @cmp_cache when given.  This is the
+ * "stringcase" compare function of #ETableExtras.
+ *
+ * Returns: a negative value, zero or a positive value, like strcmp()
+ **/
+gint
+e_table_sorting_utils_str_case_compare (gconstpointer x,
+                                        gconstpointer y,
+                                        gpointer cmp_cache)
+{
+	const gchar *cx = NULL, *cy = NULL;
+
+	if (!cmp_cache)
+		return e_str_case_compare (x, y);
+
+	if (x == NULL || y == NULL) {
+		if (x == y)
+			return 0;
+		else
+			return x ? -1 : 1;
+	}
+
+	#define prepare_value(_z, _cz)						\
+		_cz = e_table_sorting_utils_lookup_cmp_cache (cmp_cache, _z);	\
+		if (!_cz) {							\
+			gchar *tmp = g_utf8_casefold (_z, -1);			\
+			_cz = g_utf8_collate_key (tmp, -1);			\
+			g_free (tmp);						\
+										\
+			e_table_sorting_utils_add_to_cmp_cache (		\
+				cmp_cache, _z, (gchar *) _cz);			\
+		}
+
+	prepare_value (x, cx);
+	prepare_value (y, cy);
+
+	#undef prepare_value
+
+	return strcmp (cx, cy);
+}
+
+/**
+ * e_table_sorting_utils_collate_compare:
+ * @x: a string
+ * @y: another string
+ * @cmp_cache: (allow-none): a compare cache, or %NULL
+ *
+ * Compares two strings in the current locale, remembering the collation
+ * keys in @cmp_cache when given.  This is the "collate" compare function
+ * of #ETableExtras.
+ *
+ * Returns: a negative value, zero or a positive value, like strcmp()
+ **/
+gint
+e_table_sorting_utils_collate_compare (gconstpointer x,
+                                       gconstpointer y,
+                                       gpointer cmp_cache)
+{
+	const gchar *cx = NULL, *cy = NULL;
+
+	if (!cmp_cache)
+		return e_collate_compare (x, y);
+
+	if (x == NULL || y == NULL) {
+		if (x == y)
+			return 0;
+		else
+			return x ? -1 : 1;
+	}
+
+	#define prepare_value(_z, _cz)						\
+		_cz = e_table_sorting_utils_lookup_cmp_cache (cmp_cache, _z);	\
+		if (!_cz) {							\
+			_cz = g_utf8_collate_key (_z, -1);			\
+										\
+			e_table_sorting_utils_add_to_cmp_cache (		\
+				cmp_cache, _z, (gchar *) _cz);			\
+		}
+
+	prepare_value (x, cx);
+	prepare_value (y, cy);
+
+	#undef prepare_value
+
+	return strcmp (cx, cy);
+}
+
+static gint
+sort_indices_qsort_cb (gconstpointer data1,
+                       gconstpointer data2,
+                       gpointer user_data)
+{
+	SortIndicesTask *task = user_data;
+	SortIndicesData *data = task->data;
+
+	return data->compare_func (
+		*(gint *) data1, *(gint *) data2,
+		data->cmp_caches[task->task], data->user_data);
+}
+
+/* Sorts one initial run in place. */
+static gpointer
+sort_indices_run_thread (gpointer user_data)
+{
+	SortIndicesTask *task = user_data;
+	SortIndicesData *data = task->data;
+	gint first, last;
+
+	first = data->bounds[task->task];
+	last = data->bounds[task->task + 1];
+
+	g_qsort_with_data (
+		data->src + first, last - first, sizeof (gint),
+		sort_indices_qsort_cb, task);
+
+	return NULL;
+}
+
+/* Merges runs 2 * task and 2 * task + 1 from src into dst.
+ * Equal items keep their order, so the sort stays stable. */
+static gpointer
+sort_indices_merge_thread (gpointer user_data)
+{
+	SortIndicesTask *task = user_data;
+	SortIndicesData *data = task->data;
+	gpointer cmp_cache;
+	gint ii, jj, kk, mid, last;
+
+	cmp_cache = data->cmp_caches[task->task];
+
+	ii = kk = data->bounds[2 * task->task];
+	if (2 * task->task + 1 < data->n_runs) {
+		mid = data->bounds[2 * task->task + 1];
+		last = data->bounds[2 * task->task + 2];
+	} else {
+		/* Odd run out, just copied over. */
+		mid = last = data->bounds[2 * task->task + 1];
+	}
+	jj = mid;
+
+	while (ii < mid && jj < last) {
+		if (kk % SORT_CANCEL_CHECK == 0) {
+			if (g_atomic_int_get (&data->cancelled))
+				return NULL;
+			if (g_cancellable_is_cancelled (data->cancellable)) {
+				g_atomic_int_set (&data->cancelled, 1);
+				return NULL;
+			}
+		}
+
+		if (data->compare_func (
+			data->src[ii], data->src[jj],
+			cmp_cache, data->user_data) <= 0)
+			data->dst[kk++] = data->src[ii++];
+		else
+			data->dst[kk++] = data->src[jj++];
+	}
+
+	if (ii < mid)
+		memcpy (data->dst + kk, data->src + ii, (mid - ii) * sizeof (gint));
+	else if (jj < last)
+		memcpy (data->dst + kk, data->src + jj, (last - jj) * sizeof (gint));
+
+	return NULL;
+}
+
+static void
+sort_indices_run_tasks (SortIndicesData *data,
+                        gint n_tasks,
+                        GThreadFunc func)
+{
+	SortIndicesTask *tasks;
+	GThread **threads;
+	gint ii;
+
+	tasks = g_new (SortIndicesTask, n_tasks);
+	threads = g_new0 (GThread *, n_tasks);
+
+	for (ii = 0; ii < n_tasks; ii++) {
+		tasks[ii].data = data;
+		tasks[ii].task = ii;
+	}
+
+	/* The calling thread takes the first task itself. */
+	for (ii = 1; ii < n_tasks; ii++)
+		threads[ii] = g_thread_new ("e-table-sort", func, &tasks[ii]);
+
+	func (&tasks[0]);
+
+	for (ii = 1; ii < n_tasks; ii++)
+		g_thread_join (threads[ii]);
+
+	g_free (threads);
+	g_free (tasks);
+}
+
+static gint
+sort_indices_n_threads (gint n_indices,
+                        gint max_threads)
+{
+	gint n_threads;
+
+#if GLIB_CHECK_VERSION(2,36,0)
+	n_threads = g_get_num_processors ();
+#elif defined (G_OS_UNIX) && defined (_SC_NPROCESSORS_ONLN)
+	n_threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+#else
+	n_threads = 1;
+#endif
+
+	n_threads = MIN (n_threads, max_threads);
+	n_threads = MIN (n_threads, n_indices / SORT_INDICES_PER_THREAD + 1);
+
+	return n_threads;
+}
+
+/**
+ * e_table_sorting_utils_sort_indices:
+ * @indices: array of indices to sort
+ * @n_indices: number of items in @indices
+ * @compare_func: function to compare two indices
+ * @user_data: user data to pass to @compare_func
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ *
+ * Stable-sorts @indices using @compare_func.  Large arrays are split into
+ * runs which are sorted and then merged pairwise on several threads, so
+ * @compare_func must be safe to call from any thread as long as it only
+ * touches the @cmp_cache it is given; each thread gets its own compare
+ * cache (see e_table_sorting_utils_create_cmp_cache()).
+ *
+ * If @cancellable is cancelled the function returns early, and @indices
+ * holds the same indices as before, in no particular order.
+ *
+ * Returns: %TRUE if @indices were sorted, %FALSE when cancelled
+ **/
+gboolean
+e_table_sorting_utils_sort_indices (gint *indices,
+                                    gint n_indices,
+                                    ETableSortingCompareFunc compare_func,
+                                    gpointer user_data,
+                                    GCancellable *cancellable)
+{
+	return sort_indices_real (
+		indices, n_indices, compare_func,
+		user_data, cancellable, SORT_MAX_THREADS);
+}
+
+static gboolean
+sort_indices_real (gint *indices,
+                   gint n_indices,
+                   ETableSortingCompareFunc compare_func,
+                   gpointer user_data,
+                   GCancellable *cancellable,
+                   gint max_threads)
+{
+	SortIndicesData data;
+	gint *buffer;
+	gint n_threads, ii;
+
+	g_return_val_if_fail (indices != NULL || n_indices == 0, FALSE);
+	g_return_val_if_fail (compare_func != NULL, FALSE);
+
+	if (g_cancellable_is_cancelled (cancellable))
+		return FALSE;
+
+	if (n_indices < 2)
+		return TRUE;
+
+	n_threads = sort_indices_n_threads (n_indices, max_threads);
+
+	data.compare_func = compare_func;
+	data.user_data = user_data;
+	data.cancellable = cancellable;
+	data.cancelled = 0;
+
+	data.n_runs = n_threads;
+	data.bounds = g_new (gint, n_threads + 1);
+	for (ii = 0; ii <= n_threads; ii++)
+		data.bounds[ii] = (gint64) n_indices * ii / n_threads;
+
+	data.cmp_caches = g_new (gpointer, n_threads);
+	for (ii = 0; ii < n_threads; ii++)
+		data.cmp_caches[ii] = e_table_sorting_utils_create_cmp_cache ();
+
+	data.src = indices;
+	data.dst = buffer = (n_threads > 1) ? g_new (gint, n_indices) : NULL;
+
+	sort_indices_run_tasks (&data, n_threads, sort_indices_run_thread);
+
+	while (data.n_runs > 1 && !g_cancellable_is_cancelled (cancellable)) {
+		gint *tmp;
+		gint n_tasks = (data.n_runs + 1) / 2;
+
+		sort_indices_run_tasks (&data, n_tasks, sort_indices_merge_thread);
+
+		/* A half-done merge leaves dst incomplete;
+		 * src still holds every index, so stop there. */
+		if (g_atomic_int_get (&data.cancelled))
+			break;
+
+		for (ii = 0; ii < n_tasks; ii++)
+			data.bounds[ii + 1] = data.bounds[MIN (2 * ii + 2, data.n_runs)];
+		data.n_runs = n_tasks;
+
+		tmp = data.src;
+		data.src = data.dst;
+		data.dst = tmp;
+	}
+
+	if (data.src != indices)
+		memcpy (indices, data.src, n_indices * sizeof (gint));
+
+	for (ii = 0; ii < n_threads; ii++)
+		e_table_sorting_utils_free_cmp_cache (data.cmp_caches[ii]);
+
+	g_free (data.cmp_caches);
+	g_free (data.bounds);
+	g_free (buffer);
+
+	return data.n_runs == 1 && !g_cancellable_is_cancelled (cancellable);
+}
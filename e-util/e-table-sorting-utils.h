@@ -34,6 +34,31 @@
 
 G_BEGIN_DECLS
 
+/**
+ * ETableSortKeys:
+ *
+ * The sort columns of an #ETableSortInfo, resolved against a table
+ * header.  The contents are private.
+ **/
+typedef struct _ETableSortKeys ETableSortKeys;
+
+/**
+ * ETableSortingCompareFunc:
+ * @index1: the first index
+ * @index2: the second index
+ * @cmp_cache: a compare cache private to the calling thread
+ * @user_data: user data passed to e_table_sorting_utils_sort_indices()
+ *
+ * Compares the items behind two indices.
+ *
+ * Returns: a negative value if the first item comes before the second,
+ *          zero if they are equal, a positive value otherwise
+ **/
+typedef gint	(*ETableSortingCompareFunc)	(gint index1,
+						 gint index2,
+						 gpointer cmp_cache,
+						 gpointer user_data);
+
 gboolean	e_table_sorting_utils_affects_sort
 						(ETableSortInfo *sort_info,
 						 ETableHeader *full_header,
@@ -89,6 +114,36 @@ void		e_table_sorting_utils_add_to_cmp_cache
 const gchar *	e_table_sorting_utils_lookup_cmp_cache
 						(gpointer cmp_cache,
 						 const gchar *key);
+gint		e_table_sorting_utils_str_case_compare
+						(gconstpointer x,
+						 gconstpointer y,
+						 gpointer cmp_cache);
+gint		e_table_sorting_utils_collate_compare
+						(gconstpointer x,
+						 gconstpointer y,
+						 gpointer cmp_cache);
+
+gboolean	e_table_sorting_utils_sort_indices
+						(gint *indices,
+						 gint n_indices,
+						 ETableSortingCompareFunc compare_func,
+						 gpointer user_data,
+						 GCancellable *cancellable);
+
+ETableSortKeys *
+		e_table_sort_keys_new		(ETableModel *source,
+						 ETableSortInfo *sort_info,
+						 ETableHeader *full_header,
+						 gboolean with_grouping);
+void		e_table_sort_keys_free		(ETableSortKeys *keys);
+gboolean	e_table_sort_keys_sort		(ETableSortKeys *keys,
+						 gint *rows,
+						 gint n_rows,
+						 GCancellable *cancellable);
+gint		e_table_sort_keys_find_position	(ETableSortKeys *keys,
+						 const gint *sorted,
+						 gint n_sorted,
+						 gint row);
 
 G_END_DECLS
 
@@ -43,18 +43,41 @@
 
 #define d(x)
 
-#define INCREMENT_AMOUNT 100
+/* Visible rows are kept in chunks of at most this many, with a Fenwick
+ * tree over the chunk lengths.  Inserting or removing rows only moves
+ * entries within a chunk, and both mapping a row to its node and a node
+ * to its row are O(log n), instead of rewriting a flat table. */
+#define MAP_CHUNK_SIZE 512
+
+/* How full new chunks are made, leaving room for later insertions. */
+#define MAP_CHUNK_FILL (MAP_CHUNK_SIZE * 3 / 4)
+
+typedef struct _map_chunk_t map_chunk_t;
 
 typedef struct {
 	ETreePath path;
+	map_chunk_t *chunk;	/* NULL when not in the map */
 	guint32 num_visible_children;
-	guint32 index;
+	guint32 index;		/* position within the chunk */
 
 	guint expanded : 1;
 	guint expandable : 1;
 	guint expandable_set : 1;
 } node_t;
 
+struct _map_chunk_t {
+	guint index;		/* position within map_chunks */
+	guint len;
+	node_t *rows[MAP_CHUNK_SIZE];
+};
+
+/* The adapter keeps one GNode and one node_t per visible row, so
+ * allocate them together.  The GNode's data points at the node_t. */
+typedef struct {
+	GNode gnode;
+	node_t node;
+} row_t;
+
 struct _ETreeTableAdapterPrivate {
 	ETreeModel *source_model;
 	gulong pre_change_handler_id;
@@ -70,13 +93,12 @@ struct _ETreeTableAdapterPrivate {
 	ETableHeader *header;
 
 	gint n_map;
-	gint n_vals_allocated;
-	node_t **map_table;
+	GPtrArray *map_chunks;
+	gint *map_tree;		/* Fenwick tree of chunk lengths */
 	GHashTable *nodes;
 	GNode *root;
 
 	guint root_visible : 1;
-	guint remap_needed : 1;
 
 	gint last_access;
 
@@ -126,53 +148,319 @@ lookup_gnode (ETreeTableAdapter *etta,
 }
 
 static void
-resize_map (ETreeTableAdapter *etta,
-            gint size)
+map_tree_rebuild (ETreeTableAdapter *etta)
 {
-	if (size > etta->priv->n_vals_allocated) {
-		etta->priv->n_vals_allocated = MAX (etta->priv->n_vals_allocated + INCREMENT_AMOUNT, size);
-		etta->priv->map_table = g_renew (node_t *, etta->priv->map_table, etta->priv->n_vals_allocated);
+	GPtrArray *chunks = etta->priv->map_chunks;
+	gint ii, n_chunks = chunks->len;
+	gint *tree;
+
+	g_free (etta->priv->map_tree);
+	tree = g_new0 (gint, n_chunks + 1);
+
+	for (ii = 1; ii <= n_chunks; ii++) {
+		map_chunk_t *chunk = chunks->pdata[ii - 1];
+		gint parent = ii + (ii & -ii);
+
+		chunk->index = ii - 1;
+		tree[ii] += chunk->len;
+		if (parent <= n_chunks)
+			tree[parent] += tree[ii];
 	}
 
-	etta->priv->n_map = size;
+	etta->priv->map_tree = tree;
 }
 
 static void
-move_map_elements (ETreeTableAdapter *etta,
-                   gint to,
-                   gint from,
+map_tree_add (ETreeTableAdapter *etta,
+              map_chunk_t *chunk,
+              gint delta)
+{
+	gint ii, n_chunks = etta->priv->map_chunks->len;
+
+	for (ii = chunk->index + 1; ii <= n_chunks; ii += ii & -ii)
+		etta->priv->map_tree[ii] += delta;
+}
+
+/* Returns the number of rows in the chunks before 'chunk'. */
+static gint
+map_tree_rows_before (ETreeTableAdapter *etta,
+                      map_chunk_t *chunk)
+{
+	gint ii, rows = 0;
+
+	for (ii = chunk->index; ii > 0; ii -= ii & -ii)
+		rows += etta->priv->map_tree[ii];
+
+	return rows;
+}
+
+static map_chunk_t *
+map_locate (ETreeTableAdapter *etta,
+            gint row,
+            guint *offset)
+{
+	GPtrArray *chunks = etta->priv->map_chunks;
+	gint n_chunks = chunks->len;
+	gint pos = 0, bit = 1;
+
+	while (bit * 2 <= n_chunks)
+		bit *= 2;
+
+	/* Find how many whole chunks precede the row. */
+	for (; bit > 0; bit /= 2) {
+		if (pos + bit <= n_chunks && etta->priv->map_tree[pos + bit] <= row) {
+			pos += bit;
+			row -= etta->priv->map_tree[pos];
+		}
+	}
+
+	if (pos >= n_chunks)
+		return NULL;
+
+	*offset = row;
+
+	return chunks->pdata[pos];
+}
+
+static void
+map_chunk_renumber (map_chunk_t *chunk,
+                    guint from)
+{
+	guint ii;
+
+	for (ii = from; ii < chunk->len; ii++) {
+		chunk->rows[ii]->chunk = chunk;
+		chunk->rows[ii]->index = ii;
+	}
+}
+
+/* Puts 'count' rows into new chunks at position 'pos' of map_chunks.
+ * The caller rebuilds the Fenwick tree.  Returns the position after
+ * the new chunks. */
+static guint
+map_insert_chunks (ETreeTableAdapter *etta,
+                   guint pos,
+                   node_t **rows,
                    gint count)
 {
-	if (count <= 0 || from >= etta->priv->n_map)
+	GPtrArray *chunks = etta->priv->map_chunks;
+	guint ii, n_old = chunks->len, n_new;
+
+	if (count <= 0)
+		return pos;
+
+	n_new = (count + MAP_CHUNK_FILL - 1) / MAP_CHUNK_FILL;
+	g_ptr_array_set_size (chunks, n_old + n_new);
+	memmove (
+		chunks->pdata + pos + n_new, chunks->pdata + pos,
+		(n_old - pos) * sizeof (gpointer));
+
+	for (ii = 0; ii < n_new; ii++) {
+		map_chunk_t *chunk = g_new (map_chunk_t, 1);
+
+		chunk->len = MIN (count, MAP_CHUNK_FILL);
+		memcpy (chunk->rows, rows, chunk->len * sizeof (node_t *));
+		map_chunk_renumber (chunk, 0);
+
+		chunks->pdata[pos + ii] = chunk;
+		rows += chunk->len;
+		count -= chunk->len;
+	}
+
+	return pos + n_new;
+}
+
+static void
+map_clear (ETreeTableAdapter *etta)
+{
+	GPtrArray *chunks = etta->priv->map_chunks;
+	guint ii;
+
+	/* The rows may be freed already, leave them alone. */
+	for (ii = 0; ii < chunks->len; ii++)
+		g_free (chunks->pdata[ii]);
+	g_ptr_array_set_size (chunks, 0);
+
+	map_tree_rebuild (etta);
+	etta->priv->n_map = 0;
+}
+
+static void
+map_insert_rows (ETreeTableAdapter *etta,
+                 gint row,
+                 node_t **rows,
+                 gint count)
+{
+	GPtrArray *chunks = etta->priv->map_chunks;
+	map_chunk_t *chunk;
+	guint offset;
+
+	if (count <= 0)
 		return;
-	memmove (etta->priv->map_table + to, etta->priv->map_table + from, count * sizeof (node_t *));
-	etta->priv->remap_needed = TRUE;
+
+	if (chunks->len == 0) {
+		map_insert_chunks (etta, 0, rows, count);
+		map_tree_rebuild (etta);
+		etta->priv->n_map += count;
+		return;
+	}
+
+	if (row >= etta->priv->n_map) {
+		chunk = chunks->pdata[chunks->len - 1];
+		offset = chunk->len;
+	} else {
+		chunk = map_locate (etta, row, &offset);
+	}
+
+	if (chunk->len + count <= MAP_CHUNK_SIZE) {
+		memmove (
+			chunk->rows + offset + count, chunk->rows + offset,
+			(chunk->len - offset) * sizeof (node_t *));
+		memcpy (chunk->rows + offset, rows, count * sizeof (node_t *));
+		chunk->len += count;
+		map_chunk_renumber (chunk, offset);
+		map_tree_add (etta, chunk, count);
+	} else {
+		node_t **tail;
+		guint tail_len, pos;
+
+		/* Split the chunk: it keeps the rows before 'offset',
+		 * the new rows and its remaining rows follow in new
+		 * chunks right after it. */
+		tail_len = chunk->len - offset;
+		tail = g_memdup (chunk->rows + offset, tail_len * sizeof (node_t *));
+		chunk->len = offset;
+
+		pos = map_insert_chunks (etta, chunk->index + 1, rows, count);
+		map_insert_chunks (etta, pos, tail, tail_len);
+		g_free (tail);
+
+		if (chunk->len == 0) {
+			g_ptr_array_remove_index (chunks, chunk->index);
+			g_free (chunk);
+		}
+
+		map_tree_rebuild (etta);
+	}
+
+	etta->priv->n_map += count;
+}
+
+static void
+map_delete_rows (ETreeTableAdapter *etta,
+                 gint row,
+                 gint count)
+{
+	GPtrArray *chunks = etta->priv->map_chunks;
+	map_chunk_t *chunk = NULL;
+	guint offset;
+
+	/* The deleted rows may be freed already, only the
+	 * remaining ones are looked at. */
+	while (count > 0) {
+		guint n;
+
+		chunk = map_locate (etta, row, &offset);
+		if (chunk == NULL)
+			break;
+
+		n = MIN ((guint) count, chunk->len - offset);
+		memmove (
+			chunk->rows + offset, chunk->rows + offset + n,
+			(chunk->len - offset - n) * sizeof (node_t *));
+		chunk->len -= n;
+		map_chunk_renumber (chunk, offset);
+
+		etta->priv->n_map -= n;
+		count -= n;
+
+		if (chunk->len == 0) {
+			g_ptr_array_remove_index (chunks, chunk->index);
+			g_free (chunk);
+			chunk = NULL;
+			map_tree_rebuild (etta);
+		} else {
+			map_tree_add (etta, chunk, - (gint) n);
+		}
+	}
+
+	/* Don't let deletions leave lots of nearly empty chunks behind. */
+	if (chunk != NULL && chunk->len < MAP_CHUNK_SIZE / 4 &&
+	    chunk->index + 1 < chunks->len) {
+		map_chunk_t *next = chunks->pdata[chunk->index + 1];
+
+		if (chunk->len + next->len <= MAP_CHUNK_FILL) {
+			memcpy (
+				chunk->rows + chunk->len, next->rows,
+				next->len * sizeof (node_t *));
+			offset = chunk->len;
+			chunk->len += next->len;
+			map_chunk_renumber (chunk, offset);
+
+			g_ptr_array_remove_index (chunks, next->index);
+			g_free (next);
+			map_tree_rebuild (etta);
+		}
+	}
 }
 
 static gint
-fill_map (ETreeTableAdapter *etta,
-          gint index,
-          GNode *gnode)
+fill_rows (ETreeTableAdapter *etta,
+           node_t **rows,
+           gint index,
+           GNode *gnode)
 {
 	GNode *p;
 
 	if ((gnode != etta->priv->root) || etta->priv->root_visible)
-		etta->priv->map_table[index++] = gnode->data;
+		rows[index++] = gnode->data;
 
 	for (p = gnode->children; p; p = p->next)
-		index = fill_map (etta, index, p);
+		index = fill_rows (etta, rows, index, p);
 
-	etta->priv->remap_needed = TRUE;
 	return index;
 }
 
+/* Inserts the rows of the subtree at 'gnode' at 'row', leaving out
+ * 'gnode' itself unless 'with_self' is set. */
 static void
-remap_indices (ETreeTableAdapter *etta)
+map_insert_subtree (ETreeTableAdapter *etta,
+                    gint row,
+                    GNode *gnode,
+                    gboolean with_self)
 {
-	gint i;
-	for (i = 0; i < etta->priv->n_map; i++)
-		etta->priv->map_table[i]->index = i;
-	etta->priv->remap_needed = FALSE;
+	node_t *node = gnode->data;
+	node_t **rows;
+	gint count = 0;
+	GNode *p;
+
+	rows = g_new (node_t *, node->num_visible_children + 1);
+
+	if (with_self) {
+		count = fill_rows (etta, rows, 0, gnode);
+	} else {
+		for (p = gnode->children; p; p = p->next)
+			count = fill_rows (etta, rows, count, p);
+	}
+
+	map_insert_rows (etta, row, rows, count);
+
+	g_free (rows);
+}
+
+/* Rebuilds the whole map from the tree, in its current order. */
+static void
+map_rebuild (ETreeTableAdapter *etta)
+{
+	map_clear (etta);
+
+	if (etta->priv->root == NULL)
+		return;
+
+	if (!etta->priv->root_visible)
+		((node_t *) etta->priv->root->data)->chunk = NULL;
+
+	map_insert_subtree (etta, 0, etta->priv->root, TRUE);
 }
 
 static node_t *
@@ -240,22 +528,52 @@ resort_node (ETreeTableAdapter *etta,
 	g_free (paths);
 }
 
-static void
-kill_gnode (GNode *node,
-            ETreeTableAdapter *etta)
+static gboolean
+remove_gnode_path (GNode *node,
+                   gpointer user_data)
 {
+	ETreeTableAdapter *etta = user_data;
+
 	g_hash_table_remove (etta->priv->nodes, ((node_t *) node->data)->path);
 
+	return FALSE;
+}
+
+static void
+free_gnode_tree (GNode *node)
+{
 	while (node->children) {
 		GNode *next = node->children->next;
-		kill_gnode (node->children, etta);
+		free_gnode_tree (node->children);
 		node->children = next;
 	}
 
-	g_free (node->data);
-	if (node == etta->priv->root)
+	g_slice_free (row_t, (row_t *) node);
+}
+
+static void
+kill_gnode (GNode *node,
+            ETreeTableAdapter *etta)
+{
+	if (node == etta->priv->root) {
+		/* Everything goes, no need to pick them out one by one. */
+		g_hash_table_remove_all (etta->priv->nodes);
 		etta->priv->root = NULL;
-	g_node_destroy (node);
+	} else {
+		GNode *child;
+
+		g_hash_table_remove (
+			etta->priv->nodes, ((node_t *) node->data)->path);
+
+		for (child = node->children; child; child = child->next)
+			g_node_traverse (
+				child, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+				remove_gnode_path, etta);
+
+		g_node_unlink (node);
+	}
+
+	free_gnode_tree (node);
 }
 
 static void
@@ -309,8 +627,7 @@ delete_node (ETreeTableAdapter *etta,
 	to_remove += delete_children (etta, gnode);
 	kill_gnode (gnode, etta);
 
-	move_map_elements (etta, row, row + to_remove, etta->priv->n_map - row - to_remove);
-	resize_map (etta, etta->priv->n_map - to_remove);
+	map_delete_rows (etta, row, to_remove);
 
 	if (parent_gnode != NULL) {
 		node_t *parent_node = parent_gnode->data;
@@ -335,15 +652,20 @@ create_gnode (ETreeTableAdapter *etta,
 {
 	GNode *gnode;
 	node_t *node;
+	row_t *row;
+
+	row = g_slice_new0 (row_t);
+	gnode = &row->gnode;
+	node = &row->node;
+	gnode->data = node;
 
-	node = g_new0 (node_t, 1);
 	node->path = path;
-	node->index = -1;
+	node->chunk = NULL;
+	node->index = 0;
 	node->expanded = etta->priv->force_expanded_state == 0 ? e_tree_model_get_expanded_default (etta->priv->source_model) : etta->priv->force_expanded_state > 0;
 	node->expandable = e_tree_model_node_is_expandable (etta->priv->source_model, path);
 	node->expandable_set = 1;
 	node->num_visible_children = 0;
-	gnode = g_node_new (node);
 	g_hash_table_insert (etta->priv->nodes, path, gnode);
 	return gnode;
 }
@@ -377,7 +699,6 @@ generate_tree (ETreeTableAdapter *etta,
 {
 	GNode *gnode;
 	node_t *node;
-	gint size;
 
 	e_table_model_pre_change (E_TABLE_MODEL (etta));
 
@@ -385,7 +706,7 @@ generate_tree (ETreeTableAdapter *etta,
 
 	if (etta->priv->root)
 		kill_gnode (etta->priv->root, etta);
-	resize_map (etta, 0);
+	map_clear (etta);
 
 	gnode = create_gnode (etta, path);
 	node = (node_t *) gnode->data;
@@ -395,9 +716,7 @@ generate_tree (ETreeTableAdapter *etta,
 		resort_node (etta, gnode, TRUE);
 
 	etta->priv->root = gnode;
-	size =  etta->priv->root_visible ? node->num_visible_children + 1 : node->num_visible_children;
-	resize_map (etta, size);
-	fill_map (etta, 0, gnode);
+	map_rebuild (etta);
 	e_table_model_changed (E_TABLE_MODEL (etta));
 }
 
@@ -406,10 +725,11 @@ insert_node (ETreeTableAdapter *etta,
              ETreePath parent,
              ETreePath path)
 {
-	GNode *gnode, *parent_gnode;
+	GNode *gnode, *parent_gnode, *child, **siblings;
 	node_t *node, *parent_node;
 	gboolean expandable;
 	gint size, row;
+	guint ii, n_siblings;
 
 	e_table_model_pre_change (E_TABLE_MODEL (etta));
 
@@ -437,7 +757,9 @@ insert_node (ETreeTableAdapter *etta,
 			e_table_model_pre_change (E_TABLE_MODEL (etta));
 			parent_node->expandable = expandable;
 			parent_node->expandable_set = 1;
-			e_table_model_row_changed (E_TABLE_MODEL (etta), parent_node->index);
+			e_table_model_row_changed (
+				E_TABLE_MODEL (etta),
+				e_tree_table_adapter_row_of_node (etta, parent));
 		}
 	}
 
@@ -452,22 +774,49 @@ insert_node (ETreeTableAdapter *etta,
 	if (node->expanded)
 		node->num_visible_children = insert_children (etta, gnode);
 
+	/* Remember the order of the siblings, so that the map only has
+	 * to be touched where the new node goes if resorting leaves them
+	 * in place, which is the usual case. */
+	n_siblings = g_node_n_children (parent_gnode);
+	siblings = g_new (GNode *, n_siblings + 1);
+	for (ii = 0, child = parent_gnode->children; child; child = child->next)
+		siblings[ii++] = child;
+
 	g_node_append (parent_gnode, gnode);
 	update_child_counts (parent_gnode, node->num_visible_children + 1);
 	resort_node (etta, parent_gnode, FALSE);
 	resort_node (etta, gnode, TRUE);
 
+	ii = 0;
+	for (child = parent_gnode->children; child; child = child->next) {
+		if (child == gnode)
+			continue;
+		if (ii >= n_siblings || siblings[ii++] != child)
+			break;
+	}
+	g_free (siblings);
+
 	size = node->num_visible_children + 1;
-	resize_map (etta, etta->priv->n_map + size);
-	if (parent_gnode == etta->priv->root)
-		row = 0;
-	else {
-		gint new_size = parent_node->num_visible_children + 1;
-		gint old_size = new_size - size;
-		row = parent_node->index;
-		move_map_elements (etta, row + new_size, row + old_size, etta->priv->n_map - row - new_size);
+	row = e_tree_table_adapter_row_of_node (etta, parent);
+
+	if (child == NULL) {
+		/* row is -1 for an invisible root, which is fine here */
+		if (gnode->prev != NULL) {
+			node_t *prev_node = gnode->prev->data;
+
+			row = e_tree_table_adapter_row_of_node (
+				etta, prev_node->path) +
+				prev_node->num_visible_children;
+		}
+		map_insert_subtree (etta, row + 1, gnode, TRUE);
+	} else if (parent_gnode == etta->priv->root) {
+		map_rebuild (etta);
+	} else {
+		map_delete_rows (
+			etta, row, parent_node->num_visible_children + 1 - size);
+		map_insert_subtree (etta, row, parent_gnode, TRUE);
 	}
-	fill_map (etta, row, parent_gnode);
+
 	e_table_model_rows_inserted (
 		E_TABLE_MODEL (etta),
 		e_tree_table_adapter_row_of_node (etta, path), size);
@@ -540,7 +889,7 @@ tree_table_adapter_sort_info_changed_cb (ETableSortInfo *sort_info,
 
 	e_table_model_pre_change (E_TABLE_MODEL (etta));
 	resort_node (etta, etta->priv->root, TRUE);
-	fill_map (etta, 0, etta->priv->root);
+	map_rebuild (etta);
 	e_table_model_changed (E_TABLE_MODEL (etta));
 }
 
@@ -799,7 +1148,9 @@ tree_table_adapter_finalize (GObject *object)
 
 	g_hash_table_destroy (priv->nodes);
 
-	g_free (priv->map_table);
+	map_clear (E_TREE_TABLE_ADAPTER (object));
+	g_ptr_array_free (priv->map_chunks, TRUE);
+	g_free (priv->map_tree);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_tree_table_adapter_parent_class)->finalize (object);
@@ -1080,8 +1431,10 @@ e_tree_table_adapter_init (ETreeTableAdapter *etta)
 
 	etta->priv->nodes = g_hash_table_new (NULL, NULL);
 
+	etta->priv->map_chunks = g_ptr_array_new ();
+	etta->priv->map_tree = g_new0 (gint, 1);
+
 	etta->priv->root_visible = TRUE;
-	etta->priv->remap_needed = TRUE;
 }
 
 ETableModel *
@@ -1160,7 +1513,7 @@ e_tree_table_adapter_set_sort_info (ETreeTableAdapter *etta,
 
 	e_table_model_pre_change (E_TABLE_MODEL (etta));
 	resort_node (etta, etta->priv->root, TRUE);
-	fill_map (etta, 0, etta->priv->root);
+	map_rebuild (etta);
 	e_table_model_changed (E_TABLE_MODEL (etta));
 }
 
@@ -1376,8 +1729,6 @@ void
 e_tree_table_adapter_root_node_set_visible (ETreeTableAdapter *etta,
                                             gboolean visible)
 {
-	gint size;
-
 	g_return_if_fail (E_IS_TREE_TABLE_ADAPTER (etta));
 
 	if (etta->priv->root_visible == visible)
@@ -1391,10 +1742,7 @@ e_tree_table_adapter_root_node_set_visible (ETreeTableAdapter *etta,
 		if (root)
 			e_tree_table_adapter_node_set_expanded (etta, root, TRUE);
 	}
-	size = (visible ? 1 : 0) + (etta->priv->root ? ((node_t *) etta->priv->root->data)->num_visible_children : 0);
-	resize_map (etta, size);
-	if (etta->priv->root)
-		fill_map (etta, 0, etta->priv->root);
+	map_rebuild (etta);
 	e_table_model_changed (E_TABLE_MODEL (etta));
 }
 
@@ -1442,9 +1790,7 @@ e_tree_table_adapter_node_set_expanded (ETreeTableAdapter *etta,
 		update_child_counts (gnode, num_children);
 		if (etta->priv->sort_info && e_table_sort_info_sorting_get_count (etta->priv->sort_info) > 0)
 			resort_node (etta, gnode, TRUE);
-		resize_map (etta, etta->priv->n_map + num_children);
-		move_map_elements (etta, row + 1 + num_children, row + 1, etta->priv->n_map - row - 1 - num_children);
-		fill_map (etta, row, gnode);
+		map_insert_subtree (etta, row + 1, gnode, FALSE);
 		if (num_children != 0) {
 			e_table_model_rows_inserted (E_TABLE_MODEL (etta), row + 1, num_children);
 		} else
@@ -1455,9 +1801,8 @@ e_tree_table_adapter_node_set_expanded (ETreeTableAdapter *etta,
 			e_table_model_no_change (E_TABLE_MODEL (etta));
 			return;
 		}
-		move_map_elements (etta, row + 1, row + 1 + num_children, etta->priv->n_map - row - 1 - num_children);
+		map_delete_rows (etta, row + 1, num_children);
 		update_child_counts (gnode, - num_children);
-		resize_map (etta, etta->priv->n_map - num_children);
 		e_table_model_rows_deleted (E_TABLE_MODEL (etta), row + 1, num_children);
 	}
 }
@@ -1484,6 +1829,9 @@ ETreePath
 e_tree_table_adapter_node_at_row (ETreeTableAdapter *etta,
                                   gint row)
 {
+	map_chunk_t *chunk;
+	guint offset;
+
 	g_return_val_if_fail (E_IS_TREE_TABLE_ADAPTER (etta), NULL);
 
 	if (row == -1 && etta->priv->n_map > 0)
@@ -1491,7 +1839,11 @@ e_tree_table_adapter_node_at_row (ETreeTableAdapter *etta,
 	else if (row < 0 || row >= etta->priv->n_map)
 		return NULL;
 
-	return etta->priv->map_table[row]->path;
+	chunk = map_locate (etta, row, &offset);
+	if (chunk == NULL)
+		return NULL;
+
+	return chunk->rows[offset]->path;
 }
 
 gint
@@ -1503,13 +1855,10 @@ e_tree_table_adapter_row_of_node (ETreeTableAdapter *etta,
 	g_return_val_if_fail (E_IS_TREE_TABLE_ADAPTER (etta), -1);
 
 	node = get_node (etta, path);
-	if (node == NULL)
+	if (node == NULL || node->chunk == NULL)
 		return -1;
 
-	if (etta->priv->remap_needed)
-		remap_indices (etta);
-
-	return node->index;
+	return map_tree_rows_before (etta, node->chunk) + node->index;
 }
 
 gboolean
@@ -29,8 +29,25 @@
 	(G_TYPE_INSTANCE_GET_PRIVATE \
 	((obj), E_TYPE_MAIL_EXTENSION_REGISTRY, EMailExtensionRegistryPrivate))
 
+/* Resolved MIME types are forgotten once there are this many,
+ * they come from messages, so there is no telling how many. */
+#define DISPATCH_TABLE_MAX_SIZE 256
+
+typedef struct _ExtensionTiming ExtensionTiming;
+
 struct _EMailExtensionRegistryPrivate {
 	GHashTable *table;
+
+	GMutex dispatch_lock;
+	GHashTable *dispatch_table;
+
+	GMutex timing_lock;
+	GHashTable *timings;
+};
+
+struct _ExtensionTiming {
+	guint n_calls;
+	gint64 total_us;
 };
 
 G_DEFINE_ABSTRACT_TYPE (
@@ -74,6 +91,11 @@ mail_extension_registry_add_extension (EMailExtensionRegistry *registry,
 
 	extension = g_object_new (extension_type, NULL);
 
+	/* The extension can change how any MIME type resolves. */
+	g_mutex_lock (&registry->priv->dispatch_lock);
+	g_hash_table_remove_all (registry->priv->dispatch_table);
+	g_mutex_unlock (&registry->priv->dispatch_lock);
+
 	for (ii = 0; mime_types[ii] != NULL; ii++) {
 		GQueue *queue;
 
@@ -110,6 +132,11 @@ mail_extension_registry_finalize (GObject *object)
 	priv = E_MAIL_EXTENSION_REGISTRY_GET_PRIVATE (object);
 
 	g_hash_table_destroy (priv->table);
+	g_hash_table_destroy (priv->dispatch_table);
+	g_hash_table_destroy (priv->timings);
+
+	g_mutex_clear (&priv->dispatch_lock);
+	g_mutex_clear (&priv->timing_lock);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_mail_extension_registry_parent_class)->
@@ -138,6 +165,20 @@ e_mail_extension_registry_init (EMailExtensionRegistry *registry)
 		(GEqualFunc) g_str_equal,
 		(GDestroyNotify) NULL,
 		(GDestroyNotify) destroy_queue);
+
+	g_mutex_init (&registry->priv->dispatch_lock);
+	registry->priv->dispatch_table = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+
+	g_mutex_init (&registry->priv->timing_lock);
+	registry->priv->timings = g_hash_table_new_full (
+		(GHashFunc) g_direct_hash,
+		(GEqualFunc) g_direct_equal,
+		(GDestroyNotify) NULL,
+		(GDestroyNotify) g_free);
 }
 
 /**
@@ -202,6 +243,149 @@ e_mail_extension_registry_get_fallback (EMailExtensionRegistry *registry,
 	return parsers;
 }
 
+/**
+ * e_mail_extension_registry_resolve:
+ * @registry: An #EMailExtensionRegistry
+ * @mime_type: A string with mime-type to look up
+ *
+ * Looks up the #EMailExtension<!-//>s handling @mime_type, the same as
+ * e_mail_extension_registry_get_for_mime_type() followed by
+ * e_mail_extension_registry_get_fallback() when that finds nothing.
+ * The result is remembered, so resolving the same @mime_type again is
+ * a single hash table lookup.
+ *
+ * Return value: Returns #GQueue of #EMailExtension<!-//>s or %NULL when
+ * there are no extensions registered for @mime_type or its fallback.
+ */
+GQueue *
+e_mail_extension_registry_resolve (EMailExtensionRegistry *registry,
+                                   const gchar *mime_type)
+{
+	GQueue *extensions = NULL;
+	gpointer value;
+
+	g_return_val_if_fail (E_IS_MAIL_EXTENSION_REGISTRY (registry), NULL);
+	g_return_val_if_fail (mime_type && *mime_type, NULL);
+
+	g_mutex_lock (&registry->priv->dispatch_lock);
+
+	if (g_hash_table_lookup_extended (
+		registry->priv->dispatch_table, mime_type, NULL, &value)) {
+		g_mutex_unlock (&registry->priv->dispatch_lock);
+		return value;
+	}
+
+	g_mutex_unlock (&registry->priv->dispatch_lock);
+
+	extensions = e_mail_extension_registry_get_for_mime_type (
+		registry, mime_type);
+	if (extensions == NULL)
+		extensions = e_mail_extension_registry_get_fallback (
+			registry, mime_type);
+
+	g_mutex_lock (&registry->priv->dispatch_lock);
+
+	if (g_hash_table_size (registry->priv->dispatch_table) >=
+	    DISPATCH_TABLE_MAX_SIZE)
+		g_hash_table_remove_all (registry->priv->dispatch_table);
+
+	/* Misses are remembered too, as NULL. */
+	g_hash_table_insert (
+		registry->priv->dispatch_table,
+		g_strdup (mime_type), extensions);
+
+	g_mutex_unlock (&registry->priv->dispatch_lock);
+
+	return extensions;
+}
+
+/**
+ * e_mail_extension_registry_add_timing:
+ * @registry: An #EMailExtensionRegistry
+ * @extension: the extension which was called
+ * @elapsed_us: how long the call took, in microseconds
+ *
+ * Accounts @elapsed_us to the type of @extension.  Parser and formatter
+ * extensions are timed this way when the "emformat:timing" Camel debug
+ * option is on, which also prints each call along with the totals so far.
+ * The time includes any parts the extension handed on to other extensions.
+ */
+void
+e_mail_extension_registry_add_timing (EMailExtensionRegistry *registry,
+                                      gpointer extension,
+                                      gint64 elapsed_us)
+{
+	ExtensionTiming *timing;
+	GType type;
+
+	g_return_if_fail (E_IS_MAIL_EXTENSION_REGISTRY (registry));
+	g_return_if_fail (G_IS_OBJECT (extension));
+
+	type = G_OBJECT_TYPE (extension);
+
+	g_mutex_lock (&registry->priv->timing_lock);
+
+	timing = g_hash_table_lookup (
+		registry->priv->timings, GSIZE_TO_POINTER (type));
+	if (timing == NULL) {
+		timing = g_new0 (ExtensionTiming, 1);
+		g_hash_table_insert (
+			registry->priv->timings,
+			GSIZE_TO_POINTER (type), timing);
+	}
+
+	timing->n_calls++;
+	timing->total_us += elapsed_us;
+
+	if (camel_debug_start ("emformat:timing")) {
+		printf (
+			"%s: %.3f ms (%u calls, %.3f ms in total)\n",
+			g_type_name (type), elapsed_us / 1000.0,
+			timing->n_calls, timing->total_us / 1000.0);
+		camel_debug_end ();
+	}
+
+	g_mutex_unlock (&registry->priv->timing_lock);
+}
+
+/**
+ * e_mail_extension_registry_get_timing:
+ * @registry: An #EMailExtensionRegistry
+ * @extension_type: a #GType of an extension
+ * @out_n_calls: return location for the number of timed calls, or %NULL
+ * @out_total_us: return location for the total time in microseconds,
+ *                or %NULL
+ *
+ * Returns what e_mail_extension_registry_add_timing() accounted to
+ * @extension_type so far.
+ *
+ * Return value: %TRUE if @extension_type was timed at all
+ */
+gboolean
+e_mail_extension_registry_get_timing (EMailExtensionRegistry *registry,
+                                      GType extension_type,
+                                      guint *out_n_calls,
+                                      gint64 *out_total_us)
+{
+	ExtensionTiming *timing;
+
+	g_return_val_if_fail (E_IS_MAIL_EXTENSION_REGISTRY (registry), FALSE);
+
+	g_mutex_lock (&registry->priv->timing_lock);
+
+	timing = g_hash_table_lookup (
+		registry->priv->timings, GSIZE_TO_POINTER (extension_type));
+
+	if (out_n_calls != NULL)
+		*out_n_calls = (timing != NULL) ? timing->n_calls : 0;
+	if (out_total_us != NULL)
+		*out_total_us = (timing != NULL) ? timing->total_us : 0;
+
+	g_mutex_unlock (&registry->priv->timing_lock);
+
+	return timing != NULL;
+}
+
 /******************************************************************************/
 
 G_DEFINE_TYPE_WITH_CODE (
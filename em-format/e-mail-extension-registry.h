@@ -63,6 +63,18 @@ GQueue *	e_mail_extension_registry_get_for_mime_type
 GQueue *	e_mail_extension_registry_get_fallback
 					(EMailExtensionRegistry *registry,
 					 const gchar *mime_type);
+GQueue *	e_mail_extension_registry_resolve
+					(EMailExtensionRegistry *registry,
+					 const gchar *mime_type);
+void		e_mail_extension_registry_add_timing
+					(EMailExtensionRegistry *registry,
+					 gpointer extension,
+					 gint64 elapsed_us);
+gboolean	e_mail_extension_registry_get_timing
+					(EMailExtensionRegistry *registry,
+					 GType extension_type,
+					 guint *out_n_calls,
+					 gint64 *out_total_us);
 
 G_END_DECLS
 
@@ -178,11 +178,8 @@ emfe_attachment_format (EMailFormatterExtension *extension,
 
 	registry = e_mail_formatter_get_extension_registry (formatter);
 
-	extensions = e_mail_extension_registry_get_for_mime_type (
+	extensions = e_mail_extension_registry_resolve (
 		registry, empa->snoop_mime_type);
-	if (extensions == NULL)
-		extensions = e_mail_extension_registry_get_fallback (
-			registry, empa->snoop_mime_type);
 
 	/* If the attachment is requested as RAW, then call the
 	 * handler directly and do not append any other code. */
@@ -66,6 +66,8 @@ e_mail_formatter_extension_format (EMailFormatterExtension *extension,
                                    GCancellable *cancellable)
 {
 	EMailFormatterExtensionClass *class;
+	gboolean handled;
+	gint64 start;
 
 	g_return_val_if_fail (E_IS_MAIL_FORMATTER_EXTENSION (extension), FALSE);
 	g_return_val_if_fail (E_IS_MAIL_FORMATTER (formatter), FALSE);
@@ -76,7 +78,21 @@ e_mail_formatter_extension_format (EMailFormatterExtension *extension,
 	class = E_MAIL_FORMATTER_EXTENSION_GET_CLASS (extension);
 	g_return_val_if_fail (class->format != NULL, FALSE);
 
-	return class->format (extension, formatter, context, part, stream, cancellable);
+	if (!camel_debug ("emformat:timing"))
+		return class->format (
+			extension, formatter, context,
+			part, stream, cancellable);
+
+	start = g_get_monotonic_time ();
+
+	handled = class->format (
+		extension, formatter, context, part, stream, cancellable);
+
+	e_mail_extension_registry_add_timing (
+		e_mail_formatter_get_extension_registry (formatter),
+		extension, g_get_monotonic_time () - start);
+
+	return handled;
 }
 
 /**
@@ -21,6 +21,7 @@
 #endif
 
 #include <glib/gi18n-lib.h>
+#include <libsoup/soup.h>
 
 #include <e-util/e-util.h>
 
@@ -28,6 +29,11 @@
 #include "e-mail-inline-filter.h"
 #include "e-mail-part-utils.h"
 
+/* How much text to put into the message view at first.  Huge parts
+ * are cut there and get a button to load the rest on demand, so that
+ * neither the formatter nor the web view has to hold all of it. */
+#define TEXT_PLAIN_DISPLAY_LIMIT (512 * 1024)
+
 typedef EMailFormatterExtension EMailFormatterTextPlain;
 typedef EMailFormatterExtensionClass EMailFormatterTextPlainClass;
 
@@ -46,6 +52,32 @@ static const gchar *formatter_mime_types[] = {
 	NULL
 };
 
+static gboolean
+text_plain_show_all_requested (const gchar *uri)
+{
+	SoupURI *soup_uri;
+	gboolean show_all = FALSE;
+
+	if (uri == NULL)
+		return FALSE;
+
+	soup_uri = soup_uri_new (uri);
+	if (soup_uri == NULL)
+		return FALSE;
+
+	if (soup_uri->query != NULL) {
+		GHashTable *query = soup_form_decode (soup_uri->query);
+
+		show_all = g_strcmp0 (
+			g_hash_table_lookup (query, "show_all"), "1") == 0;
+		g_hash_table_destroy (query);
+	}
+
+	soup_uri_free (soup_uri);
+
+	return show_all;
+}
+
 static gboolean
 emfe_text_plain_format (EMailFormatterExtension *extension,
                         EMailFormatter *formatter,
@@ -68,6 +100,8 @@ emfe_text_plain_format (EMailFormatterExtension *extension,
 		CamelMimeFilterToHTMLFlags flags;
 		CamelMimePart *mime_part;
 		CamelDataWrapper *dw;
+		gsize limit = 0;
+		gboolean truncated;
 
 		if (context->mode == E_MAIL_FORMATTER_MODE_RAW) {
 			camel_stream_write_string (
@@ -113,8 +147,14 @@ emfe_text_plain_format (EMailFormatterExtension *extension,
 			"-e-web-view-background-color -e-web-view-text-color\" "
 			"style=\"border: none; padding: 8px; margin: 0;\">");
 
+		/* Printing always gets the whole text. */
+		if (context->mode == E_MAIL_FORMATTER_MODE_RAW &&
+		    !text_plain_show_all_requested (context->uri))
+			limit = TEXT_PLAIN_DISPLAY_LIMIT;
+
 		camel_stream_write_string (stream, content, cancellable, NULL);
-		e_mail_formatter_format_text (formatter, part, filtered_stream, cancellable);
+		truncated = e_mail_formatter_format_text_limited (
+			formatter, part, filtered_stream, limit, cancellable);
 		camel_stream_flush (filtered_stream, cancellable, NULL);
 
 		g_object_unref (filtered_stream);
@@ -122,6 +162,38 @@ emfe_text_plain_format (EMailFormatterExtension *extension,
 
 		camel_stream_write_string (stream, "</div>\n", cancellable, NULL);
 
+		if (truncated) {
+			GByteArray *byte_array;
+			gchar *label;
+
+			byte_array = camel_data_wrapper_get_byte_array (dw);
+			if (byte_array != NULL && byte_array->len > 0) {
+				gchar *size = g_format_size (byte_array->len);
+
+				label = g_strdup_printf (
+					_("Show the rest of the text (%s in total)"),
+					size);
+				g_free (size);
+			} else {
+				label = g_strdup (_("Show the rest of the text"));
+			}
+
+			/* The click is handled by EMailDisplay, which
+			 * reloads the frame with "show_all=1" added. */
+			content = g_strdup_printf (
+				"<div class=\"part-container "
+				"-e-web-view-background-color -e-web-view-text-color\" "
+				"style=\"border: none; padding: 8px; margin: 0;\">"
+				"<button type=\"button\" id=\"__evo-show-full-text\">"
+				"%s</button></div>\n", label);
+
+			camel_stream_write_string (
+				stream, content, cancellable, NULL);
+
+			g_free (content);
+			g_free (label);
+		}
+
 		if (context->mode == E_MAIL_FORMATTER_MODE_RAW) {
 			camel_stream_write_string (
 				stream, "</body></html>",
@@ -39,6 +39,8 @@
 	"evo-file://" EVOLUTION_PRIVDATADIR "/theme/webview.css"
 
 typedef struct _AsyncContext AsyncContext;
+typedef struct _LimitStream LimitStream;
+typedef struct _LimitStreamClass LimitStreamClass;
 
 struct _EMailFormatterPrivate {
 	EMailImageLoadingPolicy image_loading_policy;
@@ -60,6 +62,26 @@ struct _AsyncContext {
 	EMailFormatterMode mode;
 };
 
+/* Passes at most 'remaining' bytes through to 'target', cutting at a
+ * line break where possible, then fails further writes so the decoder
+ * stops early instead of converting text nobody is going to see.
+ * Flushing it does not flush 'target', that is left to the caller. */
+struct _LimitStream {
+	CamelStream parent;
+
+	CamelStream *target;
+	gsize remaining;
+	gboolean truncated;
+};
+
+struct _LimitStreamClass {
+	CamelStreamClass parent_class;
+};
+
+static GType limit_stream_get_type (void);
+
+G_DEFINE_TYPE (LimitStream, limit_stream, CAMEL_TYPE_STREAM)
+
 /* internal formatter extensions */
 GType e_mail_formatter_attachment_get_type (void);
 GType e_mail_formatter_attachment_bar_get_type (void);
@@ -110,6 +132,86 @@ async_context_free (AsyncContext *async_context)
 	g_slice_free (AsyncContext, async_context);
 }
 
+static gssize
+limit_stream_write (CamelStream *stream,
+                    const gchar *buffer,
+                    gsize n,
+                    GCancellable *cancellable,
+                    GError **error)
+{
+	LimitStream *limit_stream = (LimitStream *) stream;
+	gsize cut;
+
+	if (!limit_stream->truncated && n <= limit_stream->remaining) {
+		gssize written;
+
+		written = camel_stream_write (
+			limit_stream->target, buffer, n, cancellable, error);
+		if (written > 0)
+			limit_stream->remaining -= written;
+
+		return written;
+	}
+
+	if (!limit_stream->truncated) {
+		const gchar *newline;
+
+		cut = limit_stream->remaining;
+
+		/* Prefer to stop at the end of a line, otherwise at
+		 * least don't split a UTF-8 sequence in half. */
+		newline = g_strrstr_len (buffer, cut, "\n");
+		if (newline != NULL)
+			cut = newline - buffer + 1;
+		else
+			while (cut > 0 && (buffer[cut] & 0xc0) == 0x80)
+				cut--;
+
+		if (cut > 0 && camel_stream_write (
+			limit_stream->target, buffer, cut,
+			cancellable, error) == -1)
+			return -1;
+
+		limit_stream->remaining = 0;
+		limit_stream->truncated = TRUE;
+	}
+
+	g_set_error_literal (
+		error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+		"Text display limit reached");
+
+	return -1;
+}
+
+static void
+limit_stream_finalize (GObject *object)
+{
+	LimitStream *limit_stream = (LimitStream *) object;
+
+	g_object_unref (limit_stream->target);
+
+	/* Chain up to parent's finalize() method. */
+	G_OBJECT_CLASS (limit_stream_parent_class)->finalize (object);
+}
+
+static void
+limit_stream_class_init (LimitStreamClass *class)
+{
+	GObjectClass *object_class;
+	CamelStreamClass *stream_class;
+
+	object_class = G_OBJECT_CLASS (class);
+	object_class->finalize = limit_stream_finalize;
+
+	stream_class = CAMEL_STREAM_CLASS (class);
+	stream_class->write = limit_stream_write;
+}
+
+static void
+limit_stream_init (LimitStream *limit_stream)
+{
+}
+
 static EMailFormatterContext *
 mail_formatter_create_context (EMailFormatter *formatter,
                                EMailPartList *part_list,
@@ -971,11 +1073,8 @@ e_mail_formatter_format_as (EMailFormatter *formatter,
 
 	extension_registry =
 		e_mail_formatter_get_extension_registry (formatter);
-	formatters = e_mail_extension_registry_get_for_mime_type (
+	formatters = e_mail_extension_registry_resolve (
 		extension_registry, as_mime_type);
-	if (formatters == NULL)
-		formatters = e_mail_extension_registry_get_fallback (
-			extension_registry, as_mime_type);
 
 	ok = FALSE;
 
@@ -1028,17 +1127,43 @@ e_mail_formatter_format_text (EMailFormatter *formatter,
                               EMailPart *part,
                               CamelStream *stream,
                               GCancellable *cancellable)
+{
+	e_mail_formatter_format_text_limited (
+		formatter, part, stream, 0, cancellable);
+}
+
+/**
+ * e_mail_formatter_format_text_limited:
+ * @formatter: an #EMailFormatter
+ * @part: an #EMailPart to decode
+ * @stream: Where to write the converted text
+ * @limit: maximum number of bytes to write, or 0 for no limit
+ * @cancellable: optional #GCancellable object, or %NULL
+ *
+ * Like e_mail_formatter_format_text(), but stops decoding once @limit
+ * bytes of UTF-8 text were written to @stream.  The text is cut at the
+ * last line break before the limit where possible.
+ *
+ * Returns: %TRUE if the text was cut short, %FALSE if all of it was written
+ **/
+gboolean
+e_mail_formatter_format_text_limited (EMailFormatter *formatter,
+                                      EMailPart *part,
+                                      CamelStream *stream,
+                                      gsize limit,
+                                      GCancellable *cancellable)
 {
 	CamelStream *filter_stream;
 	CamelMimeFilter *filter;
 	const gchar *charset = NULL;
 	CamelMimeFilter *windows = NULL;
-	CamelStream *mem_stream = NULL;
+	LimitStream *limit_stream;
 	CamelMimePart *mime_part;
 	CamelContentType *mime_type;
+	gboolean truncated = FALSE;
 
 	if (g_cancellable_is_cancelled (cancellable))
-		return;
+		return FALSE;
 
 	mime_part = e_mail_part_ref_mime_part (part);
 	mime_type = CAMEL_DATA_WRAPPER (mime_part)->mime_type;
@@ -1075,8 +1200,13 @@ e_mail_formatter_format_text (EMailFormatter *formatter,
 		charset = formatter->priv->default_charset;
 	}
 
-	mem_stream = (CamelStream *) camel_stream_mem_new ();
-	filter_stream = camel_stream_filter_new (mem_stream);
+	/* Decode straight into the caller's stream, so that huge parts
+	 * are never held in memory as a whole and whatever renders the
+	 * output can start before the last byte is converted. */
+	limit_stream = g_object_new (limit_stream_get_type (), NULL);
+	limit_stream->target = g_object_ref (stream);
+	limit_stream->remaining = (limit > 0) ? limit : G_MAXSIZE;
+	filter_stream = camel_stream_filter_new (CAMEL_STREAM (limit_stream));
 
 	filter = camel_mime_filter_charset_new (charset, "UTF-8");
 	if (filter != NULL) {
@@ -1091,18 +1221,15 @@ e_mail_formatter_format_text (EMailFormatter *formatter,
 	camel_stream_flush (filter_stream, cancellable, NULL);
 	g_object_unref (filter_stream);
 
-	g_seekable_seek (G_SEEKABLE (mem_stream), 0, G_SEEK_SET, NULL, NULL);
-
-	camel_stream_write_to_stream (
-		mem_stream, stream, cancellable, NULL);
-	camel_stream_flush (mem_stream, cancellable, NULL);
+	truncated = limit_stream->truncated;
+	g_object_unref (limit_stream);
 
 	if (windows != NULL)
 		g_object_unref (windows);
 
-	g_object_unref (mem_stream);
-
 	g_object_unref (mime_part);
+
+	return truncated;
 }
 
 const gchar *
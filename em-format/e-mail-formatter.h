@@ -125,6 +125,12 @@ void		e_mail_formatter_format_text	(EMailFormatter *formatter,
 						 EMailPart *part,
 						 CamelStream *stream,
 						 GCancellable *cancellable);
+gboolean	e_mail_formatter_format_text_limited
+						(EMailFormatter *formatter,
+						 EMailPart *part,
+						 CamelStream *stream,
+						 gsize limit,
+						 GCancellable *cancellable);
 const gchar *	e_mail_formatter_get_sub_html_header
 						(EMailFormatter *formatter);
 gchar *		e_mail_formatter_get_html_header
@@ -31,6 +31,15 @@
 
 #define d(x)
 
+/* None of the markers is anywhere near this long.  Longer lines are not
+ * carried over into the next buffer to be scanned again, the rest of
+ * such a line is skipped instead. */
+#define MAX_MARKER_LINE 1024
+
+/* In scan-only mode this much of each part is kept, which is enough
+ * to tell whether it starts with a Content-Type header. */
+#define SCAN_ONLY_PREFIX 14
+
 G_DEFINE_TYPE (EMailInlineFilter, e_mail_inline_filter, CAMEL_TYPE_MIME_FILTER)
 
 enum {
@@ -93,6 +102,20 @@ construct_part_from_stream (CamelStream *mem,
 	return part;
 }
 
+static void
+inline_filter_append (EMailInlineFilter *emif,
+                      const gchar *data,
+                      gsize len)
+{
+	if (emif->scan_only) {
+		if (emif->data->len >= SCAN_ONLY_PREFIX)
+			return;
+		len = MIN (len, SCAN_ONLY_PREFIX - emif->data->len);
+	}
+
+	g_byte_array_append (emif->data, (guchar *) data, len);
+}
+
 static void
 inline_filter_add_part (EMailInlineFilter *emif,
                         const gchar *data,
@@ -111,7 +134,20 @@ inline_filter_add_part (EMailInlineFilter *emif,
 	else
 		encoding = emif_types[emif->state].encoding;
 
-	g_byte_array_append (emif->data, (guchar *) data, len);
+	inline_filter_append (emif, data, len);
+
+	if (emif->scan_only) {
+		/* Be conservative, the full pass decides whether
+		 * the part really parses as a MIME part. */
+		if (emif->data->len > 13 && g_ascii_strncasecmp (
+			(const gchar *) emif->data->data, "Content-Type:", 13) == 0)
+			emif->found_any = TRUE;
+
+		g_byte_array_set_size (emif->data, 0);
+
+		return;
+	}
+
 	/* check the part will actually have content */
 	if (emif->data->len <= 0) {
 		return;
@@ -244,6 +280,16 @@ inline_filter_scan (CamelMimeFilter *f,
 		while (inptr < inend && *inptr != '\n')
 			inptr++;
 
+		if (emif->in_long_line) {
+			/* The rest of an overlong line, which cannot
+			 * be a marker, see MAX_MARKER_LINE. */
+			if (inptr < inend) {
+				inptr++;
+				emif->in_long_line = FALSE;
+			}
+			continue;
+		}
+
 		if (inptr == inend && start == inptr) {
 			if (!final) {
 				camel_mime_filter_backup (f, start, inend - start);
@@ -337,12 +383,18 @@ inline_filter_scan (CamelMimeFilter *f,
 		emif->state = EMIF_PLAIN;
 
 		inline_filter_add_part (emif, data_start, inend - data_start);
-	} else if (start > data_start) {
+	} else if (start > data_start && !emif->in_long_line &&
+		   inend - start <= MAX_MARKER_LINE) {
 		/* backup the last line, in case the tag is divided within buffers */
 		camel_mime_filter_backup (f, start, inend - start);
-		g_byte_array_append (emif->data, (guchar *) data_start, start - data_start);
+		inline_filter_append (emif, data_start, start - data_start);
 	} else {
-		g_byte_array_append (emif->data, (guchar *) data_start, inend - data_start);
+		/* Skip the rest of an unfinished line in the next buffer,
+		 * a marker cannot start in the middle of it. */
+		if (inend > start && inend[-1] != '\n')
+			emif->in_long_line = TRUE;
+
+		inline_filter_append (emif, data_start, inend - data_start);
 	}
 
 	return 0;
@@ -413,6 +465,7 @@ inline_filter_reset (CamelMimeFilter *filter)
 	}
 	emif->parts = NULL;
 	g_byte_array_set_size (emif->data, 0);
+	emif->in_long_line = FALSE;
 	emif->found_any = FALSE;
 }
 
@@ -487,6 +540,29 @@ e_mail_inline_filter_get_multipart (EMailInlineFilter *emif)
 	return mp;
 }
 
+/**
+ * e_mail_inline_filter_set_scan_only:
+ * @emif: an #EMailInlineFilter
+ * @scan_only: whether to only look for inline parts
+ *
+ * In scan-only mode the filter does not keep a copy of the data
+ * passing through it, it only finds out whether there is anything
+ * embedded in the text, see e_mail_inline_filter_found_any().  Its
+ * memory use is then bounded no matter how large the text is.
+ *
+ * e_mail_inline_filter_get_multipart() must not be used in scan-only
+ * mode.  Scan-only mode may report a false positive for text which
+ * starts with a Content-Type header, but never a false negative.
+ **/
+void
+e_mail_inline_filter_set_scan_only (EMailInlineFilter *emif,
+                                    gboolean scan_only)
+{
+	g_return_if_fail (E_IS_MAIL_INLINE_FILTER (emif));
+
+	emif->scan_only = scan_only;
+}
+
 gboolean
 e_mail_inline_filter_found_any (EMailInlineFilter *emif)
 {
@@ -63,6 +63,8 @@ struct _EMailInlineFilter {
 	GSList *parts;
 
 	gboolean found_any;
+	gboolean scan_only;
+	gboolean in_long_line;
 };
 
 struct _EMailInlineFilterClass {
@@ -76,6 +78,9 @@ EMailInlineFilter *
 						 const gchar *filename);
 CamelMultipart *e_mail_inline_filter_get_multipart
 						(EMailInlineFilter *emif);
+void		e_mail_inline_filter_set_scan_only
+						(EMailInlineFilter *emif,
+						 gboolean scan_only);
 gboolean	e_mail_inline_filter_found_any	(EMailInlineFilter *emif);
 
 G_END_DECLS
@@ -84,7 +84,7 @@ empe_app_mbox_parse (EMailParserExtension *extension,
 	camel_mime_parser_init_with_stream (mime_parser, mem_stream, &error);
 	if (error != NULL) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Error parsing MBOX part: %s"),
 			error->message);
 		g_object_unref (mem_stream);
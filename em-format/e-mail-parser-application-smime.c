@@ -80,7 +80,7 @@ empe_app_smime_parse (EMailParserExtension *extension,
 
 	if (local_error != NULL) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Could not parse S/MIME message: %s"),
 			local_error->message);
 		g_error_free (local_error);
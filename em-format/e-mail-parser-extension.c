@@ -75,6 +75,8 @@ e_mail_parser_extension_parse (EMailParserExtension *extension,
                                GQueue *out_mail_parts)
 {
 	EMailParserExtensionClass *class;
+	gboolean handled;
+	gint64 start;
 
 	g_return_val_if_fail (E_IS_MAIL_PARSER_EXTENSION (extension), FALSE);
 	g_return_val_if_fail (E_IS_MAIL_PARSER (parser), FALSE);
@@ -86,8 +88,21 @@ e_mail_parser_extension_parse (EMailParserExtension *extension,
 	if (g_cancellable_is_cancelled (cancellable))
 		return FALSE;
 
-	return class->parse (
+	if (!camel_debug ("emformat:timing"))
+		return class->parse (
+			extension, parser, mime_part, part_id,
+			cancellable, out_mail_parts);
+
+	start = g_get_monotonic_time ();
+
+	handled = class->parse (
 		extension, parser, mime_part, part_id,
 		cancellable, out_mail_parts);
+
+	e_mail_extension_registry_add_timing (
+		e_mail_parser_get_extension_registry (parser),
+		extension, g_get_monotonic_time () - start);
+
+	return handled;
 }
 
@@ -79,7 +79,7 @@ empe_inlinepgp_signed_parse (EMailParserExtension *extension,
 
 	if (local_error != NULL) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Error verifying signature: %s"),
 			local_error->message);
 
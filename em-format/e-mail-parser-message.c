@@ -44,6 +44,59 @@ static const gchar *parser_mime_types[] = {
 	NULL
 };
 
+typedef struct _MessageBody MessageBody;
+
+struct _MessageBody {
+	CamelMimePart *part;
+	GString *part_id;
+	GQueue *out_mail_parts;
+	gboolean started;
+};
+
+/* If the EMailPart representing the message body is marked as an
+ * attachment, wrap it as such so it gets added to the attachment
+ * bar but also set the "force_inline" flag since it doesn't make
+ * sense to collapse the message body if we can render it. */
+static void
+empe_message_start_body (EMailParser *parser,
+                         MessageBody *body,
+                         GQueue *work_queue)
+{
+	EMailPart *mail_part;
+
+	body->started = TRUE;
+
+	mail_part = g_queue_peek_head (work_queue);
+	if (mail_part != NULL) {
+		if (e_mail_part_get_is_attachment (mail_part)) {
+			e_mail_parser_wrap_as_attachment (
+				parser, body->part, body->part_id, work_queue);
+
+			mail_part = g_queue_peek_head (work_queue);
+
+			if (mail_part != NULL)
+				mail_part->force_inline = TRUE;
+		}
+	}
+}
+
+/* The body's first parts are ready while the rest is still being
+ * parsed, pass them on after the headers. */
+static void
+empe_message_stream_body (EMailParser *parser,
+                          GQueue *work_queue,
+                          gpointer user_data)
+{
+	MessageBody *body = user_data;
+
+	if (!body->started)
+		empe_message_start_body (parser, body, work_queue);
+
+	e_queue_transfer (work_queue, body->out_mail_parts);
+
+	e_mail_parser_stream_parts (parser, body->out_mail_parts);
+}
+
 static gboolean
 empe_message_parse (EMailParserExtension *extension,
                     EMailParser *parser,
@@ -53,8 +106,8 @@ empe_message_parse (EMailParserExtension *extension,
                     GQueue *out_mail_parts)
 {
 	GQueue work_queue = G_QUEUE_INIT;
+	MessageBody body;
 	CamelContentType *ct;
-	EMailPart *mail_part;
 	gchar *mime_type;
 
 	/* Headers */
@@ -88,26 +141,23 @@ empe_message_parse (EMailParserExtension *extension,
 
 	/* Actual message body */
 
+	body.part = part;
+	body.part_id = part_id;
+	body.out_mail_parts = out_mail_parts;
+	body.started = FALSE;
+
+	e_mail_parser_push_stream (
+		parser, &work_queue,
+		empe_message_stream_body, &body);
+
 	e_mail_parser_parse_part_as (
 		parser, part, part_id, mime_type,
 		cancellable, &work_queue);
 
-	/* If the EMailPart representing the message body is marked as an
-	 * attachment, wrap it as such so it gets added to the attachment
-	 * bar but also set the "force_inline" flag since it doesn't make
-	 * sense to collapse the message body if we can render it. */
-	mail_part = g_queue_peek_head (&work_queue);
-	if (mail_part != NULL) {
-		if (e_mail_part_get_is_attachment (mail_part)) {
-			e_mail_parser_wrap_as_attachment (
-				parser, part, part_id, &work_queue);
-
-			mail_part = g_queue_peek_head (&work_queue);
+	e_mail_parser_pop_stream (parser);
 
-			if (mail_part != NULL)
-				mail_part->force_inline = TRUE;
-		}
-	}
+	if (!body.started)
+		empe_message_start_body (parser, &body, &work_queue);
 
 	e_queue_transfer (&work_queue, out_mail_parts);
 
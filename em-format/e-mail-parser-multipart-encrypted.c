@@ -63,7 +63,7 @@ empe_mp_encrypted_parse (EMailParserExtension *extension,
 	mpe = (CamelMultipartEncrypted *) camel_medium_get_content ((CamelMedium *) part);
 	if (!CAMEL_IS_MULTIPART_ENCRYPTED (mpe)) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Could not parse MIME message. "
 			"Displaying as source."));
 		e_mail_parser_parse_part_as (
@@ -79,7 +79,7 @@ empe_mp_encrypted_parse (EMailParserExtension *extension,
 		((CamelDataWrapper *) mpe)->mime_type, "protocol");
 	if (!protocol || g_ascii_strcasecmp (protocol, "application/pgp-encrypted") != 0) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Unsupported encryption type for multipart/encrypted"));
 		e_mail_parser_parse_part_as (
 			parser, part, part_id, "multipart/mixed",
@@ -98,7 +98,7 @@ empe_mp_encrypted_parse (EMailParserExtension *extension,
 
 	if (local_error != NULL) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Could not parse PGP/MIME message: %s"),
 			local_error->message);
 		e_mail_parser_parse_part_as (
@@ -44,6 +44,207 @@ static const gchar *parser_mime_types[] = {
 	NULL
 };
 
+/* Subparts of a multipart/mixed don't depend on each other, so
+ * attachments are parsed by a few helper threads while the calling
+ * thread does the primary text part first.  Each subpart collects
+ * its EMailParts separately and they are appended in subpart order,
+ * so the result doesn't depend on which thread finished first.
+ *
+ * When the caller can take parts early (see e_mail_parser_stream_parts())
+ * the parts up to the primary text part are handed on as soon as they
+ * are done, and each following subpart as soon as it and the ones
+ * before it are, so the text can be shown while attachments are still
+ * being parsed.
+ *
+ * Nested multiparts can start batches of their own from a helper
+ * thread.  Whoever starts a batch also takes jobs from it, so a batch
+ * always completes even when all helpers are busy elsewhere. */
+#define MAX_HELPER_THREADS 3
+
+typedef struct _SubpartJob SubpartJob;
+typedef struct _SubpartBatch SubpartBatch;
+
+struct _SubpartJob {
+	CamelMimePart *subpart;
+	GString *part_id;
+	GQueue mail_parts;
+	gboolean finished;	/* protected by the batch lock */
+};
+
+struct _SubpartBatch {
+	volatile gint ref_count;
+
+	EMailParser *parser;
+	GCancellable *cancellable;
+
+	SubpartJob *jobs;
+	gint *order;		/* indexes into jobs, in claim order */
+	gint n_jobs;
+	volatile gint next_job;
+
+	GMutex lock;
+	GCond cond;
+};
+
+static SubpartBatch *
+subpart_batch_ref (SubpartBatch *batch)
+{
+	g_atomic_int_inc (&batch->ref_count);
+
+	return batch;
+}
+
+static void
+subpart_batch_unref (SubpartBatch *batch)
+{
+	gint ii;
+
+	if (!g_atomic_int_dec_and_test (&batch->ref_count))
+		return;
+
+	for (ii = 0; ii < batch->n_jobs; ii++) {
+		SubpartJob *job = &batch->jobs[ii];
+
+		g_object_unref (job->subpart);
+		g_string_free (job->part_id, TRUE);
+
+		while (!g_queue_is_empty (&job->mail_parts))
+			g_object_unref (g_queue_pop_head (&job->mail_parts));
+	}
+
+	g_object_unref (batch->parser);
+	if (batch->cancellable != NULL)
+		g_object_unref (batch->cancellable);
+
+	g_free (batch->jobs);
+	g_free (batch->order);
+	g_mutex_clear (&batch->lock);
+	g_cond_clear (&batch->cond);
+
+	g_slice_free (SubpartBatch, batch);
+}
+
+static void
+empe_mp_mixed_parse_subpart (EMailParser *parser,
+                             SubpartJob *job,
+                             GCancellable *cancellable)
+{
+	EMailPart *mail_part;
+	CamelContentType *ct;
+
+	if (g_cancellable_is_cancelled (cancellable))
+		return;
+
+	e_mail_parser_parse_part (
+		parser, job->subpart, job->part_id,
+		cancellable, &job->mail_parts);
+
+	mail_part = g_queue_peek_head (&job->mail_parts);
+
+	ct = camel_mime_part_get_content_type (job->subpart);
+
+	/* Display parts with CID as attachments
+	 * (unless they already are attachments).
+	 * Show also hidden attachments with CID,
+	 * because this is multipart/mixed,
+	 * not multipart/related. */
+	if (mail_part != NULL &&
+	    e_mail_part_get_cid (mail_part) != NULL &&
+	    (!e_mail_part_get_is_attachment (mail_part) ||
+	     mail_part->is_hidden)) {
+
+		e_mail_parser_wrap_as_attachment (
+			parser, job->subpart, job->part_id, &job->mail_parts);
+
+	/* Force messages to be expandable */
+	} else if (mail_part == NULL ||
+	    (camel_content_type_is (ct, "message", "*") &&
+	     mail_part != NULL &&
+	     !e_mail_part_get_is_attachment (mail_part))) {
+
+		e_mail_parser_wrap_as_attachment (
+			parser, job->subpart, job->part_id, &job->mail_parts);
+
+		mail_part = g_queue_peek_head (&job->mail_parts);
+
+		if (mail_part != NULL)
+			mail_part->force_inline = TRUE;
+	}
+}
+
+static void
+subpart_batch_run_job (SubpartBatch *batch,
+                       gint index)
+{
+	SubpartJob *job = &batch->jobs[batch->order[index]];
+
+	empe_mp_mixed_parse_subpart (
+		batch->parser, job, batch->cancellable);
+
+	g_mutex_lock (&batch->lock);
+	job->finished = TRUE;
+	g_cond_broadcast (&batch->cond);
+	g_mutex_unlock (&batch->lock);
+}
+
+static void
+subpart_batch_run_jobs (SubpartBatch *batch)
+{
+	gint index;
+
+	while ((index = g_atomic_int_add (&batch->next_job, 1)) < batch->n_jobs)
+		subpart_batch_run_job (batch, index);
+}
+
+static void
+subpart_batch_helper_thread (SubpartBatch *batch,
+                             gpointer unused)
+{
+	subpart_batch_run_jobs (batch);
+	subpart_batch_unref (batch);
+}
+
+static GThreadPool *
+subpart_batch_get_pool (void)
+{
+	static GThreadPool *pool;
+	static gsize pool_initialized;
+
+	if (g_once_init_enter (&pool_initialized)) {
+		pool = g_thread_pool_new (
+			(GFunc) subpart_batch_helper_thread, NULL,
+			MAX_HELPER_THREADS, FALSE, NULL);
+		g_once_init_leave (&pool_initialized, 1);
+	}
+
+	return pool;
+}
+
+/* The primary text part is the first inline text/ subpart,
+ * the one the user reads while the attachments are handled. */
+static gint
+empe_mp_mixed_find_primary (CamelMultipart *mp,
+                            gint nparts)
+{
+	gint i;
+
+	for (i = 0; i < nparts; i++) {
+		CamelMimePart *subpart;
+		CamelContentType *ct;
+		const gchar *disposition;
+
+		subpart = camel_multipart_get_part (mp, i);
+		ct = camel_mime_part_get_content_type (subpart);
+		disposition = camel_mime_part_get_disposition (subpart);
+
+		if (camel_content_type_is (ct, "text", "*") &&
+		    g_strcmp0 (disposition, "attachment") != 0)
+			return i;
+	}
+
+	return 0;
+}
+
 static gboolean
 empe_mp_mixed_parse (EMailParserExtension *extension,
                      EMailParser *parser,
@@ -53,7 +254,8 @@ empe_mp_mixed_parse (EMailParserExtension *extension,
                      GQueue *out_mail_parts)
 {
 	CamelMultipart *mp;
-	gint i, nparts, len;
+	SubpartBatch *batch;
+	gint i, nparts, primary, n_helpers;
 
 	mp = (CamelMultipart *) camel_medium_get_content ((CamelMedium *) part);
 
@@ -63,58 +265,89 @@ empe_mp_mixed_parse (EMailParserExtension *extension,
 			"application/vnd.evolution.source",
 			cancellable, out_mail_parts);
 
-	len = part_id->len;
 	nparts = camel_multipart_get_number (mp);
-	for (i = 0; i < nparts; i++) {
-		GQueue work_queue = G_QUEUE_INIT;
-		EMailPart *mail_part;
-		CamelMimePart *subpart;
-		CamelContentType *ct;
+	if (nparts <= 0)
+		return TRUE;
 
-		subpart = camel_multipart_get_part (mp, i);
+	primary = empe_mp_mixed_find_primary (mp, nparts);
+
+	batch = g_slice_new0 (SubpartBatch);
+	batch->ref_count = 1;
+	batch->parser = g_object_ref (parser);
+	if (cancellable != NULL)
+		batch->cancellable = g_object_ref (cancellable);
+	batch->jobs = g_new0 (SubpartJob, nparts);
+	batch->order = g_new0 (gint, nparts);
+	batch->n_jobs = nparts;
+	g_mutex_init (&batch->lock);
+	g_cond_init (&batch->cond);
+
+	for (i = 0; i < nparts; i++) {
+		SubpartJob *job = &batch->jobs[i];
 
-		g_string_append_printf (part_id, ".mixed.%d", i);
+		job->subpart = g_object_ref (camel_multipart_get_part (mp, i));
+		job->part_id = g_string_new (part_id->str);
+		g_string_append_printf (job->part_id, ".mixed.%d", i);
+		g_queue_init (&job->mail_parts);
+	}
 
-		e_mail_parser_parse_part (
-			parser, subpart, part_id, cancellable, &work_queue);
+	/* The primary text part goes first, the rest in order. */
+	batch->order[0] = primary;
+	for (i = 0; i < primary; i++)
+		batch->order[i + 1] = i;
+	for (i = primary + 1; i < nparts; i++)
+		batch->order[i] = i;
 
-		mail_part = g_queue_peek_head (&work_queue);
+	/* Keep the primary text part to ourselves,
+	 * helpers start right with the attachments. */
+	batch->next_job = 1;
 
-		ct = camel_mime_part_get_content_type (subpart);
+	n_helpers = MIN (nparts - 1, MAX_HELPER_THREADS);
+	for (i = 0; i < n_helpers; i++)
+		g_thread_pool_push (
+			subpart_batch_get_pool (),
+			subpart_batch_ref (batch), NULL);
 
-		/* Display parts with CID as attachments
-		 * (unless they already are attachments).
-		 * Show also hidden attachments with CID,
-		 * because this is multipart/mixed,
-		 * not multipart/related. */
-		if (mail_part != NULL &&
-		    e_mail_part_get_cid (mail_part) != NULL &&
-		    (!e_mail_part_get_is_attachment (mail_part) ||
-		     mail_part->is_hidden)) {
+	subpart_batch_run_job (batch, 0);
 
-			e_mail_parser_wrap_as_attachment (
-				parser, subpart, part_id, &work_queue);
+	/* Collect the subparts in order, helping with the
+	 * remaining jobs while waiting for the next one. */
+	for (i = 0; i < nparts; i++) {
+		SubpartJob *job = &batch->jobs[i];
+		gboolean finished;
 
-		/* Force messages to be expandable */
-		} else if (mail_part == NULL ||
-		    (camel_content_type_is (ct, "message", "*") &&
-		     mail_part != NULL &&
-		     !e_mail_part_get_is_attachment (mail_part))) {
+		g_mutex_lock (&batch->lock);
+		finished = job->finished;
+		g_mutex_unlock (&batch->lock);
 
-			e_mail_parser_wrap_as_attachment (
-				parser, subpart, part_id, &work_queue);
+		while (!finished) {
+			gint index;
 
-			mail_part = g_queue_peek_head (&work_queue);
+			index = g_atomic_int_add (&batch->next_job, 1);
 
-			if (mail_part != NULL)
-				mail_part->force_inline = TRUE;
+			g_mutex_lock (&batch->lock);
+			if (index < batch->n_jobs) {
+				g_mutex_unlock (&batch->lock);
+				subpart_batch_run_job (batch, index);
+				g_mutex_lock (&batch->lock);
+			} else {
+				while (!job->finished)
+					g_cond_wait (&batch->cond, &batch->lock);
+			}
+			finished = job->finished;
+			g_mutex_unlock (&batch->lock);
 		}
 
-		e_queue_transfer (&work_queue, out_mail_parts);
+		e_queue_transfer (&job->mail_parts, out_mail_parts);
 
-		g_string_truncate (part_id, len);
+		/* Hand on what is there once the primary text part
+		 * is, unless nothing is left to wait for anyway. */
+		if (i >= primary && i + 1 < nparts)
+			e_mail_parser_stream_parts (parser, out_mail_parts);
 	}
 
+	subpart_batch_unref (batch);
+
 	return TRUE;
 }
 
@@ -77,7 +77,7 @@ empe_mp_signed_parse (EMailParserExtension *extension,
 			(CamelMultipart *) mps,
 		CAMEL_MULTIPART_SIGNED_CONTENT)) == NULL) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Could not parse MIME message. "
 			"Displaying as source."));
 		e_mail_parser_parse_part_as (
@@ -110,7 +110,7 @@ empe_mp_signed_parse (EMailParserExtension *extension,
 
 	if (cipher == NULL) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Unsupported signature format"));
 		e_mail_parser_parse_part_as (
 			parser, part, part_id, "multipart/mixed",
@@ -124,7 +124,7 @@ empe_mp_signed_parse (EMailParserExtension *extension,
 
 	if (local_error != NULL) {
 		e_mail_parser_error (
-			parser, out_mail_parts,
+			parser, part_id, out_mail_parts,
 			_("Error verifying signature: %s"),
 			local_error->message);
 		e_mail_parser_parse_part_as (
@@ -125,6 +125,26 @@ process_part (EMailParser *parser,
 	return TRUE;
 }
 
+static void
+scan_inline_parts (CamelDataWrapper *dw,
+                   EMailInlineFilter *inline_filter,
+                   GCancellable *cancellable)
+{
+	CamelStream *filtered_stream, *null;
+
+	null = camel_stream_null_new ();
+	filtered_stream = camel_stream_filter_new (null);
+	g_object_unref (null);
+
+	camel_stream_filter_add (
+		CAMEL_STREAM_FILTER (filtered_stream),
+		CAMEL_MIME_FILTER (inline_filter));
+	camel_data_wrapper_decode_to_stream_sync (
+		dw, (CamelStream *) filtered_stream, cancellable, NULL);
+	camel_stream_close ((CamelStream *) filtered_stream, cancellable, NULL);
+	g_object_unref (filtered_stream);
+}
+
 static gboolean
 empe_text_plain_parse (EMailParserExtension *extension,
                        EMailParser *parser,
@@ -133,7 +153,6 @@ empe_text_plain_parse (EMailParserExtension *extension,
                        GCancellable *cancellable,
                        GQueue *out_mail_parts)
 {
-	CamelStream *filtered_stream, *null;
 	CamelMultipart *mp;
 	CamelDataWrapper *dw;
 	CamelContentType *type;
@@ -169,21 +188,25 @@ empe_text_plain_parse (EMailParserExtension *extension,
 		charset_added = TRUE;
 	}
 
-	null = camel_stream_null_new ();
-	filtered_stream = camel_stream_filter_new (null);
-	g_object_unref (null);
+	/* Most text parts have nothing embedded in them, so first only
+	 * look for it, without the filter keeping a copy of the whole
+	 * text.  Only if something was found is the text split up. */
 	inline_filter = e_mail_inline_filter_new (
 		camel_mime_part_get_encoding (part),
 		type,
 		camel_mime_part_get_filename (part));
+	e_mail_inline_filter_set_scan_only (inline_filter, TRUE);
+	scan_inline_parts (dw, inline_filter, cancellable);
 
-	camel_stream_filter_add (
-		CAMEL_STREAM_FILTER (filtered_stream),
-		CAMEL_MIME_FILTER (inline_filter));
-	camel_data_wrapper_decode_to_stream_sync (
-		dw, (CamelStream *) filtered_stream, cancellable, NULL);
-	camel_stream_close ((CamelStream *) filtered_stream, cancellable, NULL);
-	g_object_unref (filtered_stream);
+	if (e_mail_inline_filter_found_any (inline_filter)) {
+		g_object_unref (inline_filter);
+
+		inline_filter = e_mail_inline_filter_new (
+			camel_mime_part_get_encoding (part),
+			type,
+			camel_mime_part_get_filename (part));
+		scan_inline_parts (dw, inline_filter, cancellable);
+	}
 
 	if (!e_mail_inline_filter_found_any (inline_filter)) {
 		g_object_unref (inline_filter);
@@ -38,8 +38,6 @@
 struct _EMailParserPrivate {
 	GMutex mutex;
 
-	gint last_error;
-
 	CamelSession *session;
 };
 
@@ -48,6 +46,29 @@ enum {
 	PROP_SESSION
 };
 
+enum {
+	PARTS_ADDED,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+/* A queue of EMailParts which an extension may hand on to its caller
+ * before it is done parsing, so that the first parts of a message can
+ * be shown while the rest is still being parsed.  Each thread has its
+ * own stack of them, innermost first. */
+typedef struct _MailParserStream MailParserStream;
+
+struct _MailParserStream {
+	EMailParser *parser;
+	GQueue *mail_parts;
+	EMailParserStreamFunc func;
+	gpointer user_data;
+	MailParserStream *outer;
+};
+
+static GPrivate mail_parser_streams;
+
 /* internal parser extensions */
 GType e_mail_parser_application_mbox_get_type (void);
 GType e_mail_parser_attachment_bar_get_type (void);
@@ -79,6 +100,22 @@ void e_mail_parser_internal_extensions_load (EMailExtensionRegistry *ereg);
 
 static gpointer parent_class;
 
+static void
+mail_parser_stream_cb (EMailParser *parser,
+                       GQueue *mail_parts,
+                       gpointer user_data)
+{
+	EMailPartList *part_list = user_data;
+
+	while (!g_queue_is_empty (mail_parts)) {
+		EMailPart *mail_part = g_queue_pop_head (mail_parts);
+		e_mail_part_list_add_part (part_list, mail_part);
+		g_object_unref (mail_part);
+	}
+
+	g_signal_emit (parser, signals[PARTS_ADDED], 0, part_list);
+}
+
 static void
 mail_parser_run (EMailParser *parser,
                  EMailPartList *part_list,
@@ -109,10 +146,17 @@ mail_parser_run (EMailParser *parser,
 
 	part_id = g_string_new (".message");
 
+	/* Parts may be handed out before all of them are there. */
+	e_mail_part_list_set_complete (part_list, FALSE);
+
 	mail_part = e_mail_part_new (CAMEL_MIME_PART (message), ".message");
 	e_mail_part_list_add_part (part_list, mail_part);
 	g_object_unref (mail_part);
 
+	e_mail_parser_push_stream (
+		parser, &mail_part_queue,
+		mail_parser_stream_cb, part_list);
+
 	for (iter = parsers->head; iter; iter = iter->next) {
 		EMailParserExtension *extension;
 		gboolean message_handled;
@@ -133,12 +177,18 @@ mail_parser_run (EMailParser *parser,
 			break;
 	}
 
+	e_mail_parser_pop_stream (parser);
+
 	while (!g_queue_is_empty (&mail_part_queue)) {
 		mail_part = g_queue_pop_head (&mail_part_queue);
 		e_mail_part_list_add_part (part_list, mail_part);
 		g_object_unref (mail_part);
 	}
 
+	/* A cancelled parse leaves the part list short. */
+	e_mail_part_list_set_complete (
+		part_list, !g_cancellable_is_cancelled (cancellable));
+
 	g_string_free (part_id, TRUE);
 }
 
@@ -267,6 +317,23 @@ e_mail_parser_class_init (EMailParserClass *class)
 			CAMEL_TYPE_SESSION,
 			G_PARAM_READWRITE |
 			G_PARAM_CONSTRUCT_ONLY));
+
+	/**
+	 * EMailParser::parts-added:
+	 * @parser: the #EMailParser which emitted the signal
+	 * @part_list: the #EMailPartList being filled
+	 *
+	 * Emitted when @part_list got some of its parts while the rest
+	 * of the message is still being parsed, so that they can be shown
+	 * early.  It is emitted from the thread which parses the message.
+	 **/
+	signals[PARTS_ADDED] = g_signal_new (
+		"parts-added",
+		G_TYPE_FROM_CLASS (class),
+		G_SIGNAL_RUN_LAST,
+		0, NULL, NULL, NULL,
+		G_TYPE_NONE, 1,
+		E_TYPE_MAIL_PART_LIST);
 }
 
 static void
@@ -537,10 +604,7 @@ e_mail_parser_parse_part_as (EMailParser *parser,
 	parser_class = E_MAIL_PARSER_GET_CLASS (parser);
 	reg = E_MAIL_EXTENSION_REGISTRY (parser_class->extension_registry);
 
-	parsers = e_mail_extension_registry_get_for_mime_type (reg, as_mime_type);
-	if (!parsers) {
-		parsers = e_mail_extension_registry_get_fallback (reg, as_mime_type);
-	}
+	parsers = e_mail_extension_registry_resolve (reg, as_mime_type);
 
 	if (as_mime_type)
 		g_free (as_mime_type);
@@ -569,8 +633,108 @@ e_mail_parser_parse_part_as (EMailParser *parser,
 	return mime_part_handled;
 }
 
+/**
+ * e_mail_parser_push_stream:
+ * @parser: an #EMailParser
+ * @mail_parts: the #GQueue an extension collects its #EMailPart<!-- -->s in
+ * @func: function which takes parts from @mail_parts
+ * @user_data: data to pass to @func
+ *
+ * Lets extensions parsing into @mail_parts in the current thread hand
+ * the parts collected so far on with e_mail_parser_stream_parts(), while
+ * they go on parsing the rest.  @func is then called with @mail_parts,
+ * it should move the parts somewhere else, keeping their order.
+ *
+ * Every call has to be paired with e_mail_parser_pop_stream() in the
+ * same thread.
+ **/
+void
+e_mail_parser_push_stream (EMailParser *parser,
+                           GQueue *mail_parts,
+                           EMailParserStreamFunc func,
+                           gpointer user_data)
+{
+	MailParserStream *stream;
+
+	g_return_if_fail (E_IS_MAIL_PARSER (parser));
+	g_return_if_fail (mail_parts != NULL);
+	g_return_if_fail (func != NULL);
+
+	stream = g_slice_new0 (MailParserStream);
+	stream->parser = parser;
+	stream->mail_parts = mail_parts;
+	stream->func = func;
+	stream->user_data = user_data;
+	stream->outer = g_private_get (&mail_parser_streams);
+
+	g_private_set (&mail_parser_streams, stream);
+}
+
+/**
+ * e_mail_parser_pop_stream:
+ * @parser: an #EMailParser
+ *
+ * Ends what the last e_mail_parser_push_stream() call
+ * in the current thread started.
+ **/
+void
+e_mail_parser_pop_stream (EMailParser *parser)
+{
+	MailParserStream *stream;
+
+	stream = g_private_get (&mail_parser_streams);
+
+	g_return_if_fail (stream != NULL);
+	g_return_if_fail (stream->parser == parser);
+
+	g_private_set (&mail_parser_streams, stream->outer);
+
+	g_slice_free (MailParserStream, stream);
+}
+
+/**
+ * e_mail_parser_stream_parts:
+ * @parser: an #EMailParser
+ * @mail_parts: the #GQueue passed to the extension
+ *
+ * Hands the parts collected in @mail_parts so far on, if @mail_parts
+ * was the last queue passed to e_mail_parser_push_stream() in the current
+ * thread.  The extension can append more parts to @mail_parts afterwards.
+ *
+ * Returns: %TRUE if the parts were handed on, %FALSE if the caller
+ *          processes @mail_parts only after the extension is done
+ **/
+gboolean
+e_mail_parser_stream_parts (EMailParser *parser,
+                            GQueue *mail_parts)
+{
+	MailParserStream *stream;
+
+	g_return_val_if_fail (E_IS_MAIL_PARSER (parser), FALSE);
+	g_return_val_if_fail (mail_parts != NULL, FALSE);
+
+	stream = g_private_get (&mail_parser_streams);
+
+	if (stream == NULL)
+		return FALSE;
+
+	if (stream->parser != parser || stream->mail_parts != mail_parts)
+		return FALSE;
+
+	if (g_queue_is_empty (mail_parts))
+		return TRUE;
+
+	/* The function may hand the parts on further. */
+	g_private_set (&mail_parser_streams, stream->outer);
+	stream->func (parser, mail_parts, stream->user_data);
+	g_private_set (&mail_parser_streams, stream);
+
+	return TRUE;
+}
+
 void
 e_mail_parser_error (EMailParser *parser,
+                     GString *part_id,
                      GQueue *out_mail_parts,
                      const gchar *format,
                      ...)
@@ -578,11 +742,15 @@ e_mail_parser_error (EMailParser *parser,
 	const gchar *mime_type = "application/vnd.evolution.error";
 	EMailPart *mail_part;
 	CamelMimePart *part;
+	GList *link;
 	gchar *errmsg;
+	gchar *prefix;
 	gchar *uri;
+	gint n_errors = 0;
 	va_list ap;
 
 	g_return_if_fail (E_IS_MAIL_PARSER (parser));
+	g_return_if_fail (part_id != NULL);
 	g_return_if_fail (out_mail_parts != NULL);
 	g_return_if_fail (format != NULL);
 
@@ -595,10 +763,20 @@ e_mail_parser_error (EMailParser *parser,
 	g_free (errmsg);
 	va_end (ap);
 
-	g_mutex_lock (&parser->priv->mutex);
-	parser->priv->last_error++;
-	uri = g_strdup_printf (".error.%d", parser->priv->last_error);
-	g_mutex_unlock (&parser->priv->mutex);
+	/* Numbered within the part, so that the ID does not depend
+	 * on what other threads are parsing at the same time. */
+	prefix = g_strconcat (part_id->str, ".error.", NULL);
+
+	link = g_queue_peek_head_link (out_mail_parts);
+	for (; link != NULL; link = g_list_next (link)) {
+		const gchar *id = e_mail_part_get_id (link->data);
+
+		if (id != NULL && g_str_has_prefix (id, prefix))
+			n_errors++;
+	}
+
+	uri = g_strdup_printf ("%s%d", prefix, n_errors + 1);
+	g_free (prefix);
 
 	mail_part = e_mail_part_new (part, uri);
 	e_mail_part_set_mime_type (mail_part, mime_type);
@@ -680,13 +858,8 @@ e_mail_parser_wrap_as_attachment (EMailParser *parser,
 		EMailExtensionRegistry *reg;
 
 		reg = e_mail_parser_get_extension_registry (parser);
-		extensions = e_mail_extension_registry_get_for_mime_type (
+		extensions = e_mail_extension_registry_resolve (
 			reg, snoop_mime_type);
-
-		if (!extensions) {
-			extensions = e_mail_extension_registry_get_fallback (
-				reg, snoop_mime_type);
-		}
 	}
 
 	part_id_len = part_id->len;
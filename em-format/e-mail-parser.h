@@ -47,6 +47,10 @@ typedef struct _EMailParser EMailParser;
 typedef struct _EMailParserClass EMailParserClass;
 typedef struct _EMailParserPrivate EMailParserPrivate;
 
+typedef void	(*EMailParserStreamFunc)	(EMailParser *parser,
+						 GQueue *mail_parts,
+						 gpointer user_data);
+
 struct _EMailParser {
 	GObject parent;
 	EMailParserPrivate *priv;
@@ -93,10 +97,19 @@ gboolean	e_mail_parser_parse_part_as	(EMailParser *parser,
 						 GCancellable *cancellable,
 						 GQueue *out_mail_parts);
 
+void		e_mail_parser_push_stream	(EMailParser *parser,
+						 GQueue *mail_parts,
+						 EMailParserStreamFunc func,
+						 gpointer user_data);
+void		e_mail_parser_pop_stream	(EMailParser *parser);
+gboolean	e_mail_parser_stream_parts	(EMailParser *parser,
+						 GQueue *mail_parts);
+
 void		e_mail_parser_error		(EMailParser *parser,
+						 GString *part_id,
 						 GQueue *out_mail_parts,
 						 const gchar *format,
-						 ...) G_GNUC_PRINTF (3, 4);
+						 ...) G_GNUC_PRINTF (4, 5);
 
 void		e_mail_parser_wrap_as_attachment
 						(EMailParser *parser,
@@ -112,6 +112,8 @@ mail_part_attachment_constructed (GObject *object)
 
 	attachment = e_attachment_new ();
 	e_attachment_set_mime_part (attachment, mime_part);
+	/* Only shown in the attachment bar. */
+	e_attachment_set_estimate_size (attachment, TRUE);
 	priv->attachment = g_object_ref (attachment);
 	g_object_unref (attachment);
 
@@ -29,12 +29,27 @@ struct _EMailPartListPrivate {
 	CamelMimeMessage *message;
 	gchar *message_uid;
 
+	/* Lookups vastly outnumber additions, the queue and
+	 * both indexes are guarded by a reader-writer lock. */
 	GQueue queue;
-	GMutex queue_lock;
+	GRWLock queue_lock;
+
+	/* Part ID -> GList link in queue */
+	GHashTable *id_index;
+
+	/* Content ID -> EMailPart, rebuilt when a part's
+	 * CID changes after it was added to the list.
+	 * Owns copies of the CIDs for that reason. */
+	GHashTable *cid_index;
+	volatile gint cid_index_dirty;
+
+	/* Cleared while a parser is still adding parts. */
+	volatile gint complete;
 };
 
 enum {
 	PROP_0,
+	PROP_COMPLETE,
 	PROP_FOLDER,
 	PROP_MESSAGE,
 	PROP_MESSAGE_UID
@@ -45,6 +60,46 @@ G_DEFINE_TYPE (EMailPartList, e_mail_part_list, G_TYPE_OBJECT)
 static CamelObjectBag *registry = NULL;
 G_LOCK_DEFINE_STATIC (registry);
 
+static void
+mail_part_list_index_cid (EMailPartList *part_list,
+                          EMailPart *part)
+{
+	const gchar *cid;
+
+	cid = e_mail_part_get_cid (part);
+
+	/* The first part with a given CID wins, as it
+	 * would when walking the queue from the head. */
+	if (cid != NULL && !g_hash_table_contains (part_list->priv->cid_index, cid))
+		g_hash_table_insert (
+			part_list->priv->cid_index, g_strdup (cid), part);
+}
+
+/* Call with the writer lock held. */
+static void
+mail_part_list_rebuild_cid_index (EMailPartList *part_list)
+{
+	GList *link;
+
+	g_atomic_int_set (&part_list->priv->cid_index_dirty, FALSE);
+
+	g_hash_table_remove_all (part_list->priv->cid_index);
+
+	link = g_queue_peek_head_link (&part_list->priv->queue);
+
+	for (; link != NULL; link = g_list_next (link))
+		mail_part_list_index_cid (part_list, link->data);
+}
+
+static void
+mail_part_list_part_cid_notify_cb (EMailPart *part,
+                                   GParamSpec *pspec,
+                                   EMailPartList *part_list)
+{
+	/* Rebuild the index on the next lookup. */
+	g_atomic_int_set (&part_list->priv->cid_index_dirty, TRUE);
+}
+
 static void
 mail_part_list_set_folder (EMailPartList *part_list,
                            CamelFolder *folder)
@@ -88,6 +143,12 @@ mail_part_list_set_property (GObject *object,
                              GParamSpec *pspec)
 {
 	switch (property_id) {
+		case PROP_COMPLETE:
+			e_mail_part_list_set_complete (
+				E_MAIL_PART_LIST (object),
+				g_value_get_boolean (value));
+			return;
+
 		case PROP_FOLDER:
 			mail_part_list_set_folder (
 				E_MAIL_PART_LIST (object),
@@ -117,6 +178,13 @@ mail_part_list_get_property (GObject *object,
                              GParamSpec *pspec)
 {
 	switch (property_id) {
+		case PROP_COMPLETE:
+			g_value_set_boolean (
+				value,
+				e_mail_part_list_get_complete (
+				E_MAIL_PART_LIST (object)));
+			return;
+
 		case PROP_FOLDER:
 			g_value_set_object (
 				value,
@@ -159,10 +227,15 @@ mail_part_list_dispose (GObject *object)
 		priv->message = NULL;
 	}
 
-	g_mutex_lock (&priv->queue_lock);
-	while (!g_queue_is_empty (&priv->queue))
-		g_object_unref (g_queue_pop_head (&priv->queue));
-	g_mutex_unlock (&priv->queue_lock);
+	g_rw_lock_writer_lock (&priv->queue_lock);
+	g_hash_table_remove_all (priv->id_index);
+	g_hash_table_remove_all (priv->cid_index);
+	while (!g_queue_is_empty (&priv->queue)) {
+		EMailPart *part = g_queue_pop_head (&priv->queue);
+		g_signal_handlers_disconnect_by_data (part, object);
+		g_object_unref (part);
+	}
+	g_rw_lock_writer_unlock (&priv->queue_lock);
 
 	/* Chain up to parent's dispose() method. */
 	G_OBJECT_CLASS (e_mail_part_list_parent_class)->dispose (object);
@@ -178,7 +251,9 @@ mail_part_list_finalize (GObject *object)
 	g_free (priv->message_uid);
 
 	g_warn_if_fail (g_queue_is_empty (&priv->queue));
-	g_mutex_clear (&priv->queue_lock);
+	g_hash_table_destroy (priv->id_index);
+	g_hash_table_destroy (priv->cid_index);
+	g_rw_lock_clear (&priv->queue_lock);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_mail_part_list_parent_class)->finalize (object);
@@ -197,6 +272,17 @@ e_mail_part_list_class_init (EMailPartListClass *class)
 	object_class->dispose = mail_part_list_dispose;
 	object_class->finalize = mail_part_list_finalize;
 
+	g_object_class_install_property (
+		object_class,
+		PROP_COMPLETE,
+		g_param_spec_boolean (
+			"complete",
+			"Complete",
+			"Whether all parts of the message were added",
+			TRUE,
+			G_PARAM_READWRITE |
+			G_PARAM_STATIC_STRINGS));
+
 	g_object_class_install_property (
 		object_class,
 		PROP_FOLDER,
@@ -238,8 +324,16 @@ static void
 e_mail_part_list_init (EMailPartList *part_list)
 {
 	part_list->priv = E_MAIL_PART_LIST_GET_PRIVATE (part_list);
+	part_list->priv->complete = TRUE;
+
+	g_rw_lock_init (&part_list->priv->queue_lock);
 
-	g_mutex_init (&part_list->priv->queue_lock);
+	part_list->priv->id_index = g_hash_table_new (g_str_hash, g_str_equal);
+	part_list->priv->cid_index = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
 }
 
 EMailPartList *
@@ -284,20 +378,61 @@ e_mail_part_list_get_message_uid (EMailPartList *part_list)
 	return part_list->priv->message_uid;
 }
 
+/* Whether the parser is done with the message.  A part list can be
+ * shown before it is, see EMailParser::parts-added, but anything
+ * rendered from it then lacks the parts still to come. */
+gboolean
+e_mail_part_list_get_complete (EMailPartList *part_list)
+{
+	g_return_val_if_fail (E_IS_MAIL_PART_LIST (part_list), FALSE);
+
+	return g_atomic_int_get (&part_list->priv->complete);
+}
+
+void
+e_mail_part_list_set_complete (EMailPartList *part_list,
+                               gboolean complete)
+{
+	g_return_if_fail (E_IS_MAIL_PART_LIST (part_list));
+
+	complete = (complete != FALSE);
+
+	if (g_atomic_int_get (&part_list->priv->complete) == complete)
+		return;
+
+	g_atomic_int_set (&part_list->priv->complete, complete);
+
+	g_object_notify (G_OBJECT (part_list), "complete");
+}
+
 void
 e_mail_part_list_add_part (EMailPartList *part_list,
                            EMailPart *part)
 {
+	const gchar *id;
+
 	g_return_if_fail (E_IS_MAIL_PART_LIST (part_list));
 	g_return_if_fail (E_IS_MAIL_PART (part));
 
-	g_mutex_lock (&part_list->priv->queue_lock);
+	g_rw_lock_writer_lock (&part_list->priv->queue_lock);
 
 	g_queue_push_tail (
 		&part_list->priv->queue,
 		g_object_ref (part));
 
-	g_mutex_unlock (&part_list->priv->queue_lock);
+	id = e_mail_part_get_id (part);
+	if (id != NULL && !g_hash_table_contains (part_list->priv->id_index, id))
+		g_hash_table_insert (
+			part_list->priv->id_index, (gpointer) id,
+			g_queue_peek_tail_link (&part_list->priv->queue));
+
+	mail_part_list_index_cid (part_list, part);
+
+	g_signal_connect (
+		part, "notify::cid",
+		G_CALLBACK (mail_part_list_part_cid_notify_cb), part_list);
+
+	g_rw_lock_writer_unlock (&part_list->priv->queue_lock);
 
 	e_mail_part_set_part_list (part, part_list);
 }
@@ -307,34 +442,42 @@ e_mail_part_list_ref_part (EMailPartList *part_list,
                            const gchar *part_id)
 {
 	EMailPart *match = NULL;
-	GList *head, *link;
-	gboolean by_cid;
+	GList *link;
 
 	g_return_val_if_fail (E_IS_MAIL_PART_LIST (part_list), NULL);
 	g_return_val_if_fail (part_id != NULL, NULL);
 
-	by_cid = (g_ascii_strncasecmp (part_id, "cid:", 4) == 0);
+	if (g_ascii_strncasecmp (part_id, "cid:", 4) != 0) {
+		g_rw_lock_reader_lock (&part_list->priv->queue_lock);
 
-	g_mutex_lock (&part_list->priv->queue_lock);
+		link = g_hash_table_lookup (part_list->priv->id_index, part_id);
+		if (link != NULL)
+			match = g_object_ref (link->data);
 
-	head = g_queue_peek_head_link (&part_list->priv->queue);
+		g_rw_lock_reader_unlock (&part_list->priv->queue_lock);
 
-	for (link = head; link != NULL; link = g_list_next (link)) {
-		EMailPart *candidate = E_MAIL_PART (link->data);
-		const gchar *candidate_id;
+	} else if (g_atomic_int_get (&part_list->priv->cid_index_dirty)) {
+		g_rw_lock_writer_lock (&part_list->priv->queue_lock);
 
-		if (by_cid)
-			candidate_id = e_mail_part_get_cid (candidate);
-		else
-			candidate_id = e_mail_part_get_id (candidate);
+		mail_part_list_rebuild_cid_index (part_list);
 
-		if (g_strcmp0 (candidate_id, part_id) == 0) {
-			match = g_object_ref (candidate);
-			break;
-		}
-	}
+		match = g_hash_table_lookup (
+			part_list->priv->cid_index, part_id);
+		if (match != NULL)
+			g_object_ref (match);
+
+		g_rw_lock_writer_unlock (&part_list->priv->queue_lock);
 
-	g_mutex_unlock (&part_list->priv->queue_lock);
+	} else {
+		g_rw_lock_reader_lock (&part_list->priv->queue_lock);
+
+		match = g_hash_table_lookup (
+			part_list->priv->cid_index, part_id);
+		if (match != NULL)
+			g_object_ref (match);
+
+		g_rw_lock_reader_unlock (&part_list->priv->queue_lock);
+	}
 
 	return match;
 }
@@ -365,21 +508,13 @@ e_mail_part_list_queue_parts (EMailPartList *part_list,
 	g_return_val_if_fail (E_IS_MAIL_PART_LIST (part_list), FALSE);
 	g_return_val_if_fail (result_queue != NULL, FALSE);
 
-	g_mutex_lock (&part_list->priv->queue_lock);
-
-	link = g_queue_peek_head_link (&part_list->priv->queue);
-
-	if (part_id != NULL) {
-		for (; link != NULL; link = g_list_next (link)) {
-			EMailPart *candidate = E_MAIL_PART (link->data);
-			const gchar *candidate_id;
+	g_rw_lock_reader_lock (&part_list->priv->queue_lock);
 
-			candidate_id = e_mail_part_get_id (candidate);
-
-			if (g_strcmp0 (candidate_id, part_id) == 0)
-				break;
-		}
-	}
+	if (part_id != NULL)
+		link = g_hash_table_lookup (
+			part_list->priv->id_index, part_id);
+	else
+		link = g_queue_peek_head_link (&part_list->priv->queue);
 
 	/* We skip the loop entirely if link is NULL. */
 	for (; link != NULL; link = g_list_next (link)) {
@@ -392,7 +527,7 @@ e_mail_part_list_queue_parts (EMailPartList *part_list,
 		parts_queued++;
 	}
 
-	g_mutex_unlock (&part_list->priv->queue_lock);
+	g_rw_lock_reader_unlock (&part_list->priv->queue_lock);
 
 	return parts_queued;
 }
@@ -410,9 +545,9 @@ e_mail_part_list_is_empty (EMailPartList *part_list)
 
 	g_return_val_if_fail (E_IS_MAIL_PART_LIST (part_list), TRUE);
 
-	g_mutex_lock (&part_list->priv->queue_lock);
+	g_rw_lock_reader_lock (&part_list->priv->queue_lock);
 	is_empty = g_queue_is_empty (&part_list->priv->queue);
-	g_mutex_unlock (&part_list->priv->queue_lock);
+	g_rw_lock_reader_unlock (&part_list->priv->queue_lock);
 
 	return is_empty;
 }
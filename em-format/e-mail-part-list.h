@@ -65,6 +65,9 @@ CamelMimeMessage *
 		e_mail_part_list_get_message	(EMailPartList *part_list);
 const gchar *	e_mail_part_list_get_message_uid
 						(EMailPartList *part_list);
+gboolean	e_mail_part_list_get_complete	(EMailPartList *part_list);
+void		e_mail_part_list_set_complete	(EMailPartList *part_list,
+						 gboolean complete);
 void		e_mail_part_list_add_part	(EMailPartList *part_list,
 						 EMailPart *part);
 EMailPart *	e_mail_part_list_ref_part	(EMailPartList *part_list,
@@ -0,0 +1,264 @@
+/*
+ * test-mail-partial-parse.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Parses a message with a text part and an attachment the way the
+ * reader does for display, and looks at the part list at its first
+ * paint, when EMailParser::parts-added hands it out, and once parsing
+ * is done.  The first paint has the text but not the attachment, and
+ * the part list says it is not complete, so that the mail: request
+ * serving it neither caches that output nor serves it again for the
+ * reload once parsing is done.  By then the very same part list has
+ * the attachment and says it is complete.  A cancelled parse leaves
+ * its part list incomplete. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <camel/camel.h>
+
+#include "e-mail-parser.h"
+#include "e-mail-part-attachment.h"
+#include "e-mail-part-list.h"
+
+#define TEST_MESSAGE \
+	"From: alice@example.com\r\n" \
+	"To: bob@example.org\r\n" \
+	"Subject: Quarterly report\r\n" \
+	"MIME-Version: 1.0\r\n" \
+	"Content-Type: multipart/mixed; boundary=\"=-boundary\"\r\n" \
+	"\r\n" \
+	"--=-boundary\r\n" \
+	"Content-Type: text/plain; charset=us-ascii\r\n" \
+	"\r\n" \
+	"The numbers are attached.\r\n" \
+	"--=-boundary\r\n" \
+	"Content-Type: application/octet-stream; name=\"report.bin\"\r\n" \
+	"Content-Disposition: attachment; filename=\"report.bin\"\r\n" \
+	"Content-Transfer-Encoding: base64\r\n" \
+	"\r\n" \
+	"AAECAwQFBgcICQ==\r\n" \
+	"--=-boundary--\r\n"
+
+typedef struct _FirstPaint FirstPaint;
+
+struct _FirstPaint {
+	EMailPartList *part_list;
+	gboolean complete;
+	gboolean has_text;
+	gboolean has_attachment;
+};
+
+static guint n_failures;
+
+static void
+check (gboolean condition,
+       const gchar *description)
+{
+	if (!condition) {
+		g_printerr ("FAILED: %s\n", description);
+		n_failures++;
+	}
+}
+
+static void
+part_list_scan (EMailPartList *part_list,
+                gboolean *out_has_text,
+                gboolean *out_has_attachment)
+{
+	GQueue queue = G_QUEUE_INIT;
+
+	*out_has_text = FALSE;
+	*out_has_attachment = FALSE;
+
+	e_mail_part_list_queue_parts (part_list, NULL, &queue);
+
+	while (!g_queue_is_empty (&queue)) {
+		EMailPart *part = g_queue_pop_head (&queue);
+		const gchar *mime_type;
+
+		mime_type = e_mail_part_get_mime_type (part);
+
+		if (E_IS_MAIL_PART_ATTACHMENT (part))
+			*out_has_attachment = TRUE;
+		else if (g_strcmp0 (mime_type, "text/plain") == 0)
+			*out_has_text = TRUE;
+
+		g_object_unref (part);
+	}
+}
+
+static void
+parts_added_cb (EMailParser *parser,
+                EMailPartList *part_list,
+                FirstPaint *first_paint)
+{
+	if (first_paint->part_list != NULL)
+		return;
+
+	first_paint->part_list = g_object_ref (part_list);
+	first_paint->complete = e_mail_part_list_get_complete (part_list);
+
+	part_list_scan (
+		part_list,
+		&first_paint->has_text,
+		&first_paint->has_attachment);
+}
+
+static CamelMimeMessage *
+test_message_new (void)
+{
+	CamelMimeMessage *message;
+	CamelStream *stream;
+
+	stream = camel_stream_mem_new_with_buffer (
+		TEST_MESSAGE, strlen (TEST_MESSAGE));
+
+	message = camel_mime_message_new ();
+
+	if (!camel_data_wrapper_construct_from_stream_sync (
+		CAMEL_DATA_WRAPPER (message), stream, NULL, NULL)) {
+		g_printerr ("Failed to construct the test message\n");
+		exit (EXIT_FAILURE);
+	}
+
+	g_object_unref (stream);
+
+	return message;
+}
+
+static void
+test_first_paint (EMailParser *parser,
+                  CamelMimeMessage *message)
+{
+	FirstPaint first_paint = { NULL, FALSE, FALSE, FALSE };
+	EMailPartList *part_list;
+	gboolean has_text, has_attachment;
+	gulong handler_id;
+
+	handler_id = g_signal_connect (
+		parser, "parts-added",
+		G_CALLBACK (parts_added_cb), &first_paint);
+
+	part_list = e_mail_parser_parse_sync (
+		parser, NULL, "1", message, NULL);
+
+	g_signal_handler_disconnect (parser, handler_id);
+
+	check (part_list != NULL, "message is parsed");
+	check (
+		first_paint.part_list != NULL,
+		"text is handed out before attachments are parsed");
+
+	if (part_list == NULL || first_paint.part_list == NULL)
+		goto exit;
+
+	check (
+		first_paint.has_text,
+		"first paint has the text part");
+	check (
+		!first_paint.has_attachment,
+		"first paint comes before the attachment");
+	check (
+		!first_paint.complete,
+		"part list at the first paint is not complete");
+
+	/* Output cached per part list alone would be served
+	 * again for the reload, which is why completeness
+	 * has to be part of the decision. */
+	check (
+		first_paint.part_list == part_list,
+		"reload after parsing uses the part list of the first paint");
+
+	part_list_scan (part_list, &has_text, &has_attachment);
+
+	check (has_text, "parsed message has the text part");
+	check (has_attachment, "attachment shows up once parsing is done");
+	check (
+		e_mail_part_list_get_complete (part_list),
+		"part list is complete once parsing is done");
+
+exit:
+	g_clear_object (&first_paint.part_list);
+	g_clear_object (&part_list);
+}
+
+static void
+test_cancelled (EMailParser *parser,
+                CamelMimeMessage *message)
+{
+	EMailPartList *part_list;
+	GCancellable *cancellable;
+
+	cancellable = g_cancellable_new ();
+	g_cancellable_cancel (cancellable);
+
+	part_list = e_mail_parser_parse_sync (
+		parser, NULL, "2", message, cancellable);
+
+	if (part_list != NULL) {
+		check (
+			!e_mail_part_list_get_complete (part_list),
+			"part list of a cancelled parse is not complete");
+		g_object_unref (part_list);
+	}
+
+	g_object_unref (cancellable);
+}
+
+gint
+main (gint argc,
+      gchar **argv)
+{
+	CamelSession *session;
+	CamelMimeMessage *message;
+	EMailParser *parser;
+	gchar *data_dir;
+
+	g_type_init ();
+
+	data_dir = g_dir_make_tmp ("test-mail-partial-parse-XXXXXX", NULL);
+	if (data_dir == NULL) {
+		g_printerr ("Failed to create a data directory\n");
+		return EXIT_FAILURE;
+	}
+
+	session = g_object_new (
+		CAMEL_TYPE_SESSION,
+		"user-data-dir", data_dir,
+		"user-cache-dir", data_dir, NULL);
+
+	parser = e_mail_parser_new (session);
+	message = test_message_new ();
+
+	test_first_paint (parser, message);
+	test_cancelled (parser, message);
+
+	g_object_unref (message);
+	g_object_unref (parser);
+	g_object_unref (session);
+
+	g_rmdir (data_dir);
+	g_free (data_dir);
+
+	if (n_failures > 0) {
+		g_printerr ("%u check(s) failed!\n", n_failures);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,554 @@
+/*
+ * e-mail-filter-matcher.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "e-mail-filter-matcher.h"
+
+#include <string.h>
+
+#include "e-mail-sexp.h"
+
+/* Filter rules tend to test the same few headers over and over.  So
+ * before any rule is matched for real, the header tests of all rules
+ * run together as one set: each header any test looks at is found and
+ * decoded once per message, and each distinct (header, pattern) pair
+ * is looked for once, no matter how many rules use it.  The result is
+ * a bit per test, and each rule's and/or structure over those bits
+ * tells whether the rule can match at all.  Only rules which can go
+ * on to camel_filter_search_match().
+ *
+ * The shared tests only ever rule out.  A test passes whenever its
+ * pattern occurs, ignoring case, in any string Camel could compare it
+ * with: the raw header value, its decoded forms, and the names and
+ * addresses in it.  Camel's contains, matches, starts-with and
+ * ends-with tests all imply that.  Anything else in a rule, negations
+ * included, is taken as "might match". */
+
+typedef struct _FilterMatchNode FilterMatchNode;
+
+enum {
+	FILTER_MATCH_ANY,
+	FILTER_MATCH_AND,
+	FILTER_MATCH_OR,
+	FILTER_MATCH_TEST
+};
+
+struct _FilterMatchNode {
+	gint type;
+	GPtrArray *children;	/* of FilterMatchNode, for AND and OR */
+	GArray *tests;		/* of test indexes, for TEST */
+};
+
+struct _EMailFilterMatcher {
+	GPtrArray *rules;	/* FilterMatchNode per rule */
+	GPtrArray *headers;	/* lower case header names */
+	GPtrArray *patterns;	/* lower case pattern per test */
+	GArray *test_headers;	/* header index per test */
+	GHashTable *tests;	/* "header\npattern" -> test index + 1 */
+};
+
+static const gchar *shared_header_tests[] = {
+	"header-contains",
+	"header-matches",
+	"header-starts-with",
+	"header-ends-with"
+};
+
+/* Lower cases like camel_ustrstrcase() does, one character at a time.
+ * Returns NULL for text which is not valid UTF-8. */
+static gchar *
+filter_utf8_tolower (const gchar *text)
+{
+	GString *string;
+
+	if (!g_utf8_validate (text, -1, NULL))
+		return NULL;
+
+	string = g_string_sized_new (strlen (text));
+
+	for (; *text != '\0'; text = g_utf8_next_char (text))
+		g_string_append_unichar (
+			string, g_unichar_tolower (g_utf8_get_char (text)));
+
+	return g_string_free (string, FALSE);
+}
+
+static void
+filter_match_node_free (FilterMatchNode *node)
+{
+	if (node->children != NULL)
+		g_ptr_array_free (node->children, TRUE);
+
+	if (node->tests != NULL)
+		g_array_free (node->tests, TRUE);
+
+	g_slice_free (FilterMatchNode, node);
+}
+
+static FilterMatchNode *
+filter_match_node_new (gint type)
+{
+	FilterMatchNode *node;
+
+	node = g_slice_new0 (FilterMatchNode);
+	node->type = type;
+
+	if (type == FILTER_MATCH_AND || type == FILTER_MATCH_OR)
+		node->children = g_ptr_array_new_with_free_func (
+			(GDestroyNotify) filter_match_node_free);
+	else if (type == FILTER_MATCH_TEST)
+		node->tests = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	return node;
+}
+
+static guint
+filter_matcher_add_test (EMailFilterMatcher *matcher,
+                         const gchar *header,
+                         const gchar *pattern)
+{
+	gchar *key;
+	guint index, header_index;
+
+	key = g_strconcat (header, "\n", pattern, NULL);
+	index = GPOINTER_TO_UINT (g_hash_table_lookup (matcher->tests, key));
+
+	if (index > 0) {
+		g_free (key);
+		return index - 1;
+	}
+
+	for (header_index = 0; header_index < matcher->headers->len; header_index++) {
+		if (g_str_equal (matcher->headers->pdata[header_index], header))
+			break;
+	}
+
+	if (header_index == matcher->headers->len)
+		g_ptr_array_add (matcher->headers, g_strdup (header));
+
+	index = matcher->patterns->len;
+	g_ptr_array_add (matcher->patterns, g_strdup (pattern));
+	g_array_append_val (matcher->test_headers, header_index);
+	g_hash_table_insert (matcher->tests, key, GUINT_TO_POINTER (index + 1));
+
+	return index;
+}
+
+static FilterMatchNode *
+filter_matcher_build_node (EMailFilterMatcher *matcher,
+                           EMailSExpNode *code)
+{
+	FilterMatchNode *node;
+	EMailSExpNode *head;
+	gchar *header;
+	guint ii;
+
+	if (code->type != E_MAIL_SEXP_LIST || code->children->len == 0)
+		return filter_match_node_new (FILTER_MATCH_ANY);
+
+	head = code->children->pdata[0];
+	if (head->type != E_MAIL_SEXP_ATOM)
+		return filter_match_node_new (FILTER_MATCH_ANY);
+
+	if (g_str_equal (head->value, "match-all") && code->children->len == 2)
+		return filter_matcher_build_node (
+			matcher, code->children->pdata[1]);
+
+	if (g_str_equal (head->value, "and") || g_str_equal (head->value, "or")) {
+		gboolean is_and = g_str_equal (head->value, "and");
+
+		node = filter_match_node_new (
+			is_and ? FILTER_MATCH_AND : FILTER_MATCH_OR);
+
+		for (ii = 1; ii < code->children->len; ii++) {
+			FilterMatchNode *child;
+
+			child = filter_matcher_build_node (
+				matcher, code->children->pdata[ii]);
+
+			if (child->type != FILTER_MATCH_ANY) {
+				g_ptr_array_add (node->children, child);
+				continue;
+			}
+
+			filter_match_node_free (child);
+
+			/* Anything may match, and so does the (or). */
+			if (!is_and) {
+				filter_match_node_free (node);
+				return filter_match_node_new (FILTER_MATCH_ANY);
+			}
+		}
+
+		if (node->children->len == 0) {
+			filter_match_node_free (node);
+			node = filter_match_node_new (FILTER_MATCH_ANY);
+		}
+
+		return node;
+	}
+
+	for (ii = 0; ii < G_N_ELEMENTS (shared_header_tests); ii++) {
+		if (g_str_equal (head->value, shared_header_tests[ii]))
+			break;
+	}
+
+	if (ii == G_N_ELEMENTS (shared_header_tests) || code->children->len < 3)
+		return filter_match_node_new (FILTER_MATCH_ANY);
+
+	for (ii = 1; ii < code->children->len; ii++) {
+		EMailSExpNode *child = code->children->pdata[ii];
+
+		if (child->type != E_MAIL_SEXP_STRING)
+			return filter_match_node_new (FILTER_MATCH_ANY);
+
+		/* Camel matches an empty pattern always, and
+		 * an empty header name against every header. */
+		if (*child->value == '\0')
+			return filter_match_node_new (FILTER_MATCH_ANY);
+	}
+
+	header = g_ascii_strdown (
+		((EMailSExpNode *) code->children->pdata[1])->value, -1);
+
+	/* Camel takes this one from the summary, not the headers. */
+	if (g_str_equal (header, "x-camel-mlist")) {
+		g_free (header);
+		return filter_match_node_new (FILTER_MATCH_ANY);
+	}
+
+	node = filter_match_node_new (FILTER_MATCH_TEST);
+
+	for (ii = 2; ii < code->children->len; ii++) {
+		EMailSExpNode *child = code->children->pdata[ii];
+		gchar *pattern;
+		guint index;
+
+		pattern = filter_utf8_tolower (child->value);
+		if (pattern == NULL) {
+			filter_match_node_free (node);
+			node = filter_match_node_new (FILTER_MATCH_ANY);
+			break;
+		}
+
+		index = filter_matcher_add_test (matcher, header, pattern);
+		g_array_append_val (node->tests, index);
+
+		g_free (pattern);
+	}
+
+	g_free (header);
+
+	return node;
+}
+
+/**
+ * e_mail_filter_matcher_free:
+ * @matcher: an #EMailFilterMatcher, or %NULL
+ *
+ * Frees @matcher.
+ **/
+void
+e_mail_filter_matcher_free (EMailFilterMatcher *matcher)
+{
+	if (matcher == NULL)
+		return;
+
+	g_ptr_array_free (matcher->rules, TRUE);
+	g_ptr_array_free (matcher->headers, TRUE);
+	g_ptr_array_free (matcher->patterns, TRUE);
+	g_array_free (matcher->test_headers, TRUE);
+	g_hash_table_destroy (matcher->tests);
+
+	g_slice_free (EMailFilterMatcher, matcher);
+}
+
+/**
+ * e_mail_filter_matcher_new:
+ * @rules: match expressions of filter rules
+ *
+ * Builds the shared header tests for @rules.
+ *
+ * Returns: a new #EMailFilterMatcher
+ **/
+EMailFilterMatcher *
+e_mail_filter_matcher_new (GPtrArray *rules)
+{
+	EMailFilterMatcher *matcher;
+	guint ii;
+
+	matcher = g_slice_new0 (EMailFilterMatcher);
+	matcher->rules = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) filter_match_node_free);
+	matcher->headers = g_ptr_array_new_with_free_func (g_free);
+	matcher->patterns = g_ptr_array_new_with_free_func (g_free);
+	matcher->test_headers = g_array_new (FALSE, FALSE, sizeof (guint));
+	matcher->tests = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+
+	for (ii = 0; ii < rules->len; ii++) {
+		const gchar *p = rules->pdata[ii];
+		FilterMatchNode *node;
+		EMailSExpNode *code;
+
+		code = e_mail_sexp_parse (&p);
+
+		if (code != NULL)
+			node = filter_matcher_build_node (matcher, code);
+		else
+			node = filter_match_node_new (FILTER_MATCH_ANY);
+
+		g_ptr_array_add (matcher->rules, node);
+
+		e_mail_sexp_node_free (code);
+	}
+
+	return matcher;
+}
+
+/* Returns FALSE if some value is not valid UTF-8. */
+static gboolean
+filter_add_header_value (GPtrArray *values,
+                         const gchar *value)
+{
+	gchar *lower;
+
+	if (value == NULL)
+		return TRUE;
+
+	lower = filter_utf8_tolower (value);
+	if (lower == NULL)
+		return FALSE;
+
+	g_ptr_array_add (values, lower);
+
+	return TRUE;
+}
+
+/* Collects every string Camel could compare a pattern with
+ * when testing the header value, lower cased.  Returns FALSE
+ * if that can't be done. */
+static gboolean
+filter_collect_value_strings (const gchar *value,
+                              const gchar *charset,
+                              GPtrArray *values)
+{
+	CamelInternetAddress *address;
+	const gchar *address_name, *address_email;
+	gboolean success;
+	gchar *decoded;
+	gint ii;
+
+	success = filter_add_header_value (values, value);
+
+	decoded = camel_header_decode_string (value, NULL);
+	success = success && filter_add_header_value (values, decoded);
+	g_free (decoded);
+
+	if (charset != NULL) {
+		decoded = camel_header_decode_string (value, charset);
+		success = success && filter_add_header_value (values, decoded);
+		g_free (decoded);
+	}
+
+	address = camel_internet_address_new ();
+
+	if (camel_address_decode (CAMEL_ADDRESS (address), value) > 0) {
+		gchar *formatted;
+
+		for (ii = 0; camel_internet_address_get (
+			address, ii, &address_name, &address_email); ii++) {
+			success = success &&
+				filter_add_header_value (values, address_name) &&
+				filter_add_header_value (values, address_email);
+		}
+
+		formatted = camel_address_format (CAMEL_ADDRESS (address));
+		success = success && filter_add_header_value (values, formatted);
+		g_free (formatted);
+	}
+
+	g_object_unref (address);
+
+	return success;
+}
+
+static gboolean
+filter_collect_header_values (CamelMimeMessage *message,
+                              const gchar *name,
+                              GPtrArray *values)
+{
+	struct _camel_header_raw *header;
+	CamelContentType *content_type;
+	const gchar *charset = NULL;
+	gboolean success = TRUE;
+
+	content_type = camel_mime_part_get_content_type (
+		CAMEL_MIME_PART (message));
+	if (content_type != NULL)
+		charset = camel_content_type_param (content_type, "charset");
+	if (charset != NULL)
+		charset = camel_iconv_charset_name (charset);
+
+	header = camel_mime_part_get_raw_headers (CAMEL_MIME_PART (message));
+
+	for (; success && header != NULL; header = header->next) {
+		gchar *unfolded;
+
+		if (g_ascii_strcasecmp (header->name, name) != 0)
+			continue;
+
+		/* Both as stored and unfolded, whichever Camel uses. */
+		unfolded = camel_header_unfold (header->value);
+
+		success =
+			filter_collect_value_strings (
+				header->value, charset, values) &&
+			filter_collect_value_strings (
+				unfolded, charset, values);
+
+		g_free (unfolded);
+	}
+
+	return success;
+}
+
+/**
+ * e_mail_filter_matcher_run_tests:
+ * @matcher: an #EMailFilterMatcher
+ * @message: a #CamelMimeMessage
+ *
+ * Runs the shared header tests on @message.
+ *
+ * Returns: a byte per test, set if the test may pass, for
+ *          e_mail_filter_matcher_may_match(); free with g_free()
+ **/
+guint8 *
+e_mail_filter_matcher_run_tests (EMailFilterMatcher *matcher,
+                                 CamelMimeMessage *message)
+{
+	GPtrArray *values;
+	guint8 *results;
+	guint ii, jj, kk;
+
+	results = g_malloc0 (matcher->patterns->len);
+	values = g_ptr_array_new_with_free_func (g_free);
+
+	for (ii = 0; ii < matcher->headers->len; ii++) {
+		gboolean decided;
+
+		g_ptr_array_set_size (values, 0);
+
+		decided = filter_collect_header_values (
+			message, matcher->headers->pdata[ii], values);
+
+		for (jj = 0; jj < matcher->patterns->len; jj++) {
+			const gchar *pattern = matcher->patterns->pdata[jj];
+
+			if (g_array_index (matcher->test_headers, guint, jj) != ii)
+				continue;
+
+			results[jj] = !decided;
+
+			for (kk = 0; !results[jj] && kk < values->len; kk++)
+				results[jj] = strstr (values->pdata[kk], pattern) != NULL;
+		}
+	}
+
+	g_ptr_array_free (values, TRUE);
+
+	return results;
+}
+
+static gboolean
+filter_match_node_may_match (FilterMatchNode *node,
+                             const guint8 *results)
+{
+	guint ii;
+
+	switch (node->type) {
+	case FILTER_MATCH_AND:
+		for (ii = 0; ii < node->children->len; ii++) {
+			if (!filter_match_node_may_match (
+				node->children->pdata[ii], results))
+				return FALSE;
+		}
+		return TRUE;
+
+	case FILTER_MATCH_OR:
+		for (ii = 0; ii < node->children->len; ii++) {
+			if (filter_match_node_may_match (
+				node->children->pdata[ii], results))
+				return TRUE;
+		}
+		return FALSE;
+
+	case FILTER_MATCH_TEST:
+		for (ii = 0; ii < node->tests->len; ii++) {
+			if (results[g_array_index (node->tests, guint, ii)])
+				return TRUE;
+		}
+		return FALSE;
+
+	default:
+		return TRUE;
+	}
+}
+
+/**
+ * e_mail_filter_matcher_has_tests:
+ * @matcher: an #EMailFilterMatcher
+ *
+ * Returns: whether any rule has a shared header test, that is whether
+ *          e_mail_filter_matcher_run_tests() is worth reading the
+ *          message for
+ **/
+gboolean
+e_mail_filter_matcher_has_tests (EMailFilterMatcher *matcher)
+{
+	g_return_val_if_fail (matcher != NULL, FALSE);
+
+	return matcher->patterns->len > 0;
+}
+
+/**
+ * e_mail_filter_matcher_may_match:
+ * @matcher: an #EMailFilterMatcher
+ * @rule: index of a rule passed to e_mail_filter_matcher_new()
+ * @results: what e_mail_filter_matcher_run_tests() returned
+ *
+ * Returns: %FALSE if the rule can not match the message the tests
+ *          ran on, %TRUE if it may
+ **/
+gboolean
+e_mail_filter_matcher_may_match (EMailFilterMatcher *matcher,
+                                 guint rule,
+                                 const guint8 *results)
+{
+	g_return_val_if_fail (matcher != NULL, TRUE);
+	g_return_val_if_fail (rule < matcher->rules->len, TRUE);
+
+	return filter_match_node_may_match (
+		matcher->rules->pdata[rule], results);
+}
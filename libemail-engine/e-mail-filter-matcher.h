@@ -0,0 +1,43 @@
+/*
+ * e-mail-filter-matcher.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef E_MAIL_FILTER_MATCHER_H
+#define E_MAIL_FILTER_MATCHER_H
+
+/* Rules out filter rules which can not match a message, by running
+ * the header tests of all rules together.  See e-mail-filter-matcher.c. */
+
+#include <camel/camel.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EMailFilterMatcher EMailFilterMatcher;
+
+EMailFilterMatcher *
+		e_mail_filter_matcher_new	(GPtrArray *rules);
+void		e_mail_filter_matcher_free	(EMailFilterMatcher *matcher);
+gboolean	e_mail_filter_matcher_has_tests	(EMailFilterMatcher *matcher);
+guint8 *	e_mail_filter_matcher_run_tests	(EMailFilterMatcher *matcher,
+						 CamelMimeMessage *message);
+gboolean	e_mail_filter_matcher_may_match	(EMailFilterMatcher *matcher,
+						 guint rule,
+						 const guint8 *results);
+
+G_END_DECLS
+
+#endif /* E_MAIL_FILTER_MATCHER_H */
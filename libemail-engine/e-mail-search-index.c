@@ -0,0 +1,1811 @@
+/*
+ * e-mail-search-index.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* An inverted index of the words in each message of a local folder,
+ * kept on disk under the mail data directory, one file per folder.
+ *
+ * The index is only ever used to narrow a search down: a message is
+ * dropped only if the index proves that it cannot match, and the full
+ * search expression is then run over the remaining candidates with
+ * camel_folder_search_by_uids().  The results match those of
+ * camel_folder_search_by_expression() as long as the index folds
+ * case at least as loosely as Camel does.
+ *
+ * Text is split into tokens, runs of ASCII letters and digits plus
+ * any non-ASCII bytes, with ASCII folded to lower case.  Non-ASCII
+ * characters whose upper or lower case is ASCII, like KELVIN SIGN or
+ * LATIN SMALL LETTER LONG S, are stored as that ASCII letter, since
+ * Camel's case-insensitive matching lets them match it.  A search
+ * string can only occur in a message if each of its own pure ASCII
+ * tokens occurs inside one of the message's tokens, which is what
+ * the index checks.  Tokens of a search string with any non-ASCII
+ * character do not narrow anything, those messages are all searched
+ * in full, since Camel folds their case in ways the index does not
+ * attempt to mirror.
+ *
+ * The index is reconciled with the folder on every search (messages
+ * it has not seen yet are indexed then, vanished ones are dropped) and
+ * kept up to date in the background from MailFolderCache's folder
+ * change notifications, so searches rarely have to index anything.
+ *
+ * Each document also records a stamp made from the message's summary
+ * (its Message-ID hash and received date).  The first search after an
+ * index is loaded checks the stamps against the folder, so an index
+ * left behind by a folder which was since deleted and recreated, and
+ * which reuses the old UIDs for other messages, can't hide matches.
+ * Deleting or renaming a folder drops its index right away.
+ *
+ * Changes are written out from the update thread a little while
+ * after they were made, and at shutdown, never from a search.  At
+ * most one SearchIndex exists per folder URI at any time, and only
+ * an index nobody else is using is dropped from memory, so only one
+ * writer ever touches an index file. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "e-mail-search-index.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include <libemail-engine/e-mail-folder-utils.h>
+#include <libemail-engine/e-mail-sexp.h>
+#include <libemail-engine/e-mail-session.h>
+
+#define d(x)
+
+#define INDEX_MAGIC		"EMSI"
+#define INDEX_VERSION		3
+
+/* Messages with more text than this are not indexed,
+ * they are simply always treated as candidates. */
+#define MAX_INDEXED_TEXT	(4 * 1024 * 1024)
+
+#define MAX_TOKEN_LENGTH	G_MAXUINT16
+
+/* How many folder indexes to keep in memory at once. */
+#define MAX_LOADED_INDEXES	4
+
+/* Seconds to wait after a change before writing the index out. */
+#define SAVE_DELAY_SECONDS	30
+
+#define DOC_FLAG_SKIPPED	(1 << 0)
+
+typedef struct _SearchIndex SearchIndex;
+typedef struct _UpdateData UpdateData;
+
+struct _SearchIndex {
+	volatile gint ref_count;
+	GMutex lock;
+
+	gchar *folder_uri;
+	gchar *filename;
+
+	/* Document ID -> UID (a Camel pstring), NULL once removed. */
+	GPtrArray *docs;
+	/* Document ID -> DOC_FLAG_* */
+	GByteArray *doc_flags;
+	/* Document ID -> stamp of the indexed message (guint64) */
+	GArray *doc_stamps;
+	/* UID -> document ID + 1 */
+	GHashTable *uid_to_doc;
+	/* token -> GArray of ascending document IDs (guint32) */
+	GHashTable *postings;
+	/* trigram -> GPtrArray of the tokens containing it,
+	 * built on demand, NULL when not built */
+	GHashTable *trigrams;
+
+	guint n_removed;
+	gboolean dirty;
+	/* Whether the stamps were checked against the folder. */
+	gboolean verified;
+	/* Set once the folder is gone; the index is never saved again. */
+	gboolean removed;
+	guint save_id;
+};
+
+/* With no folder, only saves the index. */
+struct _UpdateData {
+	SearchIndex *index;
+	CamelFolder *folder;
+	GPtrArray *added;
+	GPtrArray *removed;
+};
+
+static GMutex index_registry_lock;
+static GHashTable *index_registry;	/* folder URI -> SearchIndex */
+static GQueue index_registry_lru = G_QUEUE_INIT;
+
+static void	search_index_schedule_save_locked
+						(SearchIndex *index);
+
+/* ------------------------------------------------------------------ */
+/* Tokenizing                                                          */
+/* ------------------------------------------------------------------ */
+
+static inline gboolean
+is_token_char (guchar c)
+{
+	return g_ascii_isalnum (c) || c >= 0x80;
+}
+
+/* Adds the tokens of text to the token set.  Returns FALSE if a
+ * token is too long to be stored. */
+static gboolean
+index_tokenize (const guchar *text,
+                gsize length,
+                GHashTable *tokens)
+{
+	gsize ii = 0;
+
+	while (ii < length) {
+		gsize start, jj;
+		GString *token;
+
+		while (ii < length && !is_token_char (text[ii]))
+			ii++;
+
+		start = ii;
+
+		while (ii < length && is_token_char (text[ii]))
+			ii++;
+
+		if (ii == start)
+			break;
+
+		if (ii - start > MAX_TOKEN_LENGTH)
+			return FALSE;
+
+		token = g_string_sized_new (ii - start);
+
+		for (jj = start; jj < ii; jj++) {
+			gunichar ch, folded;
+
+			if (text[jj] < 0x80) {
+				g_string_append_c (token, g_ascii_tolower (text[jj]));
+				continue;
+			}
+
+			ch = g_utf8_get_char_validated (
+				(const gchar *) text + jj, ii - jj);
+
+			/* Not UTF-8, keep the byte as it is. */
+			if (ch == (gunichar) -1 || ch == (gunichar) -2) {
+				g_string_append_c (token, text[jj]);
+				continue;
+			}
+
+			folded = g_unichar_tolower (ch);
+			if (folded >= 0x80)
+				folded = g_unichar_toupper (ch);
+
+			if (folded < 0x80)
+				g_string_append_c (token, g_ascii_tolower (folded));
+			else
+				g_string_append_len (
+					token, (const gchar *) text + jj,
+					g_utf8_skip[text[jj]]);
+
+			jj += g_utf8_skip[text[jj]] - 1;
+		}
+
+		g_hash_table_add (tokens, g_string_free (token, FALSE));
+	}
+
+	return TRUE;
+}
+
+/* Collects the text parts the way Camel's body search looks at them:
+ * decoded, but not converted from their charset. */
+static gboolean
+index_collect_text (CamelDataWrapper *object,
+                    GHashTable *tokens,
+                    gsize *n_bytes,
+                    GCancellable *cancellable)
+{
+	CamelDataWrapper *containee;
+	gboolean success = TRUE;
+
+	containee = camel_medium_get_content (CAMEL_MEDIUM (object));
+
+	if (containee == NULL)
+		return TRUE;
+
+	if (CAMEL_IS_MULTIPART (containee)) {
+		CamelMultipart *multipart;
+		guint ii, n_parts;
+
+		multipart = CAMEL_MULTIPART (containee);
+		n_parts = camel_multipart_get_number (multipart);
+
+		for (ii = 0; success && ii < n_parts; ii++) {
+			CamelMimePart *part;
+
+			part = camel_multipart_get_part (multipart, ii);
+			success = index_collect_text (
+				CAMEL_DATA_WRAPPER (part),
+				tokens, n_bytes, cancellable);
+		}
+
+	} else if (CAMEL_IS_MIME_MESSAGE (containee)) {
+		success = index_collect_text (
+			containee, tokens, n_bytes, cancellable);
+
+	} else if (camel_content_type_is (containee->mime_type, "text", "*") ||
+		   camel_content_type_is (containee->mime_type, "x-evolution", "evolution-rss-feed")) {
+		GByteArray *byte_array;
+		CamelStream *stream;
+
+		byte_array = g_byte_array_new ();
+		stream = camel_stream_mem_new_with_byte_array (byte_array);
+
+		camel_data_wrapper_decode_to_stream_sync (
+			containee, stream, cancellable, NULL);
+
+		*n_bytes += byte_array->len;
+
+		if (*n_bytes > MAX_INDEXED_TEXT)
+			success = FALSE;
+		else
+			success = index_tokenize (
+				byte_array->data, byte_array->len, tokens);
+
+		g_object_unref (stream);
+	}
+
+	return success;
+}
+
+/* Tells apart different messages stored under the same UID.
+ * Never returns 0, which stands for "unknown". */
+static guint64
+index_message_stamp (CamelMessageInfo *info)
+{
+	const CamelSummaryMessageID *message_id;
+	guint64 stamp = 0;
+
+	message_id = camel_message_info_message_id (info);
+	if (message_id != NULL)
+		stamp = message_id->id.id;
+
+	stamp ^= (guint64) camel_message_info_date_received (info) *
+		G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+
+	return stamp != 0 ? stamp : 1;
+}
+
+/* Reads the message and returns its tokens, or NULL if the message
+ * can't be indexed and should always be a candidate.  Sets
+ * cancelled if it gave up because of the cancellable. */
+static GHashTable *
+index_read_message (CamelFolder *folder,
+                    const gchar *uid,
+                    GCancellable *cancellable,
+                    guint64 *stamp,
+                    gboolean *cancelled)
+{
+	CamelMessageInfo *info;
+	CamelMimeMessage *message;
+	GHashTable *tokens;
+	gsize n_bytes = 0;
+	gboolean success;
+
+	*stamp = 0;
+	*cancelled = FALSE;
+
+	info = camel_folder_get_message_info (folder, uid);
+	if (info == NULL)
+		return NULL;
+
+	*stamp = index_message_stamp (info);
+
+	tokens = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+
+	/* These headers are searched in the summary, index them from
+	 * there as well so the index can narrow "header-contains". */
+#define TOKENIZE_STRING(str) G_STMT_START { \
+	const gchar *value = (str); \
+	if (value != NULL) \
+		index_tokenize ((const guchar *) value, strlen (value), tokens); \
+	} G_STMT_END
+
+	TOKENIZE_STRING (camel_message_info_subject (info));
+	TOKENIZE_STRING (camel_message_info_from (info));
+	TOKENIZE_STRING (camel_message_info_to (info));
+	TOKENIZE_STRING (camel_message_info_cc (info));
+
+#undef TOKENIZE_STRING
+
+	camel_folder_free_message_info (folder, info);
+
+	message = camel_folder_get_message_sync (folder, uid, cancellable, NULL);
+
+	if (message == NULL) {
+		*cancelled = g_cancellable_is_cancelled (cancellable);
+		g_hash_table_destroy (tokens);
+		return NULL;
+	}
+
+	success = index_collect_text (
+		CAMEL_DATA_WRAPPER (message), tokens, &n_bytes, cancellable);
+
+	g_object_unref (message);
+
+	if (g_cancellable_is_cancelled (cancellable)) {
+		*cancelled = TRUE;
+		success = FALSE;
+	}
+
+	if (!success) {
+		g_hash_table_destroy (tokens);
+		return NULL;
+	}
+
+	return tokens;
+}
+
+/* ------------------------------------------------------------------ */
+/* The index itself                                                    */
+/* ------------------------------------------------------------------ */
+
+static gchar *
+search_index_build_filename (const gchar *folder_uri)
+{
+	gchar *checksum;
+	gchar *filename;
+
+	checksum = g_compute_checksum_for_string (
+		G_CHECKSUM_SHA1, folder_uri, -1);
+
+	filename = g_build_filename (
+		mail_session_get_data_dir (),
+		"search-index", checksum, NULL);
+
+	g_free (checksum);
+
+	return filename;
+}
+
+static SearchIndex *
+search_index_new (const gchar *folder_uri)
+{
+	SearchIndex *index;
+
+	index = g_slice_new0 (SearchIndex);
+	index->ref_count = 1;
+	g_mutex_init (&index->lock);
+
+	index->folder_uri = g_strdup (folder_uri);
+	index->filename = search_index_build_filename (folder_uri);
+
+	index->docs = g_ptr_array_new ();
+	index->doc_flags = g_byte_array_new ();
+	index->doc_stamps = g_array_new (FALSE, FALSE, sizeof (guint64));
+	index->uid_to_doc = g_hash_table_new (g_str_hash, g_str_equal);
+	index->postings = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) g_array_unref);
+
+	return index;
+}
+
+static SearchIndex *
+search_index_ref (SearchIndex *index)
+{
+	g_atomic_int_inc (&index->ref_count);
+
+	return index;
+}
+
+static void
+search_index_clear_docs (SearchIndex *index)
+{
+	guint ii;
+
+	for (ii = 0; ii < index->docs->len; ii++)
+		camel_pstring_free (index->docs->pdata[ii]);
+
+	g_ptr_array_set_size (index->docs, 0);
+	g_byte_array_set_size (index->doc_flags, 0);
+	g_array_set_size (index->doc_stamps, 0);
+	g_hash_table_remove_all (index->uid_to_doc);
+	g_hash_table_remove_all (index->postings);
+
+	if (index->trigrams != NULL) {
+		g_hash_table_destroy (index->trigrams);
+		index->trigrams = NULL;
+	}
+
+	index->n_removed = 0;
+}
+
+static void
+search_index_unref (SearchIndex *index)
+{
+	if (!g_atomic_int_dec_and_test (&index->ref_count))
+		return;
+
+	search_index_clear_docs (index);
+
+	g_ptr_array_free (index->docs, TRUE);
+	g_byte_array_free (index->doc_flags, TRUE);
+	g_array_free (index->doc_stamps, TRUE);
+	g_hash_table_destroy (index->uid_to_doc);
+	g_hash_table_destroy (index->postings);
+
+	g_free (index->folder_uri);
+	g_free (index->filename);
+
+	g_mutex_clear (&index->lock);
+
+	g_slice_free (SearchIndex, index);
+}
+
+#define TRIGRAM_KEY(p) \
+	GUINT_TO_POINTER ( \
+		((guint) (guchar) (p)[0] << 16) | \
+		((guint) (guchar) (p)[1] << 8) | \
+		((guint) (guchar) (p)[2]))
+
+static void
+search_index_add_trigrams_locked (SearchIndex *index,
+                                  const gchar *token)
+{
+	gsize ii, length;
+
+	length = strlen (token);
+
+	for (ii = 0; ii + 3 <= length; ii++) {
+		GPtrArray *tokens;
+		gpointer key;
+
+		key = TRIGRAM_KEY (token + ii);
+
+		tokens = g_hash_table_lookup (index->trigrams, key);
+		if (tokens == NULL) {
+			tokens = g_ptr_array_new ();
+			g_hash_table_insert (index->trigrams, key, tokens);
+		}
+
+		/* A token repeating a trigram is only listed once. */
+		if (tokens->len == 0 ||
+		    tokens->pdata[tokens->len - 1] != token)
+			g_ptr_array_add (tokens, (gpointer) token);
+	}
+}
+
+/* The tokens are owned by the postings table; the trigram table is
+ * dropped whenever tokens are removed from there. */
+static void
+search_index_build_trigrams_locked (SearchIndex *index)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	if (index->trigrams != NULL)
+		return;
+
+	index->trigrams = g_hash_table_new_full (
+		(GHashFunc) g_direct_hash,
+		(GEqualFunc) g_direct_equal,
+		(GDestroyNotify) NULL,
+		(GDestroyNotify) g_ptr_array_unref);
+
+	g_hash_table_iter_init (&iter, index->postings);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		search_index_add_trigrams_locked (index, key);
+}
+
+static gboolean
+search_index_lookup_doc_locked (SearchIndex *index,
+                                const gchar *uid,
+                                guint32 *out_doc_id)
+{
+	gpointer value;
+
+	value = g_hash_table_lookup (index->uid_to_doc, uid);
+	if (value == NULL)
+		return FALSE;
+
+	if (out_doc_id != NULL)
+		*out_doc_id = GPOINTER_TO_UINT (value) - 1;
+
+	return TRUE;
+}
+
+static void
+search_index_remove_doc_locked (SearchIndex *index,
+                                const gchar *uid)
+{
+	guint32 doc_id;
+
+	if (!search_index_lookup_doc_locked (index, uid, &doc_id))
+		return;
+
+	/* The document ID stays in the posting lists until the next
+	 * compaction; nothing can reach it from a UID any more. */
+	g_hash_table_remove (index->uid_to_doc, uid);
+	camel_pstring_free (index->docs->pdata[doc_id]);
+	index->docs->pdata[doc_id] = NULL;
+
+	index->n_removed++;
+	index->dirty = TRUE;
+}
+
+/* Takes ownership of tokens, which may be NULL for a skipped message. */
+static void
+search_index_add_doc_locked (SearchIndex *index,
+                             const gchar *uid,
+                             guint64 stamp,
+                             GHashTable *tokens)
+{
+	GHashTableIter iter;
+	gpointer key;
+	guint32 doc_id;
+	guint8 flags = 0;
+	const gchar *doc_uid;
+
+	search_index_remove_doc_locked (index, uid);
+
+	if (tokens == NULL)
+		flags |= DOC_FLAG_SKIPPED;
+
+	doc_id = index->docs->len;
+	doc_uid = camel_pstring_strdup (uid);
+	g_ptr_array_add (index->docs, (gpointer) doc_uid);
+	g_byte_array_append (index->doc_flags, &flags, 1);
+	g_array_append_val (index->doc_stamps, stamp);
+	g_hash_table_insert (
+		index->uid_to_doc, (gpointer) doc_uid,
+		GUINT_TO_POINTER (doc_id + 1));
+
+	index->dirty = TRUE;
+
+	if (tokens == NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, tokens);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		GArray *postings;
+
+		postings = g_hash_table_lookup (index->postings, key);
+		if (postings == NULL) {
+			postings = g_array_new (FALSE, FALSE, sizeof (guint32));
+			g_hash_table_iter_steal (&iter);
+			g_hash_table_insert (index->postings, key, postings);
+
+			if (index->trigrams != NULL)
+				search_index_add_trigrams_locked (index, key);
+		}
+
+		g_array_append_val (postings, doc_id);
+	}
+
+	g_hash_table_destroy (tokens);
+}
+
+/* Drops removed documents for good and renumbers the rest. */
+static void
+search_index_compact_locked (SearchIndex *index)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	guint32 *new_ids;
+	guint ii, n_docs = 0;
+
+	if (index->n_removed == 0)
+		return;
+
+	new_ids = g_new (guint32, index->docs->len);
+
+	for (ii = 0; ii < index->docs->len; ii++) {
+		gpointer uid = index->docs->pdata[ii];
+
+		if (uid == NULL) {
+			new_ids[ii] = G_MAXUINT32;
+			continue;
+		}
+
+		new_ids[ii] = n_docs;
+		index->docs->pdata[n_docs] = uid;
+		index->doc_flags->data[n_docs] = index->doc_flags->data[ii];
+		g_array_index (index->doc_stamps, guint64, n_docs) =
+			g_array_index (index->doc_stamps, guint64, ii);
+		g_hash_table_insert (
+			index->uid_to_doc, uid,
+			GUINT_TO_POINTER (n_docs + 1));
+		n_docs++;
+	}
+
+	g_ptr_array_set_size (index->docs, n_docs);
+	g_byte_array_set_size (index->doc_flags, n_docs);
+	g_array_set_size (index->doc_stamps, n_docs);
+
+	/* Tokens are about to be freed. */
+	if (index->trigrams != NULL) {
+		g_hash_table_destroy (index->trigrams);
+		index->trigrams = NULL;
+	}
+
+	g_hash_table_iter_init (&iter, index->postings);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		GArray *postings = value;
+		guint jj, length = 0;
+
+		for (jj = 0; jj < postings->len; jj++) {
+			guint32 doc_id;
+
+			doc_id = new_ids[g_array_index (postings, guint32, jj)];
+			if (doc_id != G_MAXUINT32)
+				g_array_index (postings, guint32, length++) = doc_id;
+		}
+
+		if (length == 0)
+			g_hash_table_iter_remove (&iter);
+		else
+			g_array_set_size (postings, length);
+	}
+
+	g_free (new_ids);
+
+	index->n_removed = 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Loading and saving                                                  */
+/* ------------------------------------------------------------------ */
+
+static void
+write_uint32 (GByteArray *buffer,
+              guint32 value)
+{
+	value = GUINT32_TO_LE (value);
+	g_byte_array_append (buffer, (guint8 *) &value, sizeof (value));
+}
+
+static void
+write_varint (GByteArray *buffer,
+              guint32 value)
+{
+	while (value >= 0x80) {
+		guint8 byte = (value & 0x7f) | 0x80;
+		g_byte_array_append (buffer, &byte, 1);
+		value >>= 7;
+	}
+
+	g_byte_array_append (buffer, (guint8 *) &value, 1);
+}
+
+static gboolean
+read_uint32 (const guchar **data,
+             const guchar *end,
+             guint32 *value)
+{
+	guint32 le;
+
+	if (end - *data < (gssize) sizeof (le))
+		return FALSE;
+
+	memcpy (&le, *data, sizeof (le));
+	*value = GUINT32_FROM_LE (le);
+	*data += sizeof (le);
+
+	return TRUE;
+}
+
+static gboolean
+read_varint (const guchar **data,
+             const guchar *end,
+             guint32 *value)
+{
+	guint shift = 0;
+
+	*value = 0;
+
+	while (*data < end && shift < 32) {
+		guchar byte = *(*data)++;
+
+		*value |= (guint32) (byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return TRUE;
+		shift += 7;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+search_index_load_locked (SearchIndex *index)
+{
+	const guchar *data, *end;
+	gchar *contents = NULL;
+	gsize length = 0;
+	guint32 version, n_docs, n_tokens, ii;
+
+	if (!g_file_get_contents (index->filename, &contents, &length, NULL))
+		return FALSE;
+
+	data = (const guchar *) contents;
+	end = data + length;
+
+	if (length < 4 || memcmp (data, INDEX_MAGIC, 4) != 0)
+		goto corrupt;
+	data += 4;
+
+	if (!read_uint32 (&data, end, &version) || version != INDEX_VERSION)
+		goto corrupt;
+
+	if (!read_uint32 (&data, end, &n_docs))
+		goto corrupt;
+
+	for (ii = 0; ii < n_docs; ii++) {
+		const gchar *uid;
+		guint32 uid_length, stamp_low, stamp_high;
+		guint64 stamp;
+		guint8 flags;
+
+		if (data >= end)
+			goto corrupt;
+		flags = *data++;
+
+		if (!read_uint32 (&data, end, &stamp_low) ||
+		    !read_uint32 (&data, end, &stamp_high))
+			goto corrupt;
+		stamp = ((guint64) stamp_high << 32) | stamp_low;
+
+		if (!read_uint32 (&data, end, &uid_length) ||
+		    uid_length == 0 || end - data < (gssize) uid_length)
+			goto corrupt;
+
+		uid = camel_pstring_add (
+			g_strndup ((const gchar *) data, uid_length), TRUE);
+		data += uid_length;
+
+		g_ptr_array_add (index->docs, (gpointer) uid);
+		g_byte_array_append (index->doc_flags, &flags, 1);
+		g_array_append_val (index->doc_stamps, stamp);
+		g_hash_table_insert (
+			index->uid_to_doc, (gpointer) uid,
+			GUINT_TO_POINTER (ii + 1));
+	}
+
+	if (!read_uint32 (&data, end, &n_tokens))
+		goto corrupt;
+
+	for (ii = 0; ii < n_tokens; ii++) {
+		GArray *postings;
+		guint32 token_length, n_postings, doc_id = 0, jj;
+		gchar *token;
+
+		if (!read_uint32 (&data, end, &token_length) ||
+		    token_length == 0 || end - data < (gssize) token_length)
+			goto corrupt;
+
+		token = g_strndup ((const gchar *) data, token_length);
+		data += token_length;
+
+		if (!read_uint32 (&data, end, &n_postings) ||
+		    n_postings > n_docs) {
+			g_free (token);
+			goto corrupt;
+		}
+
+		postings = g_array_sized_new (
+			FALSE, FALSE, sizeof (guint32), n_postings);
+		g_hash_table_insert (index->postings, token, postings);
+
+		for (jj = 0; jj < n_postings; jj++) {
+			guint32 delta;
+
+			if (!read_varint (&data, end, &delta))
+				goto corrupt;
+
+			doc_id += delta;
+			if (doc_id >= n_docs)
+				goto corrupt;
+
+			g_array_append_val (postings, doc_id);
+		}
+	}
+
+	g_free (contents);
+
+	index->dirty = FALSE;
+
+	return TRUE;
+
+corrupt:
+	g_warning (
+		"%s: Discarding damaged search index for '%s'",
+		G_STRFUNC, index->folder_uri);
+
+	search_index_clear_docs (index);
+	g_free (contents);
+
+	return FALSE;
+}
+
+static void
+search_index_save_locked (SearchIndex *index)
+{
+	GHashTableIter iter;
+	GByteArray *buffer;
+	gpointer key, value;
+	gchar *dirname;
+	GError *local_error = NULL;
+	guint ii;
+
+	if (!index->dirty || index->removed)
+		return;
+
+	search_index_compact_locked (index);
+
+	buffer = g_byte_array_new ();
+	g_byte_array_append (buffer, (guint8 *) INDEX_MAGIC, 4);
+	write_uint32 (buffer, INDEX_VERSION);
+
+	write_uint32 (buffer, index->docs->len);
+	for (ii = 0; ii < index->docs->len; ii++) {
+		const gchar *uid = index->docs->pdata[ii];
+		gsize uid_length = strlen (uid);
+		guint64 stamp;
+
+		stamp = g_array_index (index->doc_stamps, guint64, ii);
+
+		g_byte_array_append (buffer, &index->doc_flags->data[ii], 1);
+		write_uint32 (buffer, stamp & G_MAXUINT32);
+		write_uint32 (buffer, stamp >> 32);
+		write_uint32 (buffer, uid_length);
+		g_byte_array_append (buffer, (guint8 *) uid, uid_length);
+	}
+
+	write_uint32 (buffer, g_hash_table_size (index->postings));
+	g_hash_table_iter_init (&iter, index->postings);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		GArray *postings = value;
+		gsize token_length = strlen (key);
+		guint32 previous = 0;
+		guint jj;
+
+		write_uint32 (buffer, token_length);
+		g_byte_array_append (buffer, key, token_length);
+
+		write_uint32 (buffer, postings->len);
+		for (jj = 0; jj < postings->len; jj++) {
+			guint32 doc_id = g_array_index (postings, guint32, jj);
+
+			write_varint (buffer, doc_id - previous);
+			previous = doc_id;
+		}
+	}
+
+	dirname = g_path_get_dirname (index->filename);
+	g_mkdir_with_parents (dirname, 0700);
+	g_free (dirname);
+
+	if (g_file_set_contents (
+		index->filename, (gchar *) buffer->data,
+		buffer->len, &local_error)) {
+		index->dirty = FALSE;
+	} else {
+		g_warning ("%s: %s", G_STRFUNC, local_error->message);
+		g_error_free (local_error);
+	}
+
+	g_byte_array_free (buffer, TRUE);
+}
+
+/* ------------------------------------------------------------------ */
+/* Index registry                                                      */
+/* ------------------------------------------------------------------ */
+
+/* Drops indexes nobody else is using until at most MAX_LOADED_INDEXES
+ * are left.  An index still in use stays, so that its changes can't
+ * be lost and no second SearchIndex for its URI can come into being
+ * while it is being written out. */
+static void
+search_index_evict_locked (void)
+{
+	GList *link;
+
+	link = g_queue_peek_tail_link (&index_registry_lru);
+
+	while (link != NULL &&
+	       g_queue_get_length (&index_registry_lru) > MAX_LOADED_INDEXES) {
+		SearchIndex *index = link->data;
+		GList *prev = g_list_previous (link);
+
+		/* Only the registry holds a reference, and no new one
+		 * can be taken without holding index_registry_lock. */
+		if (g_atomic_int_get (&index->ref_count) == 1) {
+			g_queue_delete_link (&index_registry_lru, link);
+			g_hash_table_remove (index_registry, index->folder_uri);
+
+			g_mutex_lock (&index->lock);
+			search_index_save_locked (index);
+			g_mutex_unlock (&index->lock);
+
+			search_index_unref (index);
+		}
+
+		link = prev;
+	}
+}
+
+static SearchIndex *
+search_index_get_for_folder (CamelFolder *folder,
+                             gboolean create)
+{
+	SearchIndex *index;
+	gchar *folder_uri;
+
+	folder_uri = e_mail_folder_uri_from_folder (folder);
+
+	g_mutex_lock (&index_registry_lock);
+
+	if (index_registry == NULL)
+		index_registry = g_hash_table_new (g_str_hash, g_str_equal);
+
+	index = g_hash_table_lookup (index_registry, folder_uri);
+
+	if (index != NULL) {
+		g_queue_remove (&index_registry_lru, index);
+		g_queue_push_head (&index_registry_lru, index);
+		search_index_ref (index);
+
+	} else if (create) {
+		index = search_index_new (folder_uri);
+
+		g_mutex_lock (&index->lock);
+		search_index_load_locked (index);
+		g_mutex_unlock (&index->lock);
+
+		g_hash_table_insert (index_registry, index->folder_uri, index);
+		g_queue_push_head (&index_registry_lru, index);
+		search_index_ref (index);
+
+		search_index_evict_locked ();
+	}
+
+	g_mutex_unlock (&index_registry_lock);
+
+	g_free (folder_uri);
+
+	return index;
+}
+
+/* Forgets the index of a folder which is gone, both in memory and
+ * on disk.  Whoever still uses the SearchIndex can go on doing so,
+ * but it is never written out again. */
+static void
+search_index_remove_locked (const gchar *folder_uri)
+{
+	SearchIndex *index = NULL;
+	gchar *filename;
+
+	if (index_registry != NULL)
+		index = g_hash_table_lookup (index_registry, folder_uri);
+
+	if (index != NULL) {
+		g_queue_remove (&index_registry_lru, index);
+		g_hash_table_remove (index_registry, folder_uri);
+
+		g_mutex_lock (&index->lock);
+		index->removed = TRUE;
+		g_mutex_unlock (&index->lock);
+
+		search_index_unref (index);
+	}
+
+	filename = search_index_build_filename (folder_uri);
+	g_unlink (filename);
+	g_free (filename);
+}
+
+/* ------------------------------------------------------------------ */
+/* Search expressions                                                  */
+/* ------------------------------------------------------------------ */
+
+static gboolean
+query_has_function (EMailSExpNode *node,
+                    const gchar *function)
+{
+	guint ii;
+
+	if (g_strcmp0 (e_mail_sexp_node_get_function (node), function) == 0)
+		return TRUE;
+
+	if (node->type != E_MAIL_SEXP_LIST)
+		return FALSE;
+
+	for (ii = 0; ii < node->children->len; ii++)
+		if (query_has_function (node->children->pdata[ii], function))
+			return TRUE;
+
+	return FALSE;
+}
+
+/* Candidate sets are bitsets over document IDs.  NULL stands for
+ * "any message", i.e. the term does not narrow the search. */
+
+typedef struct {
+	SearchIndex *index;
+	guint n_docs;
+	gboolean narrows_body;
+} EvalContext;
+
+static guint8 *
+bitset_new (EvalContext *context)
+{
+	return g_malloc0 ((context->n_docs + 7) / 8);
+}
+
+static void
+bitset_and (EvalContext *context,
+            guint8 *dest,
+            const guint8 *src)
+{
+	guint ii;
+
+	for (ii = 0; ii < (context->n_docs + 7) / 8; ii++)
+		dest[ii] &= src[ii];
+}
+
+static void
+bitset_or (EvalContext *context,
+           guint8 *dest,
+           const guint8 *src)
+{
+	guint ii;
+
+	for (ii = 0; ii < (context->n_docs + 7) / 8; ii++)
+		dest[ii] |= src[ii];
+}
+
+/* Only the tokens sharing the piece's rarest trigram are looked at.
+ * Pieces shorter than a trigram don't narrow anything; they would
+ * match most of the vocabulary anyway. */
+static guint8 *
+query_eval_piece (EvalContext *context,
+                  const gchar *piece)
+{
+	SearchIndex *index = context->index;
+	GPtrArray *tokens = NULL;
+	guint8 *result;
+	gsize ii, length;
+
+	length = strlen (piece);
+	if (length < 3)
+		return NULL;
+
+	search_index_build_trigrams_locked (index);
+
+	for (ii = 0; ii + 3 <= length; ii++) {
+		GPtrArray *candidates;
+
+		candidates = g_hash_table_lookup (
+			index->trigrams, TRIGRAM_KEY (piece + ii));
+
+		/* No token contains the piece at all. */
+		if (candidates == NULL)
+			return bitset_new (context);
+
+		if (tokens == NULL || candidates->len < tokens->len)
+			tokens = candidates;
+	}
+
+	result = bitset_new (context);
+
+	for (ii = 0; ii < tokens->len; ii++) {
+		const gchar *token = tokens->pdata[ii];
+		GArray *postings;
+		guint jj;
+
+		if (length > 3 && strstr (token, piece) == NULL)
+			continue;
+
+		postings = g_hash_table_lookup (index->postings, token);
+
+		for (jj = 0; jj < postings->len; jj++) {
+			guint32 doc_id = g_array_index (postings, guint32, jj);
+
+			if (doc_id < context->n_docs)
+				result[doc_id / 8] |= 1 << (doc_id % 8);
+		}
+	}
+
+	return result;
+}
+
+static guint8 *
+query_eval_string (EvalContext *context,
+                   const gchar *string)
+{
+	const guchar *p = (const guchar *) string;
+	guint8 *result = NULL;
+
+	while (*p != '\0') {
+		const guchar *start;
+		gboolean ascii = TRUE;
+		gchar *piece;
+		guint8 *piece_result;
+		gsize ii;
+
+		while (*p != '\0' && !is_token_char (*p))
+			p++;
+
+		start = p;
+
+		while (*p != '\0' && is_token_char (*p)) {
+			if (*p >= 0x80)
+				ascii = FALSE;
+			p++;
+		}
+
+		if (p == start || !ascii)
+			continue;
+
+		piece = g_malloc (p - start + 1);
+		for (ii = 0; ii < (gsize) (p - start); ii++)
+			piece[ii] = g_ascii_tolower (start[ii]);
+		piece[ii] = '\0';
+
+		piece_result = query_eval_piece (context, piece);
+
+		if (piece_result == NULL) {
+			/* Too short to narrow anything. */
+		} else if (result == NULL) {
+			result = piece_result;
+		} else {
+			bitset_and (context, result, piece_result);
+			g_free (piece_result);
+		}
+
+		g_free (piece);
+	}
+
+	return result;
+}
+
+/* Matches if any of the string arguments from 'first' on matches. */
+static guint8 *
+query_eval_strings (EvalContext *context,
+                    EMailSExpNode *node,
+                    guint first)
+{
+	guint8 *result = NULL;
+	guint ii;
+
+	if (node->children->len <= first)
+		return NULL;
+
+	for (ii = first; ii < node->children->len; ii++) {
+		EMailSExpNode *child = node->children->pdata[ii];
+		guint8 *child_result;
+
+		if (child->type != E_MAIL_SEXP_STRING)
+			child_result = NULL;
+		else
+			child_result = query_eval_string (context, child->value);
+
+		if (child_result == NULL) {
+			g_free (result);
+			return NULL;
+		}
+
+		if (result == NULL) {
+			result = child_result;
+		} else {
+			bitset_or (context, result, child_result);
+			g_free (child_result);
+		}
+	}
+
+	return result;
+}
+
+static gboolean
+query_is_indexed_header (EMailSExpNode *node)
+{
+	EMailSExpNode *field;
+
+	if (node->children->len < 2)
+		return FALSE;
+
+	field = node->children->pdata[1];
+	if (field->type != E_MAIL_SEXP_STRING)
+		return FALSE;
+
+	return  g_ascii_strcasecmp (field->value, "subject") == 0 ||
+		g_ascii_strcasecmp (field->value, "from") == 0 ||
+		g_ascii_strcasecmp (field->value, "to") == 0 ||
+		g_ascii_strcasecmp (field->value, "cc") == 0;
+}
+
+static guint8 *
+query_eval (EvalContext *context,
+            EMailSExpNode *node)
+{
+	const gchar *function;
+	guint8 *result = NULL;
+	guint ii;
+
+	function = e_mail_sexp_node_get_function (node);
+	if (function == NULL)
+		return NULL;
+
+	if (g_str_equal (function, "and")) {
+		for (ii = 1; ii < node->children->len; ii++) {
+			guint8 *child_result;
+
+			child_result = query_eval (
+				context, node->children->pdata[ii]);
+
+			if (child_result == NULL)
+				continue;
+
+			if (result == NULL) {
+				result = child_result;
+			} else {
+				bitset_and (context, result, child_result);
+				g_free (child_result);
+			}
+		}
+
+	} else if (g_str_equal (function, "or")) {
+		result = bitset_new (context);
+
+		for (ii = 1; ii < node->children->len; ii++) {
+			guint8 *child_result;
+
+			child_result = query_eval (
+				context, node->children->pdata[ii]);
+
+			if (child_result == NULL) {
+				g_free (result);
+				return NULL;
+			}
+
+			bitset_or (context, result, child_result);
+			g_free (child_result);
+		}
+
+	} else if (g_str_equal (function, "match-all")) {
+		if (node->children->len == 2)
+			result = query_eval (context, node->children->pdata[1]);
+
+	} else if (g_str_equal (function, "body-contains")) {
+		result = query_eval_strings (context, node, 1);
+		if (result != NULL)
+			context->narrows_body = TRUE;
+
+	} else if (g_str_equal (function, "header-contains") ||
+		   g_str_equal (function, "header-matches") ||
+		   g_str_equal (function, "header-starts-with") ||
+		   g_str_equal (function, "header-ends-with")) {
+		if (query_is_indexed_header (node))
+			result = query_eval_strings (context, node, 2);
+	}
+
+	return result;
+}
+
+/* ------------------------------------------------------------------ */
+/* Public API                                                          */
+/* ------------------------------------------------------------------ */
+
+/**
+ * e_mail_search_index_folder_is_indexable:
+ * @folder: a #CamelFolder
+ *
+ * Returns whether searches in @folder can use a search index.  Only
+ * folders of local stores are indexed, since indexing reads every
+ * message.
+ *
+ * Returns: whether @folder can be indexed
+ **/
+gboolean
+e_mail_search_index_folder_is_indexable (CamelFolder *folder)
+{
+	CamelStore *store;
+	CamelProvider *provider;
+
+	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), FALSE);
+
+	if (CAMEL_IS_VEE_FOLDER (folder))
+		return FALSE;
+
+	store = camel_folder_get_parent_store (folder);
+	if (store == NULL)
+		return FALSE;
+
+	provider = camel_service_get_provider (CAMEL_SERVICE (store));
+
+	return provider != NULL && (provider->flags & CAMEL_PROVIDER_IS_LOCAL) != 0;
+}
+
+/**
+ * e_mail_search_index_search_sync:
+ * @folder: a #CamelFolder
+ * @expression: a search expression
+ * @cancellable: optional #GCancellable object, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Searches @folder like camel_folder_search_by_expression() does and
+ * returns the same result, but first narrows the search down to the
+ * messages that can possibly match using the folder's search index,
+ * when the folder and the expression allow it.  Messages not indexed
+ * yet are indexed on the way.
+ *
+ * Free the returned array with camel_folder_search_free().
+ *
+ * Returns: the matching UIDs, or %NULL on error
+ **/
+GPtrArray *
+e_mail_search_index_search_sync (CamelFolder *folder,
+                                 const gchar *expression,
+                                 GCancellable *cancellable,
+                                 GError **error)
+{
+	SearchIndex *index;
+	EMailSExpNode *query = NULL;
+	EvalContext context;
+	GPtrArray *uids, *candidates, *result;
+	guint8 *matches;
+	guint8 *seen;
+	const gchar *p;
+	gboolean verified;
+	guint ii;
+
+	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), NULL);
+	g_return_val_if_fail (expression != NULL, NULL);
+
+	if (e_mail_search_index_folder_is_indexable (folder)) {
+		p = expression;
+		query = e_mail_sexp_parse (&p);
+	}
+
+	/* Threads pull in messages which don't match themselves. */
+	if (query == NULL ||
+	    query_has_function (query, "match-threads") ||
+	    !query_has_function (query, "body-contains")) {
+		e_mail_sexp_node_free (query);
+		return camel_folder_search_by_expression (
+			folder, expression, cancellable, error);
+	}
+
+	index = search_index_get_for_folder (folder, TRUE);
+	uids = camel_folder_get_uids (folder);
+
+	g_mutex_lock (&index->lock);
+	verified = index->verified;
+	g_mutex_unlock (&index->lock);
+
+	/* Bring the index up to date with the folder. */
+	for (ii = 0; ii < uids->len; ii++) {
+		const gchar *uid = uids->pdata[ii];
+		GHashTable *tokens;
+		gboolean indexed, cancelled;
+		guint64 stamp = 0;
+		guint32 doc_id;
+
+		g_mutex_lock (&index->lock);
+		indexed = search_index_lookup_doc_locked (index, uid, &doc_id);
+		if (indexed)
+			stamp = g_array_index (index->doc_stamps, guint64, doc_id);
+		g_mutex_unlock (&index->lock);
+
+		/* An index loaded from disk may predate the folder. */
+		if (indexed && !verified) {
+			CamelMessageInfo *info;
+
+			info = camel_folder_get_message_info (folder, uid);
+			if (info != NULL) {
+				indexed = (stamp == index_message_stamp (info));
+				camel_folder_free_message_info (folder, info);
+			}
+		}
+
+		if (indexed)
+			continue;
+
+		tokens = index_read_message (
+			folder, uid, cancellable, &stamp, &cancelled);
+		if (cancelled)
+			break;
+
+		g_mutex_lock (&index->lock);
+		search_index_add_doc_locked (index, uid, stamp, tokens);
+		g_mutex_unlock (&index->lock);
+	}
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+		g_mutex_lock (&index->lock);
+		search_index_schedule_save_locked (index);
+		g_mutex_unlock (&index->lock);
+
+		camel_folder_free_uids (folder, uids);
+		search_index_unref (index);
+		e_mail_sexp_node_free (query);
+		return NULL;
+	}
+
+	g_mutex_lock (&index->lock);
+
+	index->verified = TRUE;
+
+	/* Forget messages which are no longer in the folder. */
+	seen = g_malloc0 (index->docs->len);
+	for (ii = 0; ii < uids->len; ii++) {
+		guint32 doc_id;
+
+		if (search_index_lookup_doc_locked (index, uids->pdata[ii], &doc_id))
+			seen[doc_id] = TRUE;
+	}
+	for (ii = 0; ii < index->docs->len; ii++) {
+		if (!seen[ii] && index->docs->pdata[ii] != NULL)
+			search_index_remove_doc_locked (
+				index, index->docs->pdata[ii]);
+	}
+	g_free (seen);
+
+	context.index = index;
+	context.n_docs = index->docs->len;
+	context.narrows_body = FALSE;
+
+	matches = query_eval (&context, query);
+
+	candidates = NULL;
+
+	if (matches != NULL && context.narrows_body) {
+		candidates = g_ptr_array_new ();
+
+		for (ii = 0; ii < uids->len; ii++) {
+			guint32 doc_id;
+
+			if (!search_index_lookup_doc_locked (
+				index, uids->pdata[ii], &doc_id))
+				continue;
+
+			if ((index->doc_flags->data[doc_id] & DOC_FLAG_SKIPPED) != 0 ||
+			    (matches[doc_id / 8] & (1 << (doc_id % 8))) != 0)
+				g_ptr_array_add (candidates, uids->pdata[ii]);
+		}
+	}
+
+	g_free (matches);
+
+	search_index_schedule_save_locked (index);
+
+	g_mutex_unlock (&index->lock);
+
+	d (printf (
+		"%s: %u of %u messages left to search in '%s'\n",
+		G_STRFUNC, candidates ? candidates->len : uids->len,
+		uids->len, index->folder_uri));
+
+	if (candidates == NULL) {
+		result = camel_folder_search_by_expression (
+			folder, expression, cancellable, error);
+	} else if (candidates->len == 0) {
+		result = g_ptr_array_new ();
+	} else {
+		result = camel_folder_search_by_uids (
+			folder, expression, candidates, cancellable, error);
+	}
+
+	if (candidates != NULL)
+		g_ptr_array_free (candidates, TRUE);
+
+	camel_folder_free_uids (folder, uids);
+	search_index_unref (index);
+	e_mail_sexp_node_free (query);
+
+	return result;
+}
+
+static void
+search_index_update_data_free (UpdateData *data)
+{
+	search_index_unref (data->index);
+
+	if (data->folder != NULL) {
+		g_object_unref (data->folder);
+		g_ptr_array_unref (data->added);
+		g_ptr_array_unref (data->removed);
+	}
+
+	g_slice_free (UpdateData, data);
+}
+
+static void
+search_index_update_thread (UpdateData *data,
+                            gpointer user_data)
+{
+	SearchIndex *index = data->index;
+	guint ii;
+
+	if (data->folder == NULL) {
+		g_mutex_lock (&index->lock);
+		search_index_save_locked (index);
+		g_mutex_unlock (&index->lock);
+
+		search_index_update_data_free (data);
+		return;
+	}
+
+	g_mutex_lock (&index->lock);
+	for (ii = 0; ii < data->removed->len; ii++)
+		search_index_remove_doc_locked (index, data->removed->pdata[ii]);
+	g_mutex_unlock (&index->lock);
+
+	for (ii = 0; ii < data->added->len; ii++) {
+		const gchar *uid = data->added->pdata[ii];
+		GHashTable *tokens;
+		gboolean indexed, cancelled;
+		guint64 stamp;
+
+		g_mutex_lock (&index->lock);
+		indexed = search_index_lookup_doc_locked (index, uid, NULL);
+		g_mutex_unlock (&index->lock);
+
+		if (indexed)
+			continue;
+
+		tokens = index_read_message (
+			data->folder, uid, NULL, &stamp, &cancelled);
+
+		g_mutex_lock (&index->lock);
+		search_index_add_doc_locked (index, uid, stamp, tokens);
+		g_mutex_unlock (&index->lock);
+	}
+
+	g_mutex_lock (&index->lock);
+	search_index_schedule_save_locked (index);
+	g_mutex_unlock (&index->lock);
+
+	search_index_update_data_free (data);
+}
+
+static gpointer
+search_index_create_update_pool (gpointer unused)
+{
+	return g_thread_pool_new (
+		(GFunc) search_index_update_thread,
+		NULL, 1, FALSE, NULL);
+}
+
+static GThreadPool *
+search_index_get_update_pool (void)
+{
+	static GOnce once = G_ONCE_INIT;
+
+	g_once (&once, search_index_create_update_pool, NULL);
+
+	return once.retval;
+}
+
+static gboolean
+search_index_save_timeout_cb (gpointer user_data)
+{
+	SearchIndex *index = user_data;
+	UpdateData *data;
+
+	g_mutex_lock (&index->lock);
+	index->save_id = 0;
+	g_mutex_unlock (&index->lock);
+
+	/* Write it out from the update thread, after
+	 * any updates queued up in the meantime. */
+	data = g_slice_new0 (UpdateData);
+	data->index = search_index_ref (index);
+
+	g_thread_pool_push (search_index_get_update_pool (), data, NULL);
+
+	return FALSE;
+}
+
+static void
+search_index_schedule_save_locked (SearchIndex *index)
+{
+	if (!index->dirty || index->removed || index->save_id > 0)
+		return;
+
+	index->save_id = g_timeout_add_seconds_full (
+		G_PRIORITY_LOW, SAVE_DELAY_SECONDS,
+		search_index_save_timeout_cb,
+		search_index_ref (index),
+		(GDestroyNotify) search_index_unref);
+}
+
+/**
+ * e_mail_search_index_folder_changed:
+ * @folder: a #CamelFolder
+ * @changes: the changes to @folder
+ *
+ * Updates the search index of @folder, if one is loaded, for
+ * messages added to or removed from @folder.  The work is done
+ * in a background thread.
+ **/
+void
+e_mail_search_index_folder_changed (CamelFolder *folder,
+                                    CamelFolderChangeInfo *changes)
+{
+	SearchIndex *index;
+	UpdateData *data;
+	guint ii;
+
+	g_return_if_fail (CAMEL_IS_FOLDER (folder));
+
+	if (changes == NULL)
+		return;
+
+	if (changes->uid_added->len == 0 && changes->uid_removed->len == 0)
+		return;
+
+	if (!e_mail_search_index_folder_is_indexable (folder))
+		return;
+
+	/* Indexes not in memory catch up on their next search. */
+	index = search_index_get_for_folder (folder, FALSE);
+	if (index == NULL)
+		return;
+
+	data = g_slice_new0 (UpdateData);
+	data->index = index;
+	data->folder = g_object_ref (folder);
+	data->added = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) camel_pstring_free);
+	data->removed = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) camel_pstring_free);
+
+	for (ii = 0; ii < changes->uid_added->len; ii++)
+		g_ptr_array_add (
+			data->added, (gpointer) camel_pstring_strdup (
+			changes->uid_added->pdata[ii]));
+
+	for (ii = 0; ii < changes->uid_removed->len; ii++)
+		g_ptr_array_add (
+			data->removed, (gpointer) camel_pstring_strdup (
+			changes->uid_removed->pdata[ii]));
+
+	g_thread_pool_push (search_index_get_update_pool (), data, NULL);
+}
+
+/**
+ * e_mail_search_index_folder_deleted:
+ * @store: a #CamelStore
+ * @folder_name: the full name of the deleted folder
+ *
+ * Throws away the search index of a deleted folder, so that a folder
+ * created later under the same name starts with a fresh index.
+ **/
+void
+e_mail_search_index_folder_deleted (CamelStore *store,
+                                    const gchar *folder_name)
+{
+	gchar *folder_uri;
+
+	g_return_if_fail (CAMEL_IS_STORE (store));
+	g_return_if_fail (folder_name != NULL);
+
+	folder_uri = e_mail_folder_uri_build (store, folder_name);
+
+	g_mutex_lock (&index_registry_lock);
+	search_index_remove_locked (folder_uri);
+	g_mutex_unlock (&index_registry_lock);
+
+	g_free (folder_uri);
+}
+
+/**
+ * e_mail_search_index_folder_renamed:
+ * @store: a #CamelStore
+ * @old_folder_name: the old full name of the folder
+ * @new_folder_name: the new full name of the folder
+ *
+ * Moves the search index of a renamed folder along with it.  An index
+ * which was in memory is dropped there; the next search loads the
+ * moved file again.
+ **/
+void
+e_mail_search_index_folder_renamed (CamelStore *store,
+                                    const gchar *old_folder_name,
+                                    const gchar *new_folder_name)
+{
+	SearchIndex *index = NULL;
+	gchar *old_folder_uri;
+	gchar *new_folder_uri;
+	gchar *old_filename;
+	gchar *new_filename;
+
+	g_return_if_fail (CAMEL_IS_STORE (store));
+	g_return_if_fail (old_folder_name != NULL);
+	g_return_if_fail (new_folder_name != NULL);
+
+	old_folder_uri = e_mail_folder_uri_build (store, old_folder_name);
+	new_folder_uri = e_mail_folder_uri_build (store, new_folder_name);
+	old_filename = search_index_build_filename (old_folder_uri);
+	new_filename = search_index_build_filename (new_folder_uri);
+
+	g_mutex_lock (&index_registry_lock);
+
+	/* Get the latest changes on disk before moving the file. */
+	if (index_registry != NULL)
+		index = g_hash_table_lookup (index_registry, old_folder_uri);
+	if (index != NULL) {
+		g_mutex_lock (&index->lock);
+		search_index_save_locked (index);
+		g_mutex_unlock (&index->lock);
+	}
+
+	search_index_remove_locked (new_folder_uri);
+	g_rename (old_filename, new_filename);
+
+	/* The file is gone from under the old name by
+	 * now, this only drops the index from memory. */
+	search_index_remove_locked (old_folder_uri);
+
+	g_mutex_unlock (&index_registry_lock);
+
+	g_free (old_folder_uri);
+	g_free (new_folder_uri);
+	g_free (old_filename);
+	g_free (new_filename);
+}
+
+/**
+ * e_mail_search_index_shutdown:
+ *
+ * Writes out all search indexes with unsaved changes.  Call this
+ * when the application is about to quit.
+ **/
+void
+e_mail_search_index_shutdown (void)
+{
+	GList *list, *link;
+
+	g_mutex_lock (&index_registry_lock);
+
+	list = g_queue_peek_head_link (&index_registry_lru);
+
+	for (link = list; link != NULL; link = g_list_next (link)) {
+		SearchIndex *index = link->data;
+
+		g_mutex_lock (&index->lock);
+
+		if (index->save_id > 0) {
+			g_source_remove (index->save_id);
+			index->save_id = 0;
+		}
+
+		search_index_save_locked (index);
+
+		g_mutex_unlock (&index->lock);
+	}
+
+	g_mutex_unlock (&index_registry_lock);
+}
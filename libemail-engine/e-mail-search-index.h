@@ -0,0 +1,49 @@
+/*
+ * e-mail-search-index.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef E_MAIL_SEARCH_INDEX_H
+#define E_MAIL_SEARCH_INDEX_H
+
+/* Persistent token index used to speed up body searches
+ * in local folders.  See e-mail-search-index.c. */
+
+#include <camel/camel.h>
+
+G_BEGIN_DECLS
+
+gboolean	e_mail_search_index_folder_is_indexable
+						(CamelFolder *folder);
+GPtrArray *	e_mail_search_index_search_sync	(CamelFolder *folder,
+						 const gchar *expression,
+						 GCancellable *cancellable,
+						 GError **error);
+void		e_mail_search_index_folder_changed
+						(CamelFolder *folder,
+						 CamelFolderChangeInfo *changes);
+void		e_mail_search_index_folder_deleted
+						(CamelStore *store,
+						 const gchar *folder_name);
+void		e_mail_search_index_folder_renamed
+						(CamelStore *store,
+						 const gchar *old_folder_name,
+						 const gchar *new_folder_name);
+void		e_mail_search_index_shutdown	(void);
+
+G_END_DECLS
+
+#endif /* E_MAIL_SEARCH_INDEX_H */
@@ -0,0 +1,215 @@
+/*
+ * e-mail-sexp.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* A small, forgiving reader for Camel's search and filter
+ * s-expressions.  Unlike CamelSExp it needs no symbol table up front
+ * and keeps the expression as written, so it can be inspected and
+ * written back.  Strings are unescaped the way CamelSExp's scanner
+ * does it. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "e-mail-sexp.h"
+
+#include <camel/camel.h>
+
+/**
+ * e_mail_sexp_node_new_list:
+ *
+ * Returns: a new, empty list node
+ **/
+EMailSExpNode *
+e_mail_sexp_node_new_list (void)
+{
+	EMailSExpNode *node;
+
+	node = g_slice_new0 (EMailSExpNode);
+	node->type = E_MAIL_SEXP_LIST;
+	node->children = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) e_mail_sexp_node_free);
+
+	return node;
+}
+
+/**
+ * e_mail_sexp_node_free:
+ * @node: (allow-none): an #EMailSExpNode
+ *
+ * Frees @node and everything below it.
+ **/
+void
+e_mail_sexp_node_free (EMailSExpNode *node)
+{
+	if (node == NULL)
+		return;
+
+	if (node->children != NULL)
+		g_ptr_array_free (node->children, TRUE);
+
+	g_free (node->value);
+	g_slice_free (EMailSExpNode, node);
+}
+
+/**
+ * e_mail_sexp_parse:
+ * @pp: pointer to the text to parse
+ *
+ * Reads one term from *@pp and moves *@pp past it.
+ *
+ * Returns: the term, or %NULL if there is none or it does not parse
+ **/
+EMailSExpNode *
+e_mail_sexp_parse (const gchar **pp)
+{
+	const gchar *p = *pp;
+	EMailSExpNode *node;
+
+	g_return_val_if_fail (pp != NULL && *pp != NULL, NULL);
+
+	while (g_ascii_isspace (*p))
+		p++;
+
+	if (*p == '(') {
+		node = e_mail_sexp_node_new_list ();
+
+		for (p++; ; ) {
+			EMailSExpNode *child;
+
+			while (g_ascii_isspace (*p))
+				p++;
+
+			if (*p == ')') {
+				p++;
+				break;
+			}
+
+			child = e_mail_sexp_parse (&p);
+			if (child == NULL) {
+				e_mail_sexp_node_free (node);
+				return NULL;
+			}
+
+			g_ptr_array_add (node->children, child);
+		}
+
+	} else if (*p == '"') {
+		GString *string = g_string_new (NULL);
+
+		for (p++; *p != '"'; p++) {
+			if (*p == '\0') {
+				g_string_free (string, TRUE);
+				return NULL;
+			}
+
+			if (*p == '\\' && p[1] != '\0') {
+				p++;
+				if (*p == 'n')
+					g_string_append_c (string, '\n');
+				else if (*p == 't')
+					g_string_append_c (string, '\t');
+				else
+					g_string_append_c (string, *p);
+			} else {
+				g_string_append_c (string, *p);
+			}
+		}
+		p++;
+
+		node = g_slice_new0 (EMailSExpNode);
+		node->type = E_MAIL_SEXP_STRING;
+		node->value = g_string_free (string, FALSE);
+
+	} else if (*p != '\0' && *p != ')') {
+		const gchar *start = p;
+
+		while (*p != '\0' && *p != '(' && *p != ')' &&
+		       *p != '"' && !g_ascii_isspace (*p))
+			p++;
+
+		node = g_slice_new0 (EMailSExpNode);
+		node->type = E_MAIL_SEXP_ATOM;
+		node->value = g_strndup (start, p - start);
+
+	} else {
+		return NULL;
+	}
+
+	*pp = p;
+
+	return node;
+}
+
+/**
+ * e_mail_sexp_write:
+ * @node: an #EMailSExpNode
+ * @out: a #GString
+ *
+ * Appends @node to @out in a form e_mail_sexp_parse()
+ * and CamelSExp read back as the same tree.
+ **/
+void
+e_mail_sexp_write (EMailSExpNode *node,
+                   GString *out)
+{
+	guint ii;
+
+	g_return_if_fail (node != NULL);
+	g_return_if_fail (out != NULL);
+
+	switch (node->type) {
+	case E_MAIL_SEXP_ATOM:
+		g_string_append (out, node->value);
+		break;
+	case E_MAIL_SEXP_STRING:
+		camel_sexp_encode_string (out, node->value);
+		break;
+	case E_MAIL_SEXP_LIST:
+		g_string_append_c (out, '(');
+		for (ii = 0; ii < node->children->len; ii++) {
+			if (ii > 0)
+				g_string_append_c (out, ' ');
+			e_mail_sexp_write (node->children->pdata[ii], out);
+		}
+		g_string_append_c (out, ')');
+		break;
+	}
+}
+
+/**
+ * e_mail_sexp_node_get_function:
+ * @node: an #EMailSExpNode
+ *
+ * Returns: the name of the function @node calls, or %NULL
+ *          if @node is not a list starting with an atom
+ **/
+const gchar *
+e_mail_sexp_node_get_function (EMailSExpNode *node)
+{
+	EMailSExpNode *head;
+
+	g_return_val_if_fail (node != NULL, NULL);
+
+	if (node->type != E_MAIL_SEXP_LIST || node->children->len == 0)
+		return NULL;
+
+	head = node->children->pdata[0];
+
+	return (head->type == E_MAIL_SEXP_ATOM) ? head->value : NULL;
+}
@@ -0,0 +1,53 @@
+/*
+ * e-mail-sexp.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef E_MAIL_SEXP_H
+#define E_MAIL_SEXP_H
+
+/* A plain tree of Camel's search and filter s-expressions, for code
+ * which looks at or rewrites them instead of evaluating them.  See
+ * e-mail-sexp.c. */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+	E_MAIL_SEXP_ATOM,
+	E_MAIL_SEXP_STRING,
+	E_MAIL_SEXP_LIST
+} EMailSExpType;
+
+typedef struct _EMailSExpNode EMailSExpNode;
+
+struct _EMailSExpNode {
+	EMailSExpType type;
+	gchar *value;		/* E_MAIL_SEXP_ATOM and E_MAIL_SEXP_STRING */
+	GPtrArray *children;	/* E_MAIL_SEXP_LIST, of EMailSExpNode */
+};
+
+EMailSExpNode *	e_mail_sexp_node_new_list	(void);
+void		e_mail_sexp_node_free		(EMailSExpNode *node);
+EMailSExpNode *	e_mail_sexp_parse		(const gchar **pp);
+void		e_mail_sexp_write		(EMailSExpNode *node,
+						 GString *out);
+const gchar *	e_mail_sexp_node_get_function	(EMailSExpNode *node);
+
+G_END_DECLS
+
+#endif /* E_MAIL_SEXP_H */
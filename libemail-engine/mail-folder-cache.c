@@ -45,12 +45,18 @@
 #include "mail-folder-cache.h"
 #include "e-mail-utils.h"
 #include "e-mail-folder-utils.h"
+#include "e-mail-search-index.h"
 #include "e-mail-session.h"
 #include "e-mail-store-utils.h"
 
 #define w(x)
 #define d(x)
 
+/* Folder updates are collected for this many milliseconds and then
+ * delivered to the main loop together, merging repeated unread count
+ * updates for the same folder along the way. */
+#define UPDATE_BATCH_INTERVAL 50
+
 #define MAIL_FOLDER_CACHE_GET_PRIVATE(obj) \
 	(G_TYPE_INSTANCE_GET_PRIVATE \
 	((obj), MAIL_TYPE_FOLDER_CACHE, MailFolderCachePrivate))
@@ -76,6 +82,13 @@ struct _MailFolderCachePrivate {
 
 	GQueue local_folder_uris;
 	GQueue remote_folder_uris;
+
+	/* UpdateClosures waiting for the next batch, in order, and
+	 * the ones among them which later updates can merge into. */
+	GMutex updates_lock;
+	GQueue pending_updates;
+	GHashTable *pending_counts;
+	GSource *updates_source;
 };
 
 enum {
@@ -89,6 +102,7 @@ enum {
 	FOLDER_DELETED,
 	FOLDER_RENAMED,
 	FOLDER_UNREAD_UPDATED,
+	FOLDERS_UNREAD_UPDATED,
 	FOLDER_CHANGED,
 	LAST_SIGNAL
 };
@@ -478,6 +492,56 @@ update_closure_free (UpdateClosure *closure)
 	g_slice_free (UpdateClosure, closure);
 }
 
+static void
+mail_folder_cache_unread_free (MailFolderCacheUnread *unread)
+{
+	g_clear_object (&unread->store);
+	g_free (unread->folder_name);
+
+	g_slice_free (MailFolderCacheUnread, unread);
+}
+
+static guint
+update_closure_hash (const UpdateClosure *closure)
+{
+	return g_direct_hash (closure->store) ^ g_str_hash (closure->full_name);
+}
+
+static gboolean
+update_closure_equal (const UpdateClosure *closure_a,
+                      const UpdateClosure *closure_b)
+{
+	return closure_a->store == closure_b->store &&
+		g_str_equal (closure_a->full_name, closure_b->full_name);
+}
+
+/* Folds a later unread count update into an earlier one. */
+static void
+update_closure_merge (UpdateClosure *closure,
+                      UpdateClosure *later)
+{
+	closure->unread = later->unread;
+
+	/* Details are only reported for exactly one new message. */
+	if (closure->new_messages == 0 && later->new_messages == 1) {
+		closure->msg_uid = later->msg_uid;
+		closure->msg_sender = later->msg_sender;
+		closure->msg_subject = later->msg_subject;
+		later->msg_uid = NULL;
+		later->msg_sender = NULL;
+		later->msg_subject = NULL;
+	} else if (later->new_messages > 0) {
+		g_free (closure->msg_uid);
+		g_free (closure->msg_sender);
+		g_free (closure->msg_subject);
+		closure->msg_uid = NULL;
+		closure->msg_sender = NULL;
+		closure->msg_subject = NULL;
+	}
+
+	closure->new_messages += later->new_messages;
+}
+
 static StoreInfo *
 mail_folder_cache_new_store_info (MailFolderCache *cache,
                                   CamelStore *store)
@@ -633,130 +697,205 @@ mail_folder_cache_steal_folder_info (MailFolderCache *cache,
 	return folder_info;
 }
 
+static void
+mail_folder_cache_emit_update (MailFolderCache *cache,
+                               UpdateClosure *closure)
+{
+	if (closure->signal_id == signals[FOLDER_DELETED]) {
+		g_signal_emit (
+			cache,
+			closure->signal_id, 0,
+			closure->store,
+			closure->full_name);
+	}
+
+	if (closure->signal_id == signals[FOLDER_UNAVAILABLE]) {
+		g_signal_emit (
+			cache,
+			closure->signal_id, 0,
+			closure->store,
+			closure->full_name);
+	}
+
+	if (closure->signal_id == signals[FOLDER_AVAILABLE]) {
+		g_signal_emit (
+			cache,
+			closure->signal_id, 0,
+			closure->store,
+			closure->full_name);
+	}
+
+	if (closure->signal_id == signals[FOLDER_RENAMED]) {
+		g_signal_emit (
+			cache,
+			closure->signal_id, 0,
+			closure->store,
+			closure->oldfull,
+			closure->full_name);
+	}
+
+	/* update unread counts */
+	g_signal_emit (
+		cache,
+		signals[FOLDER_UNREAD_UPDATED], 0,
+		closure->store,
+		closure->full_name,
+		closure->unread);
+
+	/* XXX The old code excluded this on FOLDER_RENAMED.
+	 *     Not sure if that was intentional (if so it was
+	 *     very subtle!) but we'll preserve the behavior.
+	 *     If it turns out to be a bug then just remove
+	 *     the signal_id check. */
+	if (closure->signal_id != signals[FOLDER_RENAMED]) {
+		g_signal_emit (
+			cache,
+			signals[FOLDER_CHANGED], 0,
+			closure->store,
+			closure->full_name,
+			closure->new_messages,
+			closure->msg_uid,
+			closure->msg_sender,
+			closure->msg_subject);
+	}
+
+	if (CAMEL_IS_VEE_STORE (closure->store) &&
+	   (closure->signal_id == signals[FOLDER_AVAILABLE] ||
+	    closure->signal_id == signals[FOLDER_RENAMED])) {
+		/* Normally the vfolder store takes care of the
+		 * folder_opened event itself, but we add folder to
+		 * the noting system later, thus we do not know about
+		 * search folders to update them in a tree, thus
+		 * ensure their changes will be tracked correctly. */
+		CamelFolder *folder;
+
+		/* FIXME camel_store_get_folder_sync() may block. */
+		folder = camel_store_get_folder_sync (
+			closure->store,
+			closure->full_name,
+			0, NULL, NULL);
+
+		if (folder != NULL) {
+			mail_folder_cache_note_folder (cache, folder);
+			g_object_unref (folder);
+		}
+	}
+}
+
 static gboolean
-mail_folder_cache_update_idle_cb (gpointer user_data)
+mail_folder_cache_update_batch_cb (gpointer user_data)
 {
 	MailFolderCache *cache;
+	GQueue queue = G_QUEUE_INIT;
+	GPtrArray *counts;
 	UpdateClosure *closure;
 
-	closure = (UpdateClosure *) user_data;
+	cache = g_weak_ref_get ((GWeakRef *) user_data);
+	if (cache == NULL)
+		return FALSE;
 
-	/* Sanity checks. */
-	g_return_val_if_fail (closure->full_name != NULL, FALSE);
+	g_mutex_lock (&cache->priv->updates_lock);
 
-	cache = g_weak_ref_get (&closure->cache);
+	/* Take the whole batch; anything submitted from
+	 * here on goes into the next one. */
+	g_hash_table_remove_all (cache->priv->pending_counts);
+	e_queue_transfer (&cache->priv->pending_updates, &queue);
+	g_source_unref (cache->priv->updates_source);
+	cache->priv->updates_source = NULL;
 
-	if (cache != NULL) {
-		if (closure->signal_id == signals[FOLDER_DELETED]) {
-			g_signal_emit (
-				cache,
-				closure->signal_id, 0,
-				closure->store,
-				closure->full_name);
-		}
+	g_mutex_unlock (&cache->priv->updates_lock);
 
-		if (closure->signal_id == signals[FOLDER_UNAVAILABLE]) {
-			g_signal_emit (
-				cache,
-				closure->signal_id, 0,
-				closure->store,
-				closure->full_name);
-		}
+	counts = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) mail_folder_cache_unread_free);
 
-		if (closure->signal_id == signals[FOLDER_AVAILABLE]) {
-			g_signal_emit (
-				cache,
-				closure->signal_id, 0,
-				closure->store,
-				closure->full_name);
-		}
+	while ((closure = g_queue_pop_head (&queue)) != NULL) {
+		MailFolderCacheUnread *unread;
 
-		if (closure->signal_id == signals[FOLDER_RENAMED]) {
-			g_signal_emit (
-				cache,
-				closure->signal_id, 0,
-				closure->store,
-				closure->oldfull,
-				closure->full_name);
-		}
+		mail_folder_cache_emit_update (cache, closure);
 
-		/* update unread counts */
-		g_signal_emit (
-			cache,
-			signals[FOLDER_UNREAD_UPDATED], 0,
-			closure->store,
-			closure->full_name,
-			closure->unread);
-
-		/* XXX The old code excluded this on FOLDER_RENAMED.
-		 *     Not sure if that was intentional (if so it was
-		 *     very subtle!) but we'll preserve the behavior.
-		 *     If it turns out to be a bug then just remove
-		 *     the signal_id check. */
-		if (closure->signal_id != signals[FOLDER_RENAMED]) {
-			g_signal_emit (
-				cache,
-				signals[FOLDER_CHANGED], 0,
-				closure->store,
-				closure->full_name,
-				closure->new_messages,
-				closure->msg_uid,
-				closure->msg_sender,
-				closure->msg_subject);
-		}
+		unread = g_slice_new0 (MailFolderCacheUnread);
+		unread->store = g_object_ref (closure->store);
+		unread->folder_name = g_strdup (closure->full_name);
+		unread->unread = closure->unread;
+		g_ptr_array_add (counts, unread);
 
-		if (CAMEL_IS_VEE_STORE (closure->store) &&
-		   (closure->signal_id == signals[FOLDER_AVAILABLE] ||
-		    closure->signal_id == signals[FOLDER_RENAMED])) {
-			/* Normally the vfolder store takes care of the
-			 * folder_opened event itself, but we add folder to
-			 * the noting system later, thus we do not know about
-			 * search folders to update them in a tree, thus
-			 * ensure their changes will be tracked correctly. */
-			CamelFolder *folder;
-
-			/* FIXME camel_store_get_folder_sync() may block. */
-			folder = camel_store_get_folder_sync (
-				closure->store,
-				closure->full_name,
-				0, NULL, NULL);
-
-			if (folder != NULL) {
-				mail_folder_cache_note_folder (cache, folder);
-				g_object_unref (folder);
-			}
-		}
-
-		g_object_unref (cache);
+		update_closure_free (closure);
 	}
 
+	if (counts->len > 0)
+		g_signal_emit (cache, signals[FOLDERS_UNREAD_UPDATED], 0, counts);
+
+	g_ptr_array_unref (counts);
+	g_object_unref (cache);
+
 	return FALSE;
 }
 
+static void
+mail_folder_cache_free_weak_ref (GWeakRef *weak_ref)
+{
+	g_weak_ref_clear (weak_ref);
+	g_slice_free (GWeakRef, weak_ref);
+}
+
 static void
 mail_folder_cache_submit_update (UpdateClosure *closure)
 {
-	GMainContext *main_context;
+	MailFolderCachePrivate *priv;
 	MailFolderCache *cache;
-	GSource *idle_source;
+	UpdateClosure *pending;
 
 	g_return_if_fail (closure != NULL);
+	g_return_if_fail (closure->full_name != NULL);
 
 	cache = g_weak_ref_get (&closure->cache);
 	g_return_if_fail (cache != NULL);
 
-	main_context = mail_folder_cache_ref_main_context (cache);
+	priv = cache->priv;
+
+	g_mutex_lock (&priv->updates_lock);
 
-	idle_source = g_idle_source_new ();
-	g_source_set_callback (
-		idle_source,
-		mail_folder_cache_update_idle_cb,
-		closure,
-		(GDestroyNotify) update_closure_free);
-	g_source_attach (idle_source, main_context);
-	g_source_unref (idle_source);
+	pending = g_hash_table_lookup (priv->pending_counts, closure);
 
-	g_main_context_unref (main_context);
+	if (closure->signal_id == 0 && pending != NULL) {
+		/* Another count update for a folder already in
+		 * this batch: keep just the one, with the latest
+		 * count and the new messages of both. */
+		update_closure_merge (pending, closure);
+		update_closure_free (closure);
+	} else {
+		/* Don't let later count updates jump ahead of
+		 * an event like this one for the same folder. */
+		if (closure->signal_id != 0)
+			g_hash_table_remove (priv->pending_counts, closure);
+		else
+			g_hash_table_add (priv->pending_counts, closure);
+
+		g_queue_push_tail (&priv->pending_updates, closure);
+	}
+
+	if (priv->updates_source == NULL) {
+		GMainContext *main_context;
+		GWeakRef *weak_ref;
+
+		main_context = mail_folder_cache_ref_main_context (cache);
+
+		weak_ref = g_slice_new0 (GWeakRef);
+		g_weak_ref_set (weak_ref, cache);
+
+		priv->updates_source =
+			g_timeout_source_new (UPDATE_BATCH_INTERVAL);
+		g_source_set_callback (
+			priv->updates_source,
+			mail_folder_cache_update_batch_cb,
+			weak_ref,
+			(GDestroyNotify) mail_folder_cache_free_weak_ref);
+		g_source_attach (priv->updates_source, main_context);
+
+		g_main_context_unref (main_context);
+	}
+
+	g_mutex_unlock (&priv->updates_lock);
 
 	g_object_unref (cache);
 }
@@ -895,6 +1034,8 @@ folder_changed_cb (CamelFolder *folder,
 	parent_store = camel_folder_get_parent_store (folder);
 	session = camel_service_ref_session (CAMEL_SERVICE (parent_store));
 
+	e_mail_search_index_folder_changed (folder, changes);
+
 	if (last_newmail_per_folder == NULL)
 		last_newmail_per_folder = g_hash_table_new (
 			g_direct_hash, g_direct_equal);
@@ -1096,6 +1237,8 @@ store_folder_deleted_cb (CamelStore *store,
                          CamelFolderInfo *info,
                          MailFolderCache *cache)
 {
+	e_mail_search_index_folder_deleted (store, info->full_name);
+
 	/* We only want deleted events to do more work
 	 * if we dont support subscriptions. */
 	if (!CAMEL_IS_SUBSCRIBABLE (store))
@@ -1164,6 +1307,9 @@ rename_folders (MailFolderCache *cache,
 	g_free (olduri);
 	g_free (newuri);
 
+	e_mail_search_index_folder_renamed (
+		store_info->store, old, fi->full_name);
+
 	g_free (old);
 }
 
@@ -1304,6 +1450,7 @@ ping_cb (MailFolderCache *cache)
 
 		m = mail_msg_new (&ping_store_info);
 		m->store = g_object_ref (service);
+		mail_msg_set_service (m, service);
 
 		mail_msg_slow_ordered_push (m);
 	}
@@ -1375,6 +1522,20 @@ mail_folder_cache_dispose (GObject *object)
 
 	g_hash_table_remove_all (priv->store_info_ht);
 
+	g_mutex_lock (&priv->updates_lock);
+
+	if (priv->updates_source != NULL) {
+		g_source_destroy (priv->updates_source);
+		g_source_unref (priv->updates_source);
+		priv->updates_source = NULL;
+	}
+
+	g_hash_table_remove_all (priv->pending_counts);
+	while (!g_queue_is_empty (&priv->pending_updates))
+		update_closure_free (g_queue_pop_head (&priv->pending_updates));
+
+	g_mutex_unlock (&priv->updates_lock);
+
 	/* Chain up to parent's dispose() method. */
 	G_OBJECT_CLASS (mail_folder_cache_parent_class)->dispose (object);
 }
@@ -1402,6 +1563,9 @@ mail_folder_cache_finalize (GObject *object)
 	while (!g_queue_is_empty (&priv->remote_folder_uris))
 		g_free (g_queue_pop_head (&priv->remote_folder_uris));
 
+	g_hash_table_destroy (priv->pending_counts);
+	g_mutex_clear (&priv->updates_lock);
+
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (mail_folder_cache_parent_class)->finalize (object);
 }
@@ -1682,6 +1846,23 @@ mail_folder_cache_class_init (MailFolderCacheClass *class)
 		G_TYPE_STRING,
 		G_TYPE_INT);
 
+	/**
+	 * MailFolderCache::folders-unread-updated
+	 * @counts: a #GPtrArray of #MailFolderCacheUnread
+	 *
+	 * Emitted once per batch of folder updates, after the individual
+	 * MailFolderCache::folder-unread-updated emissions, with the unread
+	 * counts of every folder in the batch.  Handlers that touch many
+	 * folders at once can use this to do their work in one pass.
+	 **/
+	signals[FOLDERS_UNREAD_UPDATED] = g_signal_new (
+		"folders-unread-updated",
+		G_OBJECT_CLASS_TYPE (object_class),
+		G_SIGNAL_RUN_FIRST,
+		0, NULL, NULL, NULL,
+		G_TYPE_NONE, 1,
+		G_TYPE_PTR_ARRAY);
+
 	/**
 	 * MailFolderCache::folder-changed
 	 * @store: the #CamelStore containing the folder
@@ -1738,6 +1919,12 @@ mail_folder_cache_init (MailFolderCache *cache)
 
 	g_queue_init (&cache->priv->local_folder_uris);
 	g_queue_init (&cache->priv->remote_folder_uris);
+
+	g_mutex_init (&cache->priv->updates_lock);
+	g_queue_init (&cache->priv->pending_updates);
+	cache->priv->pending_counts = g_hash_table_new (
+		(GHashFunc) update_closure_hash,
+		(GEqualFunc) update_closure_equal);
 }
 
 MailFolderCache *
@@ -52,6 +52,7 @@ G_BEGIN_DECLS
 typedef struct _MailFolderCache MailFolderCache;
 typedef struct _MailFolderCacheClass MailFolderCacheClass;
 typedef struct _MailFolderCachePrivate MailFolderCachePrivate;
+typedef struct _MailFolderCacheUnread MailFolderCacheUnread;
 
 /**
  * MailFolderCache:
@@ -94,6 +95,20 @@ struct _MailFolderCacheClass {
 						 const gchar *msg_subject);
 };
 
+/**
+ * MailFolderCacheUnread:
+ * @store: the #CamelStore containing the folder
+ * @folder_name: the name of the folder
+ * @unread: the number of unread mails in the folder
+ *
+ * One entry of a MailFolderCache::folders-unread-updated batch.
+ */
+struct _MailFolderCacheUnread {
+	CamelStore *store;
+	gchar *folder_name;
+	gint unread;
+};
+
 GType		mail_folder_cache_get_type	(void) G_GNUC_CONST;
 MailFolderCache *
 		mail_folder_cache_new		(void);
@@ -160,6 +160,9 @@ mail_msg_free (MailMsg *mail_msg)
 	if (mail_msg->cancellable != NULL)
 		g_object_unref (mail_msg->cancellable);
 
+	if (mail_msg->service != NULL)
+		g_object_unref (mail_msg->service);
+
 	if (mail_msg->error != NULL)
 		g_error_free (mail_msg->error);
 
@@ -435,6 +438,280 @@ mail_msg_proxy (MailMsg *msg)
 	G_UNLOCK (idle_source_id);
 }
 
+/* ********************************************************************** */
+
+/* Worker-thread messages are queued per CamelService (messages with no
+ * service share one queue) and handed to a common thread pool only when
+ * their service has room for them, so one busy account cannot hold up
+ * the others.  Unordered messages may run concurrently up to the service
+ * limit; fast and slow ordered messages run one at a time per service,
+ * in priority order.  A message's priority grows the longer it waits,
+ * so low priority work is not starved by a steady stream of high
+ * priority work. */
+
+/* Total unordered messages running at once, over all services. */
+#define MAX_UNORDERED_RUNNING		10
+
+/* Unordered messages running at once for one service, by default.
+ * Messages without a service may use all of MAX_UNORDERED_RUNNING. */
+#define DEFAULT_SERVICE_LIMIT		3
+
+/* A waiting message gains one priority step per this many microseconds. */
+#define AGING_INTERVAL			(2 * G_USEC_PER_SEC)
+
+typedef enum {
+	MAIL_MSG_QUEUE_UNORDERED,
+	MAIL_MSG_QUEUE_FAST_ORDERED,
+	MAIL_MSG_QUEUE_SLOW_ORDERED,
+	MAIL_MSG_N_QUEUES
+} MailMsgQueueKind;
+
+typedef struct _ServiceQueue ServiceQueue;
+typedef struct _QueuedMsg QueuedMsg;
+
+struct _ServiceQueue {
+	CamelService *service;		/* weak, or NULL */
+	GQueue queued[MAIL_MSG_N_QUEUES];
+	guint running[MAIL_MSG_N_QUEUES];
+	guint limit;
+	gint64 last_dispatch;
+
+	/* Statistics */
+	guint64 completed;
+	gint64 total_wait;
+	gint64 max_wait;
+	gint64 total_run;
+};
+
+struct _QueuedMsg {
+	MailMsg *msg;
+	ServiceQueue *service_queue;
+	CamelService *service;		/* keeps service_queue alive */
+	MailMsgQueueKind kind;
+	gint64 queued_time;
+	gint64 start_time;
+};
+
+/* All protected by scheduler_lock. */
+static GMutex scheduler_lock;
+static GHashTable *service_queues;	/* CamelService -> ServiceQueue */
+static GThreadPool *scheduler_pool;
+static guint unordered_running;
+
+static void
+service_queue_free (ServiceQueue *service_queue)
+{
+	g_slice_free (ServiceQueue, service_queue);
+}
+
+static void
+service_queue_weak_notify_cb (gpointer user_data,
+                              GObject *where_the_service_was)
+{
+	g_mutex_lock (&scheduler_lock);
+	g_hash_table_remove (service_queues, where_the_service_was);
+	g_mutex_unlock (&scheduler_lock);
+}
+
+static ServiceQueue *
+service_queue_lookup_locked (CamelService *service,
+                             gboolean create)
+{
+	ServiceQueue *service_queue;
+	gint ii;
+
+	service_queue = g_hash_table_lookup (service_queues, service);
+
+	if (service_queue == NULL && create) {
+		service_queue = g_slice_new0 (ServiceQueue);
+		service_queue->service = service;
+		service_queue->limit = (service != NULL) ?
+			DEFAULT_SERVICE_LIMIT : MAX_UNORDERED_RUNNING;
+
+		for (ii = 0; ii < MAIL_MSG_N_QUEUES; ii++)
+			g_queue_init (&service_queue->queued[ii]);
+
+		g_hash_table_insert (service_queues, service, service_queue);
+
+		if (service != NULL)
+			g_object_weak_ref (
+				G_OBJECT (service),
+				service_queue_weak_notify_cb, NULL);
+	}
+
+	return service_queue;
+}
+
+static gint64
+queued_msg_effective_priority (QueuedMsg *queued_msg,
+                               gint64 now)
+{
+	return queued_msg->msg->priority +
+		(now - queued_msg->queued_time) / AGING_INTERVAL;
+}
+
+/* Finds the message to run next from one queue: highest effective
+ * priority first, and the earliest queued among equals.  Aging never
+ * reorders messages of equal priority, so ordered queues stay FIFO
+ * within a priority as before. */
+static GList *
+service_queue_find_next (GQueue *queue,
+                         gint64 now,
+                         gint64 *out_priority)
+{
+	GList *link, *best = NULL;
+	gint64 best_priority = 0;
+
+	for (link = g_queue_peek_head_link (queue); link; link = link->next) {
+		gint64 priority;
+
+		priority = queued_msg_effective_priority (link->data, now);
+		if (best == NULL || priority > best_priority) {
+			best = link;
+			best_priority = priority;
+		}
+	}
+
+	*out_priority = best_priority;
+
+	return best;
+}
+
+static gboolean
+service_queue_can_run_locked (ServiceQueue *service_queue,
+                              MailMsgQueueKind kind)
+{
+	if (g_queue_is_empty (&service_queue->queued[kind]))
+		return FALSE;
+
+	if (kind != MAIL_MSG_QUEUE_UNORDERED)
+		return service_queue->running[kind] == 0;
+
+	return unordered_running < MAX_UNORDERED_RUNNING &&
+		service_queue->running[kind] < service_queue->limit;
+}
+
+/* Hands runnable messages to the thread pool.  Any service with room
+ * may be picked; between services the one with the highest effective
+ * priority wins, then the one served least recently. */
+static void
+mail_msg_dispatch_locked (void)
+{
+	gint64 now = g_get_monotonic_time ();
+	gint kind;
+
+	for (kind = 0; kind < MAIL_MSG_N_QUEUES; kind++) {
+		while (TRUE) {
+			GHashTableIter iter;
+			ServiceQueue *best_queue = NULL;
+			GList *best_link = NULL;
+			gint64 best_priority = 0;
+			gpointer value;
+			QueuedMsg *queued_msg;
+
+			g_hash_table_iter_init (&iter, service_queues);
+			while (g_hash_table_iter_next (&iter, NULL, &value)) {
+				ServiceQueue *service_queue = value;
+				GList *link;
+				gint64 priority;
+
+				if (!service_queue_can_run_locked (service_queue, kind))
+					continue;
+
+				link = service_queue_find_next (
+					&service_queue->queued[kind],
+					now, &priority);
+
+				if (best_queue == NULL ||
+				    priority > best_priority ||
+				    (priority == best_priority &&
+				     service_queue->last_dispatch <
+				     best_queue->last_dispatch)) {
+					best_queue = service_queue;
+					best_link = link;
+					best_priority = priority;
+				}
+			}
+
+			if (best_queue == NULL)
+				break;
+
+			queued_msg = best_link->data;
+			g_queue_delete_link (&best_queue->queued[kind], best_link);
+
+			best_queue->running[kind]++;
+			best_queue->last_dispatch = now;
+			if (kind == MAIL_MSG_QUEUE_UNORDERED)
+				unordered_running++;
+
+			g_thread_pool_push (scheduler_pool, queued_msg, NULL);
+		}
+	}
+}
+
+static void
+mail_msg_scheduler_run (QueuedMsg *queued_msg)
+{
+	ServiceQueue *service_queue = queued_msg->service_queue;
+	gint64 wait, run;
+
+	queued_msg->start_time = g_get_monotonic_time ();
+
+	/* The message may be gone once this returns. */
+	mail_msg_proxy (queued_msg->msg);
+
+	run = g_get_monotonic_time () - queued_msg->start_time;
+	wait = queued_msg->start_time - queued_msg->queued_time;
+
+	g_mutex_lock (&scheduler_lock);
+
+	service_queue->running[queued_msg->kind]--;
+	if (queued_msg->kind == MAIL_MSG_QUEUE_UNORDERED)
+		unordered_running--;
+
+	service_queue->completed++;
+	service_queue->total_wait += wait;
+	service_queue->max_wait = MAX (service_queue->max_wait, wait);
+	service_queue->total_run += run;
+
+	mail_msg_dispatch_locked ();
+
+	g_mutex_unlock (&scheduler_lock);
+
+	/* Drop the reference outside the lock, the weak
+	 * notify callback may need to take it. */
+	if (queued_msg->service != NULL)
+		g_object_unref (queued_msg->service);
+
+	g_slice_free (QueuedMsg, queued_msg);
+}
+
+static void
+mail_msg_scheduler_push (MailMsg *msg,
+                         MailMsgQueueKind kind)
+{
+	QueuedMsg *queued_msg;
+
+	queued_msg = g_slice_new0 (QueuedMsg);
+	queued_msg->msg = msg;
+	queued_msg->kind = kind;
+	queued_msg->queued_time = g_get_monotonic_time ();
+
+	if (msg->service != NULL)
+		queued_msg->service = g_object_ref (msg->service);
+
+	g_mutex_lock (&scheduler_lock);
+
+	queued_msg->service_queue =
+		service_queue_lookup_locked (queued_msg->service, TRUE);
+	g_queue_push_tail (
+		&queued_msg->service_queue->queued[kind], queued_msg);
+
+	mail_msg_dispatch_locked ();
+
+	g_mutex_unlock (&scheduler_lock);
+}
+
 void
 mail_msg_init (void)
 {
@@ -446,6 +723,18 @@ mail_msg_init (void)
 
 	mail_msg_active_table = g_hash_table_new (NULL, NULL);
 	main_thread = g_thread_self ();
+
+	g_mutex_init (&scheduler_lock);
+	service_queues = g_hash_table_new_full (
+		(GHashFunc) g_direct_hash,
+		(GEqualFunc) g_direct_equal,
+		(GDestroyNotify) NULL,
+		(GDestroyNotify) service_queue_free);
+
+	/* Threads are only limited by the scheduler, the pool
+	 * just saves us from spawning one per message. */
+	scheduler_pool = g_thread_pool_new (
+		(GFunc) mail_msg_scheduler_run, NULL, -1, FALSE, NULL);
 }
 
 static gint
@@ -461,21 +750,6 @@ mail_msg_compare (const MailMsg *msg1,
 	return (priority1 < priority2) ? 1 : -1;
 }
 
-static gpointer
-create_thread_pool (gpointer data)
-{
-	GThreadPool *thread_pool;
-	gint max_threads = GPOINTER_TO_INT (data);
-
-	/* once created, run forever */
-	thread_pool = g_thread_pool_new (
-		(GFunc) mail_msg_proxy, NULL, max_threads, FALSE, NULL);
-	g_thread_pool_set_sort_function (
-		thread_pool, (GCompareDataFunc) mail_msg_compare, NULL);
-
-	return thread_pool;
-}
-
 void
 mail_msg_main_loop_push (gpointer msg)
 {
@@ -495,31 +769,124 @@ mail_msg_main_loop_push (gpointer msg)
 void
 mail_msg_unordered_push (gpointer msg)
 {
-	static GOnce once = G_ONCE_INIT;
+	mail_msg_scheduler_push (msg, MAIL_MSG_QUEUE_UNORDERED);
+}
 
-	g_once (&once, (GThreadFunc) create_thread_pool, GINT_TO_POINTER (10));
+void
+mail_msg_fast_ordered_push (gpointer msg)
+{
+	mail_msg_scheduler_push (msg, MAIL_MSG_QUEUE_FAST_ORDERED);
+}
 
-	g_thread_pool_push ((GThreadPool *) once.retval, msg, NULL);
+void
+mail_msg_slow_ordered_push (gpointer msg)
+{
+	mail_msg_scheduler_push (msg, MAIL_MSG_QUEUE_SLOW_ORDERED);
 }
 
+/**
+ * mail_msg_set_service:
+ * @msg: a #MailMsg
+ * @service: (allow-none): the #CamelService @msg works on, or %NULL
+ *
+ * Tells the scheduler which service @msg talks to, so it is queued,
+ * limited and accounted together with that service's other messages.
+ * Call this before pushing @msg.
+ **/
 void
-mail_msg_fast_ordered_push (gpointer msg)
+mail_msg_set_service (gpointer msg,
+                      CamelService *service)
 {
-	static GOnce once = G_ONCE_INIT;
+	MailMsg *mail_msg = msg;
 
-	g_once (&once, (GThreadFunc) create_thread_pool, GINT_TO_POINTER (1));
+	g_return_if_fail (mail_msg != NULL);
+	g_return_if_fail (service == NULL || CAMEL_IS_SERVICE (service));
+
+	if (service != NULL)
+		g_object_ref (service);
 
-	g_thread_pool_push ((GThreadPool *) once.retval, msg, NULL);
+	if (mail_msg->service != NULL)
+		g_object_unref (mail_msg->service);
+
+	mail_msg->service = service;
 }
 
+/**
+ * mail_msg_set_service_limit:
+ * @service: a #CamelService
+ * @limit: how many unordered messages may run at once for @service
+ *
+ * Sets how many unordered messages for @service may run concurrently.
+ * Ordered messages always run one at a time per service.
+ **/
 void
-mail_msg_slow_ordered_push (gpointer msg)
+mail_msg_set_service_limit (CamelService *service,
+                            guint limit)
 {
-	static GOnce once = G_ONCE_INIT;
+	ServiceQueue *service_queue;
+
+	g_return_if_fail (CAMEL_IS_SERVICE (service));
+
+	g_mutex_lock (&scheduler_lock);
+
+	service_queue = service_queue_lookup_locked (service, TRUE);
+	service_queue->limit = CLAMP (limit, 1, MAX_UNORDERED_RUNNING);
+
+	/* Raising the limit may let queued messages run. */
+	mail_msg_dispatch_locked ();
+
+	g_mutex_unlock (&scheduler_lock);
+}
+
+/**
+ * mail_msg_get_service_stats:
+ * @service: (allow-none): a #CamelService, or %NULL
+ * @stats: return location for the statistics
+ *
+ * Fills @stats with the queue depth and latency figures for @service,
+ * or for messages without a service if @service is %NULL.  Times are
+ * in microseconds.
+ *
+ * Returns: %TRUE if any message was ever queued for @service
+ **/
+gboolean
+mail_msg_get_service_stats (CamelService *service,
+                            MailMsgServiceStats *stats)
+{
+	ServiceQueue *service_queue;
+	gint ii;
+
+	g_return_val_if_fail (stats != NULL, FALSE);
+
+	memset (stats, 0, sizeof (MailMsgServiceStats));
+
+	g_mutex_lock (&scheduler_lock);
+
+	service_queue = service_queue_lookup_locked (service, FALSE);
+
+	if (service_queue != NULL) {
+		for (ii = 0; ii < MAIL_MSG_N_QUEUES; ii++) {
+			stats->queued += service_queue->queued[ii].length;
+			stats->running += service_queue->running[ii];
+		}
+
+		stats->limit = service_queue->limit;
+		stats->completed = service_queue->completed;
+		stats->max_wait = service_queue->max_wait;
+
+		if (service_queue->completed > 0) {
+			stats->average_wait =
+				service_queue->total_wait /
+				(gint64) service_queue->completed;
+			stats->average_run =
+				service_queue->total_run /
+				(gint64) service_queue->completed;
+		}
+	}
 
-	g_once (&once, (GThreadFunc) create_thread_pool, GINT_TO_POINTER (1));
+	g_mutex_unlock (&scheduler_lock);
 
-	g_thread_pool_push ((GThreadPool *) once.retval, msg, NULL);
+	return service_queue != NULL;
 }
 
 gboolean
@@ -29,6 +29,7 @@
 
 typedef struct _MailMsg MailMsg;
 typedef struct _MailMsgInfo MailMsgInfo;
+typedef struct _MailMsgServiceStats MailMsgServiceStats;
 
 typedef gchar *	(*MailMsgDescFunc)		(MailMsg *msg);
 typedef void	(*MailMsgExecFunc)		(MailMsg *msg,
@@ -56,6 +57,7 @@ struct _MailMsg {
 	gint priority;			/* priority (default = 0) */
 	GCancellable *cancellable;
 	GError *error;			/* up to the caller to use this */
+	CamelService *service;		/* for scheduling, may be NULL */
 };
 
 struct _MailMsgInfo {
@@ -66,6 +68,16 @@ struct _MailMsgInfo {
 	MailMsgFreeFunc free;
 };
 
+struct _MailMsgServiceStats {
+	guint queued;			/* waiting to run */
+	guint running;
+	guint limit;			/* unordered messages at once */
+	guint64 completed;
+	gint64 average_wait;		/* microseconds */
+	gint64 max_wait;		/* microseconds */
+	gint64 average_run;		/* microseconds */
+};
+
 /* Just till we move this out to EDS */
 EAlertSink *	mail_msg_get_alert_sink (void);
 
@@ -95,6 +107,12 @@ void mail_msg_unordered_push (gpointer msg);
 void mail_msg_fast_ordered_push (gpointer msg);
 void mail_msg_slow_ordered_push (gpointer msg);
 
+/* per-service scheduling */
+void mail_msg_set_service (gpointer msg, CamelService *service);
+void mail_msg_set_service_limit (CamelService *service, guint limit);
+gboolean mail_msg_get_service_stats (CamelService *service,
+				     MailMsgServiceStats *stats);
+
 /* To implement the stop button */
 GHook * mail_cancel_hook_add (GHookFunc func, gpointer data);
 void mail_cancel_hook_remove (GHook *hook);
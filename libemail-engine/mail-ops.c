@@ -30,10 +30,15 @@
 #endif
 
 #include <errno.h>
+#include <string.h>
 
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
 
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+
 #include <libedataserver/libedataserver.h>
 
 #include <libemail-engine/mail-mt.h>
@@ -42,6 +47,7 @@
 #include "mail-ops.h"
 #include "mail-tools.h"
 
+#include "e-mail-filter-matcher.h"
 #include "e-mail-folder-utils.h"
 #include "e-mail-session.h"
 #include "e-mail-session-utils.h"
@@ -94,6 +100,517 @@ em_filter_folder_element_desc (struct _filter_mail_msg *m)
 	return g_strdup (_("Filtering Selected Messages"));
 }
 
+/* Filtering many messages runs in two stages.  A few worker threads
+ * read the messages and evaluate the filter rules' match expressions
+ * on them, a bounded number of messages ahead.  The job's own thread
+ * then commits the results strictly in message order: each message
+ * some rule matched is handed, already read, to the filter driver,
+ * which applies the actions just as camel_filter_driver_filter_folder()
+ * would.  Messages no rule matched are left alone without bothering
+ * the driver.  If there is a default folder, they are copied there
+ * together, in order, between the messages the driver handles.
+ *
+ * Messages of stores which can only hand out one message at a time,
+ * like POP3, or of folders without a summary, are read by a single
+ * thread in message order, and only the evaluation runs in parallel.
+ * Match expressions then see message info built from the headers,
+ * like the driver's own.
+ *
+ * CamelFilterDriver has no way to apply a rule's actions without
+ * matching the rule again, so the driver still matches the rules of
+ * committed messages itself, and still moves and copies them one at a
+ * time; that is cheap once the message is in memory.  Since the driver
+ * is always given the message it is never downloaded twice.
+ *
+ * Match expressions which test state the actions of earlier rules can
+ * change (flags, tags, labels, scores), or which have side effects or
+ * rely on outside help (piping the message, junk tests), are not
+ * evaluated by the workers.  With such a rule around, every message
+ * goes through the driver and the workers only read the messages
+ * ahead.
+ *
+ * Filter drivers only take part when their rules were added with
+ * mail_filter_driver_add_rule(), otherwise the workers could not know
+ * the match expressions. */
+
+#define FILTER_RULES_KEY		"mail-filter-match-rules"
+
+/* How far ahead of the commit the workers may read. */
+#define FILTER_BATCH_WINDOW		32
+#define FILTER_BATCH_MAX_THREADS	4
+
+typedef struct _FilterBatch FilterBatch;
+typedef struct _FilterBatchItem FilterBatchItem;
+typedef struct _FilterBatchFetch FilterBatchFetch;
+
+struct _FilterBatchItem {
+	const gchar *uid;
+	CamelMimeMessage *message;
+	CamelMessageInfo *info;
+	gboolean done;
+	gboolean matched;
+};
+
+struct _FilterBatch {
+	CamelSession *session;
+	CamelFolder *folder;
+	GPtrArray *uids;
+	GPtrArray *rules;	/* match expressions, NULL if not pure */
+	gboolean evaluate;
+	gboolean summary;	/* whether the folder has message info */
+	EMailFilterMatcher *matcher;
+	const gchar *store_uid;
+	GCancellable *cancellable;
+	GThreadPool *eval_pool;
+
+	GMutex lock;
+	GCond cond;
+	FilterBatchItem *items;
+};
+
+struct _FilterBatchFetch {
+	FilterBatch *batch;
+	FilterBatchItem *item;
+};
+
+static const gchar *impure_match_functions[] = {
+	"system-flag",
+	"user-flag",
+	"user-tag",
+	"get-score",
+	"pipe-message",
+	"junk-test",
+	"shell"
+};
+
+static gboolean
+filter_match_is_pure (const gchar *match)
+{
+	guint ii;
+
+	for (ii = 0; ii < G_N_ELEMENTS (impure_match_functions); ii++) {
+		if (strstr (match, impure_match_functions[ii]) != NULL)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * mail_filter_driver_add_rule:
+ * @driver: a #CamelFilterDriver
+ * @name: the name of the rule
+ * @match: the match expression of the rule
+ * @action: the action expression of the rule
+ *
+ * Adds a rule to @driver like camel_filter_driver_add_rule() does, and
+ * also remembers its match expression, so that filtering folders can
+ * evaluate it ahead of the driver.
+ **/
+void
+mail_filter_driver_add_rule (CamelFilterDriver *driver,
+                             const gchar *name,
+                             const gchar *match,
+                             const gchar *action)
+{
+	GPtrArray *rules;
+
+	g_return_if_fail (CAMEL_IS_FILTER_DRIVER (driver));
+	g_return_if_fail (match != NULL);
+
+	rules = g_object_get_data (G_OBJECT (driver), FILTER_RULES_KEY);
+	if (rules == NULL) {
+		rules = g_ptr_array_new_with_free_func (g_free);
+		g_object_set_data_full (
+			G_OBJECT (driver), FILTER_RULES_KEY, rules,
+			(GDestroyNotify) g_ptr_array_unref);
+	}
+
+	/* Rules removed by name later on stay in this list.  That
+	 * only sends more messages through the driver than needed. */
+	g_ptr_array_add (
+		rules, filter_match_is_pure (match) ?
+		g_strdup (match) : NULL);
+
+	camel_filter_driver_add_rule (driver, name, match, action);
+}
+
+static CamelMimeMessage *
+filter_batch_get_message (FilterBatchFetch *fetch,
+                          GError **error)
+{
+	FilterBatch *batch = fetch->batch;
+
+	if (fetch->item->message == NULL)
+		fetch->item->message = camel_folder_get_message_sync (
+			batch->folder, fetch->item->uid,
+			batch->cancellable, error);
+
+	return fetch->item->message;
+}
+
+static void
+filter_batch_item_clear (FilterBatch *batch,
+                         FilterBatchItem *item)
+{
+	g_clear_object (&item->message);
+
+	if (item->info == NULL)
+		return;
+
+	if (batch->summary)
+		camel_folder_free_message_info (batch->folder, item->info);
+	else
+		camel_message_info_free (item->info);
+
+	item->info = NULL;
+}
+
+static void
+filter_batch_eval_thread (gpointer data,
+                          gpointer user_data)
+{
+	FilterBatch *batch = user_data;
+	FilterBatchFetch fetch;
+	FilterBatchItem *item;
+	gboolean matched = TRUE;
+	guint index = GPOINTER_TO_UINT (data) - 1;
+	guint ii;
+
+	item = &batch->items[index];
+
+	fetch.batch = batch;
+	fetch.item = item;
+
+	if (batch->summary)
+		item->info = camel_folder_get_message_info (
+			batch->folder, item->uid);
+	else if (item->message != NULL)
+		item->info = camel_message_info_new_from_header (
+			NULL, camel_mime_part_get_raw_headers (
+			CAMEL_MIME_PART (item->message)));
+
+	if (g_cancellable_is_cancelled (batch->cancellable)) {
+		/* The commit stops at the first message anyway. */
+	} else if (batch->evaluate && item->info != NULL) {
+		guint8 *results = NULL;
+
+		matched = FALSE;
+
+		if (e_mail_filter_matcher_has_tests (batch->matcher) &&
+		    filter_batch_get_message (&fetch, NULL) != NULL)
+			results = e_mail_filter_matcher_run_tests (
+				batch->matcher, item->message);
+
+		for (ii = 0; !matched && ii < batch->rules->len; ii++) {
+			if (results != NULL && !e_mail_filter_matcher_may_match (
+				batch->matcher, ii, results))
+				continue;
+
+			/* An unmatched message is
+			 * never read, nor changed. */
+			matched = camel_filter_search_match (
+				batch->session, (CamelFilterSearchGetMessageFunc)
+				filter_batch_get_message, &fetch, item->info,
+				batch->store_uid, batch->folder,
+				batch->rules->pdata[ii], NULL) !=
+				CAMEL_SEARCH_NOMATCH;
+		}
+
+		g_free (results);
+	} else if (batch->summary) {
+		/* Errors are left for the driver to run into. */
+		filter_batch_get_message (&fetch, NULL);
+	}
+
+	g_mutex_lock (&batch->lock);
+	item->matched = matched;
+	item->done = TRUE;
+	g_cond_broadcast (&batch->cond);
+	g_mutex_unlock (&batch->lock);
+}
+
+/* Reads the messages one at a time and in order, for stores which
+ * could not do any better, then leaves them to the evaluation. */
+static void
+filter_batch_read_thread (gpointer data,
+                          gpointer user_data)
+{
+	FilterBatch *batch = user_data;
+	FilterBatchItem *item;
+
+	item = &batch->items[GPOINTER_TO_UINT (data) - 1];
+
+	/* Errors are left for the driver to run into. */
+	if (!g_cancellable_is_cancelled (batch->cancellable))
+		item->message = camel_folder_get_message_sync (
+			batch->folder, item->uid, batch->cancellable, NULL);
+
+	g_thread_pool_push (batch->eval_pool, data, NULL);
+}
+
+static guint
+filter_batch_n_threads (void)
+{
+	guint n_threads;
+
+#if GLIB_CHECK_VERSION(2,36,0)
+	n_threads = g_get_num_processors ();
+#elif defined (G_OS_UNIX) && defined (_SC_NPROCESSORS_ONLN)
+	n_threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+#else
+	n_threads = 1;
+#endif
+
+	return CLAMP (n_threads, 2, FILTER_BATCH_MAX_THREADS);
+}
+
+/* Marks a committed message as filtered. */
+static void
+filter_batch_finish_item (struct _filter_mail_msg *m,
+                          FilterBatch *batch,
+                          FilterBatchItem *item,
+                          guint *n_cached)
+{
+	if (m->delete)
+		camel_folder_set_message_flags (
+			batch->folder, item->uid,
+			CAMEL_MESSAGE_DELETED |
+			CAMEL_MESSAGE_SEEN, ~0);
+
+	if (m->cache != NULL) {
+		camel_uid_cache_save_uid (m->cache, item->uid);
+		if ((++(*n_cached) % 10) == 0)
+			camel_uid_cache_save (m->cache);
+	}
+
+	filter_batch_item_clear (batch, item);
+}
+
+/* Copies the pending messages no rule matched to the default folder,
+ * the way the driver would, but all in one go.  Only the messages
+ * which made it there are marked as filtered. */
+static gboolean
+filter_batch_flush (struct _filter_mail_msg *m,
+                    FilterBatch *batch,
+                    GPtrArray *pending,
+                    guint *n_cached,
+                    GCancellable *cancellable,
+                    GError **error)
+{
+	gboolean success = TRUE;
+	guint n_copied = 0;
+	guint ii;
+
+	if (pending->len == 0)
+		return TRUE;
+
+	if (batch->summary) {
+		GPtrArray *uids;
+
+		uids = g_ptr_array_sized_new (pending->len);
+		for (ii = 0; ii < pending->len; ii++) {
+			FilterBatchItem *item = pending->pdata[ii];
+			g_ptr_array_add (uids, (gpointer) item->uid);
+		}
+
+		success = camel_folder_transfer_messages_to_sync (
+			batch->folder, uids, m->destination,
+			FALSE, NULL, cancellable, error);
+
+		if (success)
+			n_copied = uids->len;
+
+		g_ptr_array_free (uids, TRUE);
+	} else {
+		for (ii = 0; success && ii < pending->len; ii++) {
+			FilterBatchItem *item = pending->pdata[ii];
+
+			success = camel_folder_append_message_sync (
+				m->destination, item->message, item->info,
+				NULL, cancellable, error);
+
+			if (success)
+				n_copied++;
+		}
+	}
+
+	for (ii = 0; ii < pending->len; ii++) {
+		FilterBatchItem *item = pending->pdata[ii];
+
+		if (ii < n_copied)
+			filter_batch_finish_item (m, batch, item, n_cached);
+		else
+			filter_batch_item_clear (batch, item);
+	}
+
+	g_ptr_array_set_size (pending, 0);
+
+	return success;
+}
+
+/* Returns whether the batch ran; if not,
+ * the folder is left to the driver alone. */
+static gboolean
+filter_batch_run (struct _filter_mail_msg *m,
+                  CamelFolder *folder,
+                  GPtrArray *uids,
+                  GCancellable *cancellable,
+                  GError **error)
+{
+	FilterBatch batch;
+	GThreadPool *read_pool = NULL;
+	GPtrArray *pending;
+	CamelStore *parent_store;
+	CamelProvider *provider;
+	GPtrArray *rules;
+	GError *local_error = NULL;
+	guint n_cached = 0;
+	guint ii;
+
+	rules = g_object_get_data (G_OBJECT (m->driver), FILTER_RULES_KEY);
+	if (rules == NULL || uids->len < 2)
+		return FALSE;
+
+	parent_store = camel_folder_get_parent_store (folder);
+	provider = camel_service_get_provider (CAMEL_SERVICE (parent_store));
+
+	if (provider == NULL)
+		return FALSE;
+
+	batch.session = CAMEL_SESSION (m->session);
+	batch.folder = folder;
+	batch.uids = uids;
+	batch.rules = rules;
+	batch.evaluate = TRUE;
+	batch.summary = camel_folder_has_summary_capability (folder);
+	batch.store_uid = camel_service_get_uid (CAMEL_SERVICE (parent_store));
+	batch.cancellable = cancellable;
+	batch.items = g_new0 (FilterBatchItem, uids->len);
+	g_mutex_init (&batch.lock);
+	g_cond_init (&batch.cond);
+
+	batch.matcher = NULL;
+
+	for (ii = 0; ii < uids->len; ii++)
+		batch.items[ii].uid = uids->pdata[ii];
+
+	for (ii = 0; ii < rules->len; ii++) {
+		if (rules->pdata[ii] == NULL)
+			batch.evaluate = FALSE;
+	}
+
+	if (batch.evaluate)
+		batch.matcher = e_mail_filter_matcher_new (rules);
+
+	batch.eval_pool = g_thread_pool_new (
+		filter_batch_eval_thread, &batch,
+		filter_batch_n_threads (), FALSE, NULL);
+
+	/* Remote stores without an offline cache, like POP3, download
+	 * each message anew, and mostly one at a time anyway. */
+	if (!batch.summary ||
+	    ((provider->flags & CAMEL_PROVIDER_IS_LOCAL) == 0 &&
+	     !CAMEL_IS_OFFLINE_STORE (parent_store)))
+		read_pool = g_thread_pool_new (
+			filter_batch_read_thread, &batch, 1, FALSE, NULL);
+
+	for (ii = 0; ii < uids->len && ii < FILTER_BATCH_WINDOW; ii++)
+		g_thread_pool_push (
+			read_pool != NULL ? read_pool : batch.eval_pool,
+			GUINT_TO_POINTER (ii + 1), NULL);
+
+	pending = g_ptr_array_sized_new (FILTER_BATCH_WINDOW);
+
+	for (ii = 0; ii < uids->len; ii++) {
+		FilterBatchItem *item = &batch.items[ii];
+
+		camel_operation_progress (cancellable, ii * 100 / uids->len);
+
+		g_mutex_lock (&batch.lock);
+		while (!item->done)
+			g_cond_wait (&batch.cond, &batch.lock);
+		g_mutex_unlock (&batch.lock);
+
+		if (ii + FILTER_BATCH_WINDOW < uids->len)
+			g_thread_pool_push (
+				read_pool != NULL ? read_pool : batch.eval_pool,
+				GUINT_TO_POINTER (ii + FILTER_BATCH_WINDOW + 1),
+				NULL);
+
+		if (g_cancellable_set_error_if_cancelled (
+			cancellable, &local_error))
+			break;
+
+		if (item->matched) {
+			gint status;
+
+			/* Keep the default folder in order. */
+			if (!filter_batch_flush (
+				m, &batch, pending, &n_cached,
+				cancellable, &local_error))
+				break;
+
+			status = camel_filter_driver_filter_message (
+				m->driver, item->message,
+				batch.summary ? item->info : NULL, item->uid,
+				folder, batch.store_uid, batch.store_uid,
+				cancellable, &local_error);
+
+			if (local_error != NULL || status == -1)
+				break;
+
+			filter_batch_finish_item (m, &batch, item, &n_cached);
+
+		} else if (m->destination != NULL) {
+			g_ptr_array_add (pending, item);
+
+			if (pending->len >= FILTER_BATCH_WINDOW &&
+			    !filter_batch_flush (
+				m, &batch, pending, &n_cached,
+				cancellable, &local_error))
+				break;
+
+		} else {
+			filter_batch_finish_item (m, &batch, item, &n_cached);
+		}
+	}
+
+	if (local_error == NULL)
+		filter_batch_flush (
+			m, &batch, pending, &n_cached,
+			cancellable, &local_error);
+
+	/* Drops what was not started and waits for the rest; the
+	 * readers go first since they feed the evaluation. */
+	if (read_pool != NULL)
+		g_thread_pool_free (read_pool, TRUE, TRUE);
+	g_thread_pool_free (batch.eval_pool, TRUE, TRUE);
+
+	for (ii = 0; ii < uids->len; ii++)
+		filter_batch_item_clear (&batch, &batch.items[ii]);
+
+	g_ptr_array_free (pending, TRUE);
+
+	if (m->cache != NULL)
+		camel_uid_cache_save (m->cache);
+
+	if (m->destination != NULL && local_error == NULL)
+		camel_folder_synchronize_sync (
+			m->destination, FALSE, cancellable, NULL);
+
+	e_mail_filter_matcher_free (batch.matcher);
+
+	g_free (batch.items);
+	g_mutex_clear (&batch.lock);
+	g_cond_clear (&batch.cond);
+
+	if (local_error != NULL)
+		g_propagate_error (error, local_error);
+
+	return TRUE;
+}
+
 /* filter a folder, or a subset thereof, uses source_folder/source_uids */
 /* this is shared with fetch_mail */
 static gboolean
@@ -123,9 +640,12 @@ em_filter_folder_element_exec (struct _filter_mail_msg *m,
 	else
 		folder_uids = uids = camel_folder_get_uids (folder);
 
-	success = camel_filter_driver_filter_folder (
-		m->driver, folder, m->cache, uids, m->delete,
-		cancellable, &local_error) == 0;
+	if (filter_batch_run (m, folder, uids, cancellable, &local_error))
+		success = (local_error == NULL);
+	else
+		success = camel_filter_driver_filter_folder (
+			m->driver, folder, m->cache, uids, m->delete,
+			cancellable, &local_error) == 0;
 	camel_filter_driver_flush (m->driver, &local_error);
 
 	if (folder_uids)
@@ -209,6 +729,8 @@ mail_filter_folder (EMailSession *session,
 	m->source_uids = g_ptr_array_ref (uids);
 	m->cache = NULL;
 	m->delete = FALSE;
+	mail_msg_set_service (
+		m, CAMEL_SERVICE (camel_folder_get_parent_store (source_folder)));
 
 	m->driver = camel_session_get_filter_driver (
 		CAMEL_SESSION (session), type, NULL);
@@ -526,6 +1048,7 @@ mail_fetch_mail (CamelStore *store,
 	fm->session = g_object_ref (session);
 	m->store = g_object_ref (store);
 	fm->cache = NULL;
+	mail_msg_set_service (m, CAMEL_SERVICE (store));
 	if (cancellable)
 		m->cancellable = g_object_ref (cancellable);
 	m->done = done;
@@ -1074,6 +1597,7 @@ mail_send_queue (EMailSession *session,
 	m->session = g_object_ref (session);
 	m->queue = g_object_ref (queue);
 	m->transport = g_object_ref (transport);
+	mail_msg_set_service (m, CAMEL_SERVICE (transport));
 	if (G_IS_CANCELLABLE (cancellable))
 		m->base.cancellable = g_object_ref (cancellable);
 	m->status = status;
@@ -1206,6 +1730,8 @@ mail_transfer_messages (EMailSession *session,
 	m->source = g_object_ref (source);
 	m->uids = g_ptr_array_ref (uids);
 	m->delete = delete_from_source;
+	mail_msg_set_service (
+		m, CAMEL_SERVICE (camel_folder_get_parent_store (source)));
 	m->dest_uri = g_strdup (dest_uri);
 	m->dest_flags = dest_flags;
 	m->done = done;
@@ -1328,6 +1854,8 @@ mail_sync_folder (CamelFolder *folder,
 	m = mail_msg_new (&sync_folder_info);
 	m->folder = g_object_ref (folder);
 	m->test_for_expunge = test_for_expunge;
+	mail_msg_set_service (
+		m, CAMEL_SERVICE (camel_folder_get_parent_store (folder)));
 	m->data = data;
 	m->done = done;
 
@@ -1408,6 +1936,7 @@ mail_sync_store (CamelStore *store,
 	m = mail_msg_new (&sync_store_info);
 	m->store = g_object_ref (store);
 	m->expunge = expunge;
+	mail_msg_set_service (m, CAMEL_SERVICE (store));
 	m->data = data;
 	m->done = done;
 
@@ -1486,6 +2015,7 @@ mail_empty_trash (CamelStore *store)
 
 	m = mail_msg_new (&empty_trash_info);
 	m->store = g_object_ref (store);
+	mail_msg_set_service (m, CAMEL_SERVICE (store));
 
 	mail_msg_slow_ordered_push (m);
 }
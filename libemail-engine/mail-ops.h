@@ -95,6 +95,11 @@ void		mail_filter_folder		(EMailSession *session,
 						 const gchar *type,
 						 gboolean notify);
 
+void		mail_filter_driver_add_rule	(CamelFilterDriver *driver,
+						 const gchar *name,
+						 const gchar *match,
+						 const gchar *action);
+
 /* filter driver execute shell command async callback */
 void mail_execute_shell_command (CamelFilterDriver *driver, gint argc, gchar **argv, gpointer data);
 
@@ -137,6 +137,56 @@ vfolder_get_include_subfolders_uris (EMailSession *session,
 	return g_list_reverse (uris);
 }
 
+/* What the search folder was last set up with: the expression and the
+ * source URIs whose folders were actually added to it.  A rule change
+ * which leaves the expression alone then only has to add and remove
+ * the sources that changed instead of rebuilding the whole search
+ * folder.  The difference is worked out when the setup job runs, so
+ * it is always taken against what the earlier jobs really did.  A
+ * setup which did not finish drops what was recorded, and the next
+ * one rebuilds everything.  Sources added or removed on their own, as
+ * folders come and go, are recorded as well.  Protected by the vfolder
+ * lock. */
+#define VFOLDER_SETUP_STATE_KEY "mail-vfolder-setup-state"
+
+typedef struct _VFolderSetupState VFolderSetupState;
+
+struct _VFolderSetupState {
+	gchar *query;
+	GHashTable *sources_uri;	/* NULL if nothing is recorded */
+	guint n_pending;		/* setup jobs not finished yet */
+};
+
+static GHashTable *
+vfolder_setup_new_uri_set (void)
+{
+	return g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+}
+
+static void
+vfolder_setup_state_forget (VFolderSetupState *state)
+{
+	g_free (state->query);
+	state->query = NULL;
+
+	if (state->sources_uri != NULL) {
+		g_hash_table_destroy (state->sources_uri);
+		state->sources_uri = NULL;
+	}
+}
+
+static void
+vfolder_setup_state_free (VFolderSetupState *state)
+{
+	vfolder_setup_state_forget (state);
+
+	g_slice_free (VFolderSetupState, state);
+}
+
 struct _setup_msg {
 	MailMsg base;
 
@@ -154,20 +204,21 @@ vfolder_setup_desc (struct _setup_msg *m)
 		camel_folder_get_full_name (m->folder));
 }
 
-static void
-vfolder_setup_exec (struct _setup_msg *m,
-                    GCancellable *cancellable,
-                    GError **error)
+/* Adds the URIs whose folders could all be opened to resolved. */
+static GList *
+vfolder_setup_get_folders (struct _setup_msg *m,
+                           GList *sources_uri,
+                           GHashTable *resolved,
+                           GCancellable *cancellable)
 {
 	GList *l, *list = NULL;
 	CamelFolder *folder;
 
-	camel_vee_folder_set_expression ((CamelVeeFolder *) m->folder, m->query);
-
-	for (l = m->sources_uri;
+	for (l = sources_uri;
 	     l && !vfolder_shutdown && !g_cancellable_is_cancelled (cancellable);
 	     l = l->next) {
 		const gchar *uri = l->data;
+		gboolean complete = TRUE;
 
 		d (printf (" Adding uri: %s\n", uri));
 
@@ -179,6 +230,9 @@ vfolder_setup_exec (struct _setup_msg *m,
 			GList *uris, *iter;
 
 			uris = vfolder_get_include_subfolders_uris (m->session, uri, cancellable);
+			if (uris == NULL)
+				complete = FALSE;
+
 			for (iter = uris; iter; iter = iter->next) {
 				const gchar *fi_uri = iter->data;
 
@@ -186,6 +240,8 @@ vfolder_setup_exec (struct _setup_msg *m,
 					m->session, fi_uri, 0, cancellable, NULL);
 				if (folder != NULL)
 					list = g_list_append (list, folder);
+				else
+					complete = FALSE;
 			}
 
 			g_list_free_full (uris, g_free);
@@ -193,13 +249,122 @@ vfolder_setup_exec (struct _setup_msg *m,
 			folder = e_mail_session_uri_to_folder_sync (m->session, l->data, 0, cancellable, NULL);
 			if (folder != NULL)
 				list = g_list_append (list, folder);
+			else
+				complete = FALSE;
+		}
+
+		if (complete)
+			g_hash_table_add (resolved, g_strdup (uri));
+	}
+
+	return list;
+}
+
+static void
+vfolder_setup_exec (struct _setup_msg *m,
+                    GCancellable *cancellable,
+                    GError **error)
+{
+	VFolderSetupState *state;
+	GHashTable *resolved, *resolved_removed;
+	GHashTableIter iter;
+	GList *l, *list, *removed = NULL;
+	GList *added_uri = NULL, *removed_uri = NULL;
+	gboolean incremental = FALSE;
+	gboolean cancelled;
+	gpointer key;
+
+	resolved = vfolder_setup_new_uri_set ();
+	resolved_removed = vfolder_setup_new_uri_set ();
+
+	G_LOCK (vfolder);
+
+	state = g_object_get_data (G_OBJECT (m->folder), VFOLDER_SETUP_STATE_KEY);
+
+	if (state->sources_uri != NULL && g_strcmp0 (state->query, m->query) == 0) {
+		GHashTable *wanted;
+
+		incremental = TRUE;
+		wanted = vfolder_setup_new_uri_set ();
+
+		for (l = m->sources_uri; l != NULL; l = g_list_next (l)) {
+			g_hash_table_add (wanted, g_strdup (l->data));
+			if (!g_hash_table_contains (state->sources_uri, l->data))
+				added_uri = g_list_prepend (added_uri, g_strdup (l->data));
 		}
+
+		g_hash_table_iter_init (&iter, state->sources_uri);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			if (!g_hash_table_contains (wanted, key))
+				removed_uri = g_list_prepend (removed_uri, g_strdup (key));
+		}
+
+		g_hash_table_destroy (wanted);
+	}
+
+	G_UNLOCK (vfolder);
+
+	if (!incremental) {
+		camel_vee_folder_set_expression ((CamelVeeFolder *) m->folder, m->query);
+		list = vfolder_setup_get_folders (m, m->sources_uri, resolved, cancellable);
+	} else {
+		added_uri = g_list_reverse (added_uri);
+		removed = vfolder_setup_get_folders (m, removed_uri, resolved_removed, cancellable);
+		list = vfolder_setup_get_folders (m, added_uri, resolved, cancellable);
 	}
 
-	if (!vfolder_shutdown && !g_cancellable_is_cancelled (cancellable))
+	cancelled = vfolder_shutdown || g_cancellable_is_cancelled (cancellable);
+
+	if (cancelled) {
+		/* Not set up as wanted, see below. */
+	} else if (!incremental) {
 		camel_vee_folder_set_folders ((CamelVeeFolder *) m->folder, list, cancellable);
+	} else {
+		for (l = removed; l != NULL; l = g_list_next (l))
+			camel_vee_folder_remove_folder (
+				CAMEL_VEE_FOLDER (m->folder),
+				l->data, cancellable);
+
+		for (l = list; l != NULL; l = g_list_next (l))
+			camel_vee_folder_add_folder (
+				CAMEL_VEE_FOLDER (m->folder),
+				l->data, cancellable);
+	}
+
+	G_LOCK (vfolder);
+
+	if (cancelled) {
+		/* Start over with the next setup. */
+		vfolder_setup_state_forget (state);
+	} else if (!incremental) {
+		vfolder_setup_state_forget (state);
+		state->query = g_strdup (m->query);
+		state->sources_uri = resolved;
+		resolved = NULL;
+	} else {
+		/* Sources which could not be opened stay recorded as
+		 * they were, so the next setup tries them again. */
+		g_hash_table_iter_init (&iter, resolved_removed);
+		while (g_hash_table_iter_next (&iter, &key, NULL))
+			g_hash_table_remove (state->sources_uri, key);
+
+		g_hash_table_iter_init (&iter, resolved);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			g_hash_table_iter_steal (&iter);
+			g_hash_table_add (state->sources_uri, key);
+		}
+	}
 
+	G_UNLOCK (vfolder);
+
+	if (resolved != NULL)
+		g_hash_table_destroy (resolved);
+	g_hash_table_destroy (resolved_removed);
+
+	g_list_free_full (added_uri, g_free);
+	g_list_free_full (removed_uri, g_free);
 	g_list_free_full (list, g_object_unref);
+	g_list_free_full (removed, g_object_unref);
 }
 
 static void
@@ -210,6 +375,13 @@ vfolder_setup_done (struct _setup_msg *m)
 static void
 vfolder_setup_free (struct _setup_msg *m)
 {
+	VFolderSetupState *state;
+
+	G_LOCK (vfolder);
+	state = g_object_get_data (G_OBJECT (m->folder), VFOLDER_SETUP_STATE_KEY);
+	state->n_pending--;
+	G_UNLOCK (vfolder);
+
 	camel_folder_thaw (m->folder);
 
 	g_object_unref (m->session);
@@ -234,8 +406,44 @@ vfolder_setup (CamelSession *session,
                GList *sources_uri)
 {
 	struct _setup_msg *m;
+	VFolderSetupState *state;
+	gboolean unchanged = FALSE;
+	GList *link;
 	gint id;
 
+	G_LOCK (vfolder);
+
+	state = g_object_get_data (G_OBJECT (folder), VFOLDER_SETUP_STATE_KEY);
+
+	if (state == NULL) {
+		state = g_slice_new0 (VFolderSetupState);
+
+		g_object_set_data_full (
+			G_OBJECT (folder), VFOLDER_SETUP_STATE_KEY, state,
+			(GDestroyNotify) vfolder_setup_state_free);
+	}
+
+	/* Nothing changed that would affect the matches, and
+	 * no setup is under way which could still change that. */
+	if (state->n_pending == 0 && state->sources_uri != NULL &&
+	    g_strcmp0 (state->query, query) == 0 &&
+	    g_hash_table_size (state->sources_uri) == g_list_length (sources_uri)) {
+		unchanged = TRUE;
+
+		for (link = sources_uri; unchanged && link != NULL; link = g_list_next (link))
+			unchanged = g_hash_table_contains (state->sources_uri, link->data);
+	}
+
+	if (!unchanged)
+		state->n_pending++;
+
+	G_UNLOCK (vfolder);
+
+	if (unchanged) {
+		g_list_free_full (sources_uri, g_free);
+		return 0;
+	}
+
 	m = mail_msg_new (&vfolder_setup_info);
 	m->session = g_object_ref (session);
 	m->folder = g_object_ref (folder);
@@ -312,6 +520,68 @@ vfolder_adduri_desc (struct _adduri_msg *m)
 	return description;
 }
 
+static gboolean
+vfolder_source_uri_equal (EMailSession *session,
+                          const gchar *uri_a,
+                          const gchar *uri_b)
+{
+	if (g_str_equal (uri_a, uri_b))
+		return TRUE;
+
+	/* Both with subfolders, or neither. */
+	if ((*uri_a == '*') != (*uri_b == '*'))
+		return FALSE;
+
+	if (*uri_a == '*') {
+		uri_a++;
+		uri_b++;
+	}
+
+	return e_mail_folder_uri_equal (CAMEL_SESSION (session), uri_a, uri_b);
+}
+
+/* Updates what vfolder_setup() recorded for each search folder, so a
+ * removed source is not taken as still there, and an added one not as
+ * missing.  A source is only recorded once all its folders were added,
+ * like the setup does it. */
+static void
+vfolder_adduri_record (struct _adduri_msg *m,
+                       gboolean added)
+{
+	GList *link;
+
+	G_LOCK (vfolder);
+
+	for (link = m->folders; link != NULL; link = g_list_next (link)) {
+		VFolderSetupState *state;
+		GHashTableIter iter;
+		gpointer key;
+		gboolean recorded = FALSE;
+
+		state = g_object_get_data (
+			G_OBJECT (link->data), VFOLDER_SETUP_STATE_KEY);
+
+		if (state == NULL || state->sources_uri == NULL)
+			continue;
+
+		g_hash_table_iter_init (&iter, state->sources_uri);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			if (!vfolder_source_uri_equal (m->session, key, m->uri))
+				continue;
+
+			if (added)
+				recorded = TRUE;
+			else
+				g_hash_table_iter_remove (&iter);
+		}
+
+		if (added && !recorded)
+			g_hash_table_add (state->sources_uri, g_strdup (m->uri));
+	}
+
+	G_UNLOCK (vfolder);
+}
+
 static void
 vfolder_adduri_exec (struct _adduri_msg *m,
                      GCancellable *cancellable,
@@ -319,6 +589,7 @@ vfolder_adduri_exec (struct _adduri_msg *m,
 {
 	CamelFolder *folder = NULL;
 	gboolean cache_has_info;
+	gboolean complete = TRUE;
 
 	if (vfolder_shutdown)
 		return;
@@ -337,6 +608,9 @@ vfolder_adduri_exec (struct _adduri_msg *m,
 		GList *uris, *iter;
 
 		uris = vfolder_get_include_subfolders_uris (m->session, m->uri, cancellable);
+		if (uris == NULL)
+			complete = FALSE;
+
 		for (iter = uris; iter; iter = iter->next) {
 			const gchar *fi_uri = iter->data;
 
@@ -345,6 +619,8 @@ vfolder_adduri_exec (struct _adduri_msg *m,
 			if (folder != NULL) {
 				vfolder_add_remove_one (m->folders, m->remove, folder, cancellable);
 				g_object_unref (folder);
+			} else {
+				complete = FALSE;
 			}
 		}
 
@@ -358,8 +634,17 @@ vfolder_adduri_exec (struct _adduri_msg *m,
 		if (folder != NULL) {
 			vfolder_add_remove_one (m->folders, m->remove, folder, cancellable);
 			g_object_unref (folder);
+		} else {
+			complete = FALSE;
 		}
 	}
+
+	if (vfolder_shutdown || g_cancellable_is_cancelled (cancellable))
+		complete = FALSE;
+
+	/* A removed source is gone from the record
+	 * even if its folders could not be opened. */
+	vfolder_adduri_record (m, complete && !m->remove);
 }
 
 static void
@@ -0,0 +1,140 @@
+/*
+ * test-mail-filter-matcher.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Runs the shared header tests of a few filter rules on a message and
+ * checks that a rule is only ruled out where Camel's own header tests
+ * could not match either.  Empty header names and empty patterns, the
+ * defaults of new rules in the filter editor, get particular care. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <camel/camel.h>
+
+#include "e-mail-filter-matcher.h"
+
+#define TEST_MESSAGE \
+	"From: Alice Example <alice@example.com>\r\n" \
+	"To: bob@example.org\r\n" \
+	"Subject: Quarterly report\r\n" \
+	"X-Mailing-List: reports\r\n" \
+	"Content-Type: text/plain; charset=us-ascii\r\n" \
+	"\r\n" \
+	"Numbers.\r\n"
+
+typedef struct {
+	const gchar *rule;
+	gboolean may_match;
+} TestRule;
+
+static const TestRule test_rules[] = {
+	{ "(match-all (header-contains \"subject\" \"report\"))", TRUE },
+	{ "(match-all (header-contains \"Subject\" \"REPORT\"))", TRUE },
+	{ "(match-all (header-contains \"subject\" \"invoice\"))", FALSE },
+	{ "(match-all (header-contains \"from\" \"alice@example.com\"))", TRUE },
+	{ "(match-all (header-contains \"x-unknown\" \"report\"))", FALSE },
+
+	/* An empty pattern matches whatever the header holds,
+	 * even when the message lacks the header. */
+	{ "(match-all (header-contains \"subject\" \"\"))", TRUE },
+	{ "(match-all (header-contains \"x-unknown\" \"\"))", TRUE },
+	{ "(match-all (header-contains \"subject\" \"invoice\" \"\"))", TRUE },
+	{ "(match-all (header-starts-with \"to\" \"\"))", TRUE },
+
+	/* An empty header name matches against every header. */
+	{ "(match-all (header-contains \"\" \"reports\"))", TRUE },
+	{ "(match-all (header-contains \"\" \"invoice\"))", TRUE },
+	{ "(match-all (header-ends-with \"\" \"\"))", TRUE },
+
+	/* The and/or structure is still honoured around them. */
+	{ "(match-all (and (header-contains \"\" \"x\") "
+	  "(header-contains \"subject\" \"invoice\")))", FALSE },
+	{ "(match-all (or (header-contains \"subject\" \"invoice\") "
+	  "(header-contains \"x-unknown\" \"\")))", TRUE }
+};
+
+static guint n_failures;
+
+static CamelMimeMessage *
+test_message_new (void)
+{
+	CamelMimeMessage *message;
+	CamelStream *stream;
+
+	stream = camel_stream_mem_new_with_buffer (
+		TEST_MESSAGE, strlen (TEST_MESSAGE));
+
+	message = camel_mime_message_new ();
+
+	if (!camel_data_wrapper_construct_from_stream_sync (
+		CAMEL_DATA_WRAPPER (message), stream, NULL, NULL)) {
+		g_printerr ("Failed to construct the test message\n");
+		exit (EXIT_FAILURE);
+	}
+
+	g_object_unref (stream);
+
+	return message;
+}
+
+gint
+main (gint argc,
+      gchar **argv)
+{
+	EMailFilterMatcher *matcher;
+	CamelMimeMessage *message;
+	GPtrArray *rules;
+	guint8 *results;
+	guint ii;
+
+	g_type_init ();
+
+	rules = g_ptr_array_new ();
+	for (ii = 0; ii < G_N_ELEMENTS (test_rules); ii++)
+		g_ptr_array_add (rules, (gpointer) test_rules[ii].rule);
+
+	matcher = e_mail_filter_matcher_new (rules);
+	message = test_message_new ();
+
+	results = e_mail_filter_matcher_run_tests (matcher, message);
+
+	for (ii = 0; ii < G_N_ELEMENTS (test_rules); ii++) {
+		gboolean may_match;
+
+		may_match = e_mail_filter_matcher_may_match (
+			matcher, ii, results);
+
+		if (may_match != test_rules[ii].may_match) {
+			g_printerr (
+				"FAILED: %s %s\n", test_rules[ii].rule,
+				may_match ? "may match" : "was ruled out");
+			n_failures++;
+		}
+	}
+
+	g_free (results);
+	g_object_unref (message);
+	e_mail_filter_matcher_free (matcher);
+	g_ptr_array_free (rules, TRUE);
+
+	if (n_failures > 0) {
+		g_printerr ("%u check(s) failed!\n", n_failures);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -2267,12 +2267,44 @@ gnome_canvas_size_allocate (GtkWidget *widget,
 	g_object_thaw_notify (G_OBJECT (vadjustment));
 }
 
+/* Paints one exposed rectangle, given in window coordinates. */
+static void
+gnome_canvas_draw_rect (GnomeCanvas *canvas,
+                        cairo_t *cr,
+                        gint x,
+                        gint y,
+                        gint width,
+                        gint height,
+                        gdouble hadjustment_value,
+                        gdouble vadjustment_value)
+{
+	cairo_save (cr);
+	cairo_translate (
+		cr,
+		-canvas->zoom_xofs + x,
+		-canvas->zoom_yofs + y);
+
+	x += hadjustment_value;
+	y += vadjustment_value;
+
+	gnome_canvas_paint_rect (
+		canvas, cr,
+		x, y,
+		x + width,
+		y + height);
+	cairo_restore (cr);
+}
+
+/* Above this many damaged rectangles, painting their bounding box is cheaper. */
+#define MAX_DRAW_RECTANGLES 16
+
 static gboolean
 gnome_canvas_draw (GtkWidget *widget,
                    cairo_t *cr)
 {
 	GnomeCanvas *canvas = GNOME_CANVAS (widget);
 	cairo_rectangle_int_t rect;
+	cairo_rectangle_list_t *rects;
 	GtkLayout *layout;
 	GtkAdjustment *hadjustment;
 	GtkAdjustment *vadjustment;
@@ -2299,22 +2331,40 @@ gnome_canvas_draw (GtkWidget *widget,
 		canvas->need_update = FALSE;
 	}
 
-	cairo_save (cr);
-	cairo_translate (
-		cr,
-		-canvas->zoom_xofs + rect.x,
-		-canvas->zoom_yofs + rect.y);
+	/* No pending updates, draw exposed area immediately.  When the
+	 * damage is a few separate pieces (say a changed row and the strip
+	 * uncovered by scrolling) paint only those, not their union. */
+	rects = cairo_copy_clip_rectangle_list (cr);
 
-	rect.x += hadjustment_value;
-	rect.y += vadjustment_value;
+	if (rects->status == CAIRO_STATUS_SUCCESS &&
+	    rects->num_rectangles > 1 &&
+	    rects->num_rectangles <= MAX_DRAW_RECTANGLES) {
+		gint ii;
 
-	/* No pending updates, draw exposed area immediately */
-	gnome_canvas_paint_rect (
-		canvas, cr,
-		rect.x, rect.y,
-		rect.x + rect.width,
-		rect.y + rect.height);
-	cairo_restore (cr);
+		for (ii = 0; ii < rects->num_rectangles; ii++) {
+			cairo_rectangle_t *r = &rects->rectangles[ii];
+			gint x1, y1, x2, y2;
+
+			x1 = floor (r->x);
+			y1 = floor (r->y);
+			x2 = ceil (r->x + r->width);
+			y2 = ceil (r->y + r->height);
+
+			cairo_save (cr);
+			cairo_rectangle (cr, x1, y1, x2 - x1, y2 - y1);
+			cairo_clip (cr);
+			gnome_canvas_draw_rect (
+				canvas, cr, x1, y1, x2 - x1, y2 - y1,
+				hadjustment_value, vadjustment_value);
+			cairo_restore (cr);
+		}
+	} else {
+		gnome_canvas_draw_rect (
+			canvas, cr, rect.x, rect.y, rect.width, rect.height,
+			hadjustment_value, vadjustment_value);
+	}
+
+	cairo_rectangle_list_destroy (rects);
 
 	/* And call expose on parent container class */
 	GTK_WIDGET_CLASS (gnome_canvas_parent_class)->draw (widget, cr);
@@ -0,0 +1,850 @@
+/*
+ * e-http-cache.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Cache of remote resources referenced by messages, shared by all
+ * requests.  It keeps one CamelDataCache, one SoupSession per proxy
+ * and in-memory metadata of the cached resources, and merges fetches
+ * of the same URI.  It only needs Camel and libsoup, so it can be
+ * tested against a local SoupServer. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "e-http-cache.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <camel/camel.h>
+
+#define d(x)
+
+typedef struct _HTTPCacheEntry HTTPCacheEntry;
+typedef struct _HTTPFetch HTTPFetch;
+typedef struct _HTTPSeedFile HTTPSeedFile;
+
+/* What we know about a cached resource without touching the disk. */
+struct _HTTPCacheEntry {
+	gchar *uri_md5;
+	gchar *content_type;	/* NULL if cached by an earlier session */
+	gsize size;
+};
+
+/* A fetch in progress, shared by all requests for the same URI. */
+struct _HTTPFetch {
+	volatile gint ref_count;
+	gboolean done;
+	GBytes *body;
+	gchar *content_type;
+};
+
+/* A resource cached by an earlier session. */
+struct _HTTPSeedFile {
+	gchar *uri_md5;
+	gsize size;
+	time_t mtime;
+};
+
+/* The cache entries are kept in LRU order, most recent first; the
+ * hash table maps an URI hash to its link.  Everything is protected
+ * by http_lock. */
+static GMutex http_lock;
+static GCond http_cond;
+static CamelDataCache *http_data_cache;
+static gsize http_max_size;
+static GHashTable *http_sessions;	/* proxy URI -> SoupSession */
+static GHashTable *http_entries;	/* URI MD5 -> GList link */
+static GQueue http_lru = G_QUEUE_INIT;
+static gsize http_cache_size;
+static GHashTable *http_fetches;	/* URI MD5 -> HTTPFetch */
+
+static void
+redirect_handler (SoupMessage *msg,
+                  gpointer user_data)
+{
+	if (SOUP_STATUS_IS_REDIRECTION (msg->status_code)) {
+		SoupSession *soup_session = user_data;
+		SoupURI *new_uri;
+		const gchar *new_loc;
+
+		new_loc = soup_message_headers_get_list (msg->response_headers, "Location");
+		if (!new_loc)
+			return;
+
+		new_uri = soup_uri_new_with_base (soup_message_get_uri (msg), new_loc);
+		if (!new_uri) {
+			soup_message_set_status_full (
+				msg,
+				SOUP_STATUS_MALFORMED,
+				"Invalid Redirect URL");
+			return;
+		}
+
+		soup_message_set_uri (msg, new_uri);
+		soup_session_requeue_message (soup_session, msg);
+
+		soup_uri_free (new_uri);
+	}
+}
+
+static void
+send_and_handle_redirection (SoupSession *session,
+                             SoupMessage *message)
+{
+	g_return_if_fail (message != NULL);
+
+	soup_message_set_flags (message, SOUP_MESSAGE_NO_REDIRECT);
+	soup_message_add_header_handler (
+		message, "got_body", "Location",
+		G_CALLBACK (redirect_handler), session);
+	soup_session_send_message (session, message);
+}
+
+/* Use MD5 hash of the URI as a filename of the resource cache file.
+ * We were previously using the URI as a filename but the URI is
+ * sometimes too long for a filename. */
+static gchar *
+http_cache_hash_uri (const gchar *uri)
+{
+	return g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+}
+
+static gboolean
+http_cache_is_uri_hash (const gchar *name)
+{
+	gint ii;
+
+	for (ii = 0; name[ii] != '\0'; ii++) {
+		if (!g_ascii_isxdigit (name[ii]))
+			return FALSE;
+	}
+
+	return (ii == 32);
+}
+
+static void
+http_cache_entry_free (HTTPCacheEntry *entry)
+{
+	g_free (entry->uri_md5);
+	g_free (entry->content_type);
+
+	g_slice_free (HTTPCacheEntry, entry);
+}
+
+/* Call with http_lock held. */
+static void
+http_cache_remove_link (GList *link,
+                        gboolean remove_file)
+{
+	HTTPCacheEntry *entry = link->data;
+
+	if (remove_file && http_data_cache != NULL)
+		camel_data_cache_remove (
+			http_data_cache, "http", entry->uri_md5, NULL);
+
+	g_hash_table_remove (http_entries, entry->uri_md5);
+	g_queue_delete_link (&http_lru, link);
+	http_cache_size -= entry->size;
+
+	http_cache_entry_free (entry);
+}
+
+/* Call with http_lock held.  Never evicts the most recent entry. */
+static void
+http_cache_evict (void)
+{
+	while (http_cache_size > http_max_size && http_lru.tail != http_lru.head)
+		http_cache_remove_link (http_lru.tail, TRUE);
+}
+
+/* Call with http_lock held. */
+static void
+http_cache_touch (const gchar *uri_md5,
+                  const gchar *content_type,
+                  gsize size)
+{
+	HTTPCacheEntry *entry;
+	GList *link;
+
+	link = g_hash_table_lookup (http_entries, uri_md5);
+	if (link != NULL)
+		http_cache_remove_link (link, FALSE);
+
+	entry = g_slice_new0 (HTTPCacheEntry);
+	entry->uri_md5 = g_strdup (uri_md5);
+	entry->content_type = g_strdup (content_type);
+	entry->size = size;
+
+	g_queue_push_head (&http_lru, entry);
+	g_hash_table_insert (http_entries, entry->uri_md5, http_lru.head);
+	http_cache_size += size;
+
+	http_cache_evict ();
+}
+
+static gint
+http_seed_file_compare (gconstpointer a,
+                        gconstpointer b)
+{
+	const HTTPSeedFile *file_a = *((HTTPSeedFile **) a);
+	const HTTPSeedFile *file_b = *((HTTPSeedFile **) b);
+
+	/* Most recently modified first. */
+	if (file_a->mtime > file_b->mtime)
+		return -1;
+	if (file_a->mtime < file_b->mtime)
+		return 1;
+
+	return 0;
+}
+
+static void
+http_seed_file_free (HTTPSeedFile *file)
+{
+	g_free (file->uri_md5);
+
+	g_slice_free (HTTPSeedFile, file);
+}
+
+static void
+http_cache_scan_bucket (const gchar *bucket_path,
+                        GPtrArray *files)
+{
+	GDir *dir;
+	const gchar *name;
+
+	dir = g_dir_open (bucket_path, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		HTTPSeedFile *file;
+		GStatBuf st;
+		gchar *path;
+
+		if (!http_cache_is_uri_hash (name))
+			continue;
+
+		path = g_build_filename (bucket_path, name, NULL);
+
+		if (g_stat (path, &st) == 0 && S_ISREG (st.st_mode)) {
+			file = g_slice_new0 (HTTPSeedFile);
+			file->uri_md5 = g_strdup (name);
+			file->size = st.st_size;
+			file->mtime = st.st_mtime;
+			g_ptr_array_add (files, file);
+		}
+
+		g_free (path);
+	}
+
+	g_dir_close (dir);
+}
+
+/* Resources cached by earlier sessions count against the size limit
+ * too, so the cache doesn't grow by the limit every session.  They
+ * go behind the ones used in this session, oldest last, and are the
+ * first ones evicted. */
+static gpointer
+http_cache_seed_thread (gpointer user_data)
+{
+	gchar *http_dir = user_data;
+	GPtrArray *files;
+	GDir *dir;
+	const gchar *name;
+	guint ii;
+
+	files = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) http_seed_file_free);
+
+	dir = g_dir_open (http_dir, 0, NULL);
+
+	while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+		gchar *bucket_path;
+
+		bucket_path = g_build_filename (http_dir, name, NULL);
+		http_cache_scan_bucket (bucket_path, files);
+		g_free (bucket_path);
+	}
+
+	if (dir != NULL)
+		g_dir_close (dir);
+
+	g_ptr_array_sort (files, http_seed_file_compare);
+
+	g_mutex_lock (&http_lock);
+
+	for (ii = 0; ii < files->len; ii++) {
+		HTTPSeedFile *file = files->pdata[ii];
+		HTTPCacheEntry *entry;
+
+		if (g_hash_table_contains (http_entries, file->uri_md5))
+			continue;
+
+		entry = g_slice_new0 (HTTPCacheEntry);
+		entry->uri_md5 = g_strdup (file->uri_md5);
+		entry->size = file->size;
+
+		g_queue_push_tail (&http_lru, entry);
+		g_hash_table_insert (http_entries, entry->uri_md5, http_lru.tail);
+		http_cache_size += entry->size;
+	}
+
+	http_cache_evict ();
+
+	d (printf (
+		"%s: %u files, %" G_GSIZE_FORMAT " bytes cached\n",
+		G_STRFUNC, g_hash_table_size (http_entries), http_cache_size));
+
+	g_mutex_unlock (&http_lock);
+
+	g_ptr_array_unref (files);
+	g_free (http_dir);
+
+	return NULL;
+}
+
+/**
+ * e_http_cache_setup:
+ * @cache_dir: directory for the cached resources
+ * @max_size: how much disk space the cached resources may take
+ *
+ * Sets up the cache.  Only the first call has an effect, later ones
+ * are ignored.  The resources already in @cache_dir are accounted
+ * for in a background thread; until it is done, the cache may exceed
+ * @max_size by their size.
+ **/
+void
+e_http_cache_setup (const gchar *cache_dir,
+                    gsize max_size)
+{
+	gchar *filename;
+	gchar *http_dir;
+
+	g_return_if_fail (cache_dir != NULL);
+
+	g_mutex_lock (&http_lock);
+
+	if (http_entries != NULL) {
+		g_mutex_unlock (&http_lock);
+		return;
+	}
+
+	http_max_size = max_size;
+
+	http_entries = g_hash_table_new (g_str_hash, g_str_equal);
+	http_fetches = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+
+	http_data_cache = camel_data_cache_new (cache_dir, NULL);
+
+	if (http_data_cache == NULL) {
+		g_mutex_unlock (&http_lock);
+		return;
+	}
+
+	/* cache expiry - 2 hour access, 1 day max */
+	camel_data_cache_set_expire_age (
+		http_data_cache, 24 * 60 * 60);
+	camel_data_cache_set_expire_access (
+		http_data_cache, 2 * 60 * 60);
+
+	/* The bucket directories are next to any cache file. */
+	filename = camel_data_cache_get_filename (
+		http_data_cache, "http", "0");
+	http_dir = g_path_get_dirname (filename);
+	g_free (filename);
+	filename = http_dir;
+	http_dir = g_path_get_dirname (filename);
+	g_free (filename);
+
+	g_mutex_unlock (&http_lock);
+
+	g_thread_unref (g_thread_new (
+		"http-cache-seed", http_cache_seed_thread, http_dir));
+}
+
+static CamelDataCache *
+http_cache_ref_data_cache (void)
+{
+	CamelDataCache *cache = NULL;
+
+	g_mutex_lock (&http_lock);
+
+	g_warn_if_fail (http_entries != NULL);
+
+	if (http_data_cache != NULL)
+		cache = g_object_ref (http_data_cache);
+
+	g_mutex_unlock (&http_lock);
+
+	return cache;
+}
+
+/**
+ * e_http_cache_lookup:
+ * @uri: URI of a remote resource
+ * @cancellable: (allow-none): a #GCancellable
+ * @out_content_type: (out): return location for the content type
+ *
+ * Reads the cached content of @uri into memory.  The content type
+ * comes from the in-memory metadata when the resource was used in
+ * this session, so a hit costs one read.
+ *
+ * Returns: the content, or %NULL if @uri is not cached
+ **/
+GBytes *
+e_http_cache_lookup (const gchar *uri,
+                     GCancellable *cancellable,
+                     gchar **out_content_type)
+{
+	CamelDataCache *cache;
+	CamelStream *cache_stream;
+	GByteArray *byte_array;
+	GList *link;
+	gchar *uri_md5;
+	gchar *content_type = NULL;
+	gchar *buffer;
+	gssize n_read;
+
+	g_return_val_if_fail (uri != NULL, NULL);
+	g_return_val_if_fail (out_content_type != NULL, NULL);
+
+	cache = http_cache_ref_data_cache ();
+	if (cache == NULL)
+		return NULL;
+
+	uri_md5 = http_cache_hash_uri (uri);
+
+	g_mutex_lock (&http_lock);
+
+	link = g_hash_table_lookup (http_entries, uri_md5);
+	if (link != NULL) {
+		HTTPCacheEntry *entry = link->data;
+		content_type = g_strdup (entry->content_type);
+	}
+
+	g_mutex_unlock (&http_lock);
+
+	cache_stream = camel_data_cache_get (cache, "http", uri_md5, NULL);
+	if (cache_stream == NULL) {
+		/* Expired by the CamelDataCache. */
+		g_mutex_lock (&http_lock);
+		link = g_hash_table_lookup (http_entries, uri_md5);
+		if (link != NULL)
+			http_cache_remove_link (link, FALSE);
+		g_mutex_unlock (&http_lock);
+
+		g_object_unref (cache);
+		g_free (content_type);
+		g_free (uri_md5);
+		return NULL;
+	}
+
+	g_seekable_seek (
+		G_SEEKABLE (cache_stream), 0, G_SEEK_SET, cancellable, NULL);
+
+	byte_array = g_byte_array_new ();
+	buffer = g_malloc (4096);
+
+	while ((n_read = camel_stream_read (cache_stream, buffer, 4096, cancellable, NULL)) > 0)
+		g_byte_array_append (byte_array, (guint8 *) buffer, n_read);
+
+	g_free (buffer);
+	g_object_unref (cache_stream);
+
+	/* When nothing could be read, fetch the resource again. */
+	if (n_read < 0 || byte_array->len == 0) {
+		d (printf ("Failed to load '%s' from cache.\n", uri_md5));
+		g_mutex_lock (&http_lock);
+		link = g_hash_table_lookup (http_entries, uri_md5);
+		if (link != NULL)
+			http_cache_remove_link (link, TRUE);
+		g_mutex_unlock (&http_lock);
+
+		g_byte_array_free (byte_array, TRUE);
+		g_object_unref (cache);
+		g_free (content_type);
+		g_free (uri_md5);
+		return NULL;
+	}
+
+	/* Cached by an earlier session, ask the file system once. */
+	if (content_type == NULL) {
+		GFile *file;
+		GFileInfo *info;
+		gchar *path;
+
+		path = camel_data_cache_get_filename (cache, "http", uri_md5);
+		file = g_file_new_for_path (path);
+		info = g_file_query_info (
+			file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+			0, cancellable, NULL);
+
+		if (info != NULL) {
+			content_type = g_strdup (
+				g_file_info_get_content_type (info));
+			g_object_unref (info);
+		}
+
+		g_object_unref (file);
+		g_free (path);
+	}
+
+	g_mutex_lock (&http_lock);
+	http_cache_touch (uri_md5, content_type, byte_array->len);
+	g_mutex_unlock (&http_lock);
+
+	g_object_unref (cache);
+	g_free (uri_md5);
+
+	*out_content_type = content_type;
+
+	return g_byte_array_free_to_bytes (byte_array);
+}
+
+static SoupSession *
+http_cache_ref_session (SoupURI *proxy_uri)
+{
+	SoupSession *session;
+	gchar *key;
+
+	key = (proxy_uri != NULL) ?
+		soup_uri_to_string (proxy_uri, FALSE) : g_strdup ("");
+
+	g_mutex_lock (&http_lock);
+
+	if (http_sessions == NULL)
+		http_sessions = g_hash_table_new_full (
+			(GHashFunc) g_str_hash,
+			(GEqualFunc) g_str_equal,
+			(GDestroyNotify) g_free,
+			(GDestroyNotify) g_object_unref);
+
+	session = g_hash_table_lookup (http_sessions, key);
+
+	if (session == NULL) {
+		/* Keep-alive connections are reused across requests
+		 * and the number of connections per host is capped. */
+		session = soup_session_sync_new_with_options (
+			SOUP_SESSION_TIMEOUT, 90,
+			SOUP_SESSION_MAX_CONNS,
+			E_HTTP_CACHE_MAX_CONNS,
+			SOUP_SESSION_MAX_CONNS_PER_HOST,
+			E_HTTP_CACHE_MAX_CONNS_PER_HOST,
+			NULL);
+
+		if (proxy_uri != NULL)
+			g_object_set (
+				session, SOUP_SESSION_PROXY_URI,
+				proxy_uri, NULL);
+
+		g_hash_table_insert (http_sessions, key, session);
+		key = NULL;
+	}
+
+	g_object_ref (session);
+
+	g_mutex_unlock (&http_lock);
+
+	g_free (key);
+
+	return session;
+}
+
+static GBytes *
+http_cache_fetch_from_network (const gchar *uri,
+                               const gchar *uri_md5,
+                               SoupURI *proxy_uri,
+                               GCancellable *cancellable,
+                               gchar **out_content_type)
+{
+	SoupSession *session;
+	SoupMessage *message;
+	CamelDataCache *cache;
+	CamelStream *cache_stream;
+	GBytes *body;
+	gboolean cached = FALSE;
+	GError *error = NULL;
+
+	session = http_cache_ref_session (proxy_uri);
+
+	message = soup_message_new (SOUP_METHOD_GET, uri);
+	if (message == NULL) {
+		g_object_unref (session);
+		return NULL;
+	}
+
+	soup_message_headers_append (
+		message->request_headers, "User-Agent", "Evolution/" VERSION);
+
+	send_and_handle_redirection (session, message);
+
+	g_object_unref (session);
+
+	if (!SOUP_STATUS_IS_SUCCESSFUL (message->status_code)) {
+		g_debug ("Failed to request %s (code %d)", uri, message->status_code);
+		g_object_unref (message);
+		return NULL;
+	}
+
+	cache = http_cache_ref_data_cache ();
+
+	/* Write the response body to cache */
+	cache_stream = (cache != NULL) ?
+		camel_data_cache_add (cache, "http", uri_md5, &error) : NULL;
+	if (error != NULL) {
+		g_warning (
+			"Failed to create cache file for '%s': %s",
+			uri, error->message);
+		g_clear_error (&error);
+	} else if (cache_stream != NULL) {
+		camel_stream_write (
+			cache_stream, message->response_body->data,
+			message->response_body->length, cancellable, &error);
+
+		camel_stream_close (cache_stream, cancellable, NULL);
+		g_object_unref (cache_stream);
+
+		if (error != NULL) {
+			if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+				g_warning (
+					"Failed to write data to cache stream: %s",
+					error->message);
+			g_clear_error (&error);
+			camel_data_cache_remove (cache, "http", uri_md5, NULL);
+			g_object_unref (cache);
+			g_object_unref (message);
+			return NULL;
+		}
+
+		cached = TRUE;
+	}
+
+	body = g_bytes_new (
+		message->response_body->data,
+		message->response_body->length);
+
+	*out_content_type = g_strdup (
+		soup_message_headers_get_content_type (
+		message->response_headers, NULL));
+
+	if (cached) {
+		g_mutex_lock (&http_lock);
+		http_cache_touch (
+			uri_md5, *out_content_type,
+			g_bytes_get_size (body));
+		g_mutex_unlock (&http_lock);
+	}
+
+	if (cache != NULL)
+		g_object_unref (cache);
+
+	g_object_unref (message);
+
+	return body;
+}
+
+static void
+http_fetch_unref (HTTPFetch *fetch)
+{
+	if (!g_atomic_int_dec_and_test (&fetch->ref_count))
+		return;
+
+	if (fetch->body != NULL)
+		g_bytes_unref (fetch->body);
+	g_free (fetch->content_type);
+
+	g_slice_free (HTTPFetch, fetch);
+}
+
+static void
+http_fetch_cancelled_cb (GCancellable *cancellable,
+                         gpointer user_data)
+{
+	/* Wake up requests waiting for a fetch. */
+	g_mutex_lock (&http_lock);
+	g_cond_broadcast (&http_cond);
+	g_mutex_unlock (&http_lock);
+}
+
+/**
+ * e_http_cache_fetch:
+ * @uri: URI of a remote resource
+ * @proxy_uri: (allow-none): proxy to use for @uri, or %NULL
+ * @cancellable: (allow-none): a #GCancellable
+ * @out_content_type: (out): return location for the content type
+ *
+ * Fetches the resource and adds it to the cache, or waits for the
+ * result of a fetch of the same URI that is already running.
+ * Newsletters tend to reference the same image many times, and
+ * several messages at once.  A waiting request still honors its
+ * own @cancellable.
+ *
+ * Returns: the content, or %NULL if it could not be fetched
+ **/
+GBytes *
+e_http_cache_fetch (const gchar *uri,
+                    SoupURI *proxy_uri,
+                    GCancellable *cancellable,
+                    gchar **out_content_type)
+{
+	HTTPFetch *fetch;
+	GBytes *body = NULL;
+	gchar *uri_md5;
+
+	g_return_val_if_fail (uri != NULL, NULL);
+	g_return_val_if_fail (out_content_type != NULL, NULL);
+
+	uri_md5 = http_cache_hash_uri (uri);
+
+	g_mutex_lock (&http_lock);
+
+	g_warn_if_fail (http_fetches != NULL);
+
+	fetch = (http_fetches != NULL) ?
+		g_hash_table_lookup (http_fetches, uri_md5) : NULL;
+
+	if (fetch != NULL) {
+		gulong cancelled_id = 0;
+
+		g_atomic_int_inc (&fetch->ref_count);
+
+		/* Not holding the lock, the handler
+		 * may run right away and takes it. */
+		g_mutex_unlock (&http_lock);
+
+		if (cancellable != NULL)
+			cancelled_id = g_cancellable_connect (
+				cancellable,
+				G_CALLBACK (http_fetch_cancelled_cb),
+				NULL, (GDestroyNotify) NULL);
+
+		g_mutex_lock (&http_lock);
+
+		while (!fetch->done && !g_cancellable_is_cancelled (cancellable))
+			g_cond_wait (&http_cond, &http_lock);
+
+		if (fetch->done && fetch->body != NULL) {
+			body = g_bytes_ref (fetch->body);
+			*out_content_type = g_strdup (fetch->content_type);
+		}
+
+		g_mutex_unlock (&http_lock);
+
+		if (cancelled_id > 0)
+			g_cancellable_disconnect (cancellable, cancelled_id);
+
+		http_fetch_unref (fetch);
+		g_free (uri_md5);
+
+		return body;
+	}
+
+	fetch = g_slice_new0 (HTTPFetch);
+	fetch->ref_count = 1;
+	if (http_fetches != NULL)
+		g_hash_table_insert (http_fetches, g_strdup (uri_md5), fetch);
+
+	g_mutex_unlock (&http_lock);
+
+	body = http_cache_fetch_from_network (
+		uri, uri_md5, proxy_uri, cancellable, out_content_type);
+
+	g_mutex_lock (&http_lock);
+
+	fetch->done = TRUE;
+	if (body != NULL) {
+		fetch->body = g_bytes_ref (body);
+		fetch->content_type = g_strdup (*out_content_type);
+	}
+
+	if (http_fetches != NULL)
+		g_hash_table_remove (http_fetches, uri_md5);
+	g_cond_broadcast (&http_cond);
+
+	g_mutex_unlock (&http_lock);
+
+	http_fetch_unref (fetch);
+	g_free (uri_md5);
+
+	return body;
+}
+
+/**
+ * e_http_cache_contains:
+ * @uri: URI of a remote resource
+ *
+ * Checks whether the resource at @uri is available from the cache,
+ * so it can be shown without going to the network.
+ *
+ * Returns: whether @uri is cached
+ **/
+gboolean
+e_http_cache_contains (const gchar *uri)
+{
+	gchar *uri_md5;
+	gchar *filename = NULL;
+	gboolean is_cached = FALSE;
+
+	g_return_val_if_fail (uri != NULL, FALSE);
+
+	uri_md5 = http_cache_hash_uri (uri);
+
+	g_mutex_lock (&http_lock);
+
+	if (http_entries != NULL &&
+	    g_hash_table_contains (http_entries, uri_md5))
+		is_cached = TRUE;
+	else if (http_data_cache != NULL)
+		filename = camel_data_cache_get_filename (
+			http_data_cache, "http", uri_md5);
+
+	g_mutex_unlock (&http_lock);
+
+	if (filename != NULL) {
+		is_cached = g_file_test (filename, G_FILE_TEST_EXISTS);
+		g_free (filename);
+	}
+
+	g_free (uri_md5);
+
+	return is_cached;
+}
+
+/**
+ * e_http_cache_get_size:
+ *
+ * Returns: how much disk space the cached resources
+ *          known to the cache take, in bytes
+ **/
+gsize
+e_http_cache_get_size (void)
+{
+	gsize size;
+
+	g_mutex_lock (&http_lock);
+	size = http_cache_size;
+	g_mutex_unlock (&http_lock);
+
+	return size;
+}
@@ -0,0 +1,44 @@
+/*
+ * e-http-cache.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef E_HTTP_CACHE_H
+#define E_HTTP_CACHE_H
+
+#include <libsoup/soup.h>
+
+/* Connection limits of the shared SoupSessions. */
+#define E_HTTP_CACHE_MAX_CONNS			16
+#define E_HTTP_CACHE_MAX_CONNS_PER_HOST		4
+
+G_BEGIN_DECLS
+
+void		e_http_cache_setup		(const gchar *cache_dir,
+						 gsize max_size);
+GBytes *	e_http_cache_lookup		(const gchar *uri,
+						 GCancellable *cancellable,
+						 gchar **out_content_type);
+GBytes *	e_http_cache_fetch		(const gchar *uri,
+						 SoupURI *proxy_uri,
+						 GCancellable *cancellable,
+						 gchar **out_content_type);
+gboolean	e_http_cache_contains		(const gchar *uri);
+gsize		e_http_cache_get_size		(void);
+
+G_END_DECLS
+
+#endif /* E_HTTP_CACHE_H */
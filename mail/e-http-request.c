@@ -37,6 +37,7 @@
 
 #include <shell/e-shell.h>
 
+#include "e-http-cache.h"
 #include "e-mail-ui-session.h"
 
 #define d(x)
@@ -45,6 +46,10 @@
 	(G_TYPE_INSTANCE_GET_PRIVATE \
 	((obj), E_TYPE_HTTP_REQUEST, EHTTPRequestPrivate))
 
+/* Disk space the remote resources may take, on top
+ * of the age-based expiry of the CamelDataCache. */
+#define HTTP_CACHE_SIZE			(64 * 1024 * 1024)
+
 struct _EHTTPRequestPrivate {
 	gchar *content_type;
 	gint content_length;
@@ -54,93 +59,40 @@ struct _EHTTPRequestPrivate {
 
 G_DEFINE_TYPE (EHTTPRequest, e_http_request, SOUP_TYPE_REQUEST)
 
-static gssize
-copy_stream_to_stream (CamelStream *input,
-                       GMemoryInputStream *output,
-                       GCancellable *cancellable)
+static gpointer
+http_request_setup_cache (gpointer unused)
 {
-	gchar *buff;
-	gssize read_len = 0;
-	gssize total_len = 0;
-
-	g_seekable_seek (G_SEEKABLE (input), 0, G_SEEK_SET, cancellable, NULL);
-
-	buff = g_malloc (4096);
-	while ((read_len = camel_stream_read (input, buff, 4096, cancellable, NULL)) > 0) {
-
-		g_memory_input_stream_add_data (output, buff, read_len, g_free);
-
-		total_len += read_len;
-
-		buff = g_malloc (4096);
-	}
+	e_http_cache_setup (e_get_user_cache_dir (), HTTP_CACHE_SIZE);
 
-	/* Free the last unused buffer */
-	g_free (buff);
-
-	return total_len;
+	return NULL;
 }
 
 static void
-redirect_handler (SoupMessage *msg,
-                  gpointer user_data)
+http_request_ensure_cache (void)
 {
-	if (SOUP_STATUS_IS_REDIRECTION (msg->status_code)) {
-		SoupSession *soup_session = user_data;
-		SoupURI *new_uri;
-		const gchar *new_loc;
-
-		new_loc = soup_message_headers_get_list (msg->response_headers, "Location");
-		if (!new_loc)
-			return;
-
-		new_uri = soup_uri_new_with_base (soup_message_get_uri (msg), new_loc);
-		if (!new_uri) {
-			soup_message_set_status_full (
-				msg,
-				SOUP_STATUS_MALFORMED,
-				"Invalid Redirect URL");
-			return;
-		}
+	static GOnce setup_once = G_ONCE_INIT;
 
-		soup_message_set_uri (msg, new_uri);
-		soup_session_requeue_message (soup_session, msg);
-
-		soup_uri_free (new_uri);
-	}
+	g_once (&setup_once, http_request_setup_cache, NULL);
 }
 
-static void
-send_and_handle_redirection (SoupSession *session,
-                             SoupMessage *message,
-                             gchar **new_location)
+static SoupURI *
+http_request_dup_proxy_uri (const gchar *uri)
 {
-	gchar *old_uri = NULL;
-
-	g_return_if_fail (message != NULL);
+	SoupURI *proxy_uri = NULL;
+	EProxy *proxy;
 
-	if (new_location) {
-		old_uri = soup_uri_to_string (soup_message_get_uri (message), FALSE);
-	}
+	proxy = e_proxy_new ();
+	e_proxy_setup_proxy (proxy);
 
-	soup_message_set_flags (message, SOUP_MESSAGE_NO_REDIRECT);
-	soup_message_add_header_handler (
-		message, "got_body", "Location",
-		G_CALLBACK (redirect_handler), session);
-	soup_message_headers_append (message->request_headers, "Connection", "close");
-	soup_session_send_message (session, message);
+	if (e_proxy_require_proxy_for_uri (proxy, uri))
+		proxy_uri = e_proxy_peek_uri_for (proxy, uri);
 
-	if (new_location) {
-		gchar *new_loc = soup_uri_to_string (soup_message_get_uri (message), FALSE);
+	if (proxy_uri != NULL)
+		proxy_uri = soup_uri_copy (proxy_uri);
 
-		if (new_loc && old_uri && !g_str_equal (new_loc, old_uri)) {
-			*new_location = new_loc;
-		} else {
-			g_free (new_loc);
-		}
-	}
+	g_object_unref (proxy);
 
-	g_free (old_uri);
+	return proxy_uri;
 }
 
 static void
@@ -155,12 +107,10 @@ handle_http_request (GSimpleAsyncResult *res,
 	GInputStream *stream;
 	gboolean force_load_images = FALSE;
 	EMailImageLoadingPolicy image_policy;
-	gchar *uri_md5;
 	EShell *shell;
 	GSettings *settings;
-	const gchar *user_cache_dir;
-	CamelDataCache *cache;
-	CamelStream *cache_stream;
+	GBytes *body;
+	gchar *content_type = NULL;
 	GHashTable *query;
 	gint uri_len;
 
@@ -209,68 +159,26 @@ handle_http_request (GSimpleAsyncResult *res,
 
 	g_return_if_fail (uri && *uri);
 
-	/* Use MD5 hash of the URI as a filname of the resourec cache file.
-	 * We were previously using the URI as a filename but the URI is
-	 * sometimes too long for a filename. */
-	uri_md5 = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
-
-	/* Open Evolution's cache */
-	user_cache_dir = e_get_user_cache_dir ();
-	cache = camel_data_cache_new (user_cache_dir, NULL);
-	if (cache) {
-		camel_data_cache_set_expire_age (cache, 24 * 60 * 60);
-		camel_data_cache_set_expire_access (cache, 2 * 60 * 60);
-	}
+	http_request_ensure_cache ();
 
 	/* Found item in cache! */
-	cache_stream = camel_data_cache_get (cache, "http", uri_md5, NULL);
-	if (cache_stream) {
-
-		gssize len;
-
-		stream = g_memory_input_stream_new ();
+	body = e_http_cache_lookup (uri, cancellable, &content_type);
+	if (body != NULL) {
+		request->priv->content_length = g_bytes_get_size (body);
+		request->priv->content_type = content_type;
 
-		len = copy_stream_to_stream (
-			cache_stream,
-			G_MEMORY_INPUT_STREAM (stream), cancellable);
-		request->priv->content_length = len;
+		d (
+			printf ("'%s' found in cache (%d bytes, %s)\n",
+			uri, request->priv->content_length,
+			request->priv->content_type));
 
-		g_object_unref (cache_stream);
+		stream = g_memory_input_stream_new_from_bytes (body);
+		g_bytes_unref (body);
 
-		/* When succesfully read some data from cache then
-		 * get mimetype and return the stream to WebKit.
-		 * Otherwise try to fetch the resource again from the network. */
-		if ((len != -1) && (request->priv->content_length > 0)) {
-			GFile *file;
-			GFileInfo *info;
-			gchar *path;
-
-			path = camel_data_cache_get_filename (cache, "http", uri_md5);
-			file = g_file_new_for_path (path);
-			info = g_file_query_info (
-				file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
-				0, cancellable, NULL);
-
-			request->priv->content_type = g_strdup (
-				g_file_info_get_content_type (info));
-
-			d (
-				printf ("'%s' found in cache (%d bytes, %s)\n",
-				uri, request->priv->content_length,
-				request->priv->content_type));
-
-			g_object_unref (info);
-			g_object_unref (file);
-			g_free (path);
-
-			/* Set result and quit the thread */
-			g_simple_async_result_set_op_res_gpointer (res, stream, NULL);
+		/* Set result and quit the thread */
+		g_simple_async_result_set_op_res_gpointer (res, stream, NULL);
 
-			goto cleanup;
-		} else {
-			d (printf ("Failed to load '%s' from cache.\n", uri));
-			g_object_unref (stream);
-		}
+		goto cleanup;
 	}
 
 	/* If the item is not in the cache and Evolution is in offline mode then
@@ -335,109 +243,36 @@ handle_http_request (GSimpleAsyncResult *res,
 	if ((image_policy == E_MAIL_IMAGE_LOADING_POLICY_ALWAYS) ||
 	    force_load_images) {
 
-		SoupSession *session;
-		SoupMessage *message;
-		CamelStream *cache_stream;
-		GError *error;
-		GMainContext *context;
-		EProxy *proxy;
-
-		context = g_main_context_new ();
-		g_main_context_push_thread_default (context);
-
-		session = soup_session_sync_new_with_options (
-				SOUP_SESSION_TIMEOUT, 90,
-				NULL);
-
-		proxy = e_proxy_new ();
-		e_proxy_setup_proxy (proxy);
-
-		if (e_proxy_require_proxy_for_uri (proxy, uri)) {
-			SoupURI *proxy_uri;
+		SoupURI *proxy_uri;
 
-			proxy_uri = e_proxy_peek_uri_for (proxy, uri);
-
-			g_object_set (session, SOUP_SESSION_PROXY_URI, proxy_uri, NULL);
-		}
-
-		g_clear_object (&proxy);
-
-		message = soup_message_new (SOUP_METHOD_GET, uri);
-		soup_message_headers_append (
-			message->request_headers, "User-Agent", "Evolution/" VERSION);
-
-		send_and_handle_redirection (session, message, NULL);
-
-		if (!SOUP_STATUS_IS_SUCCESSFUL (message->status_code)) {
-			g_debug ("Failed to request %s (code %d)", uri, message->status_code);
-			g_object_unref (message);
-			g_object_unref (session);
-			g_main_context_unref (context);
+		proxy_uri = http_request_dup_proxy_uri (uri);
+		body = e_http_cache_fetch (
+			uri, proxy_uri, cancellable, &content_type);
+		if (proxy_uri != NULL)
+			soup_uri_free (proxy_uri);
+		if (body == NULL)
 			goto cleanup;
-		}
-
-		/* Write the response body to cache */
-		error = NULL;
-		cache_stream = camel_data_cache_add (cache, "http", uri_md5, &error);
-		if (error != NULL) {
-			g_warning (
-				"Failed to create cache file for '%s': %s",
-				uri, error->message);
-			g_clear_error (&error);
-		} else {
-			camel_stream_write (
-				cache_stream, message->response_body->data,
-				message->response_body->length, cancellable, &error);
-
-			camel_stream_close (cache_stream, cancellable, NULL);
-			g_object_unref (cache_stream);
-
-			if (error != NULL) {
-				if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-					g_warning (
-						"Failed to write data to cache stream: %s",
-						error->message);
-				g_clear_error (&error);
-				g_object_unref (message);
-				g_object_unref (session);
-				g_main_context_unref (context);
-				goto cleanup;
-			}
-		}
 
 		/* Send the response body to WebKit */
-		stream = g_memory_input_stream_new_from_data (
-			g_memdup (message->response_body->data, message->response_body->length),
-			message->response_body->length,
-			(GDestroyNotify) g_free);
+		stream = g_memory_input_stream_new_from_bytes (body);
 
-		request->priv->content_length = message->response_body->length;
-		request->priv->content_type =
-			g_strdup (
-				soup_message_headers_get_content_type (
-					message->response_headers, NULL));
+		request->priv->content_length = g_bytes_get_size (body);
+		request->priv->content_type = content_type;
 
-		g_object_unref (message);
-		g_object_unref (session);
-		g_main_context_unref (context);
+		g_bytes_unref (body);
 
 		d (printf ("Received image from %s\n"
 			"Content-Type: %s\n"
-			"Content-Length: %d bytes\n"
-			"URI MD5: %s:\n",
+			"Content-Length: %d bytes\n",
 			uri, request->priv->content_type,
-			request->priv->content_length, uri_md5));
+			request->priv->content_length));
 
 		g_simple_async_result_set_op_res_gpointer (res, stream, NULL);
 		goto cleanup;
 	}
 
  cleanup:
-	if (cache) {
-		g_object_unref (cache);
-	}
 	g_free (uri);
-	g_free (uri_md5);
 	g_free (mail_uri);
 }
 
@@ -590,3 +425,22 @@ e_http_request_init (EHTTPRequest *request)
 	request->priv = E_HTTP_REQUEST_GET_PRIVATE (request);
 }
 
+/**
+ * e_http_request_is_cached:
+ * @uri: URI of a remote resource
+ *
+ * Checks whether the resource at @uri is available from the
+ * shared cache of remote resources, so it can be shown without
+ * going to the network.
+ *
+ * Returns: whether @uri is cached
+ **/
+gboolean
+e_http_request_is_cached (const gchar *uri)
+{
+	g_return_val_if_fail (uri != NULL, FALSE);
+
+	http_request_ensure_cache ();
+
+	return e_http_cache_contains (uri);
+}
@@ -59,6 +59,7 @@ struct _EHTTPRequestClass {
 };
 
 GType		e_http_request_get_type		(void) G_GNUC_CONST;
+gboolean	e_http_request_is_cached	(const gchar *uri);
 
 G_END_DECLS
 
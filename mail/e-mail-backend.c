@@ -35,6 +35,7 @@
 #include <shell/e-shell.h>
 
 #include <libemail-engine/e-mail-folder-utils.h>
+#include <libemail-engine/e-mail-search-index.h>
 #include <libemail-engine/e-mail-session.h>
 #include <libemail-engine/e-mail-store-utils.h>
 #include <libemail-engine/mail-config.h>
@@ -316,6 +317,8 @@ mail_backend_prepare_for_quit_cb (EShell *shell,
 	/* Cancel all pending activities. */
 	mail_cancel_all ();
 
+	e_mail_search_index_shutdown ();
+
 	list = camel_session_list_services (CAMEL_SESSION (session));
 
 	if (delete_junk) {
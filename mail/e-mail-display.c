@@ -71,8 +71,6 @@ enum {
 	PROP_PART_LIST
 };
 
-static CamelDataCache *emd_global_http_cache = NULL;
-
 static const gchar *ui =
 "<ui>"
 "  <popup name='context'>"
@@ -151,29 +149,6 @@ formatter_image_loading_policy_changed_cb (GObject *object,
 		e_mail_display_reload (display);
 }
 
-static gboolean
-mail_display_image_exists_in_cache (const gchar *image_uri)
-{
-	gchar *filename;
-	gchar *hash;
-	gboolean exists = FALSE;
-
-	g_return_val_if_fail (emd_global_http_cache != NULL, FALSE);
-
-	hash = g_compute_checksum_for_string (G_CHECKSUM_MD5, image_uri, -1);
-	filename = camel_data_cache_get_filename (
-		emd_global_http_cache, "http", hash);
-
-	if (filename != NULL) {
-		exists = g_file_test (filename, G_FILE_TEST_EXISTS);
-		g_free (filename);
-	}
-
-	g_free (hash);
-
-	return exists;
-}
-
 static void
 mail_display_update_formatter_colors (EMailDisplay *display)
 {
@@ -926,6 +901,45 @@ setup_dom_bindings (GObject *object,
 	}
 }
 
+static void
+show_full_text (WebKitDOMElement *button,
+                WebKitDOMEvent *event,
+                WebKitWebFrame *frame)
+{
+	const gchar *uri;
+	gchar *full_uri;
+
+	uri = webkit_web_frame_get_uri (frame);
+	if (uri == NULL)
+		return;
+
+	/* The text/plain formatter cut the part short, ask it
+	 * for the whole text this time. */
+	full_uri = g_strconcat (
+		uri, g_strstr_len (uri, -1, "?") != NULL ? "&" : "?",
+		"show_all=1", NULL);
+	webkit_web_frame_load_uri (frame, full_uri);
+	g_free (full_uri);
+}
+
+static void
+bind_show_full_text (WebKitWebFrame *frame)
+{
+	WebKitDOMDocument *document;
+	WebKitDOMElement *button;
+
+	document = webkit_web_frame_get_dom_document (frame);
+	if (document == NULL)
+		return;
+
+	button = webkit_dom_document_get_element_by_id (
+		document, "__evo-show-full-text");
+	if (button != NULL)
+		webkit_dom_event_target_add_event_listener (
+			WEBKIT_DOM_EVENT_TARGET (button), "click",
+			G_CALLBACK (show_full_text), FALSE, frame);
+}
+
 static void
 mail_parts_bind_dom (GObject *object,
                      GParamSpec *pspec,
@@ -946,6 +960,8 @@ mail_parts_bind_dom (GObject *object,
 	if (load_status != WEBKIT_LOAD_FINISHED)
 		return;
 
+	bind_show_full_text (frame);
+
 	web_view = webkit_web_frame_get_web_view (frame);
 	display = E_MAIL_DISPLAY (web_view);
 	if (display->priv->part_list == NULL)
@@ -1276,7 +1292,7 @@ mail_display_redirect_uri (EWebView *web_view,
 		EMailImageLoadingPolicy image_policy;
 
 		/* Check Evolution's cache */
-		image_exists = mail_display_image_exists_in_cache (uri);
+		image_exists = e_http_request_is_cached (uri);
 
 		/* If the URI is not cached and we are not allowed to load it
 		 * then redirect to invalid URI, so that webkit would display
@@ -1486,7 +1502,6 @@ static void
 e_mail_display_init (EMailDisplay *display)
 {
 	GtkUIManager *ui_manager;
-	const gchar *user_cache_dir;
 	WebKitWebSettings *settings;
 	WebKitWebFrame *main_frame;
 	GtkActionGroup *actions;
@@ -1560,17 +1575,6 @@ e_mail_display_init (EMailDisplay *display)
 		E_WEB_VIEW (display), E_TYPE_FILE_REQUEST);
 	e_web_view_install_request_handler (
 		E_WEB_VIEW (display), E_TYPE_STOCK_REQUEST);
-
-	if (emd_global_http_cache == NULL) {
-		user_cache_dir = e_get_user_cache_dir ();
-		emd_global_http_cache = camel_data_cache_new (user_cache_dir, NULL);
-
-		/* cache expiry - 2 hour access, 1 day max */
-		camel_data_cache_set_expire_age (
-			emd_global_http_cache, 24 * 60 * 60);
-		camel_data_cache_set_expire_access (
-			emd_global_http_cache, 2 * 60 * 60);
-	}
 }
 
 static void
@@ -0,0 +1,474 @@
+/*
+ * e-mail-prefetcher.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Fetches and parses the messages around the message list cursor
+ * before the user gets to them, one at a time in a worker thread.
+ * The resulting EMailPartLists go into the part list registry like
+ * those parsed for display, so EMailReader finds them there.
+ *
+ * The registry does not keep its objects alive, so the prefetcher
+ * holds on to the part lists it created, least recently wanted
+ * first out, within a memory budget estimated from message sizes.
+ * Each update replaces the list of messages to prefetch; whatever
+ * is no longer wanted, including the message being worked on, is
+ * dropped, so a jump across the list costs nothing in the end.
+ *
+ * All bookkeeping happens in the main thread. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "e-mail-prefetcher.h"
+
+#include "em-format/e-mail-parser.h"
+#include "em-format/e-mail-part-utils.h"
+
+#define d(x)
+
+/* Rough upper limit on the size of the messages held. */
+#define PREFETCH_MEMORY_BUDGET	(16 * 1024 * 1024)
+
+/* Small messages still cost their parts and formatting state. */
+#define MIN_MESSAGE_SIZE	4096
+
+typedef struct _CacheEntry CacheEntry;
+typedef struct _AsyncContext AsyncContext;
+
+struct _EMailPrefetcher {
+	volatile gint ref_count;
+
+	EMailSession *session;
+	CamelFolder *folder;
+
+	/* Message UIDs still to prefetch, most wanted first. */
+	GQueue pending;
+
+	/* The message being prefetched, if any. */
+	gchar *running_uid;
+	GCancellable *cancellable;
+
+	/* CacheEntry, most recently wanted first. */
+	GQueue lru;
+	GHashTable *lru_index;	/* mail URI -> GList link in lru */
+	gsize cache_size;
+};
+
+struct _CacheEntry {
+	gchar *mail_uri;
+	EMailPartList *part_list;
+	gsize size;
+};
+
+struct _AsyncContext {
+	EMailPrefetcher *prefetcher;
+	EMailSession *session;
+	CamelFolder *folder;
+	gchar *message_uid;
+	EMailPartList *part_list;
+};
+
+static void	prefetcher_start_next		(EMailPrefetcher *prefetcher);
+
+static void
+async_context_free (AsyncContext *async_context)
+{
+	e_mail_prefetcher_unref (async_context->prefetcher);
+	g_object_unref (async_context->session);
+	g_object_unref (async_context->folder);
+	g_free (async_context->message_uid);
+
+	if (async_context->part_list != NULL)
+		g_object_unref (async_context->part_list);
+
+	g_slice_free (AsyncContext, async_context);
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_free (entry->mail_uri);
+	g_object_unref (entry->part_list);
+
+	g_slice_free (CacheEntry, entry);
+}
+
+static void
+prefetcher_clear_cache (EMailPrefetcher *prefetcher)
+{
+	while (!g_queue_is_empty (&prefetcher->lru))
+		cache_entry_free (g_queue_pop_head (&prefetcher->lru));
+
+	g_hash_table_remove_all (prefetcher->lru_index);
+	prefetcher->cache_size = 0;
+}
+
+static void
+prefetcher_clear_pending (EMailPrefetcher *prefetcher)
+{
+	while (!g_queue_is_empty (&prefetcher->pending))
+		g_free (g_queue_pop_head (&prefetcher->pending));
+}
+
+static void
+prefetcher_cancel_running (EMailPrefetcher *prefetcher)
+{
+	if (prefetcher->cancellable != NULL)
+		g_cancellable_cancel (prefetcher->cancellable);
+}
+
+static gsize
+prefetcher_estimate_size (CamelFolder *folder,
+                          const gchar *message_uid)
+{
+	CamelMessageInfo *info;
+	gsize size = 0;
+
+	info = camel_folder_get_message_info (folder, message_uid);
+	if (info != NULL) {
+		size = camel_message_info_size (info);
+		camel_folder_free_message_info (folder, info);
+	}
+
+	return MAX (size, MIN_MESSAGE_SIZE);
+}
+
+static void
+prefetcher_add_to_cache (EMailPrefetcher *prefetcher,
+                         const gchar *mail_uri,
+                         EMailPartList *part_list,
+                         gsize size)
+{
+	CacheEntry *entry;
+
+	if (g_hash_table_contains (prefetcher->lru_index, mail_uri))
+		return;
+
+	entry = g_slice_new0 (CacheEntry);
+	entry->mail_uri = g_strdup (mail_uri);
+	entry->part_list = g_object_ref (part_list);
+	entry->size = size;
+
+	g_queue_push_head (&prefetcher->lru, entry);
+	g_hash_table_insert (
+		prefetcher->lru_index, entry->mail_uri,
+		g_queue_peek_head_link (&prefetcher->lru));
+	prefetcher->cache_size += size;
+
+	/* Always keep the newest one, however big. */
+	while (prefetcher->cache_size > PREFETCH_MEMORY_BUDGET &&
+	       prefetcher->lru.length > 1) {
+		entry = g_queue_pop_tail (&prefetcher->lru);
+		g_hash_table_remove (prefetcher->lru_index, entry->mail_uri);
+		prefetcher->cache_size -= entry->size;
+
+		d (printf ("prefetch: evicting %s\n", entry->mail_uri));
+
+		cache_entry_free (entry);
+	}
+}
+
+/* Marks a cached message as wanted again, returns whether it is cached. */
+static gboolean
+prefetcher_touch_cache (EMailPrefetcher *prefetcher,
+                        const gchar *mail_uri)
+{
+	GList *link;
+
+	link = g_hash_table_lookup (prefetcher->lru_index, mail_uri);
+	if (link == NULL)
+		return FALSE;
+
+	g_queue_unlink (&prefetcher->lru, link);
+	g_queue_push_head_link (&prefetcher->lru, link);
+
+	return TRUE;
+}
+
+static void
+prefetcher_run (GSimpleAsyncResult *simple,
+                GObject *object,
+                GCancellable *cancellable)
+{
+	AsyncContext *async_context;
+	CamelObjectBag *registry;
+	CamelMimeMessage *message;
+	EMailPartList *part_list;
+	gchar *mail_uri;
+
+	async_context = g_simple_async_result_get_op_res_gpointer (simple);
+
+	message = camel_folder_get_message_sync (
+		async_context->folder, async_context->message_uid,
+		cancellable, NULL);
+
+	if (message == NULL)
+		return;
+
+	registry = e_mail_part_list_get_registry ();
+
+	mail_uri = e_mail_part_build_uri (
+		async_context->folder,
+		async_context->message_uid, NULL, NULL);
+
+	/* Same as e_mail_reader_parse_message(), so that whichever
+	 * of the two gets to a message first does the parsing. */
+	part_list = camel_object_bag_reserve (registry, mail_uri);
+	if (part_list == NULL) {
+		EMailParser *parser;
+
+		parser = e_mail_parser_new (
+			CAMEL_SESSION (async_context->session));
+
+		part_list = e_mail_parser_parse_sync (
+			parser,
+			async_context->folder,
+			async_context->message_uid,
+			message, cancellable);
+
+		g_object_unref (parser);
+
+		/* A cancelled parse may have stopped half way,
+		 * don't let anyone display what it came up with. */
+		if (part_list != NULL && g_cancellable_is_cancelled (cancellable))
+			g_clear_object (&part_list);
+
+		if (part_list == NULL)
+			camel_object_bag_abort (registry, mail_uri);
+		else
+			camel_object_bag_add (registry, mail_uri, part_list);
+	}
+
+	g_free (mail_uri);
+	g_object_unref (message);
+
+	async_context->part_list = part_list;
+}
+
+static void
+prefetcher_done_cb (GObject *source_object,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+	GSimpleAsyncResult *simple;
+	AsyncContext *async_context;
+	EMailPrefetcher *prefetcher;
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	async_context = g_simple_async_result_get_op_res_gpointer (simple);
+	prefetcher = async_context->prefetcher;
+
+	g_clear_object (&prefetcher->cancellable);
+	g_free (prefetcher->running_uid);
+	prefetcher->running_uid = NULL;
+
+	/* Drop it if the folder changed in the meantime. */
+	if (async_context->part_list != NULL &&
+	    async_context->folder == prefetcher->folder) {
+		gchar *mail_uri;
+
+		mail_uri = e_mail_part_build_uri (
+			async_context->folder,
+			async_context->message_uid, NULL, NULL);
+
+		prefetcher_add_to_cache (
+			prefetcher, mail_uri, async_context->part_list,
+			prefetcher_estimate_size (
+				async_context->folder,
+				async_context->message_uid));
+
+		g_free (mail_uri);
+	}
+
+	prefetcher_start_next (prefetcher);
+}
+
+static void
+prefetcher_start_next (EMailPrefetcher *prefetcher)
+{
+	GSimpleAsyncResult *simple;
+	AsyncContext *async_context;
+
+	if (prefetcher->running_uid != NULL || prefetcher->folder == NULL)
+		return;
+
+	prefetcher->running_uid = g_queue_pop_head (&prefetcher->pending);
+	if (prefetcher->running_uid == NULL)
+		return;
+
+	prefetcher->cancellable = g_cancellable_new ();
+
+	async_context = g_slice_new0 (AsyncContext);
+	async_context->prefetcher = e_mail_prefetcher_ref (prefetcher);
+	async_context->session = g_object_ref (prefetcher->session);
+	async_context->folder = g_object_ref (prefetcher->folder);
+	async_context->message_uid = g_strdup (prefetcher->running_uid);
+
+	simple = g_simple_async_result_new (
+		NULL, prefetcher_done_cb, NULL,
+		e_mail_prefetcher_update);
+
+	g_simple_async_result_set_op_res_gpointer (
+		simple, async_context, (GDestroyNotify) async_context_free);
+
+	/* Below the messages the user is actually waiting for. */
+	g_simple_async_result_run_in_thread (
+		simple, prefetcher_run,
+		G_PRIORITY_LOW, prefetcher->cancellable);
+
+	g_object_unref (simple);
+}
+
+/**
+ * e_mail_prefetcher_new:
+ * @session: an #EMailSession
+ *
+ * Creates a new #EMailPrefetcher.
+ *
+ * Returns: a new #EMailPrefetcher
+ **/
+EMailPrefetcher *
+e_mail_prefetcher_new (EMailSession *session)
+{
+	EMailPrefetcher *prefetcher;
+
+	g_return_val_if_fail (E_IS_MAIL_SESSION (session), NULL);
+
+	prefetcher = g_slice_new0 (EMailPrefetcher);
+	prefetcher->ref_count = 1;
+	prefetcher->session = g_object_ref (session);
+	prefetcher->lru_index = g_hash_table_new (g_str_hash, g_str_equal);
+
+	return prefetcher;
+}
+
+EMailPrefetcher *
+e_mail_prefetcher_ref (EMailPrefetcher *prefetcher)
+{
+	g_return_val_if_fail (prefetcher != NULL, NULL);
+	g_return_val_if_fail (prefetcher->ref_count > 0, NULL);
+
+	g_atomic_int_inc (&prefetcher->ref_count);
+
+	return prefetcher;
+}
+
+void
+e_mail_prefetcher_unref (EMailPrefetcher *prefetcher)
+{
+	g_return_if_fail (prefetcher != NULL);
+	g_return_if_fail (prefetcher->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test (&prefetcher->ref_count)) {
+		prefetcher_clear_pending (prefetcher);
+		prefetcher_clear_cache (prefetcher);
+		g_hash_table_destroy (prefetcher->lru_index);
+
+		g_clear_object (&prefetcher->cancellable);
+		g_clear_object (&prefetcher->folder);
+		g_object_unref (prefetcher->session);
+		g_free (prefetcher->running_uid);
+
+		g_slice_free (EMailPrefetcher, prefetcher);
+	}
+}
+
+/**
+ * e_mail_prefetcher_update:
+ * @prefetcher: an #EMailPrefetcher
+ * @folder: the #CamelFolder the messages are in
+ * @uids: message UIDs to prefetch, most wanted first
+ *
+ * Replaces the list of messages to prefetch.  Messages prefetched
+ * earlier but no longer listed are kept while the memory budget
+ * allows, listed ones are kept in preference to others.
+ **/
+void
+e_mail_prefetcher_update (EMailPrefetcher *prefetcher,
+                          CamelFolder *folder,
+                          GPtrArray *uids)
+{
+	CamelObjectBag *registry;
+	gboolean running_wanted = FALSE;
+	gint ii;
+
+	g_return_if_fail (prefetcher != NULL);
+	g_return_if_fail (CAMEL_IS_FOLDER (folder));
+	g_return_if_fail (uids != NULL);
+
+	if (folder != prefetcher->folder) {
+		prefetcher_cancel_running (prefetcher);
+		prefetcher_clear_cache (prefetcher);
+		g_clear_object (&prefetcher->folder);
+		prefetcher->folder = g_object_ref (folder);
+	}
+
+	prefetcher_clear_pending (prefetcher);
+
+	registry = e_mail_part_list_get_registry ();
+
+	/* Walk backwards so the most wanted end up most recent. */
+	for (ii = uids->len - 1; ii >= 0; ii--) {
+		const gchar *uid = uids->pdata[ii];
+		EMailPartList *part_list;
+		gchar *mail_uri;
+
+		if (g_strcmp0 (uid, prefetcher->running_uid) == 0) {
+			running_wanted = TRUE;
+			continue;
+		}
+
+		mail_uri = e_mail_part_build_uri (folder, uid, NULL, NULL);
+
+		if (!prefetcher_touch_cache (prefetcher, mail_uri)) {
+			/* Parsed for display, or still in our cache
+			 * under another owner; either way it's there. */
+			part_list = camel_object_bag_peek (registry, mail_uri);
+
+			if (part_list != NULL)
+				g_object_unref (part_list);
+			else
+				g_queue_push_head (
+					&prefetcher->pending, g_strdup (uid));
+		}
+
+		g_free (mail_uri);
+	}
+
+	if (!running_wanted)
+		prefetcher_cancel_running (prefetcher);
+
+	prefetcher_start_next (prefetcher);
+}
+
+/**
+ * e_mail_prefetcher_cancel:
+ * @prefetcher: an #EMailPrefetcher
+ *
+ * Stops prefetching and releases the prefetched messages.
+ **/
+void
+e_mail_prefetcher_cancel (EMailPrefetcher *prefetcher)
+{
+	g_return_if_fail (prefetcher != NULL);
+
+	prefetcher_clear_pending (prefetcher);
+	prefetcher_cancel_running (prefetcher);
+	prefetcher_clear_cache (prefetcher);
+	g_clear_object (&prefetcher->folder);
+}
@@ -0,0 +1,40 @@
+/*
+ * e-mail-prefetcher.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef E_MAIL_PREFETCHER_H
+#define E_MAIL_PREFETCHER_H
+
+#include <libemail-engine/e-mail-session.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EMailPrefetcher EMailPrefetcher;
+
+EMailPrefetcher *
+		e_mail_prefetcher_new		(EMailSession *session);
+EMailPrefetcher *
+		e_mail_prefetcher_ref		(EMailPrefetcher *prefetcher);
+void		e_mail_prefetcher_unref		(EMailPrefetcher *prefetcher);
+void		e_mail_prefetcher_update	(EMailPrefetcher *prefetcher,
+						 CamelFolder *folder,
+						 GPtrArray *uids);
+void		e_mail_prefetcher_cancel	(EMailPrefetcher *prefetcher);
+
+G_END_DECLS
+
+#endif /* E_MAIL_PREFETCHER_H */
@@ -77,6 +77,18 @@ struct _AsyncContext {
 	gint filter_type;
 	gboolean replace;
 	gboolean keep_signature;
+	gboolean for_display;
+};
+
+typedef struct _ParseStreamData ParseStreamData;
+
+struct _ParseStreamData {
+	EMailReader *reader;
+	GCancellable *cancellable;
+	CamelObjectBag *registry;
+	const gchar *mail_uri;
+	EMailPartList *part_list;	/* set once registered */
+	gboolean for_display;
 };
 
 static void
@@ -2343,6 +2355,68 @@ e_mail_reader_create_vfolder_from_selected (EMailReader *reader,
 	g_ptr_array_unref (uids);
 }
 
+static gboolean
+mail_reader_show_parts_idle_cb (gpointer user_data)
+{
+	ParseStreamData *data = user_data;
+	EMailDisplay *display;
+
+	display = e_mail_reader_get_mail_display (data->reader);
+
+	/* Skip it if parsing finished in the meantime
+	 * or the user moved on to another message. */
+	if (!g_cancellable_is_cancelled (data->cancellable) &&
+	    e_mail_display_get_part_list (display) != data->part_list) {
+		e_mail_display_set_part_list (display, data->part_list);
+		e_mail_display_load (display, NULL);
+	}
+
+	return FALSE;
+}
+
+static void
+mail_reader_parse_stream_data_free (ParseStreamData *data)
+{
+	g_object_unref (data->reader);
+	g_clear_object (&data->cancellable);
+	g_object_unref (data->part_list);
+
+	g_slice_free (ParseStreamData, data);
+}
+
+/* The parser has the primary text part while attachments are still
+ * being parsed.  Register the part list right away so that requests
+ * for its parts are served, and show what is there.  The part list
+ * is not complete yet, so what is rendered from it now is not cached
+ * and does not stand in for the whole message. */
+static void
+mail_reader_parse_parts_added_cb (EMailParser *parser,
+                                  EMailPartList *part_list,
+                                  ParseStreamData *data)
+{
+	ParseStreamData *idle_data;
+
+	if (data->part_list != NULL)
+		return;
+
+	data->part_list = part_list;
+	camel_object_bag_add (data->registry, data->mail_uri, part_list);
+
+	if (!data->for_display)
+		return;
+
+	idle_data = g_slice_new0 (ParseStreamData);
+	idle_data->reader = g_object_ref (data->reader);
+	if (data->cancellable != NULL)
+		idle_data->cancellable = g_object_ref (data->cancellable);
+	idle_data->part_list = g_object_ref (part_list);
+
+	g_idle_add_full (
+		G_PRIORITY_DEFAULT,
+		mail_reader_show_parts_idle_cb, idle_data,
+		(GDestroyNotify) mail_reader_parse_stream_data_free);
+}
+
 static void
 mail_reader_parse_message_run (GSimpleAsyncResult *simple,
                                GObject *object,
@@ -2367,12 +2441,24 @@ mail_reader_parse_message_run (GSimpleAsyncResult *simple,
 		EMailBackend *mail_backend;
 		EMailSession *mail_session;
 		EMailParser *parser;
+		ParseStreamData stream_data = { 0 };
 
 		mail_backend = e_mail_reader_get_backend (reader);
 		mail_session = e_mail_backend_get_session (mail_backend);
 
+		stream_data.reader = reader;
+		stream_data.cancellable = cancellable;
+		stream_data.registry = registry;
+		stream_data.mail_uri = mail_uri;
+		stream_data.for_display = async_context->for_display;
+
 		parser = e_mail_parser_new (CAMEL_SESSION (mail_session));
 
+		g_signal_connect (
+			parser, "parts-added",
+			G_CALLBACK (mail_reader_parse_parts_added_cb),
+			&stream_data);
+
 		part_list = e_mail_parser_parse_sync (
 			parser,
 			async_context->folder,
@@ -2380,12 +2466,23 @@ mail_reader_parse_message_run (GSimpleAsyncResult *simple,
 			async_context->message,
 			cancellable);
 
+		g_signal_handlers_disconnect_by_func (
+			parser, mail_reader_parse_parts_added_cb,
+			&stream_data);
+
 		g_object_unref (parser);
 
-		if (part_list == NULL)
+		/* Don't leave a partly parsed message in the registry,
+		 * it would be shown like that the next time. */
+		if (part_list != NULL && stream_data.part_list != NULL) {
+			if (g_cancellable_is_cancelled (cancellable))
+				camel_object_bag_remove (registry, part_list);
+		} else if (part_list == NULL ||
+			   g_cancellable_is_cancelled (cancellable)) {
 			camel_object_bag_abort (registry, mail_uri);
-		else
+		} else {
 			camel_object_bag_add (registry, mail_uri, part_list);
+		}
 	}
 
 	g_free (mail_uri);
@@ -2393,14 +2490,15 @@ mail_reader_parse_message_run (GSimpleAsyncResult *simple,
 	async_context->part_list = part_list;
 }
 
-void
-e_mail_reader_parse_message (EMailReader *reader,
-                             CamelFolder *folder,
-                             const gchar *message_uid,
-                             CamelMimeMessage *message,
-                             GCancellable *cancellable,
-                             GAsyncReadyCallback callback,
-                             gpointer user_data)
+static void
+mail_reader_parse_message (EMailReader *reader,
+                           CamelFolder *folder,
+                           const gchar *message_uid,
+                           CamelMimeMessage *message,
+                           gboolean for_display,
+                           GCancellable *cancellable,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data)
 {
 	GSimpleAsyncResult *simple;
 	AsyncContext *async_context;
@@ -2420,6 +2518,7 @@ e_mail_reader_parse_message (EMailReader *reader,
 	async_context->folder = g_object_ref (folder);
 	async_context->message_uid = g_strdup (message_uid);
 	async_context->message = g_object_ref (message);
+	async_context->for_display = for_display;
 
 	simple = g_simple_async_result_new (
 		G_OBJECT (reader), callback, user_data,
@@ -2438,6 +2537,38 @@ e_mail_reader_parse_message (EMailReader *reader,
 	g_object_unref (activity);
 }
 
+void
+e_mail_reader_parse_message (EMailReader *reader,
+                             CamelFolder *folder,
+                             const gchar *message_uid,
+                             CamelMimeMessage *message,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data)
+{
+	mail_reader_parse_message (
+		reader, folder, message_uid, message, FALSE,
+		cancellable, callback, user_data);
+}
+
+/* Like e_mail_reader_parse_message(), but shows the first parts of
+ * the message in the reader's EMailDisplay while the attachments
+ * are still being parsed.  The callback should load the display
+ * again to show the whole message. */
+void
+e_mail_reader_parse_message_for_display (EMailReader *reader,
+                                         CamelFolder *folder,
+                                         const gchar *message_uid,
+                                         CamelMimeMessage *message,
+                                         GCancellable *cancellable,
+                                         GAsyncReadyCallback callback,
+                                         gpointer user_data)
+{
+	mail_reader_parse_message (
+		reader, folder, message_uid, message, TRUE,
+		cancellable, callback, user_data);
+}
+
 EMailPartList *
 e_mail_reader_parse_message_finish (EMailReader *reader,
                                     GAsyncResult *result)
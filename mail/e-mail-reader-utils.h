@@ -90,6 +90,14 @@ void		e_mail_reader_parse_message	(EMailReader *reader,
 						 GCancellable *cancellable,
 						 GAsyncReadyCallback callback,
 						 gpointer user_data);
+void		e_mail_reader_parse_message_for_display
+						(EMailReader *reader,
+						 CamelFolder *folder,
+						 const gchar *message_uid,
+						 CamelMimeMessage *message,
+						 GCancellable *cancellable,
+						 GAsyncReadyCallback callback,
+						 gpointer user_data);
 EMailPartList *	e_mail_reader_parse_message_finish
 						(EMailReader *reader,
 						 GAsyncResult *result);
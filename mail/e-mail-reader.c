@@ -45,6 +45,7 @@
 
 #include "e-mail-backend.h"
 #include "e-mail-browser.h"
+#include "e-mail-prefetcher.h"
 #include "e-mail-reader-utils.h"
 #include "e-mail-ui-session.h"
 #include "e-mail-view.h"
@@ -63,6 +64,9 @@
 
 #define d(x)
 
+/* How many messages on each side of the cursor to prefetch. */
+#define PREFETCH_NEIGHBORS 2
+
 typedef struct _EMailReaderClosure EMailReaderClosure;
 typedef struct _EMailReaderPrivate EMailReaderPrivate;
 
@@ -84,6 +88,9 @@ struct _EMailReaderPrivate {
 	 * message is selected before the retrieval has completed. */
 	GCancellable *retrieving_message;
 
+	/* Fetches and parses the messages around the cursor. */
+	EMailPrefetcher *prefetcher;
+
 	/* These flags work together to prevent message selection
 	 * restoration after a folder switch from automatically
 	 * marking the message as read.  We only want that to
@@ -147,6 +154,11 @@ mail_reader_private_free (EMailReaderPrivate *priv)
 		priv->retrieving_message = 0;
 	}
 
+	if (priv->prefetcher != NULL) {
+		e_mail_prefetcher_cancel (priv->prefetcher);
+		e_mail_prefetcher_unref (priv->prefetcher);
+	}
+
 	g_slice_free (EMailReaderPrivate, priv);
 }
 
@@ -2730,6 +2742,34 @@ exit:
 	g_clear_object (&message);
 }
 
+static void
+mail_reader_prefetch_neighbors (EMailReader *reader,
+                                CamelFolder *folder)
+{
+	EMailReaderPrivate *priv;
+	GtkWidget *message_list;
+	GPtrArray *uids;
+
+	priv = E_MAIL_READER_GET_PRIVATE (reader);
+
+	if (priv->prefetcher == NULL) {
+		EMailBackend *backend;
+		EMailSession *session;
+
+		backend = e_mail_reader_get_backend (reader);
+		session = e_mail_backend_get_session (backend);
+
+		priv->prefetcher = e_mail_prefetcher_new (session);
+	}
+
+	message_list = e_mail_reader_get_message_list (reader);
+
+	uids = message_list_get_neighbor_uids (
+		MESSAGE_LIST (message_list), PREFETCH_NEIGHBORS);
+	e_mail_prefetcher_update (priv->prefetcher, folder, uids);
+	g_ptr_array_unref (uids);
+}
+
 static gboolean
 mail_reader_message_selected_timeout_cb (EMailReader *reader)
 {
@@ -2768,8 +2808,40 @@ mail_reader_message_selected_timeout_cb (EMailReader *reader)
 			GCancellable *cancellable;
 			CamelFolder *folder;
 			EActivity *activity;
+			CamelObjectBag *registry;
+			EMailPartList *prefetched;
+			gchar *mail_uri;
 			gchar *string;
 
+			folder = e_mail_reader_ref_folder (reader);
+
+			/* Already fetched and parsed, possibly ahead of
+			 * time by the prefetcher; skip straight to it.
+			 * Not if the parser is still at it, though. */
+			registry = e_mail_part_list_get_registry ();
+			mail_uri = e_mail_part_build_uri (
+				folder, cursor_uid, NULL, NULL);
+			prefetched = camel_object_bag_peek (registry, mail_uri);
+			g_free (mail_uri);
+
+			if (prefetched != NULL &&
+			    e_mail_part_list_get_complete (prefetched) &&
+			    e_mail_part_list_get_message (prefetched) != NULL) {
+				g_signal_emit (
+					reader, signals[MESSAGE_LOADED], 0,
+					cursor_uid,
+					e_mail_part_list_get_message (prefetched));
+				priv->restoring_message_selection = FALSE;
+
+				g_object_unref (prefetched);
+				mail_reader_prefetch_neighbors (reader, folder);
+				g_clear_object (&folder);
+
+				goto exit;
+			}
+
+			g_clear_object (&prefetched);
+
 			string = g_strdup_printf (
 				_("Retrieving message '%s'"), cursor_uid);
 			e_mail_display_set_part_list (display, NULL);
@@ -2785,24 +2857,24 @@ mail_reader_message_selected_timeout_cb (EMailReader *reader)
 			closure->reader = g_object_ref (reader);
 			closure->message_uid = g_strdup (cursor_uid);
 
-			folder = e_mail_reader_ref_folder (reader);
-
 			camel_folder_get_message (
 				folder, cursor_uid, G_PRIORITY_DEFAULT,
 				cancellable, (GAsyncReadyCallback)
 				mail_reader_message_loaded_cb, closure);
 
-			g_clear_object (&folder);
-
 			if (priv->retrieving_message != NULL)
 				g_object_unref (priv->retrieving_message);
 			priv->retrieving_message = g_object_ref (cancellable);
+
+			mail_reader_prefetch_neighbors (reader, folder);
+			g_clear_object (&folder);
 		}
 	} else {
 		e_mail_display_set_part_list (display, NULL);
 		priv->restoring_message_selection = FALSE;
 	}
 
+exit:
 	priv->message_selected_timeout_id = 0;
 
 	return FALSE;
@@ -3038,7 +3110,7 @@ mail_reader_set_display_formatter_for_message (EMailReader *reader,
 	g_free (mail_uri);
 
 	if (parts == NULL) {
-		e_mail_reader_parse_message (
+		e_mail_reader_parse_message_for_display (
 			reader, folder, message_uid, message,
 			priv->retrieving_message,
 			set_mail_display_part_list, NULL);
@@ -45,8 +45,38 @@
 	(G_TYPE_INSTANCE_GET_PRIVATE \
 	((obj), E_TYPE_MAIL_REQUEST, EMailRequestPrivate))
 
+/* How much formatted output may pile up before the formatter
+ * has to wait for WebKit to read some of it. */
+#define PIPE_BUFFER_SIZE	(256 * 1024)
+
+/* How long a formatter waits for WebKit to read some of its
+ * output before it takes the reader for gone. */
+#define PIPE_WRITE_TIMEOUT	(30 * G_TIME_SPAN_SECOND)
+
+/* How many messages may be formatted at the same time. */
+#define MAX_FORMAT_THREADS	4
+
+/* Budget for the rendered output cache, and the largest
+ * single document worth keeping in it. */
+#define HTML_CACHE_SIZE		(8 * 1024 * 1024)
+#define HTML_CACHE_MAX_ENTRY	(HTML_CACHE_SIZE / 8)
+
+/* How many recently displayed messages the rendered output
+ * cache keeps parsed, so going back to one can use it. */
+#define HTML_CACHE_MAX_MESSAGES	16
+
+/* Formatter settings a part's rendered output depends on.  Only
+ * those go into the part's cache key, so changing one setting
+ * does not invalidate parts which do not use it. */
+enum {
+	HTML_CACHE_DEPENDS_CHARSET	= 1 << 0,
+	HTML_CACHE_DEPENDS_CITATIONS	= 1 << 1,
+	HTML_CACHE_DEPENDS_HEADERS	= 1 << 2,
+	HTML_CACHE_DEPENDS_IMAGES	= 1 << 3,
+	HTML_CACHE_DEPENDS_ALL		= 0xf
+};
+
 struct _EMailRequestPrivate {
-	GBytes *bytes;
 	gchar *mime_type;
 
 	GHashTable *uri_query;
@@ -56,22 +86,926 @@ struct _EMailRequestPrivate {
 	gchar *ret_mime_type;
 };
 
+/* The formatter writes the message into a MailRequestPipe through a
+ * CamelStream while WebKit reads it from a GInputStream, so the first
+ * part of a long message shows up before the rest is formatted and
+ * the whole document is never buffered. */
+typedef struct _MailRequestPipe MailRequestPipe;
+typedef struct _FormatData FormatData;
+typedef struct _HtmlCacheEntry HtmlCacheEntry;
+
+typedef struct _MailRequestOutputStream MailRequestOutputStream;
+typedef struct _MailRequestOutputStreamClass MailRequestOutputStreamClass;
+typedef struct _MailRequestInputStream MailRequestInputStream;
+typedef struct _MailRequestInputStreamClass MailRequestInputStreamClass;
+
+struct _MailRequestPipe {
+	volatile gint ref_count;
+	GMutex lock;
+	GCond cond;
+
+	GQueue chunks;		/* GBytes */
+	gsize head_offset;	/* bytes of the head chunk already read */
+	gsize buffered;
+	gsize total_written;
+
+	gboolean writer_closed;
+	gboolean reader_closed;
+
+	/* Copy of everything written, for the rendered output
+	 * cache.  Dropped once it grows past HTML_CACHE_MAX_ENTRY. */
+	GByteArray *capture;
+
+	/* Cancelled when the reader goes away. */
+	GCancellable *cancellable;
+};
+
+struct _FormatData {
+	EMailFormatter *formatter;
+	EMailFormatterContext context;
+	EMailPart *part;	/* NULL to format the whole message */
+	gboolean part_not_found;
+	gchar *mime_type;
+	CamelStream *output_stream;
+	MailRequestPipe *pipe;
+	gchar *cache_key;
+};
+
+struct _HtmlCacheEntry {
+	gchar *key;
+	GWeakRef part_list;
+	GBytes *bytes;
+};
+
+struct _MailRequestOutputStream {
+	CamelStream parent;
+	MailRequestPipe *pipe;
+};
+
+struct _MailRequestOutputStreamClass {
+	CamelStreamClass parent_class;
+};
+
+struct _MailRequestInputStream {
+	GInputStream parent;
+	MailRequestPipe *pipe;
+};
+
+struct _MailRequestInputStreamClass {
+	GInputStreamClass parent_class;
+};
+
 static const gchar *data_schemes[] = { "mail", NULL };
 
+/* Rendered output of recent requests, so that reloading a message
+ * or going back to it does not run the formatter again.  The hash
+ * table maps keys to links in the LRU queue, most recent first.
+ * The part lists of the most recently displayed messages are kept
+ * alive, so the reader finds them in the part list registry instead
+ * of parsing the message again.  Protected by html_cache. */
+static GHashTable *html_cache;
+static GQueue html_cache_lru = G_QUEUE_INIT;
+static GQueue html_cache_part_lists = G_QUEUE_INIT;
+static gsize html_cache_size;
+static guint html_cache_hits;
+static guint html_cache_misses;
+G_LOCK_DEFINE_STATIC (html_cache);
+
+/* Idle formatters, by display mode and default charset.  EMailFormatter
+ * is not thread-safe, so each formatter is checked out by one request
+ * at a time and only goes back here once its output is complete.  The
+ * hash table maps keys to GQueues.  Protected by formatters. */
+static GHashTable *formatters;
+G_LOCK_DEFINE_STATIC (formatters);
+
+static GType mail_request_output_stream_get_type (void);
+static GType mail_request_input_stream_get_type (void);
+
 G_DEFINE_TYPE (EMailRequest, e_mail_request, SOUP_TYPE_REQUEST)
 
+G_DEFINE_TYPE (
+	MailRequestOutputStream,
+	mail_request_output_stream,
+	CAMEL_TYPE_STREAM)
+
+G_DEFINE_TYPE (
+	MailRequestInputStream,
+	mail_request_input_stream,
+	G_TYPE_INPUT_STREAM)
+
+static MailRequestPipe *
+mail_request_pipe_new (void)
+{
+	MailRequestPipe *pipe;
+
+	pipe = g_slice_new0 (MailRequestPipe);
+	pipe->ref_count = 1;
+	g_mutex_init (&pipe->lock);
+	g_cond_init (&pipe->cond);
+	pipe->cancellable = g_cancellable_new ();
+
+	return pipe;
+}
+
+static MailRequestPipe *
+mail_request_pipe_ref (MailRequestPipe *pipe)
+{
+	g_atomic_int_inc (&pipe->ref_count);
+
+	return pipe;
+}
+
+static void
+mail_request_pipe_unref (MailRequestPipe *pipe)
+{
+	if (!g_atomic_int_dec_and_test (&pipe->ref_count))
+		return;
+
+	while (!g_queue_is_empty (&pipe->chunks))
+		g_bytes_unref (g_queue_pop_head (&pipe->chunks));
+
+	if (pipe->capture != NULL)
+		g_byte_array_free (pipe->capture, TRUE);
+
+	g_object_unref (pipe->cancellable);
+	g_mutex_clear (&pipe->lock);
+	g_cond_clear (&pipe->cond);
+
+	g_slice_free (MailRequestPipe, pipe);
+}
+
+static gssize
+mail_request_pipe_write (MailRequestPipe *pipe,
+                         const gchar *buffer,
+                         gsize n,
+                         GError **error)
+{
+	gssize result = n;
+	gboolean timed_out = FALSE;
+	gint64 deadline;
+
+	g_mutex_lock (&pipe->lock);
+
+	deadline = g_get_monotonic_time () + PIPE_WRITE_TIMEOUT;
+
+	while (pipe->buffered >= PIPE_BUFFER_SIZE && !pipe->reader_closed) {
+		gsize buffered = pipe->buffered;
+
+		if (!g_cond_wait_until (&pipe->cond, &pipe->lock, deadline)) {
+			/* WebKit stopped reading without closing the
+			 * stream.  Give up instead of holding on to a
+			 * formatting thread for good. */
+			pipe->reader_closed = TRUE;
+			timed_out = TRUE;
+		} else if (pipe->buffered < buffered) {
+			deadline = g_get_monotonic_time () + PIPE_WRITE_TIMEOUT;
+		}
+	}
+
+	if (timed_out) {
+		g_set_error_literal (
+			error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+			_("The message is no longer being displayed"));
+		result = -1;
+	} else if (pipe->reader_closed) {
+		g_set_error_literal (
+			error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+			_("The message is no longer being displayed"));
+		result = -1;
+	} else if (n > 0) {
+		g_queue_push_tail (&pipe->chunks, g_bytes_new (buffer, n));
+		pipe->buffered += n;
+		pipe->total_written += n;
+
+		if (pipe->capture != NULL) {
+			if (pipe->capture->len + n > HTML_CACHE_MAX_ENTRY) {
+				g_byte_array_free (pipe->capture, TRUE);
+				pipe->capture = NULL;
+			} else {
+				g_byte_array_append (
+					pipe->capture,
+					(const guint8 *) buffer, n);
+			}
+		}
+		g_cond_broadcast (&pipe->cond);
+	}
+
+	g_mutex_unlock (&pipe->lock);
+
+	/* Stop the formatter, like closing the reader does. */
+	if (timed_out)
+		g_cancellable_cancel (pipe->cancellable);
+
+	return result;
+}
+
+static void
+mail_request_pipe_close_writer (MailRequestPipe *pipe)
+{
+	g_mutex_lock (&pipe->lock);
+	pipe->writer_closed = TRUE;
+	g_cond_broadcast (&pipe->cond);
+	g_mutex_unlock (&pipe->lock);
+}
+
+static void
+mail_request_pipe_cancelled_cb (GCancellable *cancellable,
+                                MailRequestPipe *pipe)
+{
+	/* Wake up a reader waiting for data. */
+	g_mutex_lock (&pipe->lock);
+	g_cond_broadcast (&pipe->cond);
+	g_mutex_unlock (&pipe->lock);
+}
+
+static gssize
+mail_request_pipe_read (MailRequestPipe *pipe,
+                        gchar *buffer,
+                        gsize count,
+                        GCancellable *cancellable,
+                        GError **error)
+{
+	gsize n_read = 0;
+	gulong cancelled_id = 0;
+
+	/* Not holding the lock, the handler
+	 * may run right away and takes it. */
+	if (cancellable != NULL)
+		cancelled_id = g_cancellable_connect (
+			cancellable,
+			G_CALLBACK (mail_request_pipe_cancelled_cb),
+			pipe, (GDestroyNotify) NULL);
+
+	g_mutex_lock (&pipe->lock);
+
+	while (g_queue_is_empty (&pipe->chunks) && !pipe->writer_closed &&
+	       !g_cancellable_is_cancelled (cancellable))
+		g_cond_wait (&pipe->cond, &pipe->lock);
+
+	if (g_queue_is_empty (&pipe->chunks) && !pipe->writer_closed) {
+		g_mutex_unlock (&pipe->lock);
+
+		if (cancelled_id > 0)
+			g_cancellable_disconnect (cancellable, cancelled_id);
+
+		g_cancellable_set_error_if_cancelled (cancellable, error);
+
+		return -1;
+	}
+
+	while (n_read < count && !g_queue_is_empty (&pipe->chunks)) {
+		GBytes *bytes;
+		const gchar *data;
+		gsize size, n;
+
+		bytes = g_queue_peek_head (&pipe->chunks);
+		data = g_bytes_get_data (bytes, &size);
+
+		n = MIN (count - n_read, size - pipe->head_offset);
+		memcpy (buffer + n_read, data + pipe->head_offset, n);
+		n_read += n;
+		pipe->head_offset += n;
+
+		if (pipe->head_offset == size) {
+			g_bytes_unref (g_queue_pop_head (&pipe->chunks));
+			pipe->head_offset = 0;
+		}
+	}
+
+	pipe->buffered -= n_read;
+	g_cond_broadcast (&pipe->cond);
+
+	g_mutex_unlock (&pipe->lock);
+
+	if (cancelled_id > 0)
+		g_cancellable_disconnect (cancellable, cancelled_id);
+
+	return n_read;
+}
+
+static void
+mail_request_pipe_close_reader (MailRequestPipe *pipe)
+{
+	g_mutex_lock (&pipe->lock);
+	pipe->reader_closed = TRUE;
+	g_cond_broadcast (&pipe->cond);
+	g_mutex_unlock (&pipe->lock);
+
+	/* Stop the formatter, nobody is going to see the rest. */
+	g_cancellable_cancel (pipe->cancellable);
+}
+
+static gssize
+mail_request_output_stream_write (CamelStream *stream,
+                                  const gchar *buffer,
+                                  gsize n,
+                                  GCancellable *cancellable,
+                                  GError **error)
+{
+	MailRequestOutputStream *output_stream;
+
+	output_stream = (MailRequestOutputStream *) stream;
+
+	return mail_request_pipe_write (output_stream->pipe, buffer, n, error);
+}
+
+static gint
+mail_request_output_stream_close (CamelStream *stream,
+                                  GCancellable *cancellable,
+                                  GError **error)
+{
+	MailRequestOutputStream *output_stream;
+
+	output_stream = (MailRequestOutputStream *) stream;
+
+	mail_request_pipe_close_writer (output_stream->pipe);
+
+	return 0;
+}
+
+static void
+mail_request_output_stream_finalize (GObject *object)
+{
+	MailRequestOutputStream *output_stream;
+
+	output_stream = (MailRequestOutputStream *) object;
+
+	mail_request_pipe_close_writer (output_stream->pipe);
+	mail_request_pipe_unref (output_stream->pipe);
+
+	/* Chain up to parent's finalize() method. */
+	G_OBJECT_CLASS (mail_request_output_stream_parent_class)->
+		finalize (object);
+}
+
+static void
+mail_request_output_stream_class_init (MailRequestOutputStreamClass *class)
+{
+	GObjectClass *object_class;
+	CamelStreamClass *stream_class;
+
+	object_class = G_OBJECT_CLASS (class);
+	object_class->finalize = mail_request_output_stream_finalize;
+
+	stream_class = CAMEL_STREAM_CLASS (class);
+	stream_class->write = mail_request_output_stream_write;
+	stream_class->close = mail_request_output_stream_close;
+}
+
+static void
+mail_request_output_stream_init (MailRequestOutputStream *output_stream)
+{
+}
+
+static gssize
+mail_request_input_stream_read (GInputStream *stream,
+                                gpointer buffer,
+                                gsize count,
+                                GCancellable *cancellable,
+                                GError **error)
+{
+	MailRequestInputStream *input_stream;
+
+	input_stream = (MailRequestInputStream *) stream;
+
+	return mail_request_pipe_read (
+		input_stream->pipe, buffer, count, cancellable, error);
+}
+
+static gboolean
+mail_request_input_stream_close (GInputStream *stream,
+                                 GCancellable *cancellable,
+                                 GError **error)
+{
+	MailRequestInputStream *input_stream;
+
+	input_stream = (MailRequestInputStream *) stream;
+
+	mail_request_pipe_close_reader (input_stream->pipe);
+
+	return TRUE;
+}
+
+static void
+mail_request_input_stream_finalize (GObject *object)
+{
+	MailRequestInputStream *input_stream;
+
+	input_stream = (MailRequestInputStream *) object;
+
+	mail_request_pipe_close_reader (input_stream->pipe);
+	mail_request_pipe_unref (input_stream->pipe);
+
+	/* Chain up to parent's finalize() method. */
+	G_OBJECT_CLASS (mail_request_input_stream_parent_class)->
+		finalize (object);
+}
+
+static void
+mail_request_input_stream_class_init (MailRequestInputStreamClass *class)
+{
+	GObjectClass *object_class;
+	GInputStreamClass *input_stream_class;
+
+	object_class = G_OBJECT_CLASS (class);
+	object_class->finalize = mail_request_input_stream_finalize;
+
+	input_stream_class = G_INPUT_STREAM_CLASS (class);
+	input_stream_class->read_fn = mail_request_input_stream_read;
+	input_stream_class->close_fn = mail_request_input_stream_close;
+}
+
+static void
+mail_request_input_stream_init (MailRequestInputStream *input_stream)
+{
+}
+
+static void
+html_cache_entry_free (HtmlCacheEntry *entry)
+{
+	g_free (entry->key);
+	g_weak_ref_clear (&entry->part_list);
+	g_bytes_unref (entry->bytes);
+
+	g_slice_free (HtmlCacheEntry, entry);
+}
+
+static void
+html_cache_remove_link (GList *link)
+{
+	HtmlCacheEntry *entry = link->data;
+
+	g_hash_table_remove (html_cache, entry->key);
+	g_queue_delete_link (&html_cache_lru, link);
+	html_cache_size -= g_bytes_get_size (entry->bytes);
+
+	html_cache_entry_free (entry);
+}
+
+static guint
+html_cache_part_depends (const gchar *mime_type,
+                         EMailFormatterMode mode)
+{
+	/* Raw part content, nothing is formatted. */
+	if (mode == E_MAIL_FORMATTER_MODE_CID)
+		return 0;
+
+	/* The whole message. */
+	if (mime_type == NULL)
+		return HTML_CACHE_DEPENDS_ALL;
+
+	if (g_ascii_strncasecmp (mime_type, "image/", 6) == 0)
+		return HTML_CACHE_DEPENDS_IMAGES;
+
+	/* Header values are decoded with the charset. */
+	if (g_ascii_strcasecmp (
+		mime_type, "application/vnd.evolution.headers") == 0)
+		return HTML_CACHE_DEPENDS_HEADERS | HTML_CACHE_DEPENDS_CHARSET;
+
+	/* Anything else may embed other parts. */
+	return HTML_CACHE_DEPENDS_ALL;
+}
+
+static void
+html_cache_key_append_query (GString *key,
+                             GHashTable *query,
+                             const gchar *name)
+{
+	const gchar *value = g_hash_table_lookup (query, name);
+
+	g_string_append_c (key, '|');
+	if (value != NULL)
+		g_string_append (key, value);
+}
+
+static gchar *
+html_cache_build_key (EMailRequest *request,
+                      FormatData *data)
+{
+	GHashTable *query = request->priv->uri_query;
+	EMailFormatter *formatter = data->formatter;
+	GString *key;
+	guint depends;
+
+	depends = html_cache_part_depends (
+		data->mime_type, data->context.mode);
+
+	/* The folder URI and message UID are in the base URI. */
+	key = g_string_new (request->priv->uri_base);
+
+	html_cache_key_append_query (key, query, "mode");
+	html_cache_key_append_query (key, query, "part_id");
+	html_cache_key_append_query (key, query, "mime_type");
+	html_cache_key_append_query (key, query, "show_all");
+
+	/* The formatter's settings follow the preferences,
+	 * so they are the current ones. */
+	if (depends & HTML_CACHE_DEPENDS_CHARSET) {
+		html_cache_key_append_query (
+			key, query, "formatter_default_charset");
+		html_cache_key_append_query (
+			key, query, "formatter_charset");
+	}
+
+	if (depends & HTML_CACHE_DEPENDS_CITATIONS)
+		g_string_append_printf (
+			key, "|c%d:%08x",
+			e_mail_formatter_get_mark_citations (formatter),
+			e_rgba_to_value (e_mail_formatter_get_color (
+				formatter, E_MAIL_FORMATTER_COLOR_CITATION)));
+
+	if (depends & HTML_CACHE_DEPENDS_HEADERS) {
+		html_cache_key_append_query (key, query, "headers_collapsed");
+		html_cache_key_append_query (key, query, "headers_collapsable");
+		g_string_append_printf (
+			key, "|h%d%d",
+			e_mail_formatter_get_show_real_date (formatter),
+			e_mail_formatter_get_show_sender_photo (formatter));
+	}
+
+	if (depends & HTML_CACHE_DEPENDS_IMAGES)
+		g_string_append_printf (
+			key, "|i%d%d",
+			e_mail_formatter_get_animate_images (formatter),
+			e_mail_formatter_get_image_loading_policy (formatter));
+
+	return g_string_free (key, FALSE);
+}
+
+/* Marks the part list as most recently displayed, and returns the
+ * ones which fell off the end.  Their entries are dropped here, the
+ * caller unreferences the part lists after releasing the lock. */
+static GSList *
+html_cache_keep_part_list_locked (EMailPartList *part_list)
+{
+	GSList *expired = NULL;
+	GList *link;
+
+	link = g_queue_find (&html_cache_part_lists, part_list);
+
+	if (link != NULL) {
+		g_queue_unlink (&html_cache_part_lists, link);
+		g_queue_push_head_link (&html_cache_part_lists, link);
+		return NULL;
+	}
+
+	g_queue_push_head (&html_cache_part_lists, g_object_ref (part_list));
+
+	while (g_queue_get_length (&html_cache_part_lists) > HTML_CACHE_MAX_MESSAGES) {
+		EMailPartList *old = g_queue_pop_tail (&html_cache_part_lists);
+
+		link = g_queue_peek_head_link (&html_cache_lru);
+
+		while (link != NULL) {
+			HtmlCacheEntry *entry = link->data;
+			GList *next = g_list_next (link);
+			EMailPartList *entry_part_list;
+
+			entry_part_list = g_weak_ref_get (&entry->part_list);
+
+			if (entry_part_list == old)
+				html_cache_remove_link (link);
+
+			if (entry_part_list != NULL)
+				g_object_unref (entry_part_list);
+
+			link = next;
+		}
+
+		expired = g_slist_prepend (expired, old);
+	}
+
+	return expired;
+}
+
+static GBytes *
+html_cache_lookup (const gchar *key,
+                   EMailPartList *part_list)
+{
+	GBytes *bytes = NULL;
+	GSList *expired = NULL;
+	GList *link;
+
+	G_LOCK (html_cache);
+
+	link = (html_cache != NULL) ?
+		g_hash_table_lookup (html_cache, key) : NULL;
+
+	if (link != NULL) {
+		HtmlCacheEntry *entry = link->data;
+		EMailPartList *cached_part_list;
+
+		/* Output rendered from an earlier parse of the
+		 * message is stale, its part IDs may differ. */
+		cached_part_list = g_weak_ref_get (&entry->part_list);
+
+		if (cached_part_list == part_list) {
+			bytes = g_bytes_ref (entry->bytes);
+			g_queue_unlink (&html_cache_lru, link);
+			g_queue_push_head_link (&html_cache_lru, link);
+		} else {
+			html_cache_remove_link (link);
+		}
+
+		if (cached_part_list != NULL)
+			g_object_unref (cached_part_list);
+	}
+
+	if (bytes != NULL) {
+		expired = html_cache_keep_part_list_locked (part_list);
+		html_cache_hits++;
+	} else {
+		html_cache_misses++;
+	}
+
+	if (camel_debug_start ("emformat:requests")) {
+		printf (
+			"%s: %s for '%s' (%u hits, %u misses, %" G_GSIZE_FORMAT " bytes)\n",
+			G_STRFUNC, bytes ? "hit" : "miss", key,
+			html_cache_hits, html_cache_misses, html_cache_size);
+		camel_debug_end ();
+	}
+
+	G_UNLOCK (html_cache);
+
+	g_slist_free_full (expired, (GDestroyNotify) g_object_unref);
+
+	return bytes;
+}
+
+static void
+html_cache_insert (const gchar *key,
+                   EMailPartList *part_list,
+                   GByteArray *byte_array)
+{
+	HtmlCacheEntry *entry;
+	GSList *expired;
+	GList *link;
+
+	entry = g_slice_new0 (HtmlCacheEntry);
+	entry->key = g_strdup (key);
+	g_weak_ref_init (&entry->part_list, part_list);
+	entry->bytes = g_byte_array_free_to_bytes (byte_array);
+
+	G_LOCK (html_cache);
+
+	if (html_cache == NULL)
+		html_cache = g_hash_table_new (g_str_hash, g_str_equal);
+
+	link = g_hash_table_lookup (html_cache, key);
+	if (link != NULL)
+		html_cache_remove_link (link);
+
+	g_queue_push_head (&html_cache_lru, entry);
+	g_hash_table_insert (html_cache, entry->key, html_cache_lru.head);
+	html_cache_size += g_bytes_get_size (entry->bytes);
+
+	while (html_cache_size > HTML_CACHE_SIZE)
+		html_cache_remove_link (html_cache_lru.tail);
+
+	expired = html_cache_keep_part_list_locked (part_list);
+
+	G_UNLOCK (html_cache);
+
+	g_slist_free_full (expired, (GDestroyNotify) g_object_unref);
+}
+
+static void
+html_cache_invalidate (void)
+{
+	G_LOCK (html_cache);
+
+	while (html_cache_lru.tail != NULL)
+		html_cache_remove_link (html_cache_lru.tail);
+
+	G_UNLOCK (html_cache);
+}
+
+static void
+html_cache_formatter_notify_cb (EMailFormatter *formatter,
+                                GParamSpec *pspec)
+{
+	/* Set for each request, and part of the cache keys. */
+	if (g_str_equal (pspec->name, "charset"))
+		return;
+
+	/* Any other change to the formatter's settings, for example
+	 * the text colours, may make the cached output stale. */
+	html_cache_invalidate ();
+}
+
+static gchar *
+mail_request_formatter_key (EMailFormatterMode mode,
+                            const gchar *default_charset)
+{
+	gboolean printing;
+
+	printing = (mode == E_MAIL_FORMATTER_MODE_PRINTING);
+
+	return g_strdup_printf (
+		"%d|%s", printing,
+		default_charset ? default_charset : "");
+}
+
+static EMailFormatter *
+mail_request_checkout_formatter (EMailFormatterMode mode,
+                                 const gchar *default_charset,
+                                 const gchar *charset)
+{
+	EMailFormatter *formatter = NULL;
+	GQueue *idle;
+	gchar *key;
+
+	if (default_charset != NULL && *default_charset == '\0')
+		default_charset = NULL;
+	if (charset != NULL && *charset == '\0')
+		charset = NULL;
+
+	key = mail_request_formatter_key (mode, default_charset);
+
+	G_LOCK (formatters);
+
+	idle = (formatters != NULL) ?
+		g_hash_table_lookup (formatters, key) : NULL;
+	if (idle != NULL)
+		formatter = g_queue_pop_head (idle);
+
+	G_UNLOCK (formatters);
+
+	if (formatter == NULL) {
+		if (mode == E_MAIL_FORMATTER_MODE_PRINTING)
+			formatter = e_mail_formatter_print_new ();
+		else
+			formatter = e_mail_formatter_new ();
+
+		if (default_charset != NULL)
+			e_mail_formatter_set_default_charset (
+				formatter, default_charset);
+
+		g_object_set_data_full (
+			G_OBJECT (formatter), "mail-request-key",
+			g_strdup (key), (GDestroyNotify) g_free);
+
+		g_signal_connect (
+			formatter, "notify",
+			G_CALLBACK (html_cache_formatter_notify_cb), NULL);
+		g_signal_connect (
+			formatter, "need-redraw",
+			G_CALLBACK (html_cache_invalidate), NULL);
+	}
+
+	e_mail_formatter_set_charset (formatter, charset);
+
+	g_free (key);
+
+	return formatter;
+}
+
+static void
+mail_request_checkin_formatter (EMailFormatter *formatter)
+{
+	GQueue *idle;
+	const gchar *key;
+
+	key = g_object_get_data (G_OBJECT (formatter), "mail-request-key");
+
+	G_LOCK (formatters);
+
+	if (formatters == NULL)
+		formatters = g_hash_table_new_full (
+			(GHashFunc) g_str_hash,
+			(GEqualFunc) g_str_equal,
+			(GDestroyNotify) g_free,
+			(GDestroyNotify) NULL);
+
+	idle = g_hash_table_lookup (formatters, key);
+
+	if (idle == NULL) {
+		idle = g_queue_new ();
+		g_hash_table_insert (formatters, g_strdup (key), idle);
+	}
+
+	/* No more are ever busy at the same time. */
+	if (g_queue_get_length (idle) < MAX_FORMAT_THREADS) {
+		g_queue_push_head (idle, formatter);
+		formatter = NULL;
+	}
+
+	G_UNLOCK (formatters);
+
+	if (formatter != NULL)
+		g_object_unref (formatter);
+}
+
+static void
+format_data_free (FormatData *data)
+{
+	mail_request_checkin_formatter (data->formatter);
+	g_object_unref (data->context.part_list);
+	g_free (data->context.uri);
+	g_clear_object (&data->part);
+	g_free (data->mime_type);
+	g_free (data->cache_key);
+
+	if (data->pipe != NULL)
+		mail_request_pipe_unref (data->pipe);
+
+	g_slice_free (FormatData, data);
+}
+
+static void
+mail_request_format_thread (FormatData *data,
+                            gpointer user_data)
+{
+	GCancellable *cancellable = data->pipe->cancellable;
+	gboolean empty;
+
+	if (data->part_not_found) {
+		/* Fall through to the "no text content" message. */
+
+	} else if (data->part == NULL) {
+		e_mail_formatter_format_sync (
+			data->formatter, data->context.part_list,
+			data->output_stream, data->context.flags,
+			data->context.mode, cancellable);
+
+	} else if (data->context.mode == E_MAIL_FORMATTER_MODE_CID) {
+		CamelDataWrapper *dw;
+		CamelMimePart *mime_part;
+
+		mime_part = e_mail_part_ref_mime_part (data->part);
+		dw = camel_medium_get_content (CAMEL_MEDIUM (mime_part));
+
+		if (dw != NULL)
+			camel_data_wrapper_decode_to_stream_sync (
+				dw, data->output_stream, cancellable, NULL);
+
+		g_object_unref (mime_part);
+
+	} else {
+		e_mail_formatter_format_as (
+			data->formatter, &data->context, data->part,
+			data->output_stream, data->mime_type,
+			cancellable);
+	}
+
+	g_mutex_lock (&data->pipe->lock);
+	empty = (data->pipe->total_written == 0);
+	g_mutex_unlock (&data->pipe->lock);
+
+	if (empty) {
+		gchar *html;
+
+		html = g_strdup_printf (
+			"<p align='center'>%s</p>",
+			_("The message has no text content."));
+		camel_stream_write_string (
+			data->output_stream, html, NULL, NULL);
+		g_free (html);
+	}
+
+	/* Keep the output only if it is complete. */
+	if (data->cache_key != NULL && !g_cancellable_is_cancelled (cancellable)) {
+		GByteArray *capture;
+
+		g_mutex_lock (&data->pipe->lock);
+		capture = data->pipe->capture;
+		data->pipe->capture = NULL;
+		g_mutex_unlock (&data->pipe->lock);
+
+		if (capture != NULL)
+			html_cache_insert (
+				data->cache_key,
+				data->context.part_list, capture);
+	}
+
+	/* This closes the pipe, the reader sees the end of the stream. */
+	g_object_unref (data->output_stream);
+
+	format_data_free (data);
+}
+
+static gpointer
+mail_request_create_format_pool (gpointer unused)
+{
+	return g_thread_pool_new (
+		(GFunc) mail_request_format_thread,
+		NULL, MAX_FORMAT_THREADS, FALSE, NULL);
+}
+
 static void
 handle_mail_request (GSimpleAsyncResult *simple,
                      GObject *object,
                      GCancellable *cancellable)
 {
 	EMailRequest *request = E_MAIL_REQUEST (object);
-	GInputStream *stream;
-	EMailFormatter *formatter;
+	MailRequestOutputStream *output_stream;
+	MailRequestInputStream *input_stream;
 	EMailPartList *part_list;
 	CamelObjectBag *registry;
-	CamelStream *output_stream;
-	GByteArray *byte_array;
+	static GOnce once = G_ONCE_INIT;
+	FormatData *data;
+	GBytes *cached;
 	const gchar *val;
 	const gchar *default_charset, *charset;
 
@@ -110,42 +1044,26 @@ handle_mail_request (GSimpleAsyncResult *simple,
 	charset = g_hash_table_lookup (
 		request->priv->uri_query, "formatter_charset");
 
-	context.part_list = g_object_ref (part_list);
-	context.uri = request->priv->full_uri;
-
-	if (context.mode == E_MAIL_FORMATTER_MODE_PRINTING)
-		formatter = e_mail_formatter_print_new ();
-	else
-		formatter = e_mail_formatter_new ();
-
-	if (default_charset != NULL && *default_charset != '\0')
-		e_mail_formatter_set_default_charset (formatter, default_charset);
-	if (charset != NULL && *charset != '\0')
-		e_mail_formatter_set_charset (formatter, charset);
-
-	byte_array = g_byte_array_new ();
-	output_stream = camel_stream_mem_new ();
-
-	/* We retain ownership of the byte array. */
-	camel_stream_mem_set_byte_array (
-		CAMEL_STREAM_MEM (output_stream), byte_array);
+	data = g_slice_new0 (FormatData);
+	data->context = context;
+	data->context.part_list = part_list;
+	data->context.uri = g_strdup (request->priv->full_uri);
+	data->formatter = mail_request_checkout_formatter (
+		context.mode, default_charset, charset);
 
 	val = g_hash_table_lookup (request->priv->uri_query, "part_id");
 	if (val != NULL) {
-		EMailPart *part;
 		const gchar *mime_type;
 		gchar *part_id;
 
 		part_id = soup_uri_decode (val);
-		part = e_mail_part_list_ref_part (part_list, part_id);
-		if (!part) {
+		data->part = e_mail_part_list_ref_part (part_list, part_id);
+		if (!data->part) {
+			data->part_not_found = TRUE;
 			if (camel_debug_start ("emformat:requests")) {
 				printf ("%s: part with id '%s' not found\n", G_STRFUNC, part_id);
 				camel_debug_end ();
 			}
-
-			g_free (part_id);
-			goto no_part;
 		}
 		g_free (part_id);
 
@@ -155,65 +1073,54 @@ handle_mail_request (GSimpleAsyncResult *simple,
 		if (context.mode == E_MAIL_FORMATTER_MODE_SOURCE)
 			mime_type = "application/vnd.evolution.source";
 
-		if (context.mode == E_MAIL_FORMATTER_MODE_CID) {
-			CamelDataWrapper *dw;
-			CamelMimePart *mime_part;
-
-			mime_part = e_mail_part_ref_mime_part (part);
-			dw = camel_medium_get_content (CAMEL_MEDIUM (mime_part));
-			g_return_if_fail (dw);
+		if (data->part != NULL && mime_type == NULL)
+			mime_type = e_mail_part_get_mime_type (data->part);
 
-			camel_data_wrapper_decode_to_stream_sync (
-				dw, output_stream, cancellable, NULL);
-
-			g_object_unref (mime_part);
-		} else {
-			if (mime_type == NULL)
-				mime_type = e_mail_part_get_mime_type (part);
-
-			e_mail_formatter_format_as (
-				formatter, &context, part,
-				output_stream, mime_type,
-				cancellable);
-		}
-
-		g_object_unref (part);
+		data->mime_type = g_strdup (mime_type);
+	}
 
+	/* Output rendered while the message is still being parsed lacks
+	 * the parts still to come, like attachments.  It is neither kept
+	 * nor taken from the cache, which holds complete output only. */
+	if (e_mail_part_list_get_complete (part_list)) {
+		data->cache_key = html_cache_build_key (request, data);
+		cached = html_cache_lookup (data->cache_key, part_list);
 	} else {
-		e_mail_formatter_format_sync (
-			formatter, part_list, output_stream,
-			context.flags, context.mode, cancellable);
+		cached = NULL;
 	}
 
- no_part:
-	g_clear_object (&output_stream);
-	g_clear_object (&context.part_list);
+	if (cached != NULL) {
+		g_simple_async_result_set_op_res_gpointer (
+			simple, g_memory_input_stream_new_from_bytes (cached),
+			(GDestroyNotify) g_object_unref);
+		g_bytes_unref (cached);
+		format_data_free (data);
+		return;
+	}
 
-	if (byte_array->data == NULL) {
-		gchar *data;
+	data->pipe = mail_request_pipe_new ();
+	data->pipe->capture = g_byte_array_new ();
 
-		data = g_strdup_printf (
-			"<p align='center'>%s</p>",
-			_("The message has no text content."));
-		g_byte_array_append (
-			byte_array, (guint8 *) data, strlen (data));
-		g_free (data);
-	}
+	output_stream = g_object_new (
+		mail_request_output_stream_get_type (), NULL);
+	output_stream->pipe = mail_request_pipe_ref (data->pipe);
+	data->output_stream = CAMEL_STREAM (output_stream);
 
-	if (request->priv->bytes != NULL)
-		g_bytes_unref (request->priv->bytes);
-	request->priv->bytes = g_byte_array_free_to_bytes (byte_array);
+	input_stream = g_object_new (
+		mail_request_input_stream_get_type (), NULL);
+	input_stream->pipe = mail_request_pipe_ref (data->pipe);
 
-	stream = g_memory_input_stream_new_from_bytes (request->priv->bytes);
+	/* A job waiting for a free thread is no different to WebKit
+	 * from one whose output has not arrived yet.  The reader never
+	 * blocks a formatting thread for long: when it goes away the
+	 * pipe is closed, which stops the formatter, and one that stops
+	 * reading is given up on after PIPE_WRITE_TIMEOUT. */
+	g_once (&once, mail_request_create_format_pool, NULL);
+	g_thread_pool_push ((GThreadPool *) once.retval, data, NULL);
 
 	g_simple_async_result_set_op_res_gpointer (
-		simple, g_object_ref (stream),
+		simple, input_stream,
 		(GDestroyNotify) g_object_unref);
-
-	g_object_unref (stream);
-
-	g_object_unref (part_list);
-	g_object_unref (formatter);
 }
 
 static GInputStream *
@@ -305,9 +1212,6 @@ mail_request_finalize (GObject *object)
 
 	priv = E_MAIL_REQUEST_GET_PRIVATE (object);
 
-	if (priv->bytes != NULL)
-		g_bytes_unref (priv->bytes);
-
 	if (priv->uri_query != NULL)
 		g_hash_table_destroy (priv->uri_query);
 
@@ -402,15 +1306,9 @@ mail_request_send_finish (SoupRequest *request,
 static goffset
 mail_request_get_content_length (SoupRequest *request)
 {
-	EMailRequestPrivate *priv;
-	goffset content_length = -1;  /* -1 means unknown */
-
-	priv = E_MAIL_REQUEST_GET_PRIVATE (request);
-
-	if (priv->bytes != NULL)
-		content_length = g_bytes_get_size (priv->bytes);
-
-	return content_length;
+	/* The formatted message is streamed,
+	 * its length is not known up front. */
+	return -1;
 }
 
 static const gchar *
@@ -466,3 +1364,30 @@ e_mail_request_init (EMailRequest *request)
 	request->priv = E_MAIL_REQUEST_GET_PRIVATE (request);
 }
 
+/**
+ * e_mail_request_get_cache_stats:
+ * @out_hits: return location for the number of cache hits, or %NULL
+ * @out_misses: return location for the number of cache misses, or %NULL
+ * @out_size: return location for the cached bytes, or %NULL
+ *
+ * Reports how well the cache of rendered messages is doing.
+ * Reloading a message, or going back to one that has been
+ * displayed recently, is served from this cache.
+ **/
+void
+e_mail_request_get_cache_stats (guint *out_hits,
+                                guint *out_misses,
+                                gsize *out_size)
+{
+	G_LOCK (html_cache);
+
+	if (out_hits != NULL)
+		*out_hits = html_cache_hits;
+	if (out_misses != NULL)
+		*out_misses = html_cache_misses;
+	if (out_size != NULL)
+		*out_size = html_cache_size;
+
+	G_UNLOCK (html_cache);
+}
+
@@ -59,6 +59,9 @@ struct _EMailRequestClass {
 };
 
 GType		e_mail_request_get_type		(void) G_GNUC_CONST;
+void		e_mail_request_get_cache_stats	(guint *out_hits,
+						 guint *out_misses,
+						 gsize *out_size);
 
 G_END_DECLS
 
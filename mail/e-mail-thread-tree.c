@@ -0,0 +1,821 @@
+/*
+ * e-mail-thread-tree.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Message threading by References / In-Reply-To, spread over several
+ * worker threads.  This is the reference-only part of the algorithm in
+ * CamelFolderThread (no subject merging), restructured so that every
+ * step can run on its own slice of the data:
+ *
+ *   1. Each worker owns one partition of the Message-ID space and
+ *      builds a hash table and container array for just those IDs.
+ *   2. Each worker links the containers it owns to their parents,
+ *      scanning messages in order so the outcome does not depend on
+ *      thread scheduling.
+ *   3. Loops are broken, empty (phantom) containers are skipped over
+ *      and the resulting CamelFolderThreadNode tree is assembled in a
+ *      single pass.
+ *
+ * The output uses CamelFolderThreadNode so it can be consumed exactly
+ * like a CamelFolderThread tree. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "e-mail-thread-tree.h"
+
+#include <string.h>
+
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+
+/* Don't bother spreading tiny folders across threads. */
+#define MESSAGES_PER_WORKER	4096
+#define MAX_WORKERS		8
+
+/* How often the workers poll the GCancellable. */
+#define CANCEL_CHECK_INTERVAL	1024
+
+typedef struct _Container Container;
+typedef struct _Partition Partition;
+typedef struct _BuildData BuildData;
+typedef struct _WorkerData WorkerData;
+
+typedef void	(*WorkerFunc)		(BuildData *build_data,
+					 guint part);
+
+struct _EMailThreadTree {
+	volatile gint ref_count;
+	guint n_workers;
+	GPtrArray *infos;
+	CamelFolderThreadNode *nodes;
+	CamelFolderThreadNode *root;
+};
+
+struct _Container {
+	gint message;	/* index into infos, or -1 for a phantom */
+	gint parent;	/* global container index, or -1 */
+	gboolean own_parent;	/* parent came from the message itself */
+};
+
+struct _Partition {
+	GHashTable *ids;	/* guint64 * -> local container index + 1 */
+	GArray *containers;
+	guint offset;		/* global index of the first container */
+};
+
+struct _BuildData {
+	GPtrArray *infos;
+	GCancellable *cancellable;
+
+	guint n_parts;
+	Partition *parts;
+
+	/* Per message, filled by the extract step. */
+	const guint64 **message_ids;
+	const CamelSummaryReferences **references;
+	guint *message_part;
+	gint *message_container;	/* local, then global index */
+
+	/* All partitions' containers, concatenated. */
+	Container *containers;
+	guint n_containers;
+};
+
+struct _WorkerData {
+	BuildData *build_data;
+	WorkerFunc func;
+	guint part;
+};
+
+static guint
+thread_tree_default_n_workers (guint n_messages)
+{
+	guint n_workers;
+
+#if GLIB_CHECK_VERSION(2,36,0)
+	n_workers = g_get_num_processors ();
+#elif defined (G_OS_UNIX) && defined (_SC_NPROCESSORS_ONLN)
+	n_workers = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+#else
+	n_workers = 1;
+#endif
+
+	n_workers = MIN (n_workers, MAX_WORKERS);
+	n_workers = MIN (n_workers, n_messages / MESSAGES_PER_WORKER + 1);
+
+	return n_workers;
+}
+
+static gboolean
+thread_tree_check_cancelled (BuildData *build_data,
+                             guint counter)
+{
+	if (counter % CANCEL_CHECK_INTERVAL != 0)
+		return FALSE;
+
+	return g_cancellable_is_cancelled (build_data->cancellable);
+}
+
+static guint
+thread_tree_part_of_id (BuildData *build_data,
+                        guint64 id)
+{
+	/* Camel's message IDs are already hashes of
+	 * the header value, so the low bits will do. */
+	return (guint) (id % build_data->n_parts);
+}
+
+static gpointer
+thread_tree_worker_thread (gpointer user_data)
+{
+	WorkerData *worker_data = user_data;
+
+	worker_data->func (worker_data->build_data, worker_data->part);
+
+	return NULL;
+}
+
+/* Runs func once per partition, in parallel, and waits for all of them. */
+static void
+thread_tree_run_parallel (BuildData *build_data,
+                          WorkerFunc func)
+{
+	GThread **threads;
+	WorkerData *worker_data;
+	guint ii;
+
+	threads = g_new0 (GThread *, build_data->n_parts);
+	worker_data = g_new0 (WorkerData, build_data->n_parts);
+
+	for (ii = 0; ii < build_data->n_parts; ii++) {
+		worker_data[ii].build_data = build_data;
+		worker_data[ii].func = func;
+		worker_data[ii].part = ii;
+	}
+
+	/* The calling thread takes the first partition itself. */
+	for (ii = 1; ii < build_data->n_parts; ii++)
+		threads[ii] = g_thread_new (
+			"mail-thread-tree",
+			thread_tree_worker_thread,
+			&worker_data[ii]);
+
+	thread_tree_worker_thread (&worker_data[0]);
+
+	for (ii = 1; ii < build_data->n_parts; ii++)
+		g_thread_join (threads[ii]);
+
+	g_free (worker_data);
+	g_free (threads);
+}
+
+/* Step 0: pull the IDs out of the message infos. */
+static void
+thread_tree_extract_ids (BuildData *build_data,
+                         guint part)
+{
+	guint ii, first, last, length;
+
+	length = build_data->infos->len;
+	first = (guint64) length * part / build_data->n_parts;
+	last = (guint64) length * (part + 1) / build_data->n_parts;
+
+	for (ii = first; ii < last; ii++) {
+		CamelMessageInfo *info;
+		const CamelSummaryMessageID *message_id;
+		const CamelSummaryReferences *references;
+
+		if (thread_tree_check_cancelled (build_data, ii))
+			return;
+
+		info = g_ptr_array_index (build_data->infos, ii);
+		message_id = camel_message_info_message_id (info);
+		references = camel_message_info_references (info);
+
+		if (message_id != NULL && message_id->id.id != 0)
+			build_data->message_ids[ii] = &message_id->id.id;
+
+		if (references != NULL && references->size > 0)
+			build_data->references[ii] = references;
+
+		/* Messages without a Message-ID are spread evenly. */
+		if (build_data->message_ids[ii] != NULL)
+			build_data->message_part[ii] = thread_tree_part_of_id (
+				build_data, *build_data->message_ids[ii]);
+		else
+			build_data->message_part[ii] =
+				ii % build_data->n_parts;
+	}
+}
+
+static gint
+thread_tree_add_container (Partition *partition,
+                           gint message)
+{
+	Container container;
+
+	container.message = message;
+	container.parent = -1;
+	container.own_parent = FALSE;
+
+	g_array_append_val (partition->containers, container);
+
+	return partition->containers->len - 1;
+}
+
+/* Step 1: build the ID table of one partition. */
+static void
+thread_tree_build_ids (BuildData *build_data,
+                       guint part)
+{
+	Partition *partition;
+	guint ii, length;
+
+	partition = &build_data->parts[part];
+	length = build_data->infos->len;
+
+	for (ii = 0; ii < length; ii++) {
+		const CamelSummaryReferences *references;
+		const guint64 *id;
+		gpointer value;
+		gint jj;
+
+		if (thread_tree_check_cancelled (build_data, ii))
+			return;
+
+		id = build_data->message_ids[ii];
+
+		if (build_data->message_part[ii] == part) {
+			Container *container;
+			gint index = -1;
+
+			value = (id != NULL) ?
+				g_hash_table_lookup (partition->ids, id) : NULL;
+
+			if (value != NULL) {
+				index = GPOINTER_TO_INT (value) - 1;
+				container = &g_array_index (
+					partition->containers,
+					Container, index);
+				/* Seen in a References header
+				 * before, now we have the message. */
+				if (container->message == -1)
+					container->message = ii;
+				else
+					index = -1;  /* duplicate ID */
+			}
+
+			if (index == -1) {
+				index = thread_tree_add_container (
+					partition, ii);
+				if (id != NULL && value == NULL)
+					g_hash_table_insert (
+						partition->ids, (gpointer) id,
+						GINT_TO_POINTER (index + 1));
+			}
+
+			build_data->message_container[ii] = index;
+		}
+
+		references = build_data->references[ii];
+
+		if (references == NULL)
+			continue;
+
+		for (jj = 0; jj < references->size; jj++) {
+			const guint64 *ref_id;
+			gint index;
+
+			ref_id = &references->references[jj].id.id;
+
+			if (*ref_id == 0)
+				continue;
+
+			if (thread_tree_part_of_id (build_data, *ref_id) != part)
+				continue;
+
+			if (g_hash_table_contains (partition->ids, ref_id))
+				continue;
+
+			index = thread_tree_add_container (partition, -1);
+			g_hash_table_insert (
+				partition->ids, (gpointer) ref_id,
+				GINT_TO_POINTER (index + 1));
+		}
+	}
+}
+
+/* Returns the global container index for a Message-ID, or -1.
+ * Only called once all ID tables are complete and read-only. */
+static gint
+thread_tree_lookup (BuildData *build_data,
+                    guint64 id)
+{
+	Partition *partition;
+	gpointer value;
+
+	if (id == 0)
+		return -1;
+
+	partition = &build_data->parts[thread_tree_part_of_id (build_data, id)];
+	value = g_hash_table_lookup (partition->ids, &id);
+
+	if (value == NULL)
+		return -1;
+
+	return partition->offset + GPOINTER_TO_INT (value) - 1;
+}
+
+/* Step 2: link the containers of one partition to their parents.
+ * Camel keeps References nearest first, so a message's parent is
+ * references[0] and each reference is a child of the one after it.
+ * Messages are visited in order and a link implied by a References
+ * header only sticks if the container has no parent yet, while the
+ * message's own References always win; the outcome depends only on
+ * the message order, hence the same result on any number of workers. */
+static void
+thread_tree_link (BuildData *build_data,
+                  guint part)
+{
+	Container *containers;
+	guint ii, length;
+
+	containers = build_data->containers;
+	length = build_data->infos->len;
+
+	for (ii = 0; ii < length; ii++) {
+		const CamelSummaryReferences *references;
+		gint jj;
+
+		if (thread_tree_check_cancelled (build_data, ii))
+			return;
+
+		references = build_data->references[ii];
+
+		if (build_data->message_part[ii] == part) {
+			Container *container;
+			gint parent = -1;
+
+			container = &containers[build_data->message_container[ii]];
+
+			if (references != NULL)
+				parent = thread_tree_lookup (
+					build_data,
+					references->references[0].id.id);
+
+			if (parent == build_data->message_container[ii])
+				parent = -1;
+
+			container->parent = parent;
+			container->own_parent = TRUE;
+		}
+
+		if (references == NULL)
+			continue;
+
+		for (jj = 0; jj + 1 < references->size; jj++) {
+			Container *container;
+			guint64 child_id;
+			gint child, parent;
+
+			child_id = references->references[jj].id.id;
+
+			if (child_id == 0)
+				continue;
+
+			if (thread_tree_part_of_id (build_data, child_id) != part)
+				continue;
+
+			child = thread_tree_lookup (build_data, child_id);
+			container = &containers[child];
+
+			if (container->own_parent || container->parent != -1)
+				continue;
+
+			parent = thread_tree_lookup (
+				build_data,
+				references->references[jj + 1].id.id);
+
+			if (parent != child)
+				container->parent = parent;
+		}
+	}
+}
+
+/* Step 3a: make sure following parent links always terminates. */
+static void
+thread_tree_break_loops (BuildData *build_data)
+{
+	Container *containers;
+	guint8 *state;
+	guint ii;
+
+	containers = build_data->containers;
+
+	/* 0 = not visited, 1 = on the current path, 2 = done */
+	state = g_new0 (guint8, build_data->n_containers);
+
+	for (ii = 0; ii < build_data->n_containers; ii++) {
+		gint index = ii;
+
+		while (index != -1 && state[index] == 0) {
+			state[index] = 1;
+			index = containers[index].parent;
+		}
+
+		/* Walked into our own path, so cut the loop there. */
+		if (index != -1 && state[index] == 1)
+			containers[index].parent = -1;
+
+		index = ii;
+
+		while (index != -1 && state[index] == 1) {
+			state[index] = 2;
+			index = containers[index].parent;
+		}
+	}
+
+	g_free (state);
+}
+
+/* Step 3b: find each container's nearest ancestor that holds a
+ * message, so phantom containers drop out of the final tree. */
+static gint *
+thread_tree_resolve_parents (BuildData *build_data)
+{
+	Container *containers;
+	GArray *path;
+	gint *resolved;
+	guint ii;
+
+	containers = build_data->containers;
+
+	resolved = g_new (gint, build_data->n_containers);
+	for (ii = 0; ii < build_data->n_containers; ii++)
+		resolved[ii] = -2;  /* not resolved yet */
+
+	path = g_array_new (FALSE, FALSE, sizeof (gint));
+
+	for (ii = 0; ii < build_data->n_containers; ii++) {
+		gint index = ii;
+		gint result;
+		guint jj;
+
+		if (resolved[ii] != -2)
+			continue;
+
+		g_array_set_size (path, 0);
+
+		while (TRUE) {
+			gint parent = containers[index].parent;
+
+			g_array_append_val (path, index);
+
+			if (parent == -1) {
+				result = -1;
+				break;
+			}
+
+			if (containers[parent].message != -1) {
+				result = parent;
+				break;
+			}
+
+			if (resolved[parent] != -2) {
+				result = resolved[parent];
+				break;
+			}
+
+			index = parent;
+		}
+
+		/* Everything between here and the result is a phantom. */
+		for (jj = 0; jj < path->len; jj++)
+			resolved[g_array_index (path, gint, jj)] = result;
+	}
+
+	g_array_free (path, TRUE);
+
+	return resolved;
+}
+
+/* Step 3c: assemble the CamelFolderThreadNode tree.  Visiting messages
+ * in order keeps siblings in the order of the UID array we were given. */
+static void
+thread_tree_assemble (BuildData *build_data,
+                      EMailThreadTree *thread_tree,
+                      const gint *resolved)
+{
+	CamelFolderThreadNode **last_child;
+	CamelFolderThreadNode *last_root = NULL;
+	guint ii, length;
+
+	length = build_data->infos->len;
+
+	thread_tree->nodes = g_new0 (CamelFolderThreadNode, length);
+	last_child = g_new0 (CamelFolderThreadNode *, length);
+
+	for (ii = 0; ii < length; ii++) {
+		CamelFolderThreadNode *node;
+		gint parent;
+
+		node = &thread_tree->nodes[ii];
+		node->message = g_ptr_array_index (build_data->infos, ii);
+		node->order = ii;
+
+		parent = resolved[build_data->message_container[ii]];
+
+		if (parent == -1) {
+			if (last_root != NULL)
+				last_root->next = node;
+			else
+				thread_tree->root = node;
+			last_root = node;
+		} else {
+			gint parent_message;
+
+			parent_message = build_data->containers[parent].message;
+			node->parent = &thread_tree->nodes[parent_message];
+
+			if (last_child[parent_message] != NULL)
+				last_child[parent_message]->next = node;
+			else
+				node->parent->child = node;
+			last_child[parent_message] = node;
+		}
+	}
+
+	g_free (last_child);
+}
+
+static void
+thread_tree_concat_containers (BuildData *build_data)
+{
+	guint ii, offset = 0;
+
+	for (ii = 0; ii < build_data->n_parts; ii++) {
+		build_data->parts[ii].offset = offset;
+		offset += build_data->parts[ii].containers->len;
+	}
+
+	build_data->n_containers = offset;
+	build_data->containers = g_new (Container, MAX (offset, 1));
+
+	for (ii = 0; ii < build_data->n_parts; ii++) {
+		Partition *partition = &build_data->parts[ii];
+
+		if (partition->containers->len == 0)
+			continue;
+
+		memcpy (
+			build_data->containers + partition->offset,
+			partition->containers->data,
+			partition->containers->len * sizeof (Container));
+	}
+
+	for (ii = 0; ii < build_data->infos->len; ii++) {
+		guint part = build_data->message_part[ii];
+
+		build_data->message_container[ii] +=
+			build_data->parts[part].offset;
+	}
+}
+
+static void
+thread_tree_build_data_clear (BuildData *build_data)
+{
+	guint ii;
+
+	for (ii = 0; ii < build_data->n_parts; ii++) {
+		g_hash_table_destroy (build_data->parts[ii].ids);
+		g_array_free (build_data->parts[ii].containers, TRUE);
+	}
+
+	g_free (build_data->parts);
+	g_free (build_data->message_ids);
+	g_free (build_data->references);
+	g_free (build_data->message_part);
+	g_free (build_data->message_container);
+	g_free (build_data->containers);
+}
+
+/**
+ * e_mail_thread_tree_new_sync:
+ * @folder: a #CamelFolder
+ * @uids: UIDs of the messages to thread, in display order
+ * @cancellable: optional #GCancellable object, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Fetches the message infos for @uids from @folder and threads them
+ * with e_mail_thread_tree_new_for_infos().
+ *
+ * Returns: a new #EMailThreadTree, or %NULL on error or cancellation
+ **/
+EMailThreadTree *
+e_mail_thread_tree_new_sync (CamelFolder *folder,
+                             GPtrArray *uids,
+                             GCancellable *cancellable,
+                             GError **error)
+{
+	EMailThreadTree *thread_tree;
+	GPtrArray *infos;
+	guint ii;
+
+	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), NULL);
+	g_return_val_if_fail (uids != NULL, NULL);
+
+	infos = g_ptr_array_new_full (
+		uids->len, (GDestroyNotify) camel_message_info_free);
+
+	camel_folder_summary_prepare_fetch_all (folder->summary, NULL);
+
+	for (ii = 0; ii < uids->len; ii++) {
+		CamelMessageInfo *info;
+
+		if (ii % CANCEL_CHECK_INTERVAL == 0 &&
+		    g_cancellable_set_error_if_cancelled (cancellable, error)) {
+			g_ptr_array_unref (infos);
+			return NULL;
+		}
+
+		info = camel_folder_get_message_info (folder, uids->pdata[ii]);
+		if (info != NULL)
+			g_ptr_array_add (infos, info);
+	}
+
+	thread_tree = e_mail_thread_tree_new_for_infos (
+		infos, 0, cancellable, error);
+
+	g_ptr_array_unref (infos);
+
+	return thread_tree;
+}
+
+/**
+ * e_mail_thread_tree_new_for_infos:
+ * @infos: a #GPtrArray of #CamelMessageInfo, in display order
+ * @n_workers: number of threads to use, or 0 to pick one
+ * @cancellable: optional #GCancellable object, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Threads @infos by their References and In-Reply-To headers.  The
+ * work is split over @n_workers threads; the resulting tree is the
+ * same for any number of workers.  Siblings keep their relative order
+ * from @infos.  The returned tree holds a reference on @infos.
+ *
+ * Returns: a new #EMailThreadTree, or %NULL if cancelled
+ **/
+EMailThreadTree *
+e_mail_thread_tree_new_for_infos (GPtrArray *infos,
+                                  guint n_workers,
+                                  GCancellable *cancellable,
+                                  GError **error)
+{
+	EMailThreadTree *thread_tree = NULL;
+	BuildData build_data;
+	gint *resolved;
+	guint ii, length;
+
+	g_return_val_if_fail (infos != NULL, NULL);
+
+	length = infos->len;
+
+	if (n_workers == 0)
+		n_workers = thread_tree_default_n_workers (length);
+
+	memset (&build_data, 0, sizeof (BuildData));
+	build_data.infos = infos;
+	build_data.cancellable = cancellable;
+	build_data.n_parts = n_workers;
+	build_data.parts = g_new0 (Partition, n_workers);
+
+	for (ii = 0; ii < n_workers; ii++) {
+		build_data.parts[ii].ids =
+			g_hash_table_new (g_int64_hash, g_int64_equal);
+		build_data.parts[ii].containers =
+			g_array_new (FALSE, FALSE, sizeof (Container));
+	}
+
+	build_data.message_ids = g_new0 (const guint64 *, length);
+	build_data.references = g_new0 (const CamelSummaryReferences *, length);
+	build_data.message_part = g_new0 (guint, length);
+	build_data.message_container = g_new0 (gint, length);
+
+	thread_tree_run_parallel (&build_data, thread_tree_extract_ids);
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		goto exit;
+
+	thread_tree_run_parallel (&build_data, thread_tree_build_ids);
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		goto exit;
+
+	thread_tree_concat_containers (&build_data);
+
+	thread_tree_run_parallel (&build_data, thread_tree_link);
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		goto exit;
+
+	thread_tree_break_loops (&build_data);
+	resolved = thread_tree_resolve_parents (&build_data);
+
+	thread_tree = g_slice_new0 (EMailThreadTree);
+	thread_tree->ref_count = 1;
+	thread_tree->n_workers = n_workers;
+	thread_tree->infos = g_ptr_array_ref (infos);
+
+	thread_tree_assemble (&build_data, thread_tree, resolved);
+
+	g_free (resolved);
+
+exit:
+	thread_tree_build_data_clear (&build_data);
+
+	return thread_tree;
+}
+
+EMailThreadTree *
+e_mail_thread_tree_ref (EMailThreadTree *thread_tree)
+{
+	g_return_val_if_fail (thread_tree != NULL, NULL);
+	g_return_val_if_fail (thread_tree->ref_count > 0, NULL);
+
+	g_atomic_int_inc (&thread_tree->ref_count);
+
+	return thread_tree;
+}
+
+void
+e_mail_thread_tree_unref (EMailThreadTree *thread_tree)
+{
+	g_return_if_fail (thread_tree != NULL);
+	g_return_if_fail (thread_tree->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test (&thread_tree->ref_count)) {
+		g_free (thread_tree->nodes);
+		g_ptr_array_unref (thread_tree->infos);
+
+		g_slice_free (EMailThreadTree, thread_tree);
+	}
+}
+
+/**
+ * e_mail_thread_tree_get_root:
+ * @thread_tree: an #EMailThreadTree
+ *
+ * Returns the first top-level node of @thread_tree.  The remaining
+ * top-level nodes follow through the node's next pointer.  The nodes
+ * are owned by @thread_tree.
+ *
+ * Returns: the first top-level node, or %NULL if @thread_tree is empty
+ **/
+CamelFolderThreadNode *
+e_mail_thread_tree_get_root (EMailThreadTree *thread_tree)
+{
+	g_return_val_if_fail (thread_tree != NULL, NULL);
+
+	return thread_tree->root;
+}
+
+guint
+e_mail_thread_tree_get_length (EMailThreadTree *thread_tree)
+{
+	g_return_val_if_fail (thread_tree != NULL, 0);
+
+	return thread_tree->infos->len;
+}
+
+/**
+ * e_mail_thread_tree_get_n_workers:
+ * @thread_tree: an #EMailThreadTree
+ *
+ * Returns the number of threads @thread_tree was built with.
+ *
+ * Returns: the number of worker threads used
+ **/
+guint
+e_mail_thread_tree_get_n_workers (EMailThreadTree *thread_tree)
+{
+	g_return_val_if_fail (thread_tree != NULL, 0);
+
+	return thread_tree->n_workers;
+}
@@ -0,0 +1,50 @@
+/*
+ * e-mail-thread-tree.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef E_MAIL_THREAD_TREE_H
+#define E_MAIL_THREAD_TREE_H
+
+#include <camel/camel.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EMailThreadTree EMailThreadTree;
+
+EMailThreadTree *
+		e_mail_thread_tree_new_sync	(CamelFolder *folder,
+						 GPtrArray *uids,
+						 GCancellable *cancellable,
+						 GError **error);
+EMailThreadTree *
+		e_mail_thread_tree_new_for_infos
+						(GPtrArray *infos,
+						 guint n_workers,
+						 GCancellable *cancellable,
+						 GError **error);
+EMailThreadTree *
+		e_mail_thread_tree_ref		(EMailThreadTree *thread_tree);
+void		e_mail_thread_tree_unref	(EMailThreadTree *thread_tree);
+CamelFolderThreadNode *
+		e_mail_thread_tree_get_root	(EMailThreadTree *thread_tree);
+guint		e_mail_thread_tree_get_length	(EMailThreadTree *thread_tree);
+guint		e_mail_thread_tree_get_n_workers
+						(EMailThreadTree *thread_tree);
+
+G_END_DECLS
+
+#endif /* E_MAIL_THREAD_TREE_H */
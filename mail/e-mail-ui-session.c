@@ -415,7 +415,7 @@ main_get_filter_driver (CamelSession *session,
 		&& camel_session_get_check_junk (session)) {
 
 		/* implicit junk check as 1st rule */
-		camel_filter_driver_add_rule (
+		mail_filter_driver_add_rule (
 			driver, "Junk check", "(junk-test)",
 			"(begin (set-system-flag \"junk\"))");
 	}
@@ -438,10 +438,11 @@ main_get_filter_driver (CamelSession *session,
 			if (!rule->enabled)
 				continue;
 
-			e_filter_rule_build_code (rule, fsearch);
+			em_filter_rule_build_match (
+				EM_FILTER_RULE (rule), fsearch);
 			em_filter_rule_build_action (
 				EM_FILTER_RULE (rule), faction);
-			camel_filter_driver_add_rule (
+			mail_filter_driver_add_rule (
 				driver, rule->name,
 				fsearch->str, faction->str);
 		}
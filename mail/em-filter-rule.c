@@ -30,6 +30,10 @@
 #include <gtk/gtk.h>
 #include <glib/gi18n.h>
 
+#include <camel/camel.h>
+
+#include <libemail-engine/e-mail-sexp.h>
+
 #include "em-filter-rule.h"
 #include "em-filter-context.h"
 
@@ -135,6 +139,238 @@ em_filter_rule_build_action (EMFilterRule *fr,
 	g_string_append (out, ")\n");
 }
 
+/* The match code of a filter rule is evaluated by the filter driver
+ * once for every rule and every message, so it pays to hand it the
+ * cheapest equivalent expression.  The code is read back into a
+ * small tree and rewritten:
+ *
+ *  - (match-all X) becomes X, match-all is a no-op on a single message;
+ *  - nested (and) and (or) terms are flattened and duplicates dropped;
+ *  - within an (or), header tests of the same kind on the same header
+ *    are merged into one call taking all the values, so the header is
+ *    looked up and decoded once instead of once per value.
+ *
+ * Anything that does not parse is passed through unchanged. */
+
+static const gchar *mergeable_header_tests[] = {
+	"header-contains",
+	"header-matches",
+	"header-starts-with",
+	"header-ends-with",
+	"header-soundex"
+};
+
+/* Returns a key identifying the header test, or NULL if the node
+ * is not a header test with only literal string arguments. */
+static gchar *
+code_node_header_test_key (EMailSExpNode *node)
+{
+	const gchar *function;
+	EMailSExpNode *header;
+	gchar *header_name, *key;
+	gboolean mergeable = FALSE;
+	guint ii;
+
+	function = e_mail_sexp_node_get_function (node);
+	if (function == NULL || node->children->len < 3)
+		return NULL;
+
+	for (ii = 0; ii < G_N_ELEMENTS (mergeable_header_tests); ii++)
+		if (g_str_equal (function, mergeable_header_tests[ii]))
+			mergeable = TRUE;
+
+	if (!mergeable)
+		return NULL;
+
+	for (ii = 1; ii < node->children->len; ii++) {
+		EMailSExpNode *child = node->children->pdata[ii];
+
+		if (child->type != E_MAIL_SEXP_STRING)
+			return NULL;
+	}
+
+	/* Header names are not case sensitive. */
+	header = node->children->pdata[1];
+	header_name = g_ascii_strdown (header->value, -1);
+	key = g_strconcat (function, " ", header_name, NULL);
+	g_free (header_name);
+
+	return key;
+}
+
+static EMailSExpNode *
+code_simplify (EMailSExpNode *node)
+{
+	const gchar *function;
+	GPtrArray *children;
+	GHashTable *seen;
+	GHashTable *header_tests;
+	gboolean is_or;
+	guint ii;
+
+	if (node->type != E_MAIL_SEXP_LIST)
+		return node;
+
+	for (ii = 0; ii < node->children->len; ii++)
+		node->children->pdata[ii] =
+			code_simplify (node->children->pdata[ii]);
+
+	function = e_mail_sexp_node_get_function (node);
+
+	if (g_strcmp0 (function, "match-all") == 0 &&
+	    node->children->len == 2) {
+		EMailSExpNode *child = node->children->pdata[1];
+
+		node->children->pdata[1] = NULL;
+		e_mail_sexp_node_free (node);
+
+		return child;
+	}
+
+	if (g_strcmp0 (function, "and") != 0 &&
+	    g_strcmp0 (function, "or") != 0)
+		return node;
+
+	is_or = g_str_equal (function, "or");
+
+	/* Rebuild the argument list, flattening nested terms of the
+	 * same kind and dropping repeated ones.  The order of the
+	 * remaining terms is kept, (and) and (or) short-circuit. */
+	children = g_ptr_array_new ();
+	seen = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+	header_tests = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+
+	g_ptr_array_add (children, node->children->pdata[0]);
+
+	for (ii = 1; ii < node->children->len; ii++) {
+		EMailSExpNode *child = node->children->pdata[ii];
+		GPtrArray *terms;
+		guint jj;
+
+		if (g_strcmp0 (e_mail_sexp_node_get_function (child), function) == 0) {
+			/* Take over the nested term's arguments. */
+			terms = child->children;
+			g_ptr_array_remove_index (terms, 0);
+			g_ptr_array_set_free_func (terms, NULL);
+			child->children = NULL;
+			e_mail_sexp_node_free (child);
+		} else {
+			terms = g_ptr_array_new ();
+			g_ptr_array_add (terms, child);
+		}
+
+		for (jj = 0; jj < terms->len; jj++) {
+			EMailSExpNode *term = terms->pdata[jj];
+			EMailSExpNode *merged;
+			GString *text;
+			gchar *key;
+
+			text = g_string_new (NULL);
+			e_mail_sexp_write (term, text);
+
+			if (g_hash_table_contains (seen, text->str)) {
+				g_string_free (text, TRUE);
+				e_mail_sexp_node_free (term);
+				continue;
+			}
+
+			g_hash_table_add (seen, g_string_free (text, FALSE));
+
+			key = is_or ? code_node_header_test_key (term) : NULL;
+			merged = key ? g_hash_table_lookup (header_tests, key) : NULL;
+
+			if (merged != NULL) {
+				guint kk;
+
+				for (kk = 2; kk < term->children->len; kk++) {
+					g_ptr_array_add (
+						merged->children,
+						term->children->pdata[kk]);
+					term->children->pdata[kk] = NULL;
+				}
+				g_ptr_array_set_size (term->children, 2);
+				e_mail_sexp_node_free (term);
+				g_free (key);
+			} else {
+				if (key != NULL)
+					g_hash_table_insert (header_tests, key, term);
+				g_ptr_array_add (children, term);
+			}
+		}
+
+		g_ptr_array_free (terms, TRUE);
+	}
+
+	g_hash_table_destroy (seen);
+	g_hash_table_destroy (header_tests);
+
+	/* The children now belong to the new list. */
+	g_ptr_array_set_free_func (node->children, NULL);
+	g_ptr_array_free (node->children, TRUE);
+	node->children = children;
+	g_ptr_array_set_free_func (
+		node->children, (GDestroyNotify) e_mail_sexp_node_free);
+
+	if (node->children->len == 2) {
+		EMailSExpNode *child = node->children->pdata[1];
+
+		node->children->pdata[1] = NULL;
+		e_mail_sexp_node_free (node);
+
+		return child;
+	}
+
+	return node;
+}
+
+/**
+ * em_filter_rule_build_match:
+ * @fr: an #EMFilterRule
+ * @out: a #GString to append to
+ *
+ * Like e_filter_rule_build_code(), but simplifies the code for
+ * evaluation on single messages by a #CamelFilterDriver.
+ **/
+void
+em_filter_rule_build_match (EMFilterRule *fr,
+                            GString *out)
+{
+	GString *code;
+	EMailSExpNode *node;
+	const gchar *p;
+
+	code = g_string_new (NULL);
+	e_filter_rule_build_code (E_FILTER_RULE (fr), code);
+
+	p = code->str;
+	node = e_mail_sexp_parse (&p);
+
+	while (node != NULL && g_ascii_isspace (*p))
+		p++;
+
+	/* Leave anything we don't fully understand alone. */
+	if (node == NULL || *p != '\0') {
+		g_string_append (out, code->str);
+	} else {
+		node = code_simplify (node);
+		e_mail_sexp_write (node, out);
+		g_string_append_c (out, '\n');
+	}
+
+	if (node != NULL)
+		e_mail_sexp_node_free (node);
+
+	g_string_free (code, TRUE);
+}
+
 static gint
 validate (EFilterRule *fr,
           EAlert **alert)
@@ -57,5 +57,6 @@ void            em_filter_rule_remove_action  (EMFilterRule *fr, EFilterPart *fp
 void            em_filter_rule_replace_action (EMFilterRule *fr, EFilterPart *fp, EFilterPart *new);
 
 void            em_filter_rule_build_action   (EMFilterRule *fr, GString *out);
+void            em_filter_rule_build_match    (EMFilterRule *fr, GString *out);
 
 #endif /* EM_FILTER_RULE_H */
@@ -434,11 +434,14 @@ em_folder_tree_model_class_init (EMFolderTreeModelClass *class)
 		G_TYPE_POINTER);
 }
 
+/* Ancestor rows are collected in changed_parents, by path string,
+ * so the caller can signal each of them once for a whole batch. */
 static void
 folder_tree_model_set_unread_count (EMFolderTreeModel *model,
                                     CamelStore *store,
                                     const gchar *full,
-                                    gint unread)
+                                    gint unread,
+                                    GHashTable *changed_parents)
 {
 	EMFolderTreeModelStoreInfo *si;
 	GtkTreeRowReference *reference;
@@ -478,15 +481,64 @@ folder_tree_model_set_unread_count (EMFolderTreeModel *model,
 		COL_UINT_UNREAD, unread,
 		COL_UINT_UNREAD_LAST_SEL, MIN (old_unread, unread), -1);
 
+	while (gtk_tree_model_iter_parent (tree_model, &parent, &iter)) {
+		gchar *path_string;
+
+		path_string = gtk_tree_model_get_string_from_iter (
+			tree_model, &parent);
+
+		/* Its ancestors are in there already, too. */
+		if (g_hash_table_contains (changed_parents, path_string)) {
+			g_free (path_string);
+			break;
+		}
+
+		g_hash_table_add (changed_parents, path_string);
+		iter = parent;
+	}
+}
+
+static void
+folder_tree_model_folders_unread_updated (EMFolderTreeModel *model,
+                                          GPtrArray *counts)
+{
+	GtkTreeModel *tree_model;
+	GHashTable *changed_parents;
+	GHashTableIter hash_iter;
+	gpointer key;
+	guint ii;
+
+	tree_model = GTK_TREE_MODEL (model);
+
+	changed_parents = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+
+	for (ii = 0; ii < counts->len; ii++) {
+		MailFolderCacheUnread *unread = counts->pdata[ii];
+
+		folder_tree_model_set_unread_count (
+			model, unread->store, unread->folder_name,
+			unread->unread, changed_parents);
+	}
+
 	/* Folders are displayed with a bold weight to indicate that
 	 * they contain unread messages.  We signal that parent rows
-	 * have changed here to update them. */
-	while (gtk_tree_model_iter_parent (tree_model, &parent, &iter)) {
-		path = gtk_tree_model_get_path (tree_model, &parent);
-		gtk_tree_model_row_changed (tree_model, path, &parent);
+	 * have changed here to update them, once per row. */
+	g_hash_table_iter_init (&hash_iter, changed_parents);
+	while (g_hash_table_iter_next (&hash_iter, &key, NULL)) {
+		GtkTreePath *path;
+		GtkTreeIter iter;
+
+		path = gtk_tree_path_new_from_string (key);
+		if (gtk_tree_model_get_iter (tree_model, &iter, path))
+			gtk_tree_model_row_changed (tree_model, path, &iter);
 		gtk_tree_path_free (path);
-		iter = parent;
 	}
+
+	g_hash_table_destroy (changed_parents);
 }
 
 static void
@@ -624,8 +676,8 @@ em_folder_tree_model_set_session (EMFolderTreeModel *model,
 			model);
 
 		g_signal_connect_swapped (
-			folder_cache, "folder-unread-updated",
-			G_CALLBACK (folder_tree_model_set_unread_count),
+			folder_cache, "folders-unread-updated",
+			G_CALLBACK (folder_tree_model_folders_unread_updated),
 			model);
 	}
 
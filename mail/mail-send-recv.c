@@ -1154,6 +1154,7 @@ receive_update_got_folderinfo (GObject *source_object,
 		m = mail_msg_new (&refresh_folders_info);
 		m->store = g_object_ref (send_info->service);
 		m->folders = folders;
+		mail_msg_set_service (m, send_info->service);
 		m->info = send_info;
 		m->finfo = info;  /* takes ownership */
 
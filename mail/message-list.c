@@ -38,6 +38,7 @@
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 
+#include "libemail-engine/e-mail-search-index.h"
 #include "libemail-engine/e-mail-utils.h"
 #include "libemail-engine/mail-config.h"
 #include "libemail-engine/mail-mt.h"
@@ -45,6 +46,7 @@
 #include "libemail-engine/mail-tools.h"
 
 #include "e-mail-label-list-store.h"
+#include "e-mail-thread-tree.h"
 #include "e-mail-ui-session.h"
 #include "em-utils.h"
 
@@ -79,6 +81,25 @@
 #define EXCLUDE_DELETED_MESSAGES_EXPR	"(not (system-flag \"deleted\"))"
 #define EXCLUDE_JUNK_MESSAGES_EXPR	"(not (system-flag \"junk\"))"
 
+/* Folder changes adding or removing more messages than this
+ * are handled by regenerating the whole message list instead
+ * of patching the existing tree node by node. */
+#define MAX_INCREMENTAL_CHANGES 100
+
+/* Message infos stay referenced by the tree nodes that were used last,
+ * up to this many once the current main loop iteration is over.  Other
+ * nodes only keep the UID and fetch their info again when needed, so
+ * Camel is free to drop it from memory meanwhile. */
+#define INFO_WINDOW_SIZE 2048
+
+/* After this many info fetches in one go (a sort, say) load the whole
+ * summary at once instead of one message at a time. */
+#define INFO_MISSES_BEFORE_FETCH_ALL 64
+
+/* Folds a 64-bit Message-ID hash into a pointer-sized hash key. */
+#define ML_MSGID_KEY(id) \
+	GSIZE_TO_POINTER ((gsize) ((id) ^ ((id) >> 32)))
+
 typedef struct _ExtendedGNode ExtendedGNode;
 typedef struct _RegenData RegenData;
 
@@ -100,9 +121,32 @@ struct _MessageListPrivate {
 	RegenData *regen_data;
 	guint regen_idle_id;
 
+	/* Folder changes received while a regen is running.
+	 * Guarded by regen_lock, applied once it finishes. */
+	CamelFolderChangeInfo *pending_changes;
+
 	GMutex thread_tree_lock;
 	CamelFolderThread *thread_tree;
 
+	/* Message-ID -> tree node, for threading new messages
+	 * into the existing tree without rebuilding it. */
+	GHashTable *msgid_nodemap;
+
+	/* Message-IDs referenced by listed messages but not listed
+	 * themselves.  A message arriving with one of these has to
+	 * become the parent of existing rows, which only a full regen
+	 * does.  Keys are folded with ML_MSGID_KEY; a collision just
+	 * costs an unnecessary full regen. */
+	GHashTable *missing_msgids;
+
+	/* Nodes holding a reference on their message info, most
+	 * recently used first.  Trimmed to INFO_WINDOW_SIZE from
+	 * an idle callback, so infos handed out stay valid for the
+	 * rest of the main loop iteration. */
+	GQueue info_window;
+	guint info_window_trim_id;
+	guint info_misses;
+
 	struct _MLSelection clipboard;
 	gboolean destroyed;
 
@@ -132,9 +176,14 @@ struct _MessageListPrivate {
 /* XXX Plain GNode suffers from O(N) tail insertions, and that won't
  *     do for large mail folders.  This structure extends GNode with
  *     a pointer to its last child, so we get O(1) tail insertions. */
+/* The GNode's data is the message's CamelMessageInfo while the node is
+ * in the info window, NULL otherwise; use get_message_info() for it. */
 struct _ExtendedGNode {
 	GNode gnode;
 	GNode *last_child;
+	const gchar *uid;	/* camel_pstring */
+	guint64 message_id;
+	GList window_link;	/* in info_window while data is set */
 };
 
 struct _RegenData {
@@ -148,12 +197,21 @@ struct _RegenData {
 	gboolean group_by_threads;
 	gboolean thread_subject;
 
+	/* Subject threading still goes through CamelFolderThread,
+	 * plain reference threading uses the parallel EMailThreadTree. */
 	CamelFolderThread *thread_tree;
+	EMailThreadTree *reply_tree;
 
 	/* This indicates we're regenerating the message list because
 	 * we received a "folder-changed" signal from our CamelFolder. */
 	gboolean folder_changed;
 
+	/* If set, only the UIDs in this change set are re-tested against
+	 * the search and patched into the existing tree.  The results go
+	 * to 'summary' (UIDs to add or refresh) and 'removed_uids'. */
+	CamelFolderChangeInfo *changes;
+	GPtrArray *removed_uids;
+
 	CamelFolder *folder;
 	GPtrArray *summary;
 
@@ -280,8 +338,16 @@ static gint	on_click			(ETree *tree,
 static void	mail_regen_list			(MessageList *message_list,
 						 const gchar *search,
 						 gboolean folder_changed);
+static void	mail_regen_changes		(MessageList *message_list,
+						 CamelFolderChangeInfo *changes);
 static void	mail_regen_cancel		(MessageList *message_list);
 
+static void	ml_node_set_info		(MessageList *message_list,
+						 GNode *node,
+						 CamelMessageInfo *info);
+static gboolean	ml_node_release_info_cb		(GNode *node,
+						 gpointer user_data);
+
 static void	clear_info			(gchar *key,
 						 GNode *node,
 						 MessageList *message_list);
@@ -386,6 +452,7 @@ extended_g_nodes_free (GNode *node)
 		GNode *next = node->next;
 		if (node->children != NULL)
 			extended_g_nodes_free (node->children);
+		camel_pstring_free (((ExtendedGNode *) node)->uid);
 		g_slice_free (ExtendedGNode, (ExtendedGNode *) node);
 		node = next;
 	}
@@ -505,10 +572,19 @@ regen_data_unref (RegenData *regen_data)
 
 		g_free (regen_data->search);
 
+		if (regen_data->changes != NULL)
+			camel_folder_change_info_free (regen_data->changes);
+
+		if (regen_data->removed_uids != NULL)
+			g_ptr_array_free (regen_data->removed_uids, TRUE);
+
 		if (regen_data->thread_tree != NULL)
 			camel_folder_thread_messages_unref (
 				regen_data->thread_tree);
 
+		if (regen_data->reply_tree != NULL)
+			e_mail_thread_tree_unref (regen_data->reply_tree);
+
 		if (regen_data->summary != NULL) {
 			guint ii, length;
 
@@ -629,7 +705,25 @@ message_list_tree_model_insert (MessageList *message_list,
 	if (!tree_model_frozen)
 		e_tree_model_pre_change (tree_model);
 
-	node = extended_g_node_new (data);
+	node = extended_g_node_new (NULL);
+
+	/* Set up the node before anyone is told about it. */
+	if (data != NULL) {
+		ExtendedGNode *ext_node = (ExtendedGNode *) node;
+		CamelMessageInfo *info = data;
+		const CamelSummaryMessageID *message_id;
+
+		ext_node->uid = camel_pstring_strdup (
+			camel_message_info_uid (info));
+
+		message_id = camel_message_info_message_id (info);
+		if (message_id != NULL)
+			ext_node->message_id = message_id->id.id;
+
+		camel_folder_ref_message_info (
+			message_list->priv->folder, info);
+		ml_node_set_info (message_list, node, info);
+	}
 
 	if (parent != NULL) {
 		extended_g_node_insert (parent, position, node);
@@ -669,6 +763,10 @@ message_list_tree_model_remove (MessageList *message_list,
 		e_tree_model_node_removed (
 			tree_model, parent, node, old_position);
 
+	g_node_traverse (
+		node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+		ml_node_release_info_cb, message_list);
+
 	extended_g_node_destroy (node);
 
 	if (node == message_list->priv->tree_model_root)
@@ -717,22 +815,123 @@ get_message_uid (MessageList *message_list,
                  GNode *node)
 {
 	g_return_val_if_fail (node != NULL, NULL);
-	g_return_val_if_fail (node->data != NULL, NULL);
+	g_return_val_if_fail (((ExtendedGNode *) node)->uid != NULL, NULL);
+
+	return ((ExtendedGNode *) node)->uid;
+}
+
+/* Drops the node's reference on its message info, if it holds one. */
+static void
+ml_node_release_info (MessageList *message_list,
+                      GNode *node)
+{
+	ExtendedGNode *ext_node = (ExtendedGNode *) node;
+
+	if (node->data == NULL)
+		return;
+
+	g_queue_unlink (
+		&message_list->priv->info_window,
+		&ext_node->window_link);
+
+	if (message_list->priv->folder != NULL)
+		camel_folder_free_message_info (
+			message_list->priv->folder, node->data);
+	else
+		camel_message_info_free (node->data);
+
+	node->data = NULL;
+}
+
+static gboolean
+ml_node_release_info_cb (GNode *node,
+                         gpointer user_data)
+{
+	ml_node_release_info (MESSAGE_LIST (user_data), node);
+
+	return FALSE;
+}
+
+static gboolean
+ml_info_window_trim_cb (gpointer user_data)
+{
+	MessageList *message_list = MESSAGE_LIST (user_data);
+	GQueue *info_window = &message_list->priv->info_window;
+
+	while (g_queue_get_length (info_window) > INFO_WINDOW_SIZE) {
+		GList *link = g_queue_peek_tail_link (info_window);
+
+		ml_node_release_info (message_list, link->data);
+	}
+
+	message_list->priv->info_window_trim_id = 0;
+	message_list->priv->info_misses = 0;
 
-	return camel_message_info_uid (node->data);
+	return FALSE;
+}
+
+/* Makes the node hold @info (taking over the caller's reference)
+ * and moves it to the front of the info window. */
+static void
+ml_node_set_info (MessageList *message_list,
+                  GNode *node,
+                  CamelMessageInfo *info)
+{
+	ExtendedGNode *ext_node = (ExtendedGNode *) node;
+	GQueue *info_window = &message_list->priv->info_window;
+
+	ml_node_release_info (message_list, node);
+
+	node->data = info;
+	ext_node->window_link.data = node;
+	g_queue_push_head_link (info_window, &ext_node->window_link);
+
+	if (g_queue_get_length (info_window) > INFO_WINDOW_SIZE &&
+	    message_list->priv->info_window_trim_id == 0)
+		message_list->priv->info_window_trim_id = g_idle_add (
+			ml_info_window_trim_cb, message_list);
 }
 
 /* Gets the CamelMessageInfo for the message displayed at the given
- * view row.
+ * view row, fetching it from the folder if the node let go of it.
+ * The info stays valid until the main loop runs again.
  */
 static CamelMessageInfo *
 get_message_info (MessageList *message_list,
                   GNode *node)
 {
+	ExtendedGNode *ext_node = (ExtendedGNode *) node;
+	GQueue *info_window = &message_list->priv->info_window;
+	CamelFolder *folder;
+	CamelMessageInfo *info;
+
 	g_return_val_if_fail (node != NULL, NULL);
-	g_return_val_if_fail (node->data != NULL, NULL);
+	g_return_val_if_fail (ext_node->uid != NULL, NULL);
+
+	if (node->data != NULL) {
+		g_queue_unlink (info_window, &ext_node->window_link);
+		g_queue_push_head_link (info_window, &ext_node->window_link);
+		return node->data;
+	}
+
+	folder = message_list->priv->folder;
+	g_return_val_if_fail (folder != NULL, NULL);
 
-	return node->data;
+	/* The miss count starts over once the main loop goes idle. */
+	if (++message_list->priv->info_misses == INFO_MISSES_BEFORE_FETCH_ALL)
+		camel_folder_summary_prepare_fetch_all (folder->summary, NULL);
+
+	if (message_list->priv->info_window_trim_id == 0)
+		message_list->priv->info_window_trim_id = g_idle_add (
+			ml_info_window_trim_cb, message_list);
+
+	/* NULL if the message was expunged meanwhile. */
+	info = camel_folder_get_message_info (folder, ext_node->uid);
+
+	if (info != NULL)
+		ml_node_set_info (message_list, node, info);
+
+	return info;
 }
 
 static const gchar *
@@ -770,8 +969,14 @@ get_normalised_string (MessageList *message_list,
 
 	poolv = g_hash_table_lookup (message_list->normalised_hash, camel_message_info_uid (info));
 	if (poolv == NULL) {
+		const gchar *uid = camel_message_info_uid (info);
+
+		/* Keep our own reference to the UID, the message
+		 * info may be freed before its cache entry is. */
 		poolv = e_poolv_new (NORMALISED_LAST);
-		g_hash_table_insert (message_list->normalised_hash, (gchar *) camel_message_info_uid (info), poolv);
+		g_hash_table_insert (
+			message_list->normalised_hash,
+			(gpointer) camel_pstring_strdup (uid), poolv);
 	} else {
 		str = e_poolv_get (poolv, index);
 		if (*str)
@@ -1163,6 +1368,68 @@ message_list_select_prev_thread (MessageList *message_list)
 	}
 }
 
+/**
+ * message_list_get_neighbor_uids:
+ * @message_list: Message List widget
+ * @n_neighbors: how many rows to look at on each side of the cursor
+ *
+ * Returns the UIDs of the messages shown up to @n_neighbors rows
+ * after and before the cursor row, in the current sort order,
+ * nearest first and alternating between after and before.
+ *
+ * Returns: a #GPtrArray of UIDs, free with g_ptr_array_unref()
+ **/
+GPtrArray *
+message_list_get_neighbor_uids (MessageList *message_list,
+                                guint n_neighbors)
+{
+	ETreeTableAdapter *adapter;
+	GPtrArray *uids;
+	GNode *node;
+	gint row_count;
+	gint row;
+	guint ii;
+
+	g_return_val_if_fail (IS_MESSAGE_LIST (message_list), NULL);
+
+	uids = g_ptr_array_new_with_free_func ((GDestroyNotify) g_free);
+
+	if (message_list->cursor_uid == NULL)
+		return uids;
+
+	node = g_hash_table_lookup (
+		message_list->uid_nodemap,
+		message_list->cursor_uid);
+	if (node == NULL)
+		return uids;
+
+	adapter = e_tree_get_table_adapter (E_TREE (message_list));
+	row_count = e_table_model_row_count ((ETableModel *) adapter);
+
+	row = e_tree_table_adapter_row_of_node (adapter, node);
+	if (row == -1)
+		return uids;
+
+	for (ii = 1; ii <= n_neighbors; ii++) {
+		gint neighbor[2] = { row + ii, row - ii };
+		guint jj;
+
+		for (jj = 0; jj < G_N_ELEMENTS (neighbor); jj++) {
+			if (neighbor[jj] < 0 || neighbor[jj] >= row_count)
+				continue;
+
+			node = e_tree_table_adapter_node_at_row (
+				adapter, neighbor[jj]);
+			if (node != NULL && ((ExtendedGNode *) node)->uid != NULL)
+				g_ptr_array_add (
+					uids, g_strdup (
+					get_message_uid (message_list, node)));
+		}
+	}
+
+	return uids;
+}
+
 /**
  * message_list_select_all:
  * @message_list: Message List widget
@@ -1384,7 +1651,7 @@ unread_foreach (ETreeModel *etm,
 	if (!etm)
 		info = (CamelMessageInfo *) path;
 	else
-		info = ((GNode *) path)->data;
+		info = get_message_info (MESSAGE_LIST (etm), path);
 	g_return_val_if_fail (info != NULL, FALSE);
 
 	if (!(camel_message_info_flags (info) & CAMEL_MESSAGE_SEEN))
@@ -1410,7 +1677,7 @@ latest_foreach (ETreeModel *etm,
 	if (!etm)
 		info = (CamelMessageInfo *) path;
 	else
-		info = ((GNode *) path)->data;
+		info = get_message_info (MESSAGE_LIST (etm), path);
 	g_return_val_if_fail (info != NULL, FALSE);
 
 	date = ld->sent ? camel_message_info_date_sent (info)
@@ -1499,7 +1766,7 @@ add_all_labels_foreach (ETreeModel *etm,
 	if (!etm)
 		msg_info = (CamelMessageInfo *) path;
 	else
-		msg_info = ((GNode *) path)->data;
+		msg_info = get_message_info (MESSAGE_LIST (etm), path);
 	g_return_val_if_fail (msg_info != NULL, FALSE);
 
 	for (flag = camel_message_info_user_flags (msg_info); flag; flag = flag->next)
@@ -2694,6 +2961,22 @@ message_list_dispose (GObject *object)
 		message_list->uid_nodemap = NULL;
 	}
 
+	if (priv->pending_changes != NULL) {
+		camel_folder_change_info_free (priv->pending_changes);
+		priv->pending_changes = NULL;
+	}
+
+	if (priv->info_window_trim_id > 0) {
+		g_source_remove (priv->info_window_trim_id);
+		priv->info_window_trim_id = 0;
+	}
+
+	/* Let go of the message infos while we still have the folder. */
+	while (!g_queue_is_empty (&priv->info_window))
+		ml_node_release_info (
+			message_list,
+			g_queue_peek_head (&priv->info_window));
+
 	g_clear_object (&priv->session);
 	g_clear_object (&priv->folder);
 	g_clear_object (&priv->invisible);
@@ -2720,6 +3003,8 @@ message_list_finalize (GObject *object)
 	MessageList *message_list = MESSAGE_LIST (object);
 
 	g_hash_table_destroy (message_list->normalised_hash);
+	g_hash_table_destroy (message_list->priv->msgid_nodemap);
+	g_hash_table_destroy (message_list->priv->missing_msgids);
 
 	if (message_list->priv->thread_tree != NULL)
 		camel_folder_thread_messages_unref (
@@ -2865,18 +3150,11 @@ static gchar *
 message_list_get_save_id (ETreeModel *tree_model,
                           ETreePath path)
 {
-	CamelMessageInfo *info;
-
 	if (G_NODE_IS_ROOT ((GNode *) path))
 		return g_strdup ("root");
 
-	/* Note: ETable can ask for the save_id while we're clearing
-	 *       it, which is the only time info should be NULL. */
-	info = ((GNode *) path)->data;
-	if (info == NULL)
-		return NULL;
-
-	return g_strdup (camel_message_info_uid (info));
+	/* The UID stays with the node, no need to fetch the info. */
+	return g_strdup (((ExtendedGNode *) path)->uid);
 }
 
 static ETreePath
@@ -2933,9 +3211,11 @@ message_list_value_at (ETreeModel *tree_model,
 	if (G_NODE_IS_ROOT ((GNode *) path))
 		return NULL;
 
-	/* retrieve the message information array */
-	msg_info = ((GNode *) path)->data;
-	g_return_val_if_fail (msg_info != NULL, NULL);
+	/* retrieve the message information array; there is none
+	 * if the message got expunged and the list isn't updated yet */
+	msg_info = get_message_info (message_list, path);
+	if (msg_info == NULL)
+		return NULL;
 
 	return ml_tree_value_at_ex (tree_model, path, col, msg_info, message_list);
 }
@@ -3311,11 +3591,17 @@ message_list_init (MessageList *message_list)
 
 	message_list->normalised_hash = g_hash_table_new_full (
 		g_str_hash, g_str_equal,
-		(GDestroyNotify) NULL,
+		(GDestroyNotify) camel_pstring_free,
 		(GDestroyNotify) e_poolv_destroy);
 
 	message_list->uid_nodemap = g_hash_table_new (g_str_hash, g_str_equal);
 
+	message_list->priv->msgid_nodemap =
+		g_hash_table_new (g_int64_hash, g_int64_equal);
+
+	message_list->priv->missing_msgids =
+		g_hash_table_new (g_direct_hash, g_direct_equal);
+
 	message_list->cursor_uid = NULL;
 	message_list->last_sel_single = FALSE;
 
@@ -3477,11 +3763,7 @@ clear_info (gchar *key,
             GNode *node,
             MessageList *message_list)
 {
-	CamelMessageInfo *info;
-
-	info = node->data;
-	camel_folder_free_message_info (message_list->priv->folder, info);
-	node->data = NULL;
+	ml_node_release_info (message_list, node);
 }
 
 static void
@@ -3509,6 +3791,8 @@ clear_tree (MessageList *message_list,
 			(GHFunc) clear_info, message_list);
 	g_hash_table_destroy (message_list->uid_nodemap);
 	message_list->uid_nodemap = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_remove_all (message_list->priv->msgid_nodemap);
+	g_hash_table_remove_all (message_list->priv->missing_msgids);
 	g_clear_object (&folder);
 
 	message_list->priv->newest_read_date = 0;
@@ -3727,6 +4011,7 @@ ml_uid_nodemap_insert (MessageList *message_list,
                        gint row)
 {
 	CamelFolder *folder;
+	ExtendedGNode *ext_node;
 	GNode *node;
 	const gchar *uid;
 	time_t date;
@@ -3740,13 +4025,36 @@ ml_uid_nodemap_insert (MessageList *message_list,
 
 	node = message_list_tree_model_insert (
 		message_list, parent, row, info);
+	ext_node = (ExtendedGNode *) node;
 
-	uid = camel_message_info_uid (info);
+	uid = ext_node->uid;
 	flags = camel_message_info_flags (info);
 	date = camel_message_info_date_received (info);
 
-	camel_folder_ref_message_info (folder, info);
-	g_hash_table_insert (message_list->uid_nodemap, (gpointer) uid, node);
+	/* The keys point into the node, so always replace them too. */
+	g_hash_table_replace (message_list->uid_nodemap, (gpointer) uid, node);
+
+	if (ext_node->message_id != 0)
+		g_hash_table_replace (
+			message_list->priv->msgid_nodemap,
+			&ext_node->message_id, node);
+
+	if (message_list->priv->group_by_threads) {
+		const CamelSummaryReferences *references;
+		gint ii;
+
+		references = camel_message_info_references (info);
+
+		for (ii = 0; references != NULL && ii < references->size; ii++) {
+			guint64 id = references->references[ii].id.id;
+
+			if (!g_hash_table_contains (
+				message_list->priv->msgid_nodemap, &id))
+				g_hash_table_add (
+					message_list->priv->missing_msgids,
+					ML_MSGID_KEY (id));
+		}
+	}
 
 	/* Track the latest seen and unseen messages shown, used in
 	 * fallback heuristics for automatic message selection. */
@@ -3772,15 +4080,19 @@ ml_uid_nodemap_insert (MessageList *message_list,
 
 static void
 ml_uid_nodemap_remove (MessageList *message_list,
-                       CamelMessageInfo *info)
+                       GNode *node)
 {
-	CamelFolder *folder;
-	const gchar *uid;
-
-	folder = message_list_ref_folder (message_list);
-	g_return_if_fail (folder != NULL);
+	ExtendedGNode *ext_node = (ExtendedGNode *) node;
+	const gchar *uid = ext_node->uid;
 
-	uid = camel_message_info_uid (info);
+	/* Duplicate Message-IDs happen; only drop the
+	 * mapping if it still refers to this message. */
+	if (ext_node->message_id != 0 &&
+	    g_hash_table_lookup (message_list->priv->msgid_nodemap,
+	    &ext_node->message_id) == node)
+		g_hash_table_remove (
+			message_list->priv->msgid_nodemap,
+			&ext_node->message_id);
 
 	if (uid == message_list->priv->newest_read_uid) {
 		message_list->priv->newest_read_date = 0;
@@ -3792,10 +4104,11 @@ ml_uid_nodemap_remove (MessageList *message_list,
 		message_list->priv->oldest_unread_uid = NULL;
 	}
 
-	g_hash_table_remove (message_list->uid_nodemap, uid);
-	camel_folder_free_message_info (folder, info);
+	/* The message may have moved to another node already. */
+	if (g_hash_table_lookup (message_list->uid_nodemap, uid) == node)
+		g_hash_table_remove (message_list->uid_nodemap, uid);
 
-	g_object_unref (folder);
+	ml_node_release_info (message_list, node);
 }
 
 /* only call if we have a tree model */
@@ -3814,7 +4127,7 @@ static void	build_subtree_diff		(MessageList *message_list,
 
 static void
 build_tree (MessageList *message_list,
-            CamelFolderThread *thread,
+            CamelFolderThreadNode *thread_nodes,
             gboolean folder_changed)
 {
 	gint row = 0;
@@ -3856,7 +4169,7 @@ build_tree (MessageList *message_list,
 	build_subtree (
 		message_list,
 		message_list->priv->tree_model_root,
-		thread->tree, &row);
+		thread_nodes, &row);
 
 	/* Show the cursor unless we're responding to a
 	 * "folder-changed" signal from our CamelFolder. */
@@ -3973,7 +4286,7 @@ node_equal (ETreeModel *etm,
             GNode *ap,
             CamelFolderThreadNode *bp)
 {
-	if (bp->message && strcmp (camel_message_info_uid (ap->data), camel_message_info_uid (bp->message)) == 0)
+	if (bp->message && strcmp (((ExtendedGNode *) ap)->uid, camel_message_info_uid (bp->message)) == 0)
 		return 1;
 
 	return 0;
@@ -3989,7 +4302,7 @@ add_node_diff (MessageList *message_list,
                gint myrow)
 {
 	CamelMessageInfo *info;
-	GNode *new_node;
+	GNode *old_node, *new_node;
 
 	g_return_if_fail (c->message != NULL);
 
@@ -3997,7 +4310,11 @@ add_node_diff (MessageList *message_list,
 	info = (CamelMessageInfo *) c->message;
 
 	/* we just update the hashtable key */
-	ml_uid_nodemap_remove (message_list, info);
+	old_node = g_hash_table_lookup (
+		message_list->uid_nodemap,
+		camel_message_info_uid (info));
+	if (old_node != NULL)
+		ml_uid_nodemap_remove (message_list, old_node);
 	new_node = ml_uid_nodemap_insert (message_list, info, parent, myrow);
 	(*row)++;
 
@@ -4014,9 +4331,8 @@ remove_node_diff (MessageList *message_list,
                   gint depth)
 {
 	ETreePath cp, cn;
-	CamelMessageInfo *info;
 
-	t (printf ("Removing node: %s\n", (gchar *) node->data));
+	t (printf ("Removing node: %s\n", ((ExtendedGNode *) node)->uid));
 
 	/* we depth-first remove all node data's ... */
 	cp = g_node_first_child (node);
@@ -4027,14 +4343,123 @@ remove_node_diff (MessageList *message_list,
 	}
 
 	/* and the rowid entry - if and only if it is referencing this node */
-	info = node->data;
+	ml_uid_nodemap_remove (message_list, node);
 
 	/* and only at the toplevel, remove the node (etree should optimise this remove somewhat) */
 	if (depth == 0)
 		message_list_tree_model_remove (message_list, node);
+}
+
+static gboolean
+ml_node_info_ref_cb (GNode *node,
+                     gpointer user_data)
+{
+	MessageList *message_list = MESSAGE_LIST (user_data);
+	CamelMessageInfo *info;
+
+	info = get_message_info (message_list, node);
+	if (info != NULL)
+		camel_folder_ref_message_info (
+			message_list->priv->folder, info);
+
+	return FALSE;
+}
+
+static gboolean
+ml_node_info_unref_cb (GNode *node,
+                       gpointer user_data)
+{
+	if (node->data != NULL)
+		camel_folder_free_message_info (
+			CAMEL_FOLDER (user_data), node->data);
+
+	return FALSE;
+}
+
+static void
+ml_reinsert_subtree (MessageList *message_list,
+                     GNode *parent,
+                     GNode *orphan)
+{
+	GNode *node = parent, *child;
+
+	/* A message gone from the folder leaves its replies behind. */
+	if (orphan->data != NULL)
+		node = ml_uid_nodemap_insert (
+			message_list, orphan->data, parent, -1);
+
+	for (child = orphan->children; child != NULL; child = child->next)
+		ml_reinsert_subtree (message_list, node, child);
+}
+
+/* Removes a single message from the tree.  Unlike remove_node_diff(),
+ * any replies to the message are kept and move up to its parent, the
+ * same as a rebuild of the thread tree without the message would do. */
+static void
+ml_remove_message_node (MessageList *message_list,
+                        GNode *node)
+{
+	CamelFolder *folder;
+	GNode *parent, *orphans = NULL, *child;
+
+	folder = message_list_ref_folder (message_list);
+	g_return_if_fail (folder != NULL);
+
+	parent = node->parent;
+
+	if (node->children != NULL) {
+		/* Shallow copy: the copied nodes share the message
+		 * infos, so fetch them all and hold our own references. */
+		g_node_traverse (
+			node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			ml_node_info_ref_cb, message_list);
+		orphans = g_node_copy (node);
+	}
+
+	remove_node_diff (message_list, node, 0);
+
+	if (orphans != NULL) {
+		for (child = orphans->children; child; child = child->next)
+			ml_reinsert_subtree (message_list, parent, child);
+
+		g_node_traverse (
+			orphans, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			ml_node_info_unref_cb, folder);
+		g_node_destroy (orphans);
+	}
+
+	g_object_unref (folder);
+}
+
+/* Finds the node a newly arrived message should be threaded under,
+ * using its References / In-Reply-To headers, nearest ancestor first
+ * (Camel stores them in that order, the direct parent at index 0).
+ * Returns NULL if the message starts a new thread. */
+static GNode *
+ml_find_thread_parent (MessageList *message_list,
+                       CamelMessageInfo *info)
+{
+	const CamelSummaryReferences *references;
+	gint ii;
+
+	references = camel_message_info_references (info);
+
+	if (references == NULL)
+		return NULL;
+
+	for (ii = 0; ii < references->size; ii++) {
+		GNode *node;
 
-	g_return_if_fail (info);
-	ml_uid_nodemap_remove (message_list, info);
+		node = g_hash_table_lookup (
+			message_list->priv->msgid_nodemap,
+			&references->references[ii].id.id);
+		if (node != NULL && g_strcmp0 (
+		    ((ExtendedGNode *) node)->uid,
+		    camel_message_info_uid (info)) != 0)
+			return node;
+	}
+
+	return NULL;
 }
 
 /* applies a new tree structure to an existing tree, but only by changing things
@@ -4275,6 +4700,36 @@ mail_folder_hide_by_flag (CamelFolder *folder,
 	return newchanges;
 }
 
+static gboolean
+message_list_too_many_changes (CamelFolderChangeInfo *changes)
+{
+	guint n_changes;
+
+	n_changes = changes->uid_added->len + changes->uid_removed->len;
+
+	return n_changes > MAX_INCREMENTAL_CHANGES;
+}
+
+static gboolean
+message_list_can_regen_changes (MessageList *message_list,
+                                CamelFolderChangeInfo *changes)
+{
+	if (changes == NULL)
+		return FALSE;
+
+	/* Nothing to patch, so just build it. */
+	if (g_hash_table_size (message_list->uid_nodemap) == 0)
+		return FALSE;
+
+	/* Subject threading can merge whole threads when a single
+	 * message arrives; leave that to CamelFolderThread. */
+	if (message_list->priv->group_by_threads &&
+	    message_list->priv->thread_subject)
+		return FALSE;
+
+	return !message_list_too_many_changes (changes);
+}
+
 static void
 message_list_folder_changed (CamelFolder *folder,
                              CamelFolderChangeInfo *changes,
@@ -4297,10 +4752,16 @@ message_list_folder_changed (CamelFolder *folder,
 
 	d (printf ("folder changed event, changes = %p\n", changes));
 	if (changes != NULL) {
+		/* Drop the cached sort keys of messages which went away
+		 * or whose headers may have changed; the rest stay valid. */
 		for (i = 0; i < changes->uid_removed->len; i++)
 			g_hash_table_remove (
 				message_list->normalised_hash,
 				changes->uid_removed->pdata[i]);
+		for (i = 0; i < changes->uid_changed->len; i++)
+			g_hash_table_remove (
+				message_list->normalised_hash,
+				changes->uid_changed->pdata[i]);
 
 		/* Check if the hidden state has changed.
 		 * If so, modify accordingly and regenerate. */
@@ -4337,6 +4798,11 @@ message_list_folder_changed (CamelFolder *folder,
 		}
 	}
 
+	if (need_list_regen && message_list_can_regen_changes (message_list, altered_changes)) {
+		mail_regen_changes (message_list, altered_changes);
+		need_list_regen = FALSE;
+	}
+
 	if (need_list_regen)
 		mail_regen_list (message_list, message_list->search, TRUE);
 
@@ -4688,7 +5154,7 @@ on_selection_changed_cmd (ETree *tree,
 		else
 			newuid = NULL;
 	} else if ((cursor = e_tree_get_cursor (tree)))
-		newuid = (gchar *) camel_message_info_uid (cursor->data);
+		newuid = (gchar *) get_message_uid (message_list, cursor);
 	else
 		newuid = NULL;
 
@@ -5063,74 +5529,37 @@ struct sort_column_data {
 	GtkSortType sort_type;
 };
 
-struct sort_message_info_data {
-	CamelMessageInfo *mi;
-	GPtrArray *values; /* read values so far, in order of sort_array_data::sort_columns */
-};
-
 struct sort_array_data {
 	MessageList *message_list;
 	CamelFolder *folder;
 	GPtrArray *sort_columns; /* struct sort_column_data in order of sorting */
-	GHashTable *message_infos; /* uid -> struct sort_message_info_data */
-	gpointer cmp_cache;
-	GCancellable *cancellable;
+	GPtrArray *uids;
+	/* Sort keys, extracted once up front: the value of sort column
+	 * 'j' for uids->pdata[i] is values[i * sort_columns->len + j]. */
+	gpointer *values;
 };
 
 static gint
-cmp_array_uids (gconstpointer a,
-                gconstpointer b,
+cmp_array_uids (gint index1,
+                gint index2,
+                gpointer cmp_cache,
                 gpointer user_data)
 {
-	const gchar *uid1 = *(const gchar **) a;
-	const gchar *uid2 = *(const gchar **) b;
 	struct sort_array_data *sort_data = user_data;
-	gint i, res = 0;
-	struct sort_message_info_data *md1, *md2;
-
-	g_return_val_if_fail (sort_data != NULL, 0);
-
-	md1 = g_hash_table_lookup (sort_data->message_infos, uid1);
-	md2 = g_hash_table_lookup (sort_data->message_infos, uid2);
-
-	g_return_val_if_fail (md1 != NULL, 0);
-	g_return_val_if_fail (md1->mi != NULL, 0);
-	g_return_val_if_fail (md2 != NULL, 0);
-	g_return_val_if_fail (md2->mi != NULL, 0);
+	gpointer *values1, *values2;
+	guint i, n_columns;
+	gint res = 0;
 
-	if (g_cancellable_is_cancelled (sort_data->cancellable))
-		return 0;
+	n_columns = sort_data->sort_columns->len;
+	values1 = sort_data->values + index1 * n_columns;
+	values2 = sort_data->values + index2 * n_columns;
 
-	for (i = 0;
-	     res == 0
-	     && i < sort_data->sort_columns->len
-	     && !g_cancellable_is_cancelled (sort_data->cancellable);
-	     i++) {
-		gpointer v1, v2;
+	for (i = 0; res == 0 && i < n_columns; i++) {
+		gpointer v1 = values1[i], v2 = values2[i];
 		struct sort_column_data *scol = g_ptr_array_index (sort_data->sort_columns, i);
 
-		if (md1->values->len <= i) {
-			v1 = ml_tree_value_at_ex (
-				NULL, NULL,
-				scol->col->spec->compare_col,
-				md1->mi, sort_data->message_list);
-			g_ptr_array_add (md1->values, v1);
-		} else {
-			v1 = g_ptr_array_index (md1->values, i);
-		}
-
-		if (md2->values->len <= i) {
-			v2 = ml_tree_value_at_ex (
-				NULL, NULL,
-				scol->col->spec->compare_col,
-				md2->mi, sort_data->message_list);
-			g_ptr_array_add (md2->values, v2);
-		} else {
-			v2 = g_ptr_array_index (md2->values, i);
-		}
-
 		if (v1 != NULL && v2 != NULL) {
-			res = (*scol->col->compare) (v1, v2, sort_data->cmp_cache);
+			res = (*scol->col->compare) (v1, v2, cmp_cache);
 		} else if (v1 != NULL || v2 != NULL) {
 			res = v1 == NULL ? -1 : 1;
 		}
@@ -5140,26 +5569,14 @@ cmp_array_uids (gconstpointer a,
 	}
 
 	if (res == 0)
-		res = camel_folder_cmp_uids (sort_data->folder, uid1, uid2);
+		res = camel_folder_cmp_uids (
+			sort_data->folder,
+			sort_data->uids->pdata[index1],
+			sort_data->uids->pdata[index2]);
 
 	return res;
 }
 
-static void
-free_message_info_data (gpointer uid,
-                        struct sort_message_info_data *data,
-                        struct sort_array_data *sort_data)
-{
-	if (data->values) {
-		/* values in this array are not newly allocated, even ml_tree_value_at_ex
-		 * returns gpointer, not a gconstpointer */
-		g_ptr_array_free (data->values, TRUE);
-	}
-
-	camel_folder_free_message_info (sort_data->folder, data->mi);
-	g_free (data);
-}
-
 static void
 ml_sort_uids_by_tree (MessageList *message_list,
                       GPtrArray *uids,
@@ -5170,7 +5587,9 @@ ml_sort_uids_by_tree (MessageList *message_list,
 	ETableHeader *full_header;
 	CamelFolder *folder;
 	struct sort_array_data sort_data;
-	guint i, len;
+	GPtrArray *infos;
+	gint *indices;
+	guint i, j, len;
 
 	if (g_cancellable_is_cancelled (cancellable))
 		return;
@@ -5197,9 +5616,11 @@ ml_sort_uids_by_tree (MessageList *message_list,
 	sort_data.message_list = message_list;
 	sort_data.folder = folder;
 	sort_data.sort_columns = g_ptr_array_sized_new (len);
-	sort_data.message_infos = g_hash_table_new (g_str_hash, g_str_equal);
-	sort_data.cmp_cache = e_table_sorting_utils_create_cmp_cache ();
-	sort_data.cancellable = cancellable;
+	sort_data.uids = uids;
+	sort_data.values = g_new0 (gpointer, uids->len * len);
+
+	infos = g_ptr_array_new_full (
+		uids->len, (GDestroyNotify) camel_message_info_free);
 
 	for (i = 0;
 	     i < len
@@ -5230,7 +5651,7 @@ ml_sort_uids_by_tree (MessageList *message_list,
 	     i++) {
 		gchar *uid;
 		CamelMessageInfo *mi;
-		struct sort_message_info_data *md;
+		gpointer *values;
 
 		uid = g_ptr_array_index (uids, i);
 		mi = camel_folder_get_message_info (folder, uid);
@@ -5242,35 +5663,48 @@ ml_sort_uids_by_tree (MessageList *message_list,
 			continue;
 		}
 
-		md = g_new0 (struct sort_message_info_data, 1);
-		md->mi = mi;
-		md->values = g_ptr_array_sized_new (len);
+		/* The values point into the message info,
+		 * so hold on to it until we're done sorting. */
+		g_ptr_array_add (infos, mi);
 
-		g_hash_table_insert (sort_data.message_infos, uid, md);
+		values = sort_data.values + i * sort_data.sort_columns->len;
+		for (j = 0; j < sort_data.sort_columns->len; j++) {
+			struct sort_column_data *scol;
+
+			scol = g_ptr_array_index (sort_data.sort_columns, j);
+			values[j] = ml_tree_value_at_ex (
+				NULL, NULL,
+				scol->col->spec->compare_col,
+				mi, message_list);
+		}
 	}
 
-	if (!g_cancellable_is_cancelled (cancellable))
-		g_qsort_with_data (
-			uids->pdata,
-			uids->len,
-			sizeof (gpointer),
-			cmp_array_uids,
-			&sort_data);
-
 	camel_folder_summary_unlock (folder->summary, CAMEL_FOLDER_SUMMARY_SUMMARY_LOCK);
 
-	/* FIXME Teach the hash table to destroy its own data. */
-	g_hash_table_foreach (
-		sort_data.message_infos,
-		(GHFunc) free_message_info_data,
-		&sort_data);
-	g_hash_table_destroy (sort_data.message_infos);
+	indices = g_new (gint, uids->len);
+	for (i = 0; i < uids->len; i++)
+		indices[i] = i;
+
+	if (!g_cancellable_is_cancelled (cancellable) &&
+	    e_table_sorting_utils_sort_indices (
+		indices, uids->len, cmp_array_uids,
+		&sort_data, cancellable)) {
+		gpointer *sorted;
+
+		sorted = g_new (gpointer, uids->len);
+		for (i = 0; i < uids->len; i++)
+			sorted[i] = uids->pdata[indices[i]];
+		memcpy (uids->pdata, sorted, uids->len * sizeof (gpointer));
+		g_free (sorted);
+	}
+
+	g_free (indices);
+	g_free (sort_data.values);
+	g_ptr_array_unref (infos);
 
 	g_ptr_array_foreach (sort_data.sort_columns, (GFunc) g_free, NULL);
 	g_ptr_array_free (sort_data.sort_columns, TRUE);
 
-	e_table_sorting_utils_free_cmp_cache (sort_data.cmp_cache);
-
 	g_object_unref (folder);
 }
 
@@ -5335,6 +5769,148 @@ message_list_regen_tweak_search_results (MessageList *message_list,
 	camel_folder_free_message_info (folder, info);
 }
 
+static GString *
+message_list_regen_build_expr (const gchar *search,
+                               gboolean hide_deleted,
+                               gboolean hide_junk)
+{
+	GString *expr;
+
+	expr = g_string_new ("");
+
+	if (hide_deleted && hide_junk) {
+		g_string_append_printf (
+			expr, "(match-all (and %s %s))",
+			EXCLUDE_DELETED_MESSAGES_EXPR,
+			EXCLUDE_JUNK_MESSAGES_EXPR);
+	} else if (hide_deleted) {
+		g_string_append_printf (
+			expr, "(match-all %s)",
+			EXCLUDE_DELETED_MESSAGES_EXPR);
+	} else if (hide_junk) {
+		g_string_append_printf (
+			expr, "(match-all %s)",
+			EXCLUDE_JUNK_MESSAGES_EXPR);
+	}
+
+	if (search != NULL) {
+		if (expr->len == 0) {
+			g_string_assign (expr, search);
+		} else {
+			g_string_prepend (expr, "(and ");
+			g_string_append_c (expr, ' ');
+			g_string_append (expr, search);
+			g_string_append_c (expr, ')');
+		}
+	}
+
+	return expr;
+}
+
+/* Worker thread half of an incremental regen.  Only the UIDs named in
+ * the folder's change set are tested against the search expression, so
+ * the cost follows the size of the change and not the size of the folder.
+ * Testing a UID twice gives the same answer, which is why change sets may
+ * safely overlap with a regen that was already running. */
+static void
+message_list_regen_changes_thread (GSimpleAsyncResult *simple,
+                                   MessageList *message_list,
+                                   RegenData *regen_data,
+                                   GCancellable *cancellable)
+{
+	CamelFolderChangeInfo *changes;
+	CamelFolder *folder;
+	GPtrArray *uids, *matches = NULL;
+	GHashTable *matched = NULL;
+	GString *expr;
+	gboolean hide_deleted;
+	gboolean hide_junk;
+	guint ii;
+	GError *local_error = NULL;
+
+	folder = regen_data->folder;
+	changes = regen_data->changes;
+
+	hide_junk = message_list_get_hide_junk (message_list, folder);
+	hide_deleted = message_list_get_hide_deleted (message_list, folder);
+
+	regen_data->summary = g_ptr_array_new ();
+	regen_data->removed_uids = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) camel_pstring_free);
+
+	for (ii = 0; ii < changes->uid_removed->len; ii++)
+		g_ptr_array_add (
+			regen_data->removed_uids, (gpointer)
+			camel_pstring_strdup (changes->uid_removed->pdata[ii]));
+
+	uids = g_ptr_array_sized_new (
+		changes->uid_added->len + changes->uid_changed->len);
+
+	for (ii = 0; ii < changes->uid_added->len; ii++)
+		g_ptr_array_add (uids, changes->uid_added->pdata[ii]);
+
+	for (ii = 0; ii < changes->uid_changed->len; ii++)
+		g_ptr_array_add (uids, changes->uid_changed->pdata[ii]);
+
+	expr = message_list_regen_build_expr (
+		regen_data->search, hide_deleted, hide_junk);
+
+	if (expr->len > 0 && uids->len > 0) {
+		matches = camel_folder_search_by_uids (
+			folder, expr->str, uids, cancellable, &local_error);
+
+		if (matches != NULL) {
+			message_list_regen_tweak_search_results (
+				message_list,
+				matches, folder,
+				regen_data->folder_changed,
+				!hide_deleted,
+				!hide_junk);
+
+			matched = g_hash_table_new (g_str_hash, g_str_equal);
+			for (ii = 0; ii < matches->len; ii++)
+				g_hash_table_add (matched, matches->pdata[ii]);
+		}
+	}
+
+	g_string_free (expr, TRUE);
+
+	if (local_error == NULL)
+		g_cancellable_set_error_if_cancelled (
+			cancellable, &local_error);
+
+	if (local_error != NULL) {
+		g_simple_async_result_take_error (simple, local_error);
+		goto exit;
+	}
+
+	for (ii = 0; ii < uids->len; ii++) {
+		CamelMessageInfo *info = NULL;
+		const gchar *uid;
+
+		uid = g_ptr_array_index (uids, ii);
+
+		if (matched == NULL || g_hash_table_contains (matched, uid))
+			info = camel_folder_get_message_info (folder, uid);
+
+		if (info != NULL)
+			g_ptr_array_add (regen_data->summary, info);
+		else
+			g_ptr_array_add (
+				regen_data->removed_uids,
+				(gpointer) camel_pstring_strdup (uid));
+	}
+
+exit:
+	if (matched != NULL)
+		g_hash_table_destroy (matched);
+
+	if (matches != NULL)
+		camel_folder_search_free (folder, matches);
+
+	g_ptr_array_free (uids, TRUE);
+}
+
 static void
 message_list_regen_thread (GSimpleAsyncResult *simple,
                            GObject *source_object,
@@ -5358,6 +5934,12 @@ message_list_regen_thread (GSimpleAsyncResult *simple,
 	if (g_cancellable_is_cancelled (cancellable))
 		return;
 
+	if (regen_data->changes != NULL) {
+		message_list_regen_changes_thread (
+			simple, message_list, regen_data, cancellable);
+		return;
+	}
+
 	/* Just for convenience. */
 	folder = g_object_ref (regen_data->folder);
 
@@ -5373,40 +5955,15 @@ message_list_regen_thread (GSimpleAsyncResult *simple,
 
 	/* Construct the search expression. */
 
-	expr = g_string_new ("");
-
-	if (hide_deleted && hide_junk) {
-		g_string_append_printf (
-			expr, "(match-all (and %s %s))",
-			EXCLUDE_DELETED_MESSAGES_EXPR,
-			EXCLUDE_JUNK_MESSAGES_EXPR);
-	} else if (hide_deleted) {
-		g_string_append_printf (
-			expr, "(match-all %s)",
-			EXCLUDE_DELETED_MESSAGES_EXPR);
-	} else if (hide_junk) {
-		g_string_append_printf (
-			expr, "(match-all %s)",
-			EXCLUDE_JUNK_MESSAGES_EXPR);
-	}
-
-	if (regen_data->search != NULL) {
-		if (expr->len == 0) {
-			g_string_assign (expr, regen_data->search);
-		} else {
-			g_string_prepend (expr, "(and ");
-			g_string_append_c (expr, ' ');
-			g_string_append (expr, regen_data->search);
-			g_string_append_c (expr, ')');
-		}
-	}
+	expr = message_list_regen_build_expr (
+		regen_data->search, hide_deleted, hide_junk);
 
 	/* Execute the search. */
 
 	if (expr->len == 0) {
 		uids = camel_folder_get_uids (folder);
 	} else {
-		uids = camel_folder_search_by_expression (
+		uids = e_mail_search_index_search_sync (
 			folder, expr->str, cancellable, &local_error);
 
 		/* XXX This indicates we need to use a different
@@ -5442,7 +5999,18 @@ message_list_regen_thread (GSimpleAsyncResult *simple,
 		goto exit;
 
 	/* update/build a new tree */
-	if (regen_data->group_by_threads) {
+	if (regen_data->group_by_threads && !regen_data->thread_subject) {
+		ml_sort_uids_by_tree (message_list, uids, cancellable);
+
+		/* Spread over all cores and abandoned as soon
+		 * as the cancellable fires, e.g. on folder switch. */
+		regen_data->reply_tree = e_mail_thread_tree_new_sync (
+			folder, uids, cancellable, &local_error);
+
+		if (local_error != NULL)
+			g_simple_async_result_take_error (simple, local_error);
+
+	} else if (regen_data->group_by_threads) {
 		CamelFolderThread *thread_tree;
 
 		ml_sort_uids_by_tree (message_list, uids, cancellable);
@@ -5490,6 +6058,151 @@ exit:
 	g_object_unref (folder);
 }
 
+/* Returns whether a newly added message is referenced by messages
+ * already in the tree, meaning it has to be threaded above them. */
+static gboolean
+message_list_regen_adds_parent (MessageList *message_list,
+                                RegenData *regen_data)
+{
+	guint ii;
+
+	if (!regen_data->group_by_threads)
+		return FALSE;
+
+	for (ii = 0; ii < regen_data->summary->len; ii++) {
+		CamelMessageInfo *info;
+		const CamelSummaryMessageID *message_id;
+
+		info = g_ptr_array_index (regen_data->summary, ii);
+		message_id = camel_message_info_message_id (info);
+
+		if (message_id == NULL || message_id->id.id == 0)
+			continue;
+
+		if (g_hash_table_contains (
+			message_list->uid_nodemap,
+			camel_message_info_uid (info)))
+			continue;
+
+		if (g_hash_table_contains (
+			message_list->priv->missing_msgids,
+			ML_MSGID_KEY (message_id->id.id)))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Main thread half of an incremental regen: patch the
+ * worker thread's results into the existing tree. */
+static void
+message_list_regen_apply_changes (MessageList *message_list,
+                                  RegenData *regen_data)
+{
+	ETreeModel *tree_model;
+	ETreeTableAdapter *adapter;
+	ETableItem *table_item;
+	gboolean cursor_removed = FALSE;
+	guint ii;
+
+	/* New parents can't be spliced in above existing children. */
+	if (message_list_regen_adds_parent (message_list, regen_data)) {
+		mail_regen_list (message_list, regen_data->search, TRUE);
+		return;
+	}
+
+	tree_model = E_TREE_MODEL (message_list);
+	adapter = e_tree_get_table_adapter (E_TREE (message_list));
+	table_item = e_tree_get_item (E_TREE (message_list));
+
+	/* The tree model is deliberately not frozen here.  Thawing makes
+	 * the table adapter rebuild itself (and forget expanded threads),
+	 * whereas single node notifications are applied in place. */
+
+	for (ii = 0; ii < regen_data->removed_uids->len; ii++) {
+		const gchar *uid;
+		GNode *node;
+
+		uid = g_ptr_array_index (regen_data->removed_uids, ii);
+		node = g_hash_table_lookup (message_list->uid_nodemap, uid);
+
+		if (node == NULL)
+			continue;
+
+		if (g_strcmp0 (uid, message_list->cursor_uid) == 0) {
+			regen_data->last_row =
+				e_tree_table_adapter_row_of_node (
+				adapter, node);
+			cursor_removed = TRUE;
+		}
+
+		ml_remove_message_node (message_list, node);
+	}
+
+	for (ii = 0; ii < regen_data->summary->len; ii++) {
+		CamelMessageInfo *info;
+		GNode *node;
+
+		info = g_ptr_array_index (regen_data->summary, ii);
+
+		node = g_hash_table_lookup (
+			message_list->uid_nodemap,
+			camel_message_info_uid (info));
+
+		if (node != NULL) {
+			e_tree_model_pre_change (tree_model);
+			e_tree_model_node_data_changed (tree_model, node);
+
+			message_list_change_first_visible_parent (
+				message_list, node);
+		} else {
+			GNode *parent = NULL;
+
+			if (regen_data->group_by_threads)
+				parent = ml_find_thread_parent (
+					message_list, info);
+
+			ml_uid_nodemap_insert (message_list, info, parent, -1);
+		}
+	}
+
+	/* Show the cursor unless we're responding to a
+	 * "folder-changed" signal from our CamelFolder. */
+	if (regen_data->folder_changed && table_item != NULL)
+		table_item->queue_show_cursor = FALSE;
+
+	if (cursor_removed) {
+		g_free (message_list->cursor_uid);
+		message_list->cursor_uid = NULL;
+		g_signal_emit (
+			message_list,
+			signals[MESSAGE_SELECTED], 0, NULL);
+	}
+}
+
+/* Starts an incremental regen for folder changes that
+ * arrived while the previous regen was still running. */
+static void
+message_list_regen_flush_pending (MessageList *message_list)
+{
+	CamelFolderChangeInfo *changes;
+
+	g_mutex_lock (&message_list->priv->regen_lock);
+	changes = message_list->priv->pending_changes;
+	message_list->priv->pending_changes = NULL;
+	g_mutex_unlock (&message_list->priv->regen_lock);
+
+	if (changes == NULL)
+		return;
+
+	if (message_list_can_regen_changes (message_list, changes))
+		mail_regen_changes (message_list, changes);
+	else
+		mail_regen_list (message_list, message_list->search, TRUE);
+
+	camel_folder_change_info_free (changes);
+}
+
 static void
 message_list_regen_done_cb (GObject *source_object,
                             GAsyncResult *result,
@@ -5530,6 +6243,7 @@ message_list_regen_done_cb (GObject *source_object,
 	} else if (local_error != NULL) {
 		g_warning ("%s: %s", G_STRFUNC, local_error->message);
 		g_error_free (local_error);
+		message_list_regen_flush_pending (message_list);
 		return;
 	}
 
@@ -5553,7 +6267,10 @@ message_list_regen_done_cb (GObject *source_object,
 		(message_list->search != NULL) &&
 		(*message_list->search != '\0');
 
-	if (regen_data->group_by_threads) {
+	if (regen_data->changes != NULL) {
+		message_list_regen_apply_changes (message_list, regen_data);
+
+	} else if (regen_data->group_by_threads) {
 		gboolean forcing_expand_state;
 
 		forcing_expand_state =
@@ -5586,7 +6303,9 @@ message_list_regen_done_cb (GObject *source_object,
 		 * "folder-changed" signal from our CamelFolder. */
 		build_tree (
 			message_list,
-			regen_data->thread_tree,
+			(regen_data->reply_tree != NULL) ?
+			e_mail_thread_tree_get_root (regen_data->reply_tree) :
+			regen_data->thread_tree->tree,
 			regen_data->folder_changed);
 
 		message_list_set_thread_tree (
@@ -5676,6 +6395,8 @@ message_list_regen_done_cb (GObject *source_object,
 		signals[MESSAGE_LIST_BUILT], 0);
 
 	message_list->priv->any_row_changed = FALSE;
+
+	message_list_regen_flush_pending (message_list);
 }
 
 static gboolean
@@ -5711,7 +6432,11 @@ message_list_regen_idle_cb (gpointer user_data)
 	adapter = e_tree_get_table_adapter (E_TREE (message_list));
 	row_count = e_table_model_row_count (E_TABLE_MODEL (adapter));
 
-	if (row_count <= 0) {
+	if (regen_data->changes != NULL) {
+		/* The tree is patched in place, so
+		 * there's no expand state to restore. */
+
+	} else if (row_count <= 0) {
 		if (gtk_widget_get_visible (GTK_WIDGET (message_list))) {
 			gchar *txt;
 
@@ -5769,6 +6494,12 @@ mail_regen_cancel (MessageList *message_list)
 		message_list->priv->regen_idle_id = 0;
 	}
 
+	if (message_list->priv->pending_changes != NULL) {
+		camel_folder_change_info_free (
+			message_list->priv->pending_changes);
+		message_list->priv->pending_changes = NULL;
+	}
+
 	g_mutex_unlock (&message_list->priv->regen_lock);
 
 	/* Cancel outside the lock, since this will emit a signal. */
@@ -5778,48 +6509,18 @@ mail_regen_cancel (MessageList *message_list)
 	}
 }
 
+/* Call with the regen_lock held.  The new RegenData replaces
+ * message_list->priv->regen_data; cancelling the one it replaces
+ * is up to the caller. */
 static void
-mail_regen_list (MessageList *message_list,
-                 const gchar *search,
-                 gboolean folder_changed)
+mail_regen_schedule_locked (MessageList *message_list,
+                            const gchar *search,
+                            gboolean folder_changed,
+                            CamelFolderChangeInfo *changes)
 {
 	GSimpleAsyncResult *simple;
 	GCancellable *cancellable;
 	RegenData *new_regen_data;
-	RegenData *old_regen_data;
-
-	/* Report empty search as NULL, not as one/two-space string. */
-	if (search && (strcmp (search, " ") == 0 || strcmp (search, "  ") == 0))
-		search = NULL;
-
-	/* Can't list messages in a folder until we have a folder. */
-	if (message_list->priv->folder == NULL) {
-		g_free (message_list->search);
-		message_list->search = g_strdup (search);
-		return;
-	}
-
-	g_mutex_lock (&message_list->priv->regen_lock);
-
-	old_regen_data = message_list->priv->regen_data;
-
-	/* If a regen is scheduled but not yet started, just
-	 * apply the argument values without cancelling it. */
-	if (message_list->priv->regen_idle_id > 0) {
-		g_return_if_fail (old_regen_data != NULL);
-
-		if (g_strcmp0 (search, old_regen_data->search) != 0) {
-			g_free (old_regen_data->search);
-			old_regen_data->search = g_strdup (search);
-		}
-
-		old_regen_data->folder_changed = folder_changed;
-
-		/* Avoid cancelling on the way out. */
-		old_regen_data = NULL;
-
-		goto exit;
-	}
 
 	cancellable = g_cancellable_new ();
 
@@ -5827,6 +6528,11 @@ mail_regen_list (MessageList *message_list,
 	new_regen_data->search = g_strdup (search);
 	new_regen_data->folder_changed = folder_changed;
 
+	if (changes != NULL) {
+		new_regen_data->changes = camel_folder_change_info_new ();
+		camel_folder_change_info_cat (new_regen_data->changes, changes);
+	}
+
 	/* We generate the message list content in a worker thread, and
 	 * then supply our own GAsyncReadyCallback to redraw the widget. */
 
@@ -5861,6 +6567,57 @@ mail_regen_list (MessageList *message_list,
 	regen_data_unref (new_regen_data);
 
 	g_object_unref (cancellable);
+}
+
+static void
+mail_regen_list (MessageList *message_list,
+                 const gchar *search,
+                 gboolean folder_changed)
+{
+	RegenData *old_regen_data;
+
+	/* Report empty search as NULL, not as one/two-space string. */
+	if (search && (strcmp (search, " ") == 0 || strcmp (search, "  ") == 0))
+		search = NULL;
+
+	/* Can't list messages in a folder until we have a folder. */
+	if (message_list->priv->folder == NULL) {
+		g_free (message_list->search);
+		message_list->search = g_strdup (search);
+		return;
+	}
+
+	g_mutex_lock (&message_list->priv->regen_lock);
+
+	old_regen_data = message_list->priv->regen_data;
+
+	/* If a regen is scheduled but not yet started, just
+	 * apply the argument values without cancelling it. */
+	if (message_list->priv->regen_idle_id > 0) {
+		g_return_if_fail (old_regen_data != NULL);
+
+		if (g_strcmp0 (search, old_regen_data->search) != 0) {
+			g_free (old_regen_data->search);
+			old_regen_data->search = g_strdup (search);
+		}
+
+		old_regen_data->folder_changed = folder_changed;
+
+		/* Turn a pending incremental regen into a full one,
+		 * or only the changed UIDs would be searched again. */
+		if (old_regen_data->changes != NULL) {
+			camel_folder_change_info_free (old_regen_data->changes);
+			old_regen_data->changes = NULL;
+		}
+
+		/* Avoid cancelling on the way out. */
+		old_regen_data = NULL;
+
+		goto exit;
+	}
+
+	mail_regen_schedule_locked (
+		message_list, search, folder_changed, NULL);
 
 exit:
 	g_mutex_unlock (&message_list->priv->regen_lock);
@@ -5871,3 +6628,54 @@ exit:
 		regen_data_unref (old_regen_data);
 	}
 }
+
+/* Applies a folder change set to the existing message list without
+ * regenerating the whole thing.  Unlike mail_regen_list(), this never
+ * cancels a regen in progress; changes arriving meanwhile are queued
+ * and applied after it, since re-testing a UID is harmless. */
+static void
+mail_regen_changes (MessageList *message_list,
+                    CamelFolderChangeInfo *changes)
+{
+	RegenData *regen_data;
+
+	if (message_list->priv->folder == NULL)
+		return;
+
+	g_mutex_lock (&message_list->priv->regen_lock);
+
+	regen_data = message_list->priv->regen_data;
+
+	if (regen_data != NULL && message_list->priv->regen_idle_id > 0) {
+		/* Not started yet.  A full regen will see
+		 * the changes anyway when it searches. */
+		if (regen_data->changes != NULL)
+			camel_folder_change_info_cat (
+				regen_data->changes, changes);
+
+		/* A burst of changes is cheaper to rebuild from scratch. */
+		if (regen_data->changes != NULL &&
+		    message_list_too_many_changes (regen_data->changes)) {
+			camel_folder_change_info_free (regen_data->changes);
+			regen_data->changes = NULL;
+		}
+
+		regen_data->folder_changed = TRUE;
+
+	} else if (regen_data != NULL) {
+		if (message_list->priv->pending_changes == NULL)
+			message_list->priv->pending_changes =
+				camel_folder_change_info_new ();
+		camel_folder_change_info_cat (
+			message_list->priv->pending_changes, changes);
+
+		/* Checked again in message_list_regen_flush_pending(),
+		 * which falls back to a full regen past the limit. */
+
+	} else {
+		mail_regen_schedule_locked (
+			message_list, message_list->search, TRUE, changes);
+	}
+
+	g_mutex_unlock (&message_list->priv->regen_lock);
+}
@@ -192,6 +192,8 @@ void		message_list_select_uid		(MessageList *message_list,
 						 gboolean with_fallback);
 void		message_list_select_next_thread	(MessageList *message_list);
 void		message_list_select_prev_thread	(MessageList *message_list);
+GPtrArray *	message_list_get_neighbor_uids	(MessageList *message_list,
+						 guint n_neighbors);
 void		message_list_select_all		(MessageList *message_list);
 void		message_list_select_thread	(MessageList *message_list);
 void		message_list_select_subthread	(MessageList *message_list);
@@ -0,0 +1,541 @@
+/*
+ * test-mail-http-cache.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Fetches images from a local SoupServer, which holds every response
+ * for a while, through the cache of remote resources in a temporary
+ * directory.  Checks that files left by an earlier session count
+ * against the size limit, that concurrent fetches of the same URI
+ * make one request, that no more connections than allowed per host
+ * are opened, and that the least recently used resources are evicted
+ * first. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <glib/gstdio.h>
+#include <camel/camel.h>
+
+#include "e-http-cache.h"
+
+#define KiB 1024
+
+#define MAX_SIZE		(100 * KiB)
+#define SEED_SIZE		(40 * KiB)
+#define MERGE_SIZE		(10 * KiB)
+#define CONN_SIZE		(4 * KiB)
+#define BIG_SIZE		(30 * KiB)
+
+#define N_MERGE_THREADS		8
+#define N_CONN_THREADS		12
+
+/* How long the server holds every response. */
+#define RESPONSE_DELAY_MS	200
+
+typedef struct _TestServer TestServer;
+typedef struct _FetchJob FetchJob;
+
+struct _TestServer {
+	GMutex lock;
+	GMainContext *context;
+	GMainLoop *main_loop;
+	SoupServer *server;
+	GHashTable *n_requests;		/* path -> count */
+	GHashTable *sockets;		/* open client SoupSockets */
+	guint max_sockets;
+};
+
+struct _FetchJob {
+	gchar *uri;
+	gsize size;
+};
+
+static guint n_failures;
+
+static void
+check (gboolean condition,
+       const gchar *description)
+{
+	if (!condition) {
+		g_printerr ("FAILED: %s\n", description);
+		n_failures++;
+	}
+}
+
+static gsize
+size_for_path (const gchar *path)
+{
+	if (g_str_has_prefix (path, "/conn/"))
+		return CONN_SIZE;
+
+	if (g_strcmp0 (path, "/merge.png") == 0)
+		return MERGE_SIZE;
+
+	return BIG_SIZE;
+}
+
+static gboolean
+server_unpause_cb (gpointer user_data)
+{
+	SoupMessage *msg = user_data;
+	SoupServer *server;
+
+	server = g_object_get_data (G_OBJECT (msg), "test-server");
+	soup_server_unpause_message (server, msg);
+
+	return FALSE;
+}
+
+static void
+server_callback (SoupServer *server,
+                 SoupMessage *msg,
+                 const gchar *path,
+                 GHashTable *query,
+                 SoupClientContext *client,
+                 gpointer user_data)
+{
+	TestServer *test_server = user_data;
+	GSource *source;
+	gsize size;
+	guint count;
+
+	g_mutex_lock (&test_server->lock);
+	count = GPOINTER_TO_UINT (
+		g_hash_table_lookup (test_server->n_requests, path));
+	g_hash_table_insert (
+		test_server->n_requests, g_strdup (path),
+		GUINT_TO_POINTER (count + 1));
+	g_mutex_unlock (&test_server->lock);
+
+	size = size_for_path (path);
+
+	soup_message_set_status (msg, SOUP_STATUS_OK);
+	soup_message_set_response (
+		msg, "image/png", SOUP_MEMORY_TAKE,
+		g_malloc0 (size), size);
+
+	/* Hold the response, so the fetches overlap. */
+	soup_server_pause_message (server, msg);
+	g_object_set_data (G_OBJECT (msg), "test-server", server);
+
+	source = g_timeout_source_new (RESPONSE_DELAY_MS);
+	g_source_set_callback (
+		source, server_unpause_cb,
+		g_object_ref (msg), (GDestroyNotify) g_object_unref);
+	g_source_attach (source, test_server->context);
+	g_source_unref (source);
+}
+
+static void
+server_socket_disconnected_cb (SoupSocket *socket,
+                               TestServer *test_server)
+{
+	g_mutex_lock (&test_server->lock);
+	g_hash_table_remove (test_server->sockets, socket);
+	g_mutex_unlock (&test_server->lock);
+}
+
+static void
+server_request_started_cb (SoupServer *server,
+                           SoupMessage *msg,
+                           SoupClientContext *client,
+                           TestServer *test_server)
+{
+	SoupSocket *socket;
+	guint n_sockets;
+
+	socket = soup_client_context_get_socket (client);
+
+	g_mutex_lock (&test_server->lock);
+
+	if (!g_hash_table_contains (test_server->sockets, socket)) {
+		g_hash_table_add (test_server->sockets, socket);
+		g_signal_connect (
+			socket, "disconnected",
+			G_CALLBACK (server_socket_disconnected_cb),
+			test_server);
+	}
+
+	n_sockets = g_hash_table_size (test_server->sockets);
+	test_server->max_sockets = MAX (test_server->max_sockets, n_sockets);
+
+	g_mutex_unlock (&test_server->lock);
+}
+
+static gpointer
+server_thread (gpointer user_data)
+{
+	TestServer *test_server = user_data;
+
+	g_main_context_push_thread_default (test_server->context);
+	g_main_loop_run (test_server->main_loop);
+	g_main_context_pop_thread_default (test_server->context);
+
+	return NULL;
+}
+
+static TestServer *
+test_server_new (void)
+{
+	TestServer *test_server;
+	SoupAddress *address;
+
+	test_server = g_slice_new0 (TestServer);
+	g_mutex_init (&test_server->lock);
+	test_server->context = g_main_context_new ();
+	test_server->main_loop = g_main_loop_new (test_server->context, FALSE);
+	test_server->n_requests = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+	test_server->sockets = g_hash_table_new (NULL, NULL);
+
+	address = soup_address_new ("127.0.0.1", SOUP_ADDRESS_ANY_PORT);
+	soup_address_resolve_sync (address, NULL);
+
+	test_server->server = soup_server_new (
+		SOUP_SERVER_INTERFACE, address,
+		SOUP_SERVER_ASYNC_CONTEXT, test_server->context,
+		NULL);
+
+	g_object_unref (address);
+
+	if (test_server->server == NULL) {
+		g_printerr ("Failed to start the test server\n");
+		exit (EXIT_FAILURE);
+	}
+
+	soup_server_add_handler (
+		test_server->server, NULL,
+		server_callback, test_server, NULL);
+
+	g_signal_connect (
+		test_server->server, "request-started",
+		G_CALLBACK (server_request_started_cb), test_server);
+
+	soup_server_run_async (test_server->server);
+
+	g_thread_unref (g_thread_new (
+		"test-server", server_thread, test_server));
+
+	return test_server;
+}
+
+static guint
+test_server_get_n_requests (TestServer *test_server,
+                            const gchar *path)
+{
+	guint count;
+
+	g_mutex_lock (&test_server->lock);
+	count = GPOINTER_TO_UINT (
+		g_hash_table_lookup (test_server->n_requests, path));
+	g_mutex_unlock (&test_server->lock);
+
+	return count;
+}
+
+static gchar *
+test_server_dup_uri (TestServer *test_server,
+                     const gchar *path)
+{
+	return g_strdup_printf (
+		"http://127.0.0.1:%u%s",
+		soup_server_get_port (test_server->server), path);
+}
+
+static gpointer
+fetch_thread (gpointer user_data)
+{
+	FetchJob *job = user_data;
+	GBytes *body;
+	gchar *content_type = NULL;
+
+	body = e_http_cache_fetch (job->uri, NULL, NULL, &content_type);
+
+	if (body != NULL) {
+		job->size = g_bytes_get_size (body);
+		g_bytes_unref (body);
+	}
+
+	g_free (content_type);
+
+	return NULL;
+}
+
+/* Runs a fetch of each URI in its own thread, all at once. */
+static void
+fetch_all (gchar **uris,
+           guint n_uris,
+           gsize expected_size)
+{
+	GThread **threads;
+	FetchJob *jobs;
+	guint ii;
+
+	threads = g_new0 (GThread *, n_uris);
+	jobs = g_new0 (FetchJob, n_uris);
+
+	for (ii = 0; ii < n_uris; ii++) {
+		jobs[ii].uri = uris[ii];
+		threads[ii] = g_thread_new ("fetch", fetch_thread, &jobs[ii]);
+	}
+
+	for (ii = 0; ii < n_uris; ii++) {
+		g_thread_join (threads[ii]);
+		if (jobs[ii].size != expected_size) {
+			g_printerr (
+				"FAILED: fetched %" G_GSIZE_FORMAT
+				" bytes of '%s', expected %" G_GSIZE_FORMAT "\n",
+				jobs[ii].size, jobs[ii].uri, expected_size);
+			n_failures++;
+		}
+	}
+
+	g_free (threads);
+	g_free (jobs);
+}
+
+/* Leaves a file as an earlier session would, modified "age"
+ * seconds ago. */
+static void
+create_seed_file (CamelDataCache *cache,
+                  const gchar *uri,
+                  glong age)
+{
+	CamelStream *stream;
+	struct utimbuf times;
+	gchar *uri_md5;
+	gchar *filename;
+	gchar *data;
+
+	uri_md5 = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+
+	stream = camel_data_cache_add (cache, "http", uri_md5, NULL);
+	g_return_if_fail (stream != NULL);
+
+	data = g_malloc0 (SEED_SIZE);
+	camel_stream_write (stream, data, SEED_SIZE, NULL, NULL);
+	camel_stream_close (stream, NULL, NULL);
+	g_object_unref (stream);
+	g_free (data);
+
+	filename = camel_data_cache_get_filename (cache, "http", uri_md5);
+	times.actime = times.modtime = time (NULL) - age;
+	g_utime (filename, &times);
+	g_free (filename);
+
+	g_free (uri_md5);
+}
+
+static void
+remove_recursive (const gchar *path)
+{
+	if (g_file_test (path, G_FILE_TEST_IS_DIR)) {
+		GDir *dir;
+		const gchar *name;
+
+		dir = g_dir_open (path, 0, NULL);
+		while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+			gchar *child;
+
+			child = g_build_filename (path, name, NULL);
+			remove_recursive (child);
+			g_free (child);
+		}
+
+		if (dir != NULL)
+			g_dir_close (dir);
+	}
+
+	g_remove (path);
+}
+
+static void
+test_seeding (const gchar *cache_dir)
+{
+	CamelDataCache *cache;
+	gint64 deadline;
+
+	cache = camel_data_cache_new (cache_dir, NULL);
+	g_return_if_fail (cache != NULL);
+
+	create_seed_file (cache, "http://seed.example/1.png", 300);
+	create_seed_file (cache, "http://seed.example/2.png", 200);
+	create_seed_file (cache, "http://seed.example/3.png", 100);
+
+	g_object_unref (cache);
+
+	e_http_cache_setup (cache_dir, MAX_SIZE);
+
+	/* The files are accounted for in a background thread. */
+	deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+	while (e_http_cache_get_size () != 2 * SEED_SIZE &&
+	       g_get_monotonic_time () < deadline)
+		g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+
+	check (
+		e_http_cache_get_size () == 2 * SEED_SIZE,
+		"files of an earlier session are accounted for");
+	check (
+		!e_http_cache_contains ("http://seed.example/1.png"),
+		"oldest file of an earlier session is evicted");
+	check (
+		e_http_cache_contains ("http://seed.example/2.png") &&
+		e_http_cache_contains ("http://seed.example/3.png"),
+		"newer files of an earlier session are kept");
+}
+
+static void
+test_merging (TestServer *test_server)
+{
+	gchar *uris[N_MERGE_THREADS];
+	guint ii;
+
+	for (ii = 0; ii < N_MERGE_THREADS; ii++)
+		uris[ii] = test_server_dup_uri (test_server, "/merge.png");
+
+	fetch_all (uris, N_MERGE_THREADS, MERGE_SIZE);
+
+	check (
+		test_server_get_n_requests (test_server, "/merge.png") == 1,
+		"concurrent fetches of the same URI make one request");
+	check (
+		e_http_cache_contains (uris[0]),
+		"fetched resource is cached");
+
+	for (ii = 0; ii < N_MERGE_THREADS; ii++)
+		g_free (uris[ii]);
+}
+
+static void
+test_connections (TestServer *test_server)
+{
+	gchar *uris[N_CONN_THREADS];
+	guint max_sockets;
+	guint ii;
+
+	for (ii = 0; ii < N_CONN_THREADS; ii++) {
+		gchar *path = g_strdup_printf ("/conn/%u.png", ii);
+		uris[ii] = test_server_dup_uri (test_server, path);
+		g_free (path);
+	}
+
+	fetch_all (uris, N_CONN_THREADS, CONN_SIZE);
+
+	g_mutex_lock (&test_server->lock);
+	max_sockets = test_server->max_sockets;
+	g_mutex_unlock (&test_server->lock);
+
+	g_print (
+		"%u connections at most for %u concurrent fetches\n",
+		max_sockets, N_CONN_THREADS);
+
+	check (
+		max_sockets <= E_HTTP_CACHE_MAX_CONNS_PER_HOST,
+		"no more connections than allowed per host");
+	check (
+		max_sockets > 1,
+		"fetches of different URIs run in parallel");
+	check (
+		!e_http_cache_contains ("http://seed.example/2.png"),
+		"least recently used file is evicted when over the limit");
+	check (
+		e_http_cache_get_size () <= MAX_SIZE,
+		"cache stays within the size limit");
+
+	for (ii = 0; ii < N_CONN_THREADS; ii++)
+		g_free (uris[ii]);
+}
+
+static void
+test_eviction (TestServer *test_server)
+{
+	GBytes *body;
+	gchar *content_type = NULL;
+	gchar *merge_uri;
+	gchar *big_uri;
+
+	/* Using the oldest resource makes it the most recent one. */
+	body = e_http_cache_lookup (
+		"http://seed.example/3.png", NULL, &content_type);
+	check (
+		body != NULL && g_bytes_get_size (body) == SEED_SIZE,
+		"file of an earlier session is read from the cache");
+	if (body != NULL)
+		g_bytes_unref (body);
+	g_free (content_type);
+
+	merge_uri = test_server_dup_uri (test_server, "/merge.png");
+	big_uri = test_server_dup_uri (test_server, "/big.png");
+
+	fetch_all (&big_uri, 1, BIG_SIZE);
+
+	check (
+		e_http_cache_contains (big_uri),
+		"newly fetched resource is cached");
+	check (
+		e_http_cache_contains ("http://seed.example/3.png"),
+		"recently used resource is kept");
+	check (
+		!e_http_cache_contains (merge_uri),
+		"least recently used resource is evicted");
+	check (
+		e_http_cache_get_size () <= MAX_SIZE,
+		"cache stays within the size limit");
+
+	g_free (merge_uri);
+	g_free (big_uri);
+}
+
+gint
+main (gint argc,
+      gchar **argv)
+{
+	TestServer *test_server;
+	gchar *cache_dir;
+
+	g_type_init ();
+
+	cache_dir = g_dir_make_tmp ("test-mail-http-cache-XXXXXX", NULL);
+	if (cache_dir == NULL) {
+		g_printerr ("Failed to create a cache directory\n");
+		return EXIT_FAILURE;
+	}
+
+	test_seeding (cache_dir);
+
+	test_server = test_server_new ();
+
+	test_merging (test_server);
+	test_connections (test_server);
+	test_eviction (test_server);
+
+	g_main_loop_quit (test_server->main_loop);
+
+	remove_recursive (cache_dir);
+	g_free (cache_dir);
+
+	if (n_failures > 0) {
+		g_printerr ("%u check(s) failed!\n", n_failures);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,331 @@
+/*
+ * test-mail-threading.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Threads a synthetic summary with CamelFolderThread, with one worker
+ * and with the default number of workers.  Checks that every message
+ * gets the same parent as CamelFolderThread gives it, that the worker
+ * count does not change the tree, and reports timings. */
+
+#include <stdlib.h>
+
+#include "e-mail-thread-tree.h"
+
+#define MAX_THREAD_DEPTH 6
+
+/* A folder that only has a summary, for CamelFolderThread to read. */
+typedef CamelFolder TestFolder;
+typedef CamelFolderClass TestFolderClass;
+
+GType test_folder_get_type (void);
+
+G_DEFINE_TYPE (TestFolder, test_folder, CAMEL_TYPE_FOLDER)
+
+static void
+test_folder_class_init (TestFolderClass *class)
+{
+}
+
+static void
+test_folder_init (TestFolder *folder)
+{
+}
+
+static guint64
+message_id_for_index (guint index)
+{
+	return (guint64) index * 2654435761U + 1;
+}
+
+/* Each message replies to a random earlier one about half the time and
+ * lists its ancestors nearest first, as Camel stores References, cut
+ * off after a few.  About one message in twenty is then left out of the
+ * summary, so replies to it must thread through a phantom. */
+static GPtrArray *
+create_summary (CamelFolder *folder,
+                guint n_messages)
+{
+	GPtrArray *infos;
+	gint *parents;
+	GRand *rand;
+	guint ii;
+
+	infos = g_ptr_array_new_full (
+		n_messages, (GDestroyNotify) camel_message_info_free);
+
+	parents = g_new (gint, n_messages);
+	rand = g_rand_new_with_seed (n_messages);
+
+	for (ii = 0; ii < n_messages; ii++) {
+		CamelMessageInfoBase *info;
+		guint n_refs = 0;
+		gint ancestor;
+
+		parents[ii] = (ii > 0 && g_rand_boolean (rand)) ?
+			g_rand_int_range (rand, 0, ii) : -1;
+
+		for (ancestor = parents[ii];
+		     ancestor != -1 && n_refs < MAX_THREAD_DEPTH;
+		     ancestor = parents[ancestor])
+			n_refs++;
+
+		if (g_rand_int_range (rand, 0, 20) == 0)
+			continue;
+
+		info = (CamelMessageInfoBase *)
+			camel_message_info_new (folder->summary);
+		info->uid = camel_pstring_add (
+			g_strdup_printf ("%u", ii), TRUE);
+		info->message_id.id.id = message_id_for_index (ii);
+
+		if (n_refs > 0) {
+			guint jj = 0;
+
+			info->references = g_malloc0 (
+				sizeof (CamelSummaryReferences) +
+				sizeof (CamelSummaryMessageID) * (n_refs - 1));
+			info->references->size = n_refs;
+
+			for (ancestor = parents[ii]; jj < n_refs;
+			     ancestor = parents[ancestor])
+				info->references->references[jj++].id.id =
+					message_id_for_index (ancestor);
+		}
+
+		/* The summary takes over the reference it is given. */
+		camel_folder_summary_add (
+			folder->summary,
+			camel_message_info_ref (info));
+
+		g_ptr_array_add (infos, info);
+	}
+
+	g_rand_free (rand);
+	g_free (parents);
+
+	return infos;
+}
+
+static gboolean
+compare_nodes (CamelFolderThreadNode *a,
+               CamelFolderThreadNode *b)
+{
+	while (a != NULL && b != NULL) {
+		if (a->message != b->message)
+			return FALSE;
+		if (!compare_nodes (a->child, b->child))
+			return FALSE;
+		a = a->next;
+		b = b->next;
+	}
+
+	return (a == NULL && b == NULL);
+}
+
+/* Records the parent message of every message in a thread tree.  Nodes
+ * without a message (CamelFolderThread keeps top-level ones grouping
+ * several threads) are skipped, so only the message hierarchy counts. */
+static void
+collect_parents (CamelFolderThreadNode *node,
+                 gconstpointer parent,
+                 GHashTable *parents)
+{
+	for (; node != NULL; node = node->next) {
+		gconstpointer message = node->message;
+
+		if (message != NULL)
+			g_hash_table_insert (
+				parents, (gpointer) message,
+				(gpointer) parent);
+
+		collect_parents (
+			node->child,
+			(message != NULL) ? message : parent,
+			parents);
+	}
+}
+
+static guint
+count_parent_mismatches (CamelFolderThreadNode *expected,
+                         CamelFolderThreadNode *actual)
+{
+	GHashTable *expected_parents;
+	GHashTable *actual_parents;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint n_mismatches = 0;
+
+	expected_parents = g_hash_table_new (g_direct_hash, g_direct_equal);
+	actual_parents = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	collect_parents (expected, NULL, expected_parents);
+	collect_parents (actual, NULL, actual_parents);
+
+	g_hash_table_iter_init (&iter, expected_parents);
+
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		gpointer actual_value;
+
+		if (!g_hash_table_lookup_extended (
+			actual_parents, key, NULL, &actual_value) ||
+		    actual_value != value) {
+			if (n_mismatches < 10)
+				g_printerr (
+					"Message %s: expected parent %s, got %s\n",
+					camel_message_info_uid (key),
+					value ? camel_message_info_uid (value) : "none",
+					actual_value ? camel_message_info_uid (actual_value) : "none");
+			n_mismatches++;
+		}
+	}
+
+	if (g_hash_table_size (actual_parents) !=
+	    g_hash_table_size (expected_parents)) {
+		g_printerr (
+			"Expected %u messages in the tree, got %u\n",
+			g_hash_table_size (expected_parents),
+			g_hash_table_size (actual_parents));
+		n_mismatches++;
+	}
+
+	g_hash_table_destroy (expected_parents);
+	g_hash_table_destroy (actual_parents);
+
+	return n_mismatches;
+}
+
+static CamelFolderThread *
+time_folder_thread (CamelFolder *folder,
+                    GPtrArray *infos)
+{
+	CamelFolderThread *folder_thread;
+	GPtrArray *uids;
+	GTimer *timer;
+	guint ii;
+
+	uids = g_ptr_array_sized_new (infos->len);
+
+	for (ii = 0; ii < infos->len; ii++)
+		g_ptr_array_add (
+			uids, (gpointer) camel_message_info_uid (
+			infos->pdata[ii]));
+
+	timer = g_timer_new ();
+
+	folder_thread = camel_folder_thread_messages_new (
+		folder, uids, FALSE);
+
+	g_timer_stop (timer);
+
+	g_print (
+		"%u messages, CamelFolderThread: %.3f seconds\n",
+		infos->len, g_timer_elapsed (timer, NULL));
+
+	g_timer_destroy (timer);
+	g_ptr_array_free (uids, TRUE);
+
+	return folder_thread;
+}
+
+static EMailThreadTree *
+time_thread_tree (GPtrArray *infos,
+                  guint n_workers)
+{
+	EMailThreadTree *thread_tree;
+	GTimer *timer;
+	GError *error = NULL;
+
+	timer = g_timer_new ();
+
+	thread_tree = e_mail_thread_tree_new_for_infos (
+		infos, n_workers, NULL, &error);
+
+	g_timer_stop (timer);
+
+	if (error != NULL) {
+		g_printerr ("%s\n", error->message);
+		exit (EXIT_FAILURE);
+	}
+
+	g_print (
+		"%u messages, %u worker(s): %.3f seconds\n",
+		infos->len,
+		e_mail_thread_tree_get_n_workers (thread_tree),
+		g_timer_elapsed (timer, NULL));
+
+	g_timer_destroy (timer);
+
+	return thread_tree;
+}
+
+gint
+main (gint argc,
+      gchar **argv)
+{
+	CamelFolder *folder;
+	CamelFolderThread *folder_thread;
+	EMailThreadTree *single, *parallel;
+	GPtrArray *infos;
+	guint n_messages = 300000;
+	guint n_mismatches;
+	gboolean same;
+
+	g_type_init ();
+
+	if (argc > 1)
+		n_messages = strtoul (argv[1], NULL, 10);
+
+	folder = g_object_new (
+		test_folder_get_type (),
+		"display-name", "test",
+		"full-name", "test", NULL);
+	folder->summary = camel_folder_summary_new (folder);
+
+	infos = create_summary (folder, n_messages);
+
+	folder_thread = time_folder_thread (folder, infos);
+	single = time_thread_tree (infos, 1);
+	parallel = time_thread_tree (infos, 0);
+
+	n_mismatches = count_parent_mismatches (
+		folder_thread->tree,
+		e_mail_thread_tree_get_root (single));
+
+	same = compare_nodes (
+		e_mail_thread_tree_get_root (single),
+		e_mail_thread_tree_get_root (parallel));
+
+	camel_folder_thread_messages_unref (folder_thread);
+	e_mail_thread_tree_unref (single);
+	e_mail_thread_tree_unref (parallel);
+	g_ptr_array_unref (infos);
+	g_object_unref (folder);
+
+	if (n_mismatches > 0) {
+		g_printerr (
+			"%u message(s) threaded differently "
+			"from CamelFolderThread!\n", n_mismatches);
+		return EXIT_FAILURE;
+	}
+
+	if (!same) {
+		g_printerr ("Thread trees differ!\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}